@@ -0,0 +1,634 @@
+/*
+ * audio.c -- PCM playback of an AVI audio track, see audio.h
+ *
+ * Times are nanoseconds, presentation times those of playback.h; the
+ * clock is measured against CLOCK_MONOTONIC.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "audio.h"
+
+/* a measurement this far off the clock is no jitter but a stall of the
+   device or of the reader, the clock is set to it */
+#define AUDIO_SNAP_NS    50000000LL
+/* the drift of the device is fit to no less than this of measurements, */
+#define AUDIO_DRIFT_NS   1000000000LL
+/* and taken up to this */
+#define AUDIO_DRIFT_MAX  0.002
+
+struct audio_s
+{
+  avi_t *AVI;
+  int track;
+  audio_sink_t sink;
+  audio_format_t fmt;       /* in the ring, to the device */
+  audio_format_t in;        /* of the track */
+  uint64_t bytes;           /* of the track */
+  pcm_conv_t conv;          /* in to fmt, */
+  int convert;              /* unless they are the same */
+  uint8_t *scratch;         /* read into, where in is larger than fmt */
+
+  /* the ring; head and tail count the bytes since audio_start */
+  uint8_t *ring;
+  long frames;              /* it holds */
+  long size;
+  long chunk;               /* read at once */
+  atomic_uint_least64_t head;      /* read into the ring */
+  atomic_uint_least64_t tail;      /* taken by the device */
+  atomic_int eos;           /* the reader is done, head is final */
+  atomic_int waiting;       /* the reader sleeps on room */
+  atomic_int stop;
+  sem_t room, ready;
+  pthread_t thread;
+  int running, playing;
+  uint64_t start_byte, start_pts;
+  atomic_ulong reads, full_waits;
+
+  /* the clock, under lock. The device takes it in every pull, but only
+     for a few updates */
+  pthread_mutex_t lock;
+  uint64_t pos;             /* bytes pulled, silence past the end too */
+  int anchored;             /* the device has pulled */
+  int64_t a_t, a_pts;       /* the clock went through a_pts at a_t */
+  double rate;              /* its pace against CLOCK_MONOTONIC */
+  int64_t ref_t, ref_pts;   /* first measurement of the fit, and */
+  double n, sx, sy, sxx, sxy;      /* its sums from there, n = 0 restarts */
+  int64_t quiet_until;      /* silence of an underrun is heard until */
+  int64_t last;             /* handed out last */
+  audio_stats_t st;
+};
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void audio_sem_wait(sem_t *s) {
+  while (sem_wait(s) < 0 && errno == EINTR)
+    ;
+}
+
+/* sample frames <-> ns, without overflowing for long files */
+static uint64_t samples_ns(long rate, uint64_t n) {
+  return n / rate * 1000000000ULL + n % rate * 1000000000ULL / rate;
+}
+
+static uint64_t ns_samples(long rate, uint64_t ns) {
+  return ns / 1000000000ULL * rate + ns % 1000000000ULL * rate / 1000000000ULL;
+}
+
+/* presentation time of byte b after the start */
+static uint64_t byte_pts(audio_t *a, uint64_t b) {
+  return a->start_pts + samples_ns(a->fmt.rate, b / a->fmt.block);
+}
+
+/*************************************************************************/
+
+static void format_init(audio_format_t *f, long rate, pcm_fmt_t sample, int channels) {
+  f->rate = rate;
+  f->channels = channels;
+  f->bits = pcm_fmt_bytes(sample) * 8;
+  f->block = channels * pcm_fmt_bytes(sample);
+  f->sample = sample;
+}
+
+/* the ring and the scratch buffer for fmt */
+static int buffers_alloc(audio_t *a) {
+  uint8_t *ring, *scratch = NULL;
+  const long chunk = a->frames / 4;
+
+  // whole sample frames, so that no read or pull splits one at the wrap
+  ring = malloc(a->frames * a->fmt.block);
+  if (a->convert && a->in.block > a->fmt.block) scratch = malloc(chunk * a->in.block);
+  if (!ring || (a->convert && a->in.block > a->fmt.block && !scratch)) {
+    free(ring);
+    free(scratch);
+    return -1;
+  }
+  free(a->ring);
+  free(a->scratch);
+  a->ring = ring;
+  a->scratch = scratch;
+  a->size = a->frames * a->fmt.block;
+  a->chunk = chunk * a->fmt.block;
+  return 0;
+}
+
+audio_t *audio_new(avi_t *AVI, int track, const audio_sink_t *sink, int ring_ms) {
+  const track_t *t;
+  audio_t *a;
+  pcm_fmt_t sample;
+
+  if (track < 0 || track >= AVI->anum || !sink || !sink->start) return NULL;
+  t = &AVI->track[track];
+  sample = pcm_fmt_wave(t->a_fmt, (int) t->a_bits);
+  if (sample == PCM_FMT_NONE || !t->audio_index || t->a_rate <= 0
+      || t->a_chans < 1 || t->a_chans > PCM_MAX_CHANNELS)
+    return NULL;
+
+  a = calloc(1, sizeof(*a));
+  if (!a) return NULL;
+  a->AVI = AVI;
+  a->track = track;
+  a->sink = *sink;
+  format_init(&a->in, t->a_rate, sample, (int) t->a_chans);
+  a->fmt = a->in;
+  a->bytes = (uint64_t) t->audio_bytes;
+
+  a->frames = a->fmt.rate * (ring_ms > 0 ? ring_ms : 500) / 1000;
+  if (a->frames < 1024) a->frames = 1024;
+  if (buffers_alloc(a) < 0) {
+    free(a);
+    return NULL;
+  }
+
+  sem_init(&a->room, 0, 0);
+  sem_init(&a->ready, 0, 0);
+  pthread_mutex_init(&a->lock, NULL);
+  a->rate = 1.0;
+  return a;
+}
+
+void audio_free(audio_t *a) {
+  if (!a) return;
+  audio_stop(a);
+  pthread_mutex_destroy(&a->lock);
+  sem_destroy(&a->ready);
+  sem_destroy(&a->room);
+  free(a->scratch);
+  free(a->ring);
+  free(a);
+}
+
+int audio_set_output(audio_t *a, pcm_fmt_t sample, int channels, float gain) {
+  const audio_format_t old = a->fmt;
+  const pcm_conv_t conv = a->conv;
+  const int convert = a->convert;
+
+  audio_stop(a);
+  if (pcm_conv_init(&a->conv, a->in.sample, a->in.channels, sample, channels) < 0) {
+    a->conv = conv;
+    return -1;
+  }
+  a->conv.gain = gain;
+  pcm_conv_update(&a->conv);
+  a->convert = a->conv.mix != PCM_MIX_COPY || sample != a->in.sample;
+  format_init(&a->fmt, a->in.rate, sample, channels);
+  if (buffers_alloc(a) < 0) {
+    a->fmt = old;
+    a->conv = conv;
+    a->convert = convert;
+    return -1;
+  }
+  return 0;
+}
+
+const audio_format_t *audio_format(audio_t *a) {
+  return &a->fmt;
+}
+
+const audio_format_t *audio_track_format(audio_t *a) {
+  return &a->in;
+}
+
+uint64_t audio_duration(audio_t *a) {
+  return samples_ns(a->in.rate, a->bytes / a->in.block);
+}
+
+/* keeps the ring full, until the end of the track or audio_stop. The
+   track is read into the ring and converted there in place, or through
+   the scratch buffer where its frames are the larger */
+static void *audio_reader(void *arg) {
+  audio_t *a = arg;
+  const long prefill = a->size / 2;
+  uint64_t head = 0, pos = a->start_byte;
+  int ready = 0;
+
+  while (!atomic_load(&a->stop)) {
+    long n, got, want;
+    uint8_t *dst, *buf;
+
+    if (a->size - (long) (head - atomic_load(&a->tail)) < a->chunk) {
+      atomic_store(&a->waiting, 1);
+      // the device may have made room since
+      if (a->size - (long) (head - atomic_load(&a->tail)) < a->chunk) {
+        atomic_fetch_add(&a->full_waits, 1);
+        audio_sem_wait(&a->room);
+      }
+      atomic_store(&a->waiting, 0);
+      continue;
+    }
+
+    // up to the wrap, the next read goes on from there
+    n = a->size - (long) (head % a->size);
+    if (n > a->chunk) n = a->chunk;
+    dst = a->ring + head % a->size;
+    buf = a->scratch ? a->scratch : dst;
+    want = n / a->fmt.block * a->in.block;
+    got = AVI_read_audio_at(a->AVI, a->track, (long) pos, (char *) buf, want);
+    atomic_fetch_add(&a->reads, 1);
+    if (got >= a->in.block) {
+      const long frames = got / a->in.block;
+
+      if (a->convert) pcm_convert(&a->conv, buf, dst, frames);
+      pos += frames * a->in.block;
+      head += frames * a->fmt.block;
+      atomic_store_explicit(&a->head, head, memory_order_release);
+    }
+    // short only at the end, or on an error: the track is over for us
+    if (got < want) {
+      atomic_store(&a->eos, 1);
+      break;
+    }
+    if (!ready && (long) head >= prefill) {
+      sem_post(&a->ready);
+      ready = 1;
+    }
+  }
+  if (!ready) sem_post(&a->ready);
+  return NULL;
+}
+
+int audio_start(audio_t *a, uint64_t pts_ns) {
+  audio_stop(a);
+
+  a->start_pts = pts_ns;
+  a->start_byte = ns_samples(a->in.rate, pts_ns) * a->in.block;
+  atomic_store(&a->head, 0);
+  atomic_store(&a->tail, 0);
+  atomic_store(&a->eos, a->start_byte >= a->bytes);
+  atomic_store(&a->waiting, 0);
+  atomic_store(&a->stop, 0);
+  atomic_store(&a->reads, 0);
+  atomic_store(&a->full_waits, 0);
+  while (sem_trywait(&a->room) == 0)
+    ;
+  while (sem_trywait(&a->ready) == 0)
+    ;
+
+  // the drift of the device is kept, it is the same device
+  pthread_mutex_lock(&a->lock);
+  a->pos = 0;
+  a->anchored = 0;
+  a->n = 0;
+  a->quiet_until = 0;
+  a->last = (int64_t) pts_ns;
+  memset(&a->st, 0, sizeof(a->st));
+  a->st.ring_bytes = a->size;
+  a->st.ring_min = a->size;
+  a->st.drift_ppm = (a->rate - 1) * 1e6;
+  pthread_mutex_unlock(&a->lock);
+
+  if (!atomic_load(&a->eos)) {
+    if (pthread_create(&a->thread, NULL, audio_reader, a) != 0) return -1;
+    a->running = 1;
+    audio_sem_wait(&a->ready);
+  }
+  if (a->sink.start(a->sink.opaque, a, &a->fmt) < 0) {
+    audio_stop(a);
+    return -1;
+  }
+  a->playing = 1;
+  return 0;
+}
+
+void audio_stop(audio_t *a) {
+  if (a->playing) {
+    a->sink.stop(a->sink.opaque);
+    a->playing = 0;
+  }
+  if (a->running) {
+    atomic_store(&a->stop, 1);
+    sem_post(&a->room);
+    pthread_join(a->thread, NULL);
+    a->running = 0;
+  }
+}
+
+/*************************************************************************/
+/* the clock                                                             */
+/*************************************************************************/
+
+static int64_t clock_at(audio_t *a, int64_t t) {
+  return a->a_pts + (int64_t) ((double) (t - a->a_t) * a->rate);
+}
+
+/* the device plays presentation time m at t: the clock takes an eighth
+   of the error at every pull, its pace is the slope of a least squares
+   fit of the measurements since the last snap or underrun. A pull that
+   comes late is off by as much, the fit does not hang on any single one.
+   fit is 0 while the device plays the silence of an underrun, which says
+   nothing about its pace */
+static void clock_measure(audio_t *a, int64_t t, int64_t m, int fit) {
+  int64_t e, c;
+  double x, y;
+
+  c = a->anchored ? clock_at(a, t) : m;
+  e = m - c;
+  if (e > AUDIO_SNAP_NS || e < -AUDIO_SNAP_NS) {
+    // the clock holds in audio_clock until m has caught up with it
+    a->st.snaps++;
+    a->n = 0;
+    c = m;
+    e = 0;
+  }
+  a->a_t = t;
+  a->a_pts = c + e / 8;
+  a->anchored = 1;
+
+  if (!fit) {
+    a->n = 0;
+    return;
+  }
+  a->st.measured++;
+  if ((e < 0 ? -e : e) > a->st.max_error_ns) a->st.max_error_ns = e < 0 ? -e : e;
+  a->st.error_ns += (uint64_t) (e < 0 ? -e : e);
+  if (!a->n) {
+    a->ref_t = t;
+    a->ref_pts = m;
+    a->sx = a->sy = a->sxx = a->sxy = 0;
+  }
+  x = (double) (t - a->ref_t);
+  y = (double) (m - a->ref_pts);
+  a->n++;
+  a->sx += x;
+  a->sy += y;
+  a->sxx += x * x;
+  a->sxy += x * y;
+  if (x >= AUDIO_DRIFT_NS) {
+    double d = a->n * a->sxx - a->sx * a->sx, r;
+
+    if (d <= 0) return;
+    r = (a->n * a->sxy - a->sx * a->sy) / d;
+    if (r > 1 + AUDIO_DRIFT_MAX) r = 1 + AUDIO_DRIFT_MAX;
+    if (r < 1 - AUDIO_DRIFT_MAX) r = 1 - AUDIO_DRIFT_MAX;
+    a->rate = r;
+    a->st.drift_ppm = (r - 1) * 1e6;
+  }
+}
+
+uint64_t audio_clock(audio_t *a) {
+  int64_t v;
+
+  pthread_mutex_lock(&a->lock);
+  v = a->last;
+  if (a->anchored) {
+    int64_t end = (int64_t) byte_pts(a, a->pos);
+
+    v = clock_at(a, (int64_t) now_ns());
+    // nothing can be heard that the device has not got yet
+    if (v > end) v = end;
+    if (v < a->last) v = a->last;
+    a->last = v;
+  }
+  pthread_mutex_unlock(&a->lock);
+  return (uint64_t) v;
+}
+
+long audio_pull(audio_t *a, void *buf, long bytes, uint64_t delay_ns) {
+  // eos before head: once the reader is done, head is final
+  const int eos = atomic_load(&a->eos);
+  const uint64_t tail = atomic_load(&a->tail);
+  const uint64_t head = atomic_load_explicit(&a->head, memory_order_acquire);
+  const int64_t t = (int64_t) now_ns();
+  long have = (long) (head - tail), n, off, first;
+
+  bytes -= bytes % a->fmt.block;
+  n = have < bytes ? have : bytes;
+  off = (long) (tail % a->size);
+  first = a->size - off < n ? a->size - off : n;
+  memcpy(buf, a->ring + off, first);
+  memcpy((uint8_t *) buf + first, a->ring, n - first);
+  // 8 bit PCM is unsigned
+  memset((uint8_t *) buf + n, a->fmt.sample == PCM_FMT_U8 ? 0x80 : 0, bytes - n);
+  atomic_store(&a->tail, tail + n);
+  // wake the reader once it can read a whole chunk
+  if (a->size - (long) (head - tail - n) >= a->chunk && atomic_exchange(&a->waiting, 0))
+    sem_post(&a->room);
+
+  pthread_mutex_lock(&a->lock);
+  // data heard after the silence of an underrun is as late as that,
+  // which only the snaps take care of
+  clock_measure(a, t, (int64_t) byte_pts(a, a->pos) - (int64_t) delay_ns,
+                n > 0 && t >= a->quiet_until);
+  if (n < bytes && !eos)
+    a->quiet_until = t + (int64_t) delay_ns + (int64_t) samples_ns(a->fmt.rate, bytes / a->fmt.block);
+  // past the end of the track the silence counts as time, video plays
+  // on; before, the clock waits for the track
+  a->pos += eos ? bytes : n;
+  a->st.pulls++;
+  a->st.played += n;
+  if (n < bytes && !eos) {
+    a->st.underruns++;
+    a->st.silence += bytes - n;
+  }
+  if (!eos && have < a->st.ring_min) a->st.ring_min = have;
+  a->st.latency_ns = delay_ns;
+  pthread_mutex_unlock(&a->lock);
+  return n;
+}
+
+void audio_get_stats(audio_t *a, audio_stats_t *st) {
+  pthread_mutex_lock(&a->lock);
+  *st = a->st;
+  pthread_mutex_unlock(&a->lock);
+  st->reads = atomic_load(&a->reads);
+  st->full_waits = atomic_load(&a->full_waits);
+}
+
+/*************************************************************************/
+/* the host device: periods of the device clock, timed on               */
+/* CLOCK_MONOTONIC; period j is heard from t0 + j * period on            */
+/*************************************************************************/
+
+struct audio_host_s
+{
+  audio_host_config_t cfg;
+  audio_t *a;
+  long period_bytes;
+  double period_ns;
+  uint8_t *buf;
+  FILE *wav;
+  uint64_t wav_bytes;
+
+  pthread_t thread;
+  atomic_int stop;
+  int running;
+
+  pthread_mutex_t lock;     /* what is queued, for audio_host_pts */
+  uint64_t t0;
+  long pulled;              /* periods */
+  uint64_t *heard;          /* track bytes up to the end of period j, at
+                               j % (periods + 2) */
+};
+
+static void put_le(uint8_t *p, uint32_t v, int n) {
+  int i;
+
+  for (i = 0; i < n; i++) p[i] = (uint8_t) (v >> 8 * i);
+}
+
+/* a canonical 44 byte header, the sizes are filled in at the end */
+static void wav_header(audio_host_t *h, const audio_format_t *fmt, uint64_t data) {
+  uint8_t b[44];
+
+  memcpy(b, "RIFF", 4);
+  put_le(b + 4, (uint32_t) (36 + data), 4);
+  memcpy(b + 8, "WAVEfmt ", 8);
+  put_le(b + 16, 16, 4);
+  put_le(b + 20, fmt->sample == PCM_FMT_F32 ? 3 : WAVE_FORMAT_PCM, 2);    // 3: IEEE float
+  put_le(b + 22, fmt->channels, 2);
+  put_le(b + 24, (uint32_t) fmt->rate, 4);
+  put_le(b + 28, (uint32_t) (fmt->rate * fmt->block), 4);
+  put_le(b + 32, fmt->block, 2);
+  put_le(b + 34, fmt->bits, 2);
+  memcpy(b + 36, "data", 4);
+  put_le(b + 40, (uint32_t) data, 4);
+  fseek(h->wav, 0, SEEK_SET);
+  fwrite(b, 1, sizeof(b), h->wav);
+}
+
+static uint64_t heard_by(audio_host_t *h, long j) {
+  return j < 0 ? 0 : h->heard[j % (h->cfg.periods + 2)];
+}
+
+/* pulls period j, which is heard from t0 + j * period on */
+static void host_pull(audio_host_t *h, long j) {
+  const uint64_t start = h->t0 + (uint64_t) (j * h->period_ns), now = now_ns();
+  long n = audio_pull(h->a, h->buf, h->period_bytes, start > now ? start - now : 0);
+
+  if (h->wav && fwrite(h->buf, 1, h->period_bytes, h->wav) == (size_t) h->period_bytes)
+    h->wav_bytes += h->period_bytes;
+  pthread_mutex_lock(&h->lock);
+  h->heard[j % (h->cfg.periods + 2)] = heard_by(h, j - 1) + n;
+  h->pulled = j + 1;
+  pthread_mutex_unlock(&h->lock);
+}
+
+static void *host_thread(void *arg) {
+  audio_host_t *h = arg;
+  long j;
+
+  // the queue is filled at once, then one period is pulled whenever
+  // one has been played
+  for (j = 0; j < h->cfg.periods; j++) host_pull(h, j);
+  for (j = 1; !atomic_load(&h->stop); j++) {
+    uint64_t t = h->t0 + (uint64_t) (j * h->period_ns);
+    struct timespec ts = { (time_t) (t / 1000000000ULL), (long) (t % 1000000000ULL) };
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+      ;
+    host_pull(h, j + h->cfg.periods - 1);
+  }
+  return NULL;
+}
+
+static int host_start(void *opaque, audio_t *a, const audio_format_t *fmt) {
+  audio_host_t *h = opaque;
+  const long frames = (long) (fmt->rate * (int64_t) h->cfg.period_us / 1000000);
+
+  if (frames < 1) return -1;
+  h->a = a;
+  h->period_bytes = frames * fmt->block;
+  // a fast device plays a period in less time
+  h->period_ns = (double) samples_ns(fmt->rate, frames) / (1 + h->cfg.skew_ppm / 1e6);
+  free(h->buf);
+  if (!(h->buf = malloc(h->period_bytes))) return -1;
+  if (h->cfg.wav) {
+    if (!(h->wav = fopen(h->cfg.wav, "wb"))) return -1;
+    h->wav_bytes = 0;
+    wav_header(h, fmt, 0);
+  }
+
+  h->pulled = 0;
+  h->t0 = now_ns();
+  atomic_store(&h->stop, 0);
+  if (pthread_create(&h->thread, NULL, host_thread, h) != 0) {
+    if (h->wav) fclose(h->wav);
+    h->wav = NULL;
+    return -1;
+  }
+  h->running = 1;
+  return 0;
+}
+
+static void host_stop(void *opaque) {
+  audio_host_t *h = opaque;
+
+  if (!h->running) return;
+  atomic_store(&h->stop, 1);
+  pthread_join(h->thread, NULL);
+  h->running = 0;
+  if (h->wav) {
+    wav_header(h, audio_format(h->a), h->wav_bytes);
+    fclose(h->wav);
+    h->wav = NULL;
+  }
+}
+
+audio_host_t *audio_host_new(const audio_host_config_t *cfg) {
+  audio_host_t *h = calloc(1, sizeof(*h));
+
+  if (!h) return NULL;
+  if (cfg) h->cfg = *cfg;
+  if (h->cfg.period_us <= 0) h->cfg.period_us = 10000;
+  if (h->cfg.periods <= 0) h->cfg.periods = 4;
+  h->heard = calloc(h->cfg.periods + 2, sizeof(*h->heard));
+  if (!h->heard) {
+    free(h);
+    return NULL;
+  }
+  pthread_mutex_init(&h->lock, NULL);
+  return h;
+}
+
+void audio_host_free(audio_host_t *h) {
+  if (!h) return;
+  host_stop(h);
+  pthread_mutex_destroy(&h->lock);
+  free(h->heard);
+  free(h->buf);
+  free(h);
+}
+
+audio_sink_t audio_host_sink(audio_host_t *h) {
+  audio_sink_t s = { host_start, host_stop, h };
+
+  return s;
+}
+
+uint64_t audio_host_pts(audio_host_t *h) {
+  uint64_t t = now_ns(), b;
+  long j;
+  double played;
+
+  pthread_mutex_lock(&h->lock);
+  if (!h->pulled || t < h->t0) {
+    pthread_mutex_unlock(&h->lock);
+    return h->a ? byte_pts(h->a, 0) : 0;
+  }
+  // in period j, played of it; a period not pulled in time is silence
+  played = (t - h->t0) / h->period_ns;
+  j = (long) played;
+  if (j >= h->pulled) {
+    b = heard_by(h, h->pulled - 1);
+  } else {
+    long n = (long) ((played - j) * h->period_bytes);
+
+    b = heard_by(h, j - 1);
+    if ((uint64_t) n > heard_by(h, j) - b) n = (long) (heard_by(h, j) - b);
+    b += n;
+  }
+  pthread_mutex_unlock(&h->lock);
+  return byte_pts(h->a, b);
+}
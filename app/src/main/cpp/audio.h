@@ -0,0 +1,140 @@
+/*
+ * audio.h -- PCM playback of an AVI audio track, and the clock video
+ * follows
+ *
+ * A reader thread reads the track into a ring of PCM bytes ahead of the
+ * output, the output device drains the ring with audio_pull from a
+ * thread or callback of its own. With every pull the device tells how
+ * long it will be until the data it takes is heard, which gives the
+ * presentation time heard at that moment. audio_clock smooths these
+ * measurements into a clock that runs at the pace of the device: the
+ * jitter of the pulls is filtered out, the drift of the device against
+ * CLOCK_MONOTONIC is followed. playback_set_audio schedules the video
+ * on that clock (audio master).
+ *
+ * Only PCM is taken, integer or float. It goes to the device as stored,
+ * or in the sample format and channels set with audio_set_output: the
+ * reader converts what it reads into the ring with pcmconv.h, which
+ * also downmixes and applies a gain.
+ *
+ * The host device below is a thread that plays at a set pace into
+ * nothing or into a WAV file; it knows exactly what it plays when,
+ * which lets sync and latency be measured without audio hardware. The
+ * Android device (OpenSL ES) is in audio_sles.c.
+ */
+
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <stdint.h>
+
+#include "avilib1_1_5/avilib.h"
+#include "pcmconv.h"
+
+typedef struct
+{
+  long rate;                /* sample frames per second */
+  int  channels;
+  int  bits;                /* per sample */
+  int  block;               /* bytes of a sample frame */
+  pcm_fmt_t sample;
+} audio_format_t;
+
+typedef struct audio_s audio_t;
+
+/* an output device. start opens it for fmt and has it call audio_pull
+   until stop, which returns once it no longer does. start fails for a
+   format the device can't play */
+typedef struct
+{
+  int   (*start)(void *opaque, audio_t *a, const audio_format_t *fmt);
+  void  (*stop)(void *opaque);
+  void  *opaque;
+} audio_sink_t;
+
+typedef struct
+{
+  unsigned long pulls;
+  uint64_t played;          /* bytes of audio handed to the device */
+  unsigned long underruns;  /* pulls the ring could not fill */
+  uint64_t silence;         /* bytes of silence they got instead */
+  unsigned long reads;      /* AVI_read_audio_at calls of the reader */
+  unsigned long full_waits; /* reader found the ring full */
+  long     ring_bytes;
+  long     ring_min;        /* fewest bytes in the ring at a pull */
+  uint64_t latency_ns;      /* delay the device gave with the last pull */
+  unsigned long snaps;      /* clock set to a measurement, too far off */
+  unsigned long measured;   /* pulls outside underruns, of those: */
+  int64_t  max_error_ns;    /* worst measurement against the clock */
+  uint64_t error_ns;        /* sum of |error| */
+  double   drift_ppm;       /* device against CLOCK_MONOTONIC, > 0 fast */
+} audio_stats_t;
+
+/* track of AVI, counted from 0; the ring holds ring_ms of audio, 0 for
+   500. NULL for a track that is not PCM (see pcm_fmt_wave). AVI stays
+   owned by the caller; the reader only uses AVI_read_audio_at, so video
+   can be read from the handle meanwhile */
+audio_t *audio_new(avi_t *AVI, int track, const audio_sink_t *sink, int ring_ms);
+void audio_free(audio_t *a);
+
+/* what the device gets from now on, by default the track's format.
+   Stops playback. gain is a factor on the samples, -1 for a format or
+   channel count pcmconv does not convert to */
+int audio_set_output(audio_t *a, pcm_fmt_t sample, int channels, float gain);
+
+/* of the device; audio_track_format is that of the track */
+const audio_format_t *audio_format(audio_t *a);
+const audio_format_t *audio_track_format(audio_t *a);
+/* presentation time of the end of the track */
+uint64_t audio_duration(audio_t *a);
+
+/* plays from presentation time pts on, once the ring is filled. The
+   clock stays at pts until the device plays */
+int  audio_start(audio_t *a, uint64_t pts_ns);
+void audio_stop(audio_t *a);
+
+/* presentation time heard now, never going back. Past the end of the
+   track silence is played, and counted like audio */
+uint64_t audio_clock(audio_t *a);
+
+/* For devices: fills bytes (whole sample frames) of buf, with silence
+   where the ring ran dry, and returns the bytes of the track in it.
+   The first byte of buf is heard delay_ns from now. Does not block */
+long audio_pull(audio_t *a, void *buf, long bytes, uint64_t delay_ns);
+
+void audio_get_stats(audio_t *a, audio_stats_t *st);
+
+/*************************************************************************/
+/* the host device                                                       */
+/*************************************************************************/
+
+typedef struct
+{
+  int    period_us;         /* pulled at once, 0 for 10 ms */
+  int    periods;           /* queued in the device, 0 for 4 */
+  double skew_ppm;          /* its clock against CLOCK_MONOTONIC */
+  const char *wav;          /* what it plays goes here, NULL drops it */
+} audio_host_config_t;
+
+typedef struct audio_host_s audio_host_t;
+
+audio_host_t *audio_host_new(const audio_host_config_t *cfg);
+void audio_host_free(audio_host_t *h);
+audio_sink_t audio_host_sink(audio_host_t *h);
+/* presentation time the emulated speaker plays now, exactly; it stays
+   on the last sample heard while the speaker gets silence */
+uint64_t audio_host_pts(audio_host_t *h);
+
+/*************************************************************************/
+/* the Android device, OpenSL ES (audio_sles.c, built for Android only)  */
+/*************************************************************************/
+
+typedef struct audio_sles_s audio_sles_t;
+
+/* output_ms is what the mixer and the hardware below the buffer queue
+   add to the latency, OpenSL ES does not tell */
+audio_sles_t *audio_sles_new(int output_ms);
+void audio_sles_free(audio_sles_t *s);
+audio_sink_t audio_sles_sink(audio_sles_t *s);
+
+#endif /* AUDIO_H */
@@ -0,0 +1,169 @@
+/*
+ * audio_sles.c -- the Android audio device of audio.h, an OpenSL ES
+ * player on a buffer queue
+ *
+ * A few periods are queued; whenever the player is done with one, its
+ * callback pulls the next into it and queues it again. The callback
+ * runs on a thread of the audio framework and must not block, which
+ * audio_pull does not. It plays 8 or 16 bit mono or stereo, which
+ * audio_set_output converts any track to; other formats fail to start
+ * and video keeps its own clock.
+ */
+
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include <SLES/OpenSLES.h>
+#include <SLES/OpenSLES_Android.h>
+
+#include "audio.h"
+
+#define SLES_PERIODS    3
+#define SLES_PERIOD_MS  20
+
+struct audio_sles_s
+{
+  SLObjectItf engine_obj;
+  SLEngineItf engine;
+  SLObjectItf mix;
+  uint64_t output_ns;
+
+  /* while playing */
+  SLObjectItf player;
+  SLPlayItf play;
+  SLAndroidSimpleBufferQueueItf queue;
+  audio_t *a;
+  uint8_t *buf[SLES_PERIODS];
+  long period_bytes;
+  uint64_t period_ns;
+  int next;                 /* buffer to refill */
+  atomic_int stop;
+};
+
+/* the player is done with the oldest buffer, the others are queued in
+   front of the one refilled */
+static void sles_done(SLAndroidSimpleBufferQueueItf q, void *opaque) {
+  audio_sles_t *s = opaque;
+  uint8_t *b = s->buf[s->next];
+
+  if (atomic_load(&s->stop)) return;
+  audio_pull(s->a, b, s->period_bytes, (SLES_PERIODS - 1) * s->period_ns + s->output_ns);
+  (*q)->Enqueue(q, b, (SLuint32) s->period_bytes);
+  s->next = (s->next + 1) % SLES_PERIODS;
+}
+
+static void sles_close(audio_sles_t *s) {
+  int i;
+
+  if (s->player) (*s->player)->Destroy(s->player);
+  s->player = NULL;
+  for (i = 0; i < SLES_PERIODS; i++) {
+    free(s->buf[i]);
+    s->buf[i] = NULL;
+  }
+}
+
+static int sles_start(void *opaque, audio_t *a, const audio_format_t *fmt) {
+  audio_sles_t *s = opaque;
+  SLDataLocator_AndroidSimpleBufferQueue loc = { SL_DATALOCATOR_ANDROIDSIMPLEBUFFERQUEUE, SLES_PERIODS };
+  SLDataFormat_PCM pcm;
+  SLDataSource src = { &loc, &pcm };
+  SLDataLocator_OutputMix out = { SL_DATALOCATOR_OUTPUTMIX, s->mix };
+  SLDataSink snk = { &out, NULL };
+  const SLInterfaceID ids[] = { SL_IID_ANDROIDSIMPLEBUFFERQUEUE };
+  const SLboolean req[] = { SL_BOOLEAN_TRUE };
+  long frames = fmt->rate * SLES_PERIOD_MS / 1000;
+  int i;
+
+  if ((fmt->sample != PCM_FMT_U8 && fmt->sample != PCM_FMT_S16) || fmt->channels > 2 || frames < 1) return -1;
+  pcm.formatType = SL_DATAFORMAT_PCM;
+  pcm.numChannels = fmt->channels;
+  pcm.samplesPerSec = (SLuint32) fmt->rate * 1000;     // mHz
+  pcm.bitsPerSample = fmt->sample == PCM_FMT_U8 ? SL_PCMSAMPLEFORMAT_FIXED_8 : SL_PCMSAMPLEFORMAT_FIXED_16;
+  pcm.containerSize = pcm.bitsPerSample;
+  pcm.channelMask = fmt->channels == 1 ? SL_SPEAKER_FRONT_CENTER
+                                       : SL_SPEAKER_FRONT_LEFT | SL_SPEAKER_FRONT_RIGHT;
+  pcm.endianness = SL_BYTEORDER_LITTLEENDIAN;
+
+  s->a = a;
+  s->period_bytes = frames * fmt->block;
+  s->period_ns = (uint64_t) frames * 1000000000ULL / fmt->rate;
+  s->next = 0;
+  atomic_store(&s->stop, 0);
+  for (i = 0; i < SLES_PERIODS; i++)
+    if (!(s->buf[i] = malloc(s->period_bytes))) goto fail;
+
+  if ((*s->engine)->CreateAudioPlayer(s->engine, &s->player, &src, &snk, 1, ids, req) != SL_RESULT_SUCCESS) {
+    s->player = NULL;
+    goto fail;
+  }
+  if ((*s->player)->Realize(s->player, SL_BOOLEAN_FALSE) != SL_RESULT_SUCCESS
+      || (*s->player)->GetInterface(s->player, SL_IID_PLAY, &s->play) != SL_RESULT_SUCCESS
+      || (*s->player)->GetInterface(s->player, SL_IID_ANDROIDSIMPLEBUFFERQUEUE, &s->queue) != SL_RESULT_SUCCESS
+      || (*s->queue)->RegisterCallback(s->queue, sles_done, s) != SL_RESULT_SUCCESS)
+    goto fail;
+
+  // all periods queued up front, period i is heard i periods from now
+  for (i = 0; i < SLES_PERIODS; i++) {
+    audio_pull(a, s->buf[i], s->period_bytes, i * s->period_ns + s->output_ns);
+    if ((*s->queue)->Enqueue(s->queue, s->buf[i], (SLuint32) s->period_bytes) != SL_RESULT_SUCCESS)
+      goto fail;
+  }
+  if ((*s->play)->SetPlayState(s->play, SL_PLAYSTATE_PLAYING) != SL_RESULT_SUCCESS) goto fail;
+  return 0;
+
+fail:
+  sles_close(s);
+  return -1;
+}
+
+static void sles_stop(void *opaque) {
+  audio_sles_t *s = opaque;
+
+  if (!s->player) return;
+  // Destroy waits for a callback that is running
+  atomic_store(&s->stop, 1);
+  (*s->play)->SetPlayState(s->play, SL_PLAYSTATE_STOPPED);
+  (*s->queue)->Clear(s->queue);
+  sles_close(s);
+}
+
+audio_sles_t *audio_sles_new(int output_ms) {
+  audio_sles_t *s = calloc(1, sizeof(*s));
+
+  if (!s) return NULL;
+  s->output_ns = (uint64_t) output_ms * 1000000;
+  if (slCreateEngine(&s->engine_obj, 0, NULL, 0, NULL, NULL) != SL_RESULT_SUCCESS) {
+    free(s);
+    return NULL;
+  }
+  if ((*s->engine_obj)->Realize(s->engine_obj, SL_BOOLEAN_FALSE) != SL_RESULT_SUCCESS
+      || (*s->engine_obj)->GetInterface(s->engine_obj, SL_IID_ENGINE, &s->engine) != SL_RESULT_SUCCESS
+      || (*s->engine)->CreateOutputMix(s->engine, &s->mix, 0, NULL, NULL) != SL_RESULT_SUCCESS) {
+    (*s->engine_obj)->Destroy(s->engine_obj);
+    free(s);
+    return NULL;
+  }
+  if ((*s->mix)->Realize(s->mix, SL_BOOLEAN_FALSE) != SL_RESULT_SUCCESS) {
+    (*s->mix)->Destroy(s->mix);
+    (*s->engine_obj)->Destroy(s->engine_obj);
+    free(s);
+    return NULL;
+  }
+  atomic_init(&s->stop, 0);
+  return s;
+}
+
+void audio_sles_free(audio_sles_t *s) {
+  if (!s) return;
+  sles_stop(s);
+  (*s->mix)->Destroy(s->mix);
+  (*s->engine_obj)->Destroy(s->engine_obj);
+  free(s);
+}
+
+audio_sink_t audio_sles_sink(audio_sles_t *s) {
+  audio_sink_t sink = { sles_start, sles_stop, s };
+
+  return sink;
+}
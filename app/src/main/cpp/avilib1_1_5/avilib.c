@@ -38,6 +38,12 @@
 #include "avilib.h"
 #include "platform.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #define INFO_LIST
 
 enum {
@@ -46,6 +52,9 @@ enum {
   MAX_INFO_STRLEN = 64,               /* XXX: ???                   */
   FRAME_RATE_SCALE = 1000000,          /* XXX: ???                   */
   HEADERBYTES = 2048,             /* bytes for the header       */
+  AVI_ARENA_SIZE = 64 * 1024,       /* block size of the handle arenas */
+  AVI_TRACE_EVENTS = 1 << 20,       /* spans kept by AVI_trace_start */
+  AVI_REC_BUF = 1024,               /* records buffered by AVI_record_start */
 };
 
 /* AVI_MAX_LEN: The maximum length of an AVI file, we stay a bit below
@@ -70,6 +79,9 @@ static int avi_update_header(avi_t *AVI);
 /* The following variable indicates the kind of error */
 static long AVI_errno = 0;
 
+/* new handles start with I/O statistics, see AVI_set_io_stats_default */
+static int avi_io_stats_default = 0;
+
 
 /*************************************************************************/
 
@@ -122,6 +134,263 @@ static uint32_t str2ulong_key(unsigned char *str) {
 
 /*************************************************************************/
 
+/* All file access of a handle goes through these. Without a backend
+   (AVI->io.read_at == NULL) they map to the plat_ calls on AVI->fdes,
+   otherwise to the backend, with AVI->io_pos as file position. */
+
+static ssize_t avi_io_read(avi_t *AVI, void *buf, size_t count) {
+  ssize_t n;
+
+  if (!AVI->io.read_at)
+    return plat_read(AVI->fdes, buf, count);
+
+  n = AVI->io.read_at(AVI->io.opaque, buf, count, AVI->io_pos);
+  if (n > 0) AVI->io_pos += n;
+  return n;
+}
+
+static ssize_t avi_io_write(avi_t *AVI, const void *buf, size_t count) {
+  ssize_t n;
+
+  if (!AVI->io.read_at)
+    return plat_write(AVI->fdes, buf, count);
+  if (!AVI->io.write_at) {
+    errno = EBADF;
+    return -1;
+  }
+
+  n = AVI->io.write_at(AVI->io.opaque, buf, count, AVI->io_pos);
+  if (n > 0) AVI->io_pos += n;
+  return n;
+}
+
+static int64_t avi_io_seek(avi_t *AVI, int64_t offset, int whence) {
+  int64_t pos;
+
+  if (!AVI->io.read_at)
+    return plat_seek(AVI->fdes, offset, whence);
+
+  switch (whence) {
+    case SEEK_SET: pos = offset; break;
+    case SEEK_CUR: pos = AVI->io_pos + offset; break;
+    case SEEK_END: pos = AVI->io.size(AVI->io.opaque) + offset; break;
+    default: pos = -1; break;
+  }
+  if (pos < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  AVI->io_pos = pos;
+  return pos;
+}
+
+/* positional read, leaves the file position alone */
+static ssize_t avi_io_pread(avi_t *AVI, void *buf, size_t count, int64_t offset) {
+  if (!AVI->io.read_at)
+    return plat_pread(AVI->fdes, buf, count, offset);
+  return AVI->io.read_at(AVI->io.opaque, buf, count, offset);
+}
+
+/* With AVI->io_stats set, the calls above are counted and timed for
+   the API function that is running (AVI->io_op). While tracing they
+   also show up as spans. */
+
+#define avi_io_watched(AVI) ((AVI)->io_stats || (AVI)->rec || plat_trace_enabled())
+
+static void avi_io_count(avi_io_counter_t *c, ssize_t n, uint64_t ns) {
+  int b = 0;
+
+  c->calls++;
+  if (n > 0) c->bytes += n;
+  c->ns += ns;
+  while (b < AVI_IO_HIST_BUCKETS - 1 && (ns >> (b + 1)))
+    b++;
+  c->hist[b]++;
+}
+
+static void avi_io_jump(avi_t *AVI, int64_t pos) {
+  AVI->io_stats->op[AVI->io_op].seek_distance +=
+      (pos > AVI->io_stat_pos) ? pos - AVI->io_stat_pos : AVI->io_stat_pos - pos;
+  AVI->io_stat_pos = pos;
+}
+
+/* Read trace of a handle, see AVI_record_start */
+
+struct avi_recorder_s {
+  int fd;
+  int err;
+  uint64_t last_ns;
+  int n;
+  avi_rec_entry_t buf[AVI_REC_BUF];
+};
+
+static void avi_record_flush(avi_t *AVI) {
+  struct avi_recorder_s *rec = AVI->rec;
+  size_t len = rec->n * sizeof(avi_rec_entry_t);
+
+  if (rec->n && !rec->err && plat_write(rec->fd, rec->buf, len) != (ssize_t) len)
+    rec->err = 1;
+  rec->n = 0;
+}
+
+static void avi_record(avi_t *AVI, int64_t offset, ssize_t n, uint64_t t0, int flags) {
+  struct avi_recorder_s *rec = AVI->rec;
+  avi_rec_entry_t *e = &rec->buf[rec->n];
+  uint64_t dt = (t0 - rec->last_ns) / 1000;
+
+  e->offset = offset;
+  e->length = n;
+  e->delta_us = dt > UINT32_MAX ? UINT32_MAX : dt;
+  e->op = AVI->io_op;
+  e->flags = flags;
+  e->track = 0;
+  e->id = 0;
+  if (AVI->io_op == AVI_IO_READ_VIDEO) {
+    e->id = AVI->video_pos;
+  } else if (AVI->io_op == AVI_IO_READ_AUDIO) {
+    e->track = AVI->aptr;
+    e->id = AVI->track[AVI->aptr].audio_posc;
+  }
+  rec->last_ns = t0;
+
+  if (++rec->n == AVI_REC_BUF)
+    avi_record_flush(AVI);
+}
+
+static int avi_record_close(avi_t *AVI) {
+  int err;
+
+  avi_record_flush(AVI);
+  err = plat_close(AVI->rec->fd) < 0 || AVI->rec->err;
+  plat_free(AVI->rec);
+  AVI->rec = NULL;
+  return err ? -1 : 0;
+}
+
+/* account a read (write == 0) or write of n bytes that started at t0;
+   pos >= 0 for positional calls */
+static void avi_io_done(avi_t *AVI, int write, ssize_t n, uint64_t t0, int64_t pos) {
+  uint64_t dt = plat_time_ns() - t0;
+
+  if (AVI->io_stats) {
+    avi_io_op_stats_t *st = &AVI->io_stats->op[AVI->io_op];
+
+    avi_io_count(write ? &st->write : &st->read, n, dt);
+    if (pos >= 0)
+      avi_io_jump(AVI, pos + (n > 0 ? n : 0));
+    else if (n > 0)
+      AVI->io_stat_pos += n;
+  }
+  if (AVI->rec && !write && n > 0) {
+    // sequential reads: the position moved past the data already
+    if (pos >= 0) avi_record(AVI, pos, n, t0, AVI_REC_PREAD);
+    else avi_record(AVI, avi_io_seek(AVI, 0, SEEK_CUR) - n, n, t0, 0);
+  }
+  plat_trace_span(write ? "write" : "read", "io", t0, dt, "bytes", n);
+}
+
+static ssize_t avi_read(avi_t *AVI, void *buf, size_t count) {
+  uint64_t t0;
+  ssize_t n;
+
+  if (!avi_io_watched(AVI))
+    return avi_io_read(AVI, buf, count);
+
+  t0 = plat_time_ns();
+  n = avi_io_read(AVI, buf, count);
+  avi_io_done(AVI, 0, n, t0, -1);
+  return n;
+}
+
+static ssize_t avi_write(avi_t *AVI, const void *buf, size_t count) {
+  uint64_t t0;
+  ssize_t n;
+
+  if (!avi_io_watched(AVI))
+    return avi_io_write(AVI, buf, count);
+
+  t0 = plat_time_ns();
+  n = avi_io_write(AVI, buf, count);
+  avi_io_done(AVI, 1, n, t0, -1);
+  return n;
+}
+
+static int64_t avi_seek(avi_t *AVI, int64_t offset, int whence) {
+  uint64_t t0, dt;
+  int64_t pos;
+
+  if (!avi_io_watched(AVI))
+    return avi_io_seek(AVI, offset, whence);
+
+  t0 = plat_time_ns();
+  pos = avi_io_seek(AVI, offset, whence);
+  dt = plat_time_ns() - t0;
+  if (AVI->io_stats) {
+    AVI->io_stats->op[AVI->io_op].seek_ns += dt;
+    AVI->io_stats->op[AVI->io_op].seeks++;
+    if (pos >= 0)
+      avi_io_jump(AVI, pos);
+  }
+  plat_trace_span("seek", "io", t0, dt, "pos", pos);
+  return pos;
+}
+
+/* a span for one step of opening a file, see AVI_trace_start */
+#define avi_trace_phase(name, t0, arg_name, arg) \
+    plat_trace_span(name, "parse", t0, plat_time_ns() - (t0), arg_name, arg)
+
+/* Called first by API functions: charges I/O to the function
+   (AVI_get_io_stats) */
+
+static void avi_enter(avi_t *AVI, int op) {
+  AVI->io_op = op;
+}
+
+/* Heap blocks of a handle are charged to it (see AVI_memory_stats) by
+   these, the site is still the caller's. Nothing is charged by thread,
+   so what others allocate between calls stays theirs */
+
+#define avi_malloc(AVI, size)       avi_own(AVI, plat_malloc(size))
+#define avi_zalloc(AVI, size)       avi_own(AVI, plat_zalloc(size))
+#define avi_realloc(AVI, p, size)   avi_own(AVI, plat_realloc(p, size))
+
+static void *avi_own(avi_t *AVI, void *ptr) {
+  plat_mem_adopt(ptr, AVI);
+  return ptr;
+}
+
+/* counted as a read, the jump to offset adds to the seek distance */
+static ssize_t avi_pread(avi_t *AVI, void *buf, size_t count, int64_t offset) {
+  uint64_t t0;
+  ssize_t n;
+
+  if (!avi_io_watched(AVI))
+    return avi_io_pread(AVI, buf, count, offset);
+
+  t0 = plat_time_ns();
+  n = avi_io_pread(AVI, buf, count, offset);
+  avi_io_done(AVI, 0, n, t0, offset);
+  return n;
+}
+
+static int avi_truncate(avi_t *AVI, int64_t length) {
+  if (!AVI->io.read_at)
+    return plat_ftruncate(AVI->fdes, length);
+  if (!AVI->io.truncate)
+    return 0;
+  return AVI->io.truncate(AVI->io.opaque, length);
+}
+
+static int avi_close_file(avi_t *AVI) {
+  if (!AVI->io.read_at)
+    return plat_close(AVI->fdes);
+  if (!AVI->io.close)
+    return 0;
+  return AVI->io.close(AVI->io.opaque);
+}
+
+/*************************************************************************/
+
 /* Calculate audio sample size from number of bits and number of channels.
    This may have to be adjusted for eg. 12 bits and stereo */
 
@@ -150,11 +419,11 @@ static int avi_add_chunk(avi_t *AVI, const unsigned char *tag,
   /* Output tag, length and data, restore previous position
       if the write fails */
 
-  if (plat_write(AVI->fdes, (char *) c, 8) != 8 ||
-      plat_write(AVI->fdes, (char *) data, length) != length ||
-      plat_write(AVI->fdes, &p, length & 1) != (length & 1)) // if len is uneven, write a pad byte
+  if (avi_write(AVI, (char *) c, 8) != 8 ||
+      avi_write(AVI, (char *) data, length) != length ||
+      avi_write(AVI, &p, length & 1) != (length & 1)) // if len is uneven, write a pad byte
   {
-    plat_seek(AVI->fdes, AVI->pos, SEEK_SET);
+    avi_seek(AVI, AVI->pos, SEEK_SET);
     AVI_errno = AVI_ERR_WRITE;
     return -1;
   }
@@ -168,6 +437,90 @@ static int avi_add_chunk(avi_t *AVI, const unsigned char *tag,
   return 0;
 }
 
+/* Copy length bytes at offset of src to the current position of AVI.
+   Between two plain files the payload stays in the kernel. */
+
+static ssize_t avi_copy_data(avi_t *AVI, avi_t *src, off_t offset, size_t length) {
+  char *buf;
+  ssize_t n = 0, r = 0;
+
+  if (!AVI->io.read_at && !src->io.read_at) {
+    uint64_t t0;
+
+    if (!avi_io_watched(AVI) && !src->io_stats)
+      return plat_copy(AVI->fdes, src->fdes, offset, length);
+
+    t0 = plat_time_ns();
+    n = plat_copy(AVI->fdes, src->fdes, offset, length);
+    avi_io_done(AVI, 1, n, t0, -1);
+    if (src->io_stats && src != AVI) {
+      avi_io_count(&src->io_stats->op[src->io_op].read, n, plat_time_ns() - t0);
+      avi_io_jump(src, offset + (n > 0 ? n : 0));
+    }
+    return n;
+  }
+
+  buf = avi_malloc(AVI, length < (1 << 20) ? length : (1 << 20));
+  if (!buf) return -1;
+
+  while (r < length) {
+    size_t todo = length - r;
+    if (todo > (1 << 20)) todo = (1 << 20);
+    n = avi_pread(src, buf, todo, offset + r);
+    if (n <= 0 || avi_write(AVI, buf, n) != n) break;
+    r += n;
+  }
+  plat_free(buf);
+  return r;
+}
+
+/* Same as avi_add_chunk, but the chunk data is taken from src at
+   offset, so the payload never has to pass through a user buffer */
+
+static int avi_copy_chunk(avi_t *AVI, const unsigned char *tag,
+                          avi_t *src, off_t offset, int length) {
+  unsigned char c[8];
+  char p = 0;
+
+  memcpy(c, tag, 4);
+  long2str(c + 4, length);
+
+  if (avi_write(AVI, (char *) c, 8) != 8 ||
+      avi_copy_data(AVI, src, offset, length) != length ||
+      avi_write(AVI, &p, length & 1) != (length & 1)) {
+    avi_seek(AVI, AVI->pos, SEEK_SET);
+    AVI_errno = AVI_ERR_WRITE;
+    return -1;
+  }
+
+  AVI->pos += 8 + PAD_EVEN(length);
+
+  return 0;
+}
+
+/* Put a JUNK chunk in front of the next chunk, so that its payload
+   starts at a multiple of AVI->chunk_align */
+
+static int avi_pad_chunk(avi_t *AVI) {
+  long align = AVI->chunk_align;
+  long pad;
+
+  if (align <= 0 || (AVI->pos + 8) % align == 0)
+    return 0;
+
+  pad = (align - (AVI->pos + 16) % align) % align;
+
+  if (!AVI->pad_buf) {
+    AVI->pad_buf = plat_arena_zalloc(AVI->arena, align);
+    if (!AVI->pad_buf) {
+      AVI_errno = AVI_ERR_NO_MEM;
+      return -1;
+    }
+  }
+
+  return avi_add_chunk(AVI, (unsigned char *) "JUNK", AVI->pad_buf, pad);
+}
+
 #define OUTD(n) long2str(ix00+bl,n); bl+=4
 #define OUTW(n) ix00[bl] = (n)&0xff; ix00[bl+1] = (n>>8)&0xff; bl+=2
 #define OUTC(n) ix00[bl] = (n)&0xff; bl+=1
@@ -178,8 +531,13 @@ static int avi_ixnn_entry(avi_t *AVI, avistdindex_chunk *ch,
                           avisuperindex_entry *en) {
   int bl, k;
   unsigned int max = ch->nEntriesInUse * sizeof(uint32_t) * ch->wLongsPerEntry + 24; // header
-  char *ix00 = plat_malloc(max);
+  char *ix00 = plat_arena_alloc(AVI->scratch, max);
   char dfcc[5];
+
+  if (!ix00) {
+    AVI_errno = AVI_ERR_NO_MEM;
+    return -1;
+  }
   memcpy(dfcc, ch->fcc, 4);
   dfcc[4] = 0;
 
@@ -211,11 +569,11 @@ static int avi_ixnn_entry(avi_t *AVI, avistdindex_chunk *ch,
     OUTD(ch->aIndex[k].dwOffset);
     OUTD(ch->aIndex[k].dwSize);
   }
-  avi_add_chunk(AVI, ch->fcc, ix00, max);
+  k = avi_add_chunk(AVI, ch->fcc, ix00, max);
 
-  plat_free(ix00);
+  plat_arena_reset(AVI->scratch);
 
-  return 0;
+  return k;
 }
 
 #undef OUTS
@@ -228,7 +586,7 @@ static int avi_init_super_index(avi_t *AVI, const unsigned char *idxtag,
                                 avisuperindex_chunk **si) {
   int k;
 
-  avisuperindex_chunk *sil = plat_zalloc(sizeof(avisuperindex_chunk));
+  avisuperindex_chunk *sil = plat_arena_zalloc(AVI->arena, sizeof(avisuperindex_chunk));
   if (sil == NULL) {
     AVI_errno = AVI_ERR_NO_MEM;
     return -1;
@@ -243,19 +601,23 @@ static int avi_init_super_index(avi_t *AVI, const unsigned char *idxtag,
   memset(sil->dwReserved, 0, sizeof(sil->dwReserved));
 
   // NR_IXNN_CHUNKS == allow 32 indices which means 32 GB files -- arbitrary
-  sil->aIndex = plat_zalloc(sil->wLongsPerEntry * NR_IXNN_CHUNKS * sizeof(uint32_t));
+  sil->aIndex = plat_arena_zalloc(AVI->arena, sil->wLongsPerEntry * NR_IXNN_CHUNKS * sizeof(uint32_t));
   if (!sil->aIndex) {
     AVI_errno = AVI_ERR_NO_MEM;
     return -1;
   }
 
-  sil->stdindex = plat_zalloc(NR_IXNN_CHUNKS * sizeof(avistdindex_chunk *));
+  sil->stdindex = plat_arena_zalloc(AVI->arena, NR_IXNN_CHUNKS * sizeof(avistdindex_chunk *));
   if (!sil->stdindex) {
     AVI_errno = AVI_ERR_NO_MEM;
     return -1;
   }
   for (k = 0; k < NR_IXNN_CHUNKS; k++) {
-    sil->stdindex[k] = plat_zalloc(sizeof(avistdindex_chunk));
+    sil->stdindex[k] = plat_arena_zalloc(AVI->arena, sizeof(avistdindex_chunk));
+    if (!sil->stdindex[k]) {
+      AVI_errno = AVI_ERR_NO_MEM;
+      return -1;
+    }
     // gets rewritten later
     sil->stdindex[k]->qwBaseOffset = (uint64_t) k * NEW_RIFF_THRES;
   }
@@ -283,7 +645,7 @@ static int avi_add_std_index(avi_t *AVI, const unsigned char *idxtag,
 
   //stdil->qwBaseOffset = AVI->video_superindex->aIndex[ cur_std_idx ]->qwOffset;
 
-  stdil->aIndex = plat_zalloc(stdil->dwSize * sizeof(uint32_t) * stdil->wLongsPerEntry);
+  stdil->aIndex = avi_zalloc(AVI, stdil->dwSize * sizeof(uint32_t) * stdil->wLongsPerEntry);
 
   if (!stdil->aIndex) {
     AVI_errno = AVI_ERR_NO_MEM;
@@ -296,6 +658,11 @@ static int avi_add_odml_index_entry_core(avi_t *AVI, long flags, off_t pos,
                                          unsigned long len,
                                          avistdindex_chunk *si) {
   int cur_chunk_idx;
+
+  // dwOffset is relative to the current RIFF chunk and can not point back
+  if (pos < si->qwBaseOffset)
+    return 1;
+
   // put new chunk into index
   si->nEntriesInUse++;
   cur_chunk_idx = si->nEntriesInUse - 1;
@@ -303,7 +670,7 @@ static int avi_add_odml_index_entry_core(avi_t *AVI, long flags, off_t pos,
   // need to fetch more memory
   if (cur_chunk_idx >= si->dwSize) {
     si->dwSize += 4096;
-    si->aIndex = plat_realloc(si->aIndex, si->dwSize * sizeof(uint32_t) * si->wLongsPerEntry);
+    si->aIndex = avi_realloc(AVI, si->aIndex, si->dwSize * sizeof(uint32_t) * si->wLongsPerEntry);
   }
 
   if (len > AVI->max_len)
@@ -330,8 +697,10 @@ static int avi_add_odml_index_entry(avi_t *AVI, const unsigned char *tag,
   int video = !audio;
 
   unsigned int cur_std_idx;
-  int audtr;
+  int audtr, ret = 0;
   off_t towrite = 0LL;
+  // a new chunk goes to AVI->pos, which moves if a new RIFF is started
+  int new_chunk = (pos == AVI->pos);
 
   if (video) {
 
@@ -391,7 +760,9 @@ static int avi_add_odml_index_entry(avi_t *AVI, const unsigned char *tag,
                  + 4 + 4 + 2 + 1 + 1 + 4 + 4 + 8 + 4;
     }
   }
-  towrite += len + (len & 1) + 8;
+  // a duplicate (AVI_dup_frame) writes no payload, only its index entry
+  if (new_chunk)
+    towrite += len + (len & 1) + 8;
 
   //printf("ODML: towrite = 0x%llX = %lld\n", towrite, towrite);
 
@@ -399,6 +770,9 @@ static int avi_add_odml_index_entry(avi_t *AVI, const unsigned char *tag,
       (off_t) (AVI->pos + towrite) >
       (off_t) ((off_t) NEW_RIFF_THRES * AVI->video_superindex->nEntriesInUse)) {
 
+    uint64_t t_rot = plat_time_ns();
+    off_t pos_rot = AVI->pos;
+
     plat_log_send(PLAT_LOG_INFO, __FILE__, "Adding a new RIFF chunk: %d",
                   AVI->video_superindex->nEntriesInUse);
 
@@ -483,27 +857,40 @@ static int avi_add_odml_index_entry(avi_t *AVI, const unsigned char *tag,
 
       // now we can be sure
       AVI->is_opendml++;
+
+      // the RIFF header moved the next video payload off the boundary
+      if (video && avi_pad_chunk(AVI))
+        return -1;
+
+      if (AVI->io_stats)
+        avi_io_count(&AVI->io_stats->riff, AVI->pos - pos_rot, plat_time_ns() - t_rot);
+      plat_trace_span("RIFF rotation", "write", t_rot, plat_time_ns() - t_rot,
+                      "riff", cur_std_idx);
     }
 
   }
 
 
+  if (new_chunk)
+    pos = AVI->pos;
+
   if (video) {
-    avi_add_odml_index_entry_core(AVI, flags, AVI->pos, len,
-                                  AVI->video_superindex->stdindex[
-                                      AVI->video_superindex->nEntriesInUse - 1]);
+    ret = avi_add_odml_index_entry_core(AVI, flags, pos, len,
+                                        AVI->video_superindex->stdindex[
+                                            AVI->video_superindex->nEntriesInUse - 1]);
 
-    AVI->total_frames++;
+    if (ret == 0)
+      AVI->total_frames++;
   } // video
 
   if (audio) {
-    avi_add_odml_index_entry_core(AVI, flags, AVI->pos, len,
-                                  AVI->track[AVI->aptr].audio_superindex->stdindex[
-                                      AVI->track[AVI->aptr].audio_superindex->nEntriesInUse - 1]);
+    ret = avi_add_odml_index_entry_core(AVI, flags, pos, len,
+                                        AVI->track[AVI->aptr].audio_superindex->stdindex[
+                                            AVI->track[AVI->aptr].audio_superindex->nEntriesInUse - 1]);
   }
 
 
-  return 0;
+  return ret;
 }
 
 // #undef NR_IXNN_CHUNKS
@@ -513,7 +900,7 @@ static int avi_add_index_entry(avi_t *AVI, const unsigned char *tag, long flags,
   void *ptr;
 
   if (AVI->n_idx >= AVI->max_idx) {
-    ptr = plat_realloc((void *) AVI->idx, (AVI->max_idx + 4096) * 16);
+    ptr = avi_realloc(AVI, (void *) AVI->idx, (AVI->max_idx + 4096) * 16);
 
     if (ptr == 0) {
       AVI_errno = AVI_ERR_NO_MEM;
@@ -568,37 +955,56 @@ int AVI_can_read_audio(avi_t *AVI) {
    returns a pointer to avi_t on success, a zero pointer on error
 */
 
-avi_t *AVI_open_output_file(const char *filename) {
-  avi_t *AVI = NULL;
-  uint8_t AVI_header[HEADERBYTES];
-  int i;
+/* Allocate a zeroed avi_t together with its arenas */
 
-  /* Allocate the avi_t struct and zero it */
+static avi_t *avi_alloc(void) {
+  avi_t *AVI = plat_zalloc(sizeof(avi_t));
 
-  AVI = plat_zalloc(sizeof(avi_t));
-  if (!AVI) {
-    AVI_errno = AVI_ERR_NO_MEM;
-    return NULL;
+  if (AVI) {
+    plat_mem_adopt(AVI, AVI);
+    AVI->io_op = AVI_IO_OPEN;
+    if (avi_io_stats_default)
+      AVI->io_stats = avi_zalloc(AVI, sizeof(avi_io_stats_t));
+    AVI->arena = plat_arena_new(AVI_ARENA_SIZE);
+    AVI->scratch = plat_arena_new(AVI_ARENA_SIZE);
+    if (!AVI->arena || !AVI->scratch) {
+      plat_arena_free(AVI->arena);
+      plat_arena_free(AVI->scratch);
+      plat_free(AVI);
+      AVI = NULL;
+    } else {
+      plat_arena_adopt(AVI->arena, AVI);
+      plat_arena_adopt(AVI->scratch, AVI);
+    }
   }
+  if (!AVI)
+    AVI_errno = AVI_ERR_NO_MEM;
 
-  AVI->fdes = plat_open(filename, O_RDWR | O_CREAT | O_TRUNC,
-                        S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+  return AVI;
+}
 
-  if (AVI->fdes < 0) {
-    AVI_errno = AVI_ERR_OPEN;
-    plat_free(AVI);
-    return NULL;
-  }
+static void avi_free(avi_t *AVI) {
+  if (AVI->rec)
+    avi_record_close(AVI);
+  plat_free(AVI->io_stats);
+  plat_arena_free(AVI->arena);
+  plat_arena_free(AVI->scratch);
+  plat_free(AVI);
+}
+
+static avi_t *avi_init_output(avi_t *AVI) {
+  uint8_t AVI_header[HEADERBYTES];
+  int i;
 
   /* Write out HEADERBYTES bytes, the header will go here
        when we are finished with writing */
 
   memset(AVI_header, 0, sizeof(AVI_header));
-  i = plat_write(AVI->fdes, (char *) AVI_header, HEADERBYTES);
+  i = avi_write(AVI, (char *) AVI_header, HEADERBYTES);
   if (i != HEADERBYTES) {
-    plat_close(AVI->fdes);
+    avi_close_file(AVI);
     AVI_errno = AVI_ERR_WRITE;
-    plat_free(AVI);
+    avi_free(AVI);
     return NULL;
   }
 
@@ -612,13 +1018,62 @@ avi_t *AVI_open_output_file(const char *filename) {
   return AVI;
 }
 
+avi_t *AVI_open_output_file(const char *filename) {
+  avi_t *AVI = NULL;
+
+  /* Allocate the avi_t struct and zero it */
+
+  AVI = avi_alloc();
+  if (!AVI)
+    return NULL;
+
+  AVI->fdes = plat_open(filename, O_RDWR | O_CREAT | O_TRUNC,
+                        S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+
+  if (AVI->fdes < 0) {
+    AVI_errno = AVI_ERR_OPEN;
+    avi_free(AVI);
+    return NULL;
+  }
+
+  return avi_init_output(AVI);
+}
+
+/*
+   AVI_open_output_io: Like AVI_open_output_file, but all output goes
+                       through the backend io (needs write_at). The
+                       handle owns the backend, AVI_close closes it.
+*/
+
+avi_t *AVI_open_output_io(const avi_io_t *io) {
+  avi_t *AVI = NULL;
+
+  if (!io->read_at || !io->write_at || !io->size) {
+    AVI_errno = AVI_ERR_OPEN;
+    return NULL;
+  }
+
+  AVI = avi_alloc();
+  if (!AVI)
+    return NULL;
+
+  AVI->io = *io;
+  AVI->fdes = -1;
+
+  return avi_init_output(AVI);
+}
+
 void AVI_set_video(avi_t *AVI, int width, int height, double fps,
                    const char *compressor) {
+  avi_enter(AVI, AVI_IO_OTHER);
   /* may only be called if file is open for writing */
   if (AVI->mode != AVI_MODE_READ) {
     AVI->width = width;
     AVI->height = height;
     AVI->fps = fps;
+    // what avi_update_header will store
+    AVI->fps_rate = fps < 0.001 ? 0 : (uint32_t) (FRAME_RATE_SCALE * fps + 0.5);
+    AVI->fps_scale = AVI->fps_rate ? FRAME_RATE_SCALE : 0;
 
     if (strncmp(compressor, "RGB", 3) == 0) {
       memset(AVI->compressor, 0, 4);
@@ -635,6 +1090,7 @@ void AVI_set_video(avi_t *AVI, int width, int height, double fps,
 
 void AVI_set_audio(avi_t *AVI, int channels, long rate, int bits, int format,
                    long mp3rate) {
+  avi_enter(AVI, AVI_IO_OTHER);
   /* may only be called if file is open for writing */
   if (AVI->mode != AVI_MODE_READ) {
     AVI->aptr = AVI->anum;
@@ -747,7 +1203,7 @@ int avi_update_header(avi_t *AVI) {
   if (hasIndex) flag |= AVIF_HASINDEX;
   if (hasIndex && AVI->must_use_index) flag |= AVIF_MUSTUSEINDEX;
   OUTLONG(flag);               /* Flags */
-  OUTLONG(0);                  // no frames yet
+  OUTLONG(AVI->video_frames);  // frames so far
   OUTLONG(0);                  /* InitialFrames */
 
   OUTLONG(AVI->anum + 1);
@@ -781,8 +1237,8 @@ int avi_update_header(avi_t *AVI) {
   OUTLONG(FRAME_RATE_SCALE);              /* Scale */
   OUTLONG(frate);              /* Rate: Rate/Scale == samples/second */
   OUTLONG(0);                  /* Start */
-  OUTLONG(0);                  // no frames yet
-  OUTLONG(0);                  /* SuggestedBufferSize */
+  OUTLONG(AVI->video_frames);  // frames so far
+  OUTLONG(AVI->max_len);       /* SuggestedBufferSize */
   OUTLONG(-1);                 /* Quality */
   OUTLONG(0);                  /* SampleSize */
   OUTLONG(0);                  /* Frame */
@@ -920,9 +1376,9 @@ int avi_update_header(avi_t *AVI) {
   /* Output the header, truncate the file to the number of bytes
       actually written, report an error if someting goes wrong */
 
-  if (plat_seek(AVI->fdes, 0, SEEK_SET) < 0 ||
-      plat_write(AVI->fdes, (char *) AVI_header, HEADERBYTES) != HEADERBYTES ||
-      plat_seek(AVI->fdes, AVI->pos, SEEK_SET) < 0) {
+  if (avi_seek(AVI, 0, SEEK_SET) < 0 ||
+      avi_write(AVI, (char *) AVI_header, HEADERBYTES) != HEADERBYTES ||
+      avi_seek(AVI, AVI->pos, SEEK_SET) < 0) {
     AVI_errno = AVI_ERR_CLOSE;
     return -1;
   }
@@ -1604,9 +2060,9 @@ static int avi_close_output_file(avi_t *AVI) {
   /* Output the header, truncate the file to the number of bytes
       actually written, report an error if someting goes wrong */
 
-  if (plat_seek(AVI->fdes, 0, SEEK_SET) < 0 ||
-      plat_write(AVI->fdes, (char *) AVI_header, HEADERBYTES) != HEADERBYTES ||
-      plat_ftruncate(AVI->fdes, AVI->pos) < 0) {
+  if (avi_seek(AVI, 0, SEEK_SET) < 0 ||
+      avi_write(AVI, (char *) AVI_header, HEADERBYTES) != HEADERBYTES ||
+      avi_truncate(AVI, AVI->pos) < 0) {
     AVI_errno = AVI_ERR_CLOSE;
     return -1;
   }
@@ -1620,17 +2076,17 @@ static int avi_close_output_file(avi_t *AVI) {
 
     for (k = 1; k < AVI->video_superindex->nEntriesInUse; k++) {
       // the len of the RIFF Chunk
-      plat_seek(AVI->fdes, AVI->video_superindex->stdindex[k]->qwBaseOffset + 4, SEEK_SET);
+      avi_seek(AVI, AVI->video_superindex->stdindex[k]->qwBaseOffset + 4, SEEK_SET);
       len = AVI->video_superindex->stdindex[k + 1]->qwBaseOffset -
             AVI->video_superindex->stdindex[k]->qwBaseOffset - 8;
       long2str(f, len);
-      plat_write(AVI->fdes, f, 4);
+      avi_write(AVI, f, 4);
 
       // len of the LIST/movi chunk
-      plat_seek(AVI->fdes, 8, SEEK_CUR);
+      avi_seek(AVI, 8, SEEK_CUR);
       len -= 12;
       long2str(f, len);
-      plat_write(AVI->fdes, f, 4);
+      avi_write(AVI, f, 4);
     }
   }
 
@@ -1640,6 +2096,127 @@ static int avi_close_output_file(avi_t *AVI) {
   return 0;
 }
 
+/*************************************************************************/
+/* checkpoints: index journal in the aviindex text format                */
+
+/* Remember the index entry of the chunk with header at pos.
+   type is 1 for video, 2.. for the audio tracks */
+
+static int avi_journal_entry(avi_t *AVI, const unsigned char *tag, int type,
+                             off_t pos, unsigned long len, int key) {
+  if (AVI->ckpt_fd <= 0) return 0;
+
+  if (AVI->ckpt_size - AVI->ckpt_len < 64) {
+    char *p = avi_realloc(AVI, AVI->ckpt_buf, AVI->ckpt_size + 64 * 1024);
+    if (!p) {
+      AVI_errno = AVI_ERR_NO_MEM;
+      return -1;
+    }
+    AVI->ckpt_buf = p;
+    AVI->ckpt_size += 64 * 1024;
+  }
+
+  AVI->ckpt_len += snprintf(AVI->ckpt_buf + AVI->ckpt_len, AVI->ckpt_size - AVI->ckpt_len,
+                            "%.4s %d 0 0 %lld %lu %d 0\n", tag, type,
+                            (long long) pos, len, key ? 1 : 0);
+  return 0;
+}
+
+/* Append the pending journal entries and rewrite the header, so that
+   the file can be opened with its journal after a crash */
+
+static int avi_checkpoint(avi_t *AVI) {
+  uint64_t t0 = plat_time_ns(), dt;
+  int ret = 0;
+
+  if (AVI->ckpt_len > 0 &&
+      plat_write(AVI->ckpt_fd, AVI->ckpt_buf, AVI->ckpt_len) != AVI->ckpt_len)
+    ret = -1;
+  AVI->ckpt_len = 0;
+
+  if (avi_update_header(AVI) < 0)
+    ret = -1;
+
+  if (AVI->ckpt_sync) {
+    if (!AVI->io.read_at)
+      plat_fsync(AVI->fdes);
+    plat_fsync(AVI->ckpt_fd);
+  }
+
+  AVI->ckpt_pending = 0;
+
+  dt = plat_time_ns() - t0;
+  AVI->ckpt_count++;
+  AVI->ckpt_total_ns += dt;
+  if (dt > AVI->ckpt_max_ns) AVI->ckpt_max_ns = dt;
+
+  if (ret) AVI_errno = AVI_ERR_WRITE;
+  return ret;
+}
+
+static int avi_checkpoint_frame(avi_t *AVI) {
+  if (AVI->ckpt_frames <= 0) return 0;
+  if (++AVI->ckpt_pending < AVI->ckpt_frames) return 0;
+  return avi_checkpoint(AVI);
+}
+
+/*
+   AVI_set_checkpoint: Every frames video frames, append the index
+                       entries written since the last checkpoint to
+                       the journal file and rewrite the header. With
+                       sync the data is also flushed to the device.
+                       The work per checkpoint is the 2 KB header plus
+                       one journal line per chunk since the last one.
+
+                       A file left behind by a crash is opened in
+                       O(index size) with
+                       AVI_open_input_indexfile(filename, 0, journal).
+*/
+
+int AVI_set_checkpoint(avi_t *AVI, long frames, const char *journal, int sync) {
+  char line[128];
+  int n;
+
+  avi_enter(AVI, AVI_IO_OTHER);
+  if (AVI->mode == AVI_MODE_READ) {
+    AVI_errno = AVI_ERR_NOT_PERM;
+    return -1;
+  }
+  if (AVI->ckpt_fd > 0) {
+    plat_log_send(PLAT_LOG_ERROR, __FILE__, "checkpoint journal already set");
+    return -1;
+  }
+
+  AVI->ckpt_fd = plat_open(journal, O_WRONLY | O_CREAT | O_TRUNC,
+                           S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  if (AVI->ckpt_fd < 0) {
+    AVI->ckpt_fd = 0;
+    AVI_errno = AVI_ERR_OPEN;
+    return -1;
+  }
+
+  n = snprintf(line, sizeof(line),
+               "AVIIDX1 # Generated by %s-%s avilib checkpoint\n"
+               "TAG TYPE CHUNK CHUNK/TYPE POS LEN KEY MS\n", PACKAGE, VERSION);
+  if (plat_write(AVI->ckpt_fd, line, n) != n) {
+    AVI_errno = AVI_ERR_WRITE;
+    return -1;
+  }
+
+  AVI->ckpt_frames = frames;
+  AVI->ckpt_sync = sync;
+  AVI->ckpt_pending = 0;
+
+  return avi_checkpoint(AVI);
+}
+
+int AVI_checkpoint_stats(avi_t *AVI, long *count, uint64_t *total_us, uint64_t *max_us) {
+  if (count) *count = AVI->ckpt_count;
+  if (total_us) *total_us = AVI->ckpt_total_ns / 1000;
+  if (max_us) *max_us = AVI->ckpt_max_ns / 1000;
+  return 0;
+}
+
 /*
    AVI_write_data:
    Add video or audio data to the file;
@@ -1650,8 +2227,8 @@ static int avi_close_output_file(avi_t *AVI) {
 
 */
 
-static int plat_write_data(avi_t *AVI, const char *data, unsigned long length,
-                           int audio, int keyframe) {
+static int plat_write_data(avi_t *AVI, const char *data, avi_t *src, off_t offset,
+                           unsigned long length, int audio, int keyframe) {
   int n = 0;
 
   unsigned char astr[5];
@@ -1673,6 +2250,8 @@ static int plat_write_data(avi_t *AVI, const char *data, unsigned long length,
   //set tag for current audio track
   snprintf((char *) astr, sizeof(astr), "0%1dwb", (int) (AVI->aptr + 1));
 
+  if (!audio && avi_pad_chunk(AVI)) return -1;
+
   if (audio) {
     if (!AVI->is_opendml) n = avi_add_index_entry(AVI, astr, 0x10, AVI->pos, length);
     n += avi_add_odml_index_entry(AVI, astr, 0x10, AVI->pos, length);
@@ -1686,9 +2265,15 @@ static int plat_write_data(avi_t *AVI, const char *data, unsigned long length,
 
   if (n) return -1;
 
-  /* Output tag and data */
+  if (avi_journal_entry(AVI, audio ? astr : (unsigned char *) "00db",
+                        audio ? AVI->aptr + 2 : 1, AVI->pos, length, audio || keyframe))
+    return -1;
+
+  /* Output tag and data, data == NULL means copy it from src */
 
-  if (audio)
+  if (data == NULL)
+    n = avi_copy_chunk(AVI, audio ? astr : (unsigned char *) "00db", src, offset, length);
+  else if (audio)
     n = avi_add_chunk(AVI, (unsigned char *) astr, data, length);
   else
     n = avi_add_chunk(AVI, (unsigned char *) "00db", data, length);
@@ -1698,36 +2283,514 @@ static int plat_write_data(avi_t *AVI, const char *data, unsigned long length,
   return 0;
 }
 
-int AVI_write_frame(avi_t *AVI, const char *data, long bytes, int keyframe) {
-  off_t pos;
+/* Returns 1 if the sum of absolute differences of a and b is at
+   most max_sad. Gives up as soon as the limit is exceeded. */
 
-  if (AVI->mode == AVI_MODE_READ) {
+static int avi_frame_similar(const unsigned char *a, const unsigned char *b,
+                             long len, uint64_t max_sad) {
+  uint64_t sad = 0;
+  long i = 0;
+
+  if (max_sad == 0)
+    return memcmp(a, b, len) == 0;
+
+#if defined(__SSE2__)
+  while (i + 16 <= len) {
+    __m128i acc = _mm_setzero_si128();
+    long end = (len - i < 4096) ? i + ((len - i) & ~15L) : i + 4096;
+
+    for (; i < end; i += 16) {
+      __m128i va = _mm_loadu_si128((const __m128i *) (a + i));
+      __m128i vb = _mm_loadu_si128((const __m128i *) (b + i));
+      acc = _mm_add_epi64(acc, _mm_sad_epu8(va, vb));
+    }
+    sad += (uint64_t) _mm_cvtsi128_si32(acc) +
+           (uint64_t) _mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+    if (sad > max_sad) return 0;
+  }
+#elif defined(__ARM_NEON)
+  while (i + 16 <= len) {
+    uint32x4_t acc = vdupq_n_u32(0);
+    long end = (len - i < 4096) ? i + ((len - i) & ~15L) : i + 4096;
+
+    for (; i < end; i += 16) {
+      uint8x16_t d = vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+      acc = vpadalq_u16(acc, vpaddlq_u8(d));
+    }
+    sad += (uint64_t) vgetq_lane_u32(acc, 0) + vgetq_lane_u32(acc, 1) +
+           vgetq_lane_u32(acc, 2) + vgetq_lane_u32(acc, 3);
+    if (sad > max_sad) return 0;
+  }
+#endif
+
+  for (; i < len; i++)
+    sad += (a[i] > b[i]) ? a[i] - b[i] : b[i] - a[i];
+
+  return sad <= max_sad;
+}
+
+/* Write the audio collected for track j as one chunk */
+
+static int avi_flush_audio(avi_t *AVI, int j) {
+  track_t *t = &AVI->track[j];
+  int aptr = AVI->aptr;
+  int n;
+
+  if (t->agg_len == 0) return 0;
+
+  AVI->aptr = j;
+  n = plat_write_data(AVI, t->agg_buf, NULL, 0, t->agg_len, 1, 0);
+  AVI->aptr = aptr;
+  if (n) return -1;
+
+  t->audio_bytes += t->agg_len;
+  t->audio_chunks++;
+  t->agg_len = 0;
+  return 0;
+}
+
+static int avi_flush_all_audio(avi_t *AVI) {
+  int j;
+
+  for (j = 0; j < AVI->anum; j++)
+    if (avi_flush_audio(AVI, j)) return -1;
+  return 0;
+}
+
+/* Number of bytes after which the audio of track j is flushed */
+
+static long avi_audio_agg_limit(avi_t *AVI, int j) {
+  track_t *t = &AVI->track[j];
+  long limit = AVI->agg_bytes, rate, by_time;
+
+  if (AVI->agg_ms > 0) {
+    if (t->a_fmt == WAVE_FORMAT_PCM)
+      rate = t->a_rate * ((t->a_bits + 7) / 8) * t->a_chans;
+    else
+      rate = 1000 * t->mp3rate / 8;
+    by_time = rate * AVI->agg_ms / 1000;
+    if (by_time > 0 && (limit <= 0 || by_time < limit))
+      limit = by_time;
+  }
+  return limit;
+}
+
+static int avi_buffer_audio(avi_t *AVI, const char *data, long bytes) {
+  track_t *t = &AVI->track[AVI->aptr];
+  long limit = avi_audio_agg_limit(AVI, AVI->aptr);
+
+  if (t->agg_len + bytes > t->agg_size) {
+    long size = t->agg_len + bytes;
+    char *p;
+
+    if (size < limit) size = limit;
+    p = avi_realloc(AVI, t->agg_buf, size);
+    if (!p) {
+      AVI_errno = AVI_ERR_NO_MEM;
+      return -1;
+    }
+    t->agg_buf = p;
+    t->agg_size = size;
+  }
+
+  memcpy(t->agg_buf + t->agg_len, data, bytes);
+  t->agg_len += bytes;
+
+  if (t->agg_len >= limit)
+    return avi_flush_audio(AVI, AVI->aptr);
+  return 0;
+}
+
+int AVI_write_frame(avi_t *AVI, const char *data, long bytes, int keyframe) {
+  avi_enter(AVI, AVI_IO_WRITE_FRAME);
+  if (AVI->mode == AVI_MODE_READ) {
     AVI_errno = AVI_ERR_NOT_PERM;
     return -1;
   }
 
-  pos = AVI->pos;
+  // audio collected so far belongs in front of this frame
+  if (avi_flush_all_audio(AVI)) return -1;
+
+  if (AVI->dup_detect && AVI->dup_valid && AVI->dup_buf && bytes == AVI->last_len &&
+      avi_frame_similar((const unsigned char *) AVI->dup_buf,
+                        (const unsigned char *) data, bytes, AVI->dup_max_sad))
+    return AVI_dup_frame(AVI);
 
-  if (plat_write_data(AVI, data, bytes, 0, keyframe)) return -1;
+  // from here on dup_buf is older than the last frame, until the copy below
+  AVI->dup_valid = 0;
 
-  AVI->last_pos = pos;
+  if (plat_write_data(AVI, data, NULL, 0, bytes, 0, keyframe)) return -1;
+
+  // the chunk is the last thing written, a new RIFF may precede it
+  AVI->last_pos = AVI->pos - 8 - PAD_EVEN(bytes);
   AVI->last_len = bytes;
+  AVI->last_key = keyframe ? 1 : 0;
   AVI->video_frames++;
-  return 0;
+
+  if (AVI->dup_detect) {
+    if (bytes > AVI->dup_buf_size) {
+      // without a copy the next frame is simply written
+      char *p = avi_realloc(AVI, AVI->dup_buf, bytes);
+      if (p) {
+        AVI->dup_buf = p;
+        AVI->dup_buf_size = bytes;
+      }
+    }
+    if (bytes <= AVI->dup_buf_size) {
+      memcpy(AVI->dup_buf, data, bytes);
+      AVI->dup_valid = 1;
+    }
+  }
+
+  return avi_checkpoint_frame(AVI);
+}
+
+/*
+   AVI_dup_frame: Repeat the last written video frame. Only index
+                  entries are added, they point to the chunk that is
+                  already in the file.
+
+   returns 0 on success, -1 on error (AVI_errno is set)
+*/
+
+int AVI_dup_frame(avi_t *AVI) {
+  long flags;
+  int n;
+
+  avi_enter(AVI, AVI_IO_WRITE_FRAME);
+  if (AVI->mode == AVI_MODE_READ) {
+    AVI_errno = AVI_ERR_NOT_PERM;
+    return -1;
+  }
+  if (AVI->video_frames == 0) {
+    AVI_errno = AVI_ERR_NO_VIDS;
+    return -1;
+  }
+
+  if (avi_flush_all_audio(AVI)) return -1;
+
+  flags = AVI->last_key ? 0x10 : 0x0;
+
+  if (!AVI->is_opendml &&
+      avi_add_index_entry(AVI, (unsigned char *) "00db", flags, AVI->last_pos, AVI->last_len))
+    return -1;
+
+  n = avi_add_odml_index_entry(AVI, (unsigned char *) "00db", flags, AVI->last_pos,
+                               AVI->last_len);
+  if (n < 0) return -1;
+
+  if (n > 0) {
+    /* The frame lives in an earlier RIFF chunk which the current ix##
+       can not reference: store a copy, taken from our own file */
+
+    if (plat_write_data(AVI, NULL, AVI, AVI->last_pos + 8, AVI->last_len, 0,
+                        AVI->last_key))
+      return -1;
+    AVI->last_pos = AVI->pos - 8 - PAD_EVEN(AVI->last_len);
+  } else {
+    if (avi_journal_entry(AVI, (unsigned char *) "00db", 1, AVI->last_pos, AVI->last_len,
+                          AVI->last_key))
+      return -1;
+    AVI->must_use_index = 1;
+  }
+
+  AVI->video_frames++;
+  return avi_checkpoint_frame(AVI);
+}
+
+/*
+   AVI_set_dup_detection: Compare each frame given to AVI_write_frame
+                          with the previous one and write it as a
+                          duplicate (see AVI_dup_frame) if the sum of
+                          absolute byte differences is at most max_sad.
+                          max_sad == 0 only catches identical frames.
+                          Meant for uncompressed video.
+*/
+
+void AVI_set_dup_detection(avi_t *AVI, int enable, long max_sad) {
+  // the frame to compare with is the next one written
+  AVI->dup_detect = enable;
+  AVI->dup_valid = 0;
+  AVI->dup_max_sad = (max_sad < 0) ? 0 : max_sad;
 }
 
 int AVI_write_audio(avi_t *AVI, const char *data, long bytes) {
+  avi_enter(AVI, AVI_IO_WRITE_AUDIO);
   if (AVI->mode == AVI_MODE_READ) {
     AVI_errno = AVI_ERR_NOT_PERM;
     return -1;
   }
 
-  if (plat_write_data(AVI, data, bytes, 1, 0)) return -1;
+  // VBR audio needs one chunk per frame, never merge those
+  if ((AVI->agg_bytes > 0 || AVI->agg_ms > 0) && !AVI->track[AVI->aptr].a_vbr)
+    return avi_buffer_audio(AVI, data, bytes);
+
+  if (plat_write_data(AVI, data, NULL, 0, bytes, 1, 0)) return -1;
   AVI->track[AVI->aptr].audio_bytes += bytes;
   AVI->track[AVI->aptr].audio_chunks++;
   return 0;
 }
 
+/*
+   AVI_set_chunk_alignment: Pad with JUNK chunks so that the payload of
+                            every video chunk starts at a multiple of
+                            align bytes (a power of two, e.g. 4096 for
+                            O_DIRECT readers). 0 turns padding off.
+*/
+
+int AVI_set_chunk_alignment(avi_t *AVI, long align) {
+  if (AVI->mode == AVI_MODE_READ) {
+    AVI_errno = AVI_ERR_NOT_PERM;
+    return -1;
+  }
+  if (align < 0 || (align & (align - 1)) != 0 || (align > 0 && align < 16)) {
+    plat_log_send(PLAT_LOG_ERROR, __FILE__, "invalid chunk alignment %ld", align);
+    return -1;
+  }
+
+  // the buffer is the handle arena's and stays there until AVI_close, a
+  // larger alignment just takes a new one
+  if (AVI->pad_buf && align > AVI->chunk_align)
+    AVI->pad_buf = NULL;
+  AVI->chunk_align = align;
+  return 0;
+}
+
+/*
+   AVI_set_audio_aggregation: Collect the data given to AVI_write_audio
+                              per track and write it as one chunk when
+                              bytes bytes or ms milliseconds of audio
+                              are buffered (whichever comes first,
+                              0 ignores a limit), or before the next
+                              video frame. bytes == ms == 0 turns it off.
+*/
+
+int AVI_set_audio_aggregation(avi_t *AVI, long bytes, long ms) {
+  if (AVI->mode == AVI_MODE_READ) {
+    AVI_errno = AVI_ERR_NOT_PERM;
+    return -1;
+  }
+
+  if (avi_flush_all_audio(AVI)) return -1;
+
+  AVI->agg_bytes = bytes;
+  AVI->agg_ms = ms;
+  return 0;
+}
+
+
+/*******************************************************************
+ *                                                                 *
+ *    Lossless cut and join, payloads are copied kernel side       *
+ *                                                                 *
+ *******************************************************************/
+
+/* Output file gets the stream layout of the input file */
+
+static avi_t *avi_open_output_like(avi_t *in, const char *filename) {
+  avi_t *out;
+  int j;
+
+  out = AVI_open_output_file(filename);
+  if (!out) return NULL;
+
+  AVI_set_video(out, in->width, in->height, in->fps, in->compressor);
+
+  for (j = 0; j < in->anum; j++) {
+    AVI_set_audio(out, in->track[j].a_chans, in->track[j].a_rate,
+                  in->track[j].a_bits, in->track[j].a_fmt, in->track[j].mp3rate);
+    AVI_set_audio_vbr(out, in->track[j].a_vbr);
+  }
+  out->aptr = 0;
+
+  return out;
+}
+
+/* Copy the audio chunks of in that are stored in front of file
+   position limit (all that are left if limit < 0) to out. Track j
+   continues at audio chunk aposc[j], which is updated. */
+
+static int avi_copy_audio(avi_t *out, avi_t *in, off_t limit, long *aposc) {
+  int j;
+
+  for (j = 0; j < in->anum; j++) {
+    track_t *t = &in->track[j];
+
+    if (!t->audio_index) continue;
+
+    while (aposc[j] < t->audio_chunks &&
+           (limit < 0 || t->audio_index[aposc[j]].pos < limit)) {
+      out->io_op = AVI_IO_WRITE_AUDIO;
+      in->io_op = AVI_IO_READ_AUDIO;
+      out->aptr = j;
+      if (plat_write_data(out, NULL, in, t->audio_index[aposc[j]].pos,
+                          t->audio_index[aposc[j]].len, 1, 0))
+        return -1;
+      out->track[j].audio_bytes += t->audio_index[aposc[j]].len;
+      out->track[j].audio_chunks++;
+      aposc[j]++;
+    }
+  }
+  out->aptr = 0;
+
+  return 0;
+}
+
+/* Copy video frames first..last of in to out, together with the audio
+   chunks interleaved with them */
+
+static int avi_copy_frames(avi_t *out, avi_t *in, long first, long last,
+                           long *aposc) {
+  long i;
+
+  for (i = first; i <= last; i++) {
+    if (avi_copy_audio(out, in, in->video_index[i].pos, aposc)) return -1;
+
+    out->io_op = AVI_IO_WRITE_FRAME;
+    in->io_op = AVI_IO_READ_VIDEO;
+    if (plat_write_data(out, NULL, in, in->video_index[i].pos,
+                        in->video_index[i].len, 0, in->video_index[i].key == 0x10))
+      return -1;
+    out->last_pos = out->pos - 8 - PAD_EVEN(in->video_index[i].len);
+    out->last_len = in->video_index[i].len;
+    out->last_key = (in->video_index[i].key == 0x10);
+    out->video_frames++;
+    out->dup_valid = 0;
+  }
+
+  return avi_copy_audio(out, in,
+                        (last + 1 < in->video_frames) ? in->video_index[last + 1].pos : -1,
+                        aposc);
+}
+
+/* first audio chunk that is stored behind video frame frame-1 */
+
+static long avi_first_audio_chunk(avi_t *in, int j, long frame) {
+  long n0 = 0, n1 = in->track[j].audio_chunks, n;
+  off_t pos;
+
+  if (frame == 0 || !in->track[j].audio_index) return 0;
+  pos = in->video_index[frame - 1].pos;
+
+  while (n0 < n1) {
+    n = (n0 + n1) / 2;
+    if (in->track[j].audio_index[n].pos < pos)
+      n0 = n + 1;
+    else
+      n1 = n;
+  }
+  return n0;
+}
+
+/*
+   AVI_cut: Write frames first_frame..last_frame of AVI (opened for
+            reading with an index) to a new file. The start is moved
+            back to the closest keyframe, so the result decodes
+            without the frames in front of it.
+
+   returns 0 on success, -1 on error (AVI_errno is set)
+*/
+
+int AVI_cut(avi_t *AVI, long first_frame, long last_frame, const char *filename) {
+  long aposc[AVI_MAX_TRACKS];
+  avi_t *out;
+  int j, ret;
+
+  if (AVI->mode == AVI_MODE_WRITE) {
+    AVI_errno = AVI_ERR_NOT_PERM;
+    return -1;
+  }
+  if (!AVI->video_index) {
+    AVI_errno = AVI_ERR_NO_IDX;
+    return -1;
+  }
+
+  if (first_frame < 0) first_frame = 0;
+  if (last_frame >= AVI->video_frames) last_frame = AVI->video_frames - 1;
+  if (first_frame > last_frame) {
+    AVI_errno = AVI_ERR_NO_VIDS;
+    return -1;
+  }
+
+  // no keyframe in front of first_frame -> start at the beginning
+  while (first_frame > 0 && AVI->video_index[first_frame].key != 0x10)
+    first_frame--;
+
+  for (j = 0; j < AVI->anum; j++)
+    aposc[j] = avi_first_audio_chunk(AVI, j, first_frame);
+
+  out = avi_open_output_like(AVI, filename);
+  if (!out) return -1;
+
+  ret = avi_copy_frames(out, AVI, first_frame, last_frame, aposc);
+
+  if (AVI_close(out) < 0) ret = -1;
+
+  return ret;
+}
+
+/*
+   AVI_join: Concatenate n files opened for reading (with an index)
+             into a new file. All inputs must have the same video
+             size and compressor and the same audio tracks.
+
+   returns 0 on success, -1 on error (AVI_errno is set)
+*/
+
+int AVI_join(avi_t **inputs, int n, const char *filename) {
+  long aposc[AVI_MAX_TRACKS];
+  avi_t *out;
+  int i, j, ret = 0;
+
+  if (n <= 0) {
+    AVI_errno = AVI_ERR_NO_VIDS;
+    return -1;
+  }
+
+  for (i = 0; i < n; i++) {
+    if (inputs[i]->mode == AVI_MODE_WRITE) {
+      AVI_errno = AVI_ERR_NOT_PERM;
+      return -1;
+    }
+    if (!inputs[i]->video_index) {
+      AVI_errno = AVI_ERR_NO_IDX;
+      return -1;
+    }
+    if (inputs[i]->width != inputs[0]->width ||
+        inputs[i]->height != inputs[0]->height ||
+        strncmp(inputs[i]->compressor, inputs[0]->compressor, 4) != 0 ||
+        inputs[i]->anum != inputs[0]->anum) {
+      plat_log_send(PLAT_LOG_ERROR, __FILE__,
+                    "AVI_join: input %d does not match the first input", i);
+      AVI_errno = AVI_ERR_NOT_PERM;
+      return -1;
+    }
+    for (j = 0; j < inputs[0]->anum; j++) {
+      if (inputs[i]->track[j].a_fmt != inputs[0]->track[j].a_fmt ||
+          inputs[i]->track[j].a_chans != inputs[0]->track[j].a_chans ||
+          inputs[i]->track[j].a_rate != inputs[0]->track[j].a_rate ||
+          inputs[i]->track[j].a_bits != inputs[0]->track[j].a_bits) {
+        plat_log_send(PLAT_LOG_ERROR, __FILE__,
+                      "AVI_join: audio track %d of input %d does not match", j, i);
+        AVI_errno = AVI_ERR_NOT_PERM;
+        return -1;
+      }
+    }
+  }
+
+  out = avi_open_output_like(inputs[0], filename);
+  if (!out) return -1;
+
+  for (i = 0; i < n && ret == 0; i++) {
+    for (j = 0; j < inputs[i]->anum; j++) aposc[j] = 0;
+    if (inputs[i]->video_frames > 0)
+      ret = avi_copy_frames(out, inputs[i], 0, inputs[i]->video_frames - 1, aposc);
+  }
+
+  if (AVI_close(out) < 0) ret = -1;
+
+  return ret;
+}
 
 long AVI_bytes_remain(avi_t *AVI) {
   if (AVI->mode == AVI_MODE_READ) return 0;
@@ -1770,6 +2833,165 @@ int AVI_get_comment_fd(avi_t *AVI) {
   return AVI->comment_fd;
 }
 
+/*
+   AVI_memory_stats: Heap and arena memory charged to AVI (everything
+                     allocated by calls on this handle, including the
+                     handle itself), or to the whole library if AVI is
+                     NULL. Needs a build with PLAT_MEM_STATS.
+
+   returns 0 on success, -1 on error (AVI_errno is set)
+*/
+
+int AVI_memory_stats(avi_t *AVI, avi_mem_stats_t *st) {
+  PlatMemStats ps;
+
+  if (plat_mem_stats(AVI, &ps) < 0) {
+    AVI_errno = AVI_ERR_UNSUPPORTED;
+    return -1;
+  }
+  st->live_bytes = ps.live_bytes;
+  st->peak_bytes = ps.peak_bytes;
+  st->allocs = ps.allocs;
+  st->frees = ps.frees;
+  return 0;
+}
+
+/* AVI_memory_dump: Print live and peak bytes per allocation site to f */
+
+int AVI_memory_dump(FILE *f) {
+  if (plat_mem_dump(f) < 0) {
+    AVI_errno = AVI_ERR_UNSUPPORTED;
+    return -1;
+  }
+  return 0;
+}
+
+/*
+   AVI_set_io_stats: Count and time all file I/O of AVI from now on
+                     (enable != 0, restarts the counters) or stop it.
+                     Costs two clock reads per call while on.
+*/
+
+int AVI_set_io_stats(avi_t *AVI, int enable) {
+  if (!enable) {
+    plat_free(AVI->io_stats);
+    AVI->io_stats = NULL;
+    return 0;
+  }
+
+  if (!AVI->io_stats) {
+    AVI->io_stats = avi_malloc(AVI, sizeof(avi_io_stats_t));
+    if (!AVI->io_stats) {
+      AVI_errno = AVI_ERR_NO_MEM;
+      return -1;
+    }
+  }
+  memset(AVI->io_stats, 0, sizeof(avi_io_stats_t));
+  return 0;
+}
+
+/* AVI_set_io_stats_default: Turn statistics on for handles opened later,
+                             so that the I/O of opening is included */
+
+void AVI_set_io_stats_default(int enable) {
+  avi_io_stats_default = enable;
+}
+
+/*
+   AVI_trace_start: Record spans of the open phases (header walk, hdrl
+                    parse, index loading and building), every read,
+                    write and seek and the writer's RIFF rotations of
+                    all handles. AVI_trace_stop writes them to the
+                    file given here, as Chrome trace event JSON.
+*/
+
+int AVI_trace_start(const char *filename) {
+  if (plat_trace_open(filename, AVI_TRACE_EVENTS) < 0) {
+    AVI_errno = AVI_ERR_NO_MEM;
+    return -1;
+  }
+  return 0;
+}
+
+int AVI_trace_stop(void) {
+  if (plat_trace_close() < 0) {
+    AVI_errno = AVI_ERR_WRITE;
+    return -1;
+  }
+  return 0;
+}
+
+/*
+   AVI_record_start: Log every read of AVI from now on to filename:
+                     offset, length, time and the frame or audio chunk
+                     it was for (see avi_rec_entry_t). AVI_record_stop
+                     or AVI_close end the trace. The bench tool
+                     avireplay plays such traces back.
+*/
+
+int AVI_record_start(avi_t *AVI, const char *filename) {
+  avi_rec_header_t h;
+  int64_t cur;
+
+  if (AVI->rec) AVI_record_stop(AVI);
+
+  AVI->rec = avi_malloc(AVI, sizeof(struct avi_recorder_s));
+  if (!AVI->rec) {
+    AVI_errno = AVI_ERR_NO_MEM;
+    return -1;
+  }
+  AVI->rec->fd = plat_open(filename, O_WRONLY | O_CREAT | O_TRUNC,
+                           S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+  if (AVI->rec->fd < 0) {
+    plat_free(AVI->rec);
+    AVI->rec = NULL;
+    AVI_errno = AVI_ERR_OPEN;
+    return -1;
+  }
+  AVI->rec->err = 0;
+  AVI->rec->n = 0;
+  AVI->rec->last_ns = plat_time_ns();
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, AVI_REC_MAGIC, 4);
+  h.version = AVI_REC_VERSION;
+  h.start_ns = AVI->rec->last_ns;
+  if (AVI->io.read_at) {
+    h.file_size = AVI->io.size(AVI->io.opaque);
+  } else {
+    cur = plat_seek(AVI->fdes, 0, SEEK_CUR);
+    h.file_size = plat_seek(AVI->fdes, 0, SEEK_END);
+    plat_seek(AVI->fdes, cur, SEEK_SET);
+  }
+
+  if (plat_write(AVI->rec->fd, &h, sizeof(h)) != sizeof(h)) {
+    avi_record_close(AVI);
+    AVI_errno = AVI_ERR_WRITE;
+    return -1;
+  }
+  return 0;
+}
+
+int AVI_record_stop(avi_t *AVI) {
+  if (!AVI->rec) return 0;
+  if (avi_record_close(AVI) < 0) {
+    AVI_errno = AVI_ERR_WRITE;
+    return -1;
+  }
+  return 0;
+}
+
+/* AVI_get_io_stats: Copy the counters, -1 if statistics are off */
+
+int AVI_get_io_stats(avi_t *AVI, avi_io_stats_t *st) {
+  if (!AVI->io_stats) {
+    AVI_errno = AVI_ERR_NOT_PERM;
+    return -1;
+  }
+  *st = *AVI->io_stats;
+  return 0;
+}
+
 
 /*******************************************************************
  *                                                                 *
@@ -1778,75 +3000,75 @@ int AVI_get_comment_fd(avi_t *AVI) {
  *******************************************************************/
 
 int AVI_close(avi_t *AVI) {
+  const void *mem_owner = AVI;
+  uint64_t t0 = plat_time_ns();
   int j, k, ret = 0;
 
+  avi_enter(AVI, AVI_IO_CLOSE);
+
   /* If the file was open for writing, the header and index still have
        to be written */
 
   if (AVI->mode == AVI_MODE_WRITE) {
-    ret = avi_close_output_file(AVI);
+    ret = avi_flush_all_audio(AVI);
+    if (AVI->ckpt_fd > 0 && AVI->ckpt_len > 0 &&
+        plat_write(AVI->ckpt_fd, AVI->ckpt_buf, AVI->ckpt_len) != AVI->ckpt_len)
+      ret = -1;
+    if (avi_close_output_file(AVI) < 0) ret = -1;
   }
 
+  if (AVI->ckpt_fd > 0)
+    plat_close(AVI->ckpt_fd);
+  if (AVI->ckpt_buf)
+    plat_free(AVI->ckpt_buf);
+
   /* Even if there happened an error, we first clean up */
 
   if (AVI->comment_fd > 0)
     plat_close(AVI->comment_fd);
   AVI->comment_fd = -1;
 
-  plat_close(AVI->fdes);
+  avi_close_file(AVI);
 
   if (AVI->idx)
     plat_free(AVI->idx);
   if (AVI->video_index)
     plat_free(AVI->video_index);
 
+  /* The superindex structures, format headers and the like live in
+     AVI->arena, only the growing index arrays are on the heap */
+
   if (AVI->video_superindex && AVI->video_superindex->stdindex) {
-    for (j = 0; j < NR_IXNN_CHUNKS; j++) {
-      if (AVI->video_superindex->stdindex[j]) {
-        if (AVI->video_superindex->stdindex[j]->aIndex) {
-          plat_free(AVI->video_superindex->stdindex[j]->aIndex);
-        }
-        plat_free(AVI->video_superindex->stdindex[j]);
-      }
-    }
-    if (AVI->video_superindex->stdindex)
-      plat_free(AVI->video_superindex->stdindex);
-    if (AVI->video_superindex->aIndex)
-      plat_free(AVI->video_superindex->aIndex);
-    plat_free(AVI->video_superindex);
+    for (j = 0; j < NR_IXNN_CHUNKS; j++)
+      plat_free(AVI->video_superindex->stdindex[j]->aIndex);
   }
 
   for (j = 0; j < AVI->anum; j++) {
+    avisuperindex_chunk *a = AVI->track[j].audio_superindex;
+
+    if (AVI->track[j].agg_buf)
+      plat_free(AVI->track[j].agg_buf);
     if (AVI->track[j].audio_index)
       plat_free(AVI->track[j].audio_index);
-    if (AVI->track[j].audio_superindex) {
-      // shortcut
-      avisuperindex_chunk *a = AVI->track[j].audio_superindex;
-      for (k = 0; k < NR_IXNN_CHUNKS; k++) {
-        if (a->stdindex && a->stdindex[k]) {
-          if (a->stdindex[k]->aIndex) {
-            plat_free(a->stdindex[k]->aIndex);
-          }
-          plat_free(a->stdindex[k]);
-        }
-      }
-      if (a->stdindex)
-        plat_free(a->stdindex);
-      if (a->aIndex)
-        plat_free(a->aIndex);
-      plat_free(a);
+    if (a && a->stdindex) {
+      for (k = 0; k < NR_IXNN_CHUNKS; k++)
+        plat_free(a->stdindex[k]->aIndex);
     }
   }
 
-  if (AVI->bitmap_info_header)
-    plat_free(AVI->bitmap_info_header);
-  for (j = 0; j < AVI->anum; j++)
-    if (AVI->wave_format_ex[j])
-      plat_free(AVI->wave_format_ex[j]);
+  if (AVI->dup_buf)
+    plat_free(AVI->dup_buf);
+  if (AVI->direct_buf) {
+    plat_aligned_free(AVI->direct_buf);
+    plat_close(AVI->direct_fd);
+  }
 
-  plat_free(AVI);
+  avi_free(AVI);
+  plat_mem_release(mem_owner);
   AVI = NULL;
 
+  plat_trace_span("AVI_close", "api", t0, plat_time_ns() - t0, NULL, 0);
+
   return ret;
 }
 
@@ -1857,23 +3079,18 @@ int AVI_close(avi_t *AVI) {
    return 0; \
 } while (0)
 
-avi_t *AVI_open_indexfd(int fd, int getIndex, const char *indexfile) {
-  avi_t *AVI = plat_zalloc(sizeof(avi_t));
-  if (AVI == NULL) {
-    AVI_errno = AVI_ERR_NO_MEM;
-    return NULL;
-  }
+static avi_t *avi_open_input(avi_t *AVI, int getIndex, const char *indexfile) {
+  uint64_t t0 = plat_time_ns();
 
+  avi_enter(AVI, AVI_IO_OPEN);
   AVI->mode = AVI_MODE_READ; /* open for reading */
 
-  // file alread open
-  AVI->fdes = fd;
-
   if (indexfile) {
-    AVI->index_file = strdup(indexfile);
+    AVI->index_file = plat_arena_strdup(AVI->arena, indexfile);
   }
   AVI_errno = 0;
   avi_parse_input_file(AVI, getIndex);
+  plat_trace_span("AVI_open", "api", t0, plat_time_ns() - t0, "error", AVI_errno);
 
   if (AVI != NULL && !AVI_errno) {
     AVI->aptr = 0; //reset
@@ -1882,6 +3099,107 @@ avi_t *AVI_open_indexfd(int fd, int getIndex, const char *indexfile) {
   return (AVI_errno) ? NULL : AVI;
 }
 
+avi_t *AVI_open_indexfd(int fd, int getIndex, const char *indexfile) {
+  avi_t *AVI = avi_alloc();
+  if (AVI == NULL)
+    return NULL;
+
+  // file alread open
+  AVI->fdes = fd;
+
+  return avi_open_input(AVI, getIndex, indexfile);
+}
+
+/*
+   AVI_open_io: Read an AVI through a custom backend. The handle owns
+                the backend, io->close is called by AVI_close (also
+                when opening fails).
+*/
+
+avi_t *AVI_open_io(const avi_io_t *io, int getIndex) {
+  avi_t *AVI;
+
+  if (!io->read_at || !io->size) {
+    AVI_errno = AVI_ERR_OPEN;
+    return NULL;
+  }
+
+  AVI = avi_alloc();
+  if (AVI == NULL) {
+    if (io->close) io->close(io->opaque);
+    return NULL;
+  }
+
+  AVI->io = *io;
+  AVI->fdes = -1;
+
+  return avi_open_input(AVI, getIndex, NULL);
+}
+
+/* in-memory backend */
+
+typedef struct {
+  const char *buf;
+  size_t len;
+} avi_mem_t;
+
+static ssize_t avi_mem_read_at(void *opaque, void *buf, size_t count, int64_t offset) {
+  avi_mem_t *m = opaque;
+
+  if (offset < 0) return -1;
+  if (offset >= m->len) return 0;
+  if (count > m->len - offset) count = m->len - offset;
+  memcpy(buf, m->buf + offset, count);
+  return count;
+}
+
+static int64_t avi_mem_size(void *opaque) {
+  return ((avi_mem_t *) opaque)->len;
+}
+
+static const void *avi_mem_peek(void *opaque, int64_t offset, size_t count) {
+  avi_mem_t *m = opaque;
+
+  if (offset < 0 || offset > m->len || count > m->len - offset) return NULL;
+  return m->buf + offset;
+}
+
+static int avi_mem_close(void *opaque) {
+  plat_free(opaque);
+  return 0;
+}
+
+/*
+   AVI_open_memory: Read an AVI that is completely in memory. buf is
+                    not copied and must stay valid until AVI_close.
+                    Frame reads are plain memory copies, AVI_peek_frame
+                    gives access without any copy.
+*/
+
+avi_t *AVI_open_memory(const void *buf, size_t len, int getIndex) {
+  avi_io_t io;
+  avi_t *AVI;
+  avi_mem_t *m = plat_malloc(sizeof(avi_mem_t));
+
+  if (!m) {
+    AVI_errno = AVI_ERR_NO_MEM;
+    return NULL;
+  }
+  m->buf = buf;
+  m->len = len;
+
+  memset(&io, 0, sizeof(io));
+  io.read_at = avi_mem_read_at;
+  io.size = avi_mem_size;
+  io.peek = avi_mem_peek;
+  io.close = avi_mem_close;
+  io.opaque = m;
+
+  AVI = AVI_open_io(&io, getIndex);
+  if (AVI) plat_mem_adopt(m, AVI);
+  return AVI;
+}
+
 avi_t *AVI_open_input_indexfile(const char *filename, int getIndex,
                                 const char *indexfile) {
   int fd = plat_open(filename, O_RDONLY, 0);
@@ -1900,6 +3218,71 @@ avi_t *AVI_open_fd(int fd, int getIndex) {
   return AVI_open_indexfd(fd, getIndex, NULL);
 }
 
+/* Open filename a second time with O_DIRECT for the video reads and
+   get an aligned bounce buffer that holds the largest frame */
+
+static int avi_setup_direct(avi_t *AVI, const char *filename) {
+  long align = AVI_DIRECT_ALIGN;
+  off_t max = 0;
+  long i;
+
+  if (!AVI->video_index || AVI->io.read_at)
+    return -1;
+
+  for (i = 0; i < AVI->video_frames; i++)
+    if (AVI->video_index[i].len > max) max = AVI->video_index[i].len;
+
+  AVI->direct_fd = plat_open_direct(filename);
+  if (AVI->direct_fd < 0)
+    return -1;
+
+  // a frame may start anywhere within its first block
+  AVI->direct_size = ((max + align - 1) / align + 1) * align;
+  AVI->direct_buf = plat_aligned_alloc(align, AVI->direct_size);
+  if (!AVI->direct_buf) {
+    plat_close(AVI->direct_fd);
+    return -1;
+  }
+  return 0;
+}
+
+/*
+   AVI_open_input_file_direct: Like AVI_open_input_file, but video
+                               frames are read with O_DIRECT, bypassing
+                               the page cache. Falls back to normal
+                               reads if that is not possible.
+*/
+
+avi_t *AVI_open_input_file_direct(const char *filename, int getIndex) {
+  avi_t *AVI = AVI_open_input_file(filename, getIndex);
+
+  if (AVI && avi_setup_direct(AVI, filename) < 0)
+    plat_log_send(PLAT_LOG_WARNING, __FILE__,
+                  "%s: direct I/O not available, using buffered reads", filename);
+  return AVI;
+}
+
+/* Read len bytes at pos through the aligned buffer of the O_DIRECT fd */
+
+static long avi_read_direct(avi_t *AVI, char *buf, off_t pos, long len) {
+  long align = AVI_DIRECT_ALIGN;
+  off_t start = pos & ~((off_t) align - 1);
+  long todo = ((pos + len - start + align - 1) / align) * align;
+  ssize_t n;
+
+  if (avi_io_watched(AVI)) {
+    uint64_t t0 = plat_time_ns();
+    n = plat_pread(AVI->direct_fd, AVI->direct_buf, todo, start);
+    avi_io_done(AVI, 0, n, t0, start);
+  } else
+    n = plat_pread(AVI->direct_fd, AVI->direct_buf, todo, start);
+  if (n < pos - start + len)
+    return -1;
+
+  memcpy(buf, AVI->direct_buf + (pos - start), len);
+  return len;
+}
+
 // transcode-0.6.8
 // reads a file generated by aviindex and builds the index out of it.
 
@@ -1963,12 +3346,12 @@ int avi_parse_index_from_file(avi_t *AVI, const char *filename) {
   for (j = 0; j < AVI->anum; ++j) AVI->track[j].audio_chunks = aud_chunks[j];
 
   if (AVI->video_frames == 0) ERR_EXIT(AVI_ERR_NO_VIDS);
-  AVI->video_index = plat_malloc(vid_chunks * sizeof(video_index_entry));
+  AVI->video_index = avi_malloc(AVI, vid_chunks * sizeof(video_index_entry));
   if (AVI->video_index == 0) ERR_EXIT(AVI_ERR_NO_MEM);
 
   for (j = 0; j < AVI->anum; ++j) {
     if (AVI->track[j].audio_chunks) {
-      AVI->track[j].audio_index = plat_malloc(aud_chunks[j] * sizeof(audio_index_entry));
+      AVI->track[j].audio_index = avi_malloc(AVI, aud_chunks[j] * sizeof(audio_index_entry));
       if (AVI->track[j].audio_index == 0) ERR_EXIT(AVI_ERR_NO_MEM);
     }
   }
@@ -2028,7 +3411,7 @@ int avi_parse_index_from_file(avi_t *AVI, const char *filename) {
   return 0;
 }
 
-static uint8_t *avi_build_audio_superindex(avisuperindex_chunk *si, uint8_t *a) {
+static uint8_t *avi_build_audio_superindex(avi_t *AVI, avisuperindex_chunk *si, uint8_t *a) {
   int j = 0;
 
   memcpy(si->fcc, a, 4);
@@ -2052,7 +3435,11 @@ static uint8_t *avi_build_audio_superindex(avisuperindex_chunk *si, uint8_t *a)
     plat_log_send(PLAT_LOG_WARNING, __FILE__, "Invalid Header, bIndexSubType != 0");
   }
 
-  si->aIndex = plat_zalloc(si->wLongsPerEntry * si->nEntriesInUse * sizeof(uint32_t));
+  si->aIndex = plat_arena_zalloc(AVI->arena, si->wLongsPerEntry * si->nEntriesInUse * sizeof(uint32_t));
+  if (!si->aIndex) {
+    si->nEntriesInUse = 0;
+    return a;
+  }
   // position of ix## chunks
   for (j = 0; j < si->nEntriesInUse; ++j) {
     si->aIndex[j].qwOffset = str2ullong(a);
@@ -2081,6 +3468,30 @@ static uint8_t *avi_build_audio_superindex(avisuperindex_chunk *si, uint8_t *a)
   return a;
 }
 
+/* the colour table of a palettized video stream: the RGBQUADs after the
+   BITMAPINFOHEADER in strf, len bytes of which are in the header list */
+static void avi_parse_palette(avi_t *AVI, uint8_t *strf, long len, long avail) {
+  uint32_t size, bits, colors;
+
+  AVI->palette = NULL;
+  AVI->palette_colors = 0;
+  if (len > avail) len = avail;
+  if (len < (long) sizeof(alBITMAPINFOHEADER)) return;
+  size = str2ulong(strf);
+  bits = str2ushort(strf + 14);
+  colors = str2ulong(strf + 32);
+  if (size < sizeof(alBITMAPINFOHEADER) || size > (uint32_t) len) return;
+  // biClrUsed 0 means all the bit depth can address
+  if (!colors && bits >= 1 && bits <= 8) colors = 1u << bits;
+  if (colors > 256) colors = 256;
+  if (colors > (len - size) / 4) colors = (len - size) / 4;
+  if (!colors) return;
+
+  AVI->palette = plat_arena_alloc(AVI->arena, colors * 4);
+  if (AVI->palette == NULL) return;
+  memcpy(AVI->palette, strf + size, colors * 4);
+  AVI->palette_colors = colors;
+}
 
 static int avi_parse_input_file(avi_t *AVI, int getIndex) {
   long i, rate, scale, idx_type;
@@ -2096,10 +3507,11 @@ static int avi_parse_input_file(avi_t *AVI, int getIndex) {
   //  int auds_strf_seen = 0;
   char data[256];
   off_t oldpos = -1, newpos = -1, n;
+  uint64_t t_phase = plat_time_ns(), t_sub;
 
   /* Read first 12 bytes and check that this is an AVI file */
 
-  if (plat_read(AVI->fdes, data, 12) != 12) ERR_EXIT(AVI_ERR_READ);
+  if (avi_read(AVI, data, 12) != 12) ERR_EXIT(AVI_ERR_READ);
 
   if (strncasecmp(data, "RIFF", 4) != 0 ||
       strncasecmp(data + 8, "AVI ", 4) != 0)
@@ -2110,8 +3522,8 @@ static int avi_parse_input_file(avi_t *AVI, int getIndex) {
       present idx1 tag */
 
   while (1) {
-    if (plat_read(AVI->fdes, data, 8) != 8) break; /* We assume it's EOF */
-    newpos = plat_seek(AVI->fdes, 0, SEEK_CUR);
+    if (avi_read(AVI, data, 8) != 8) break; /* We assume it's EOF */
+    newpos = avi_seek(AVI, 0, SEEK_CUR);
     if (oldpos == newpos) {
       /* This is a broken AVI stream... */
       return -1;
@@ -2122,43 +3534,49 @@ static int avi_parse_input_file(avi_t *AVI, int getIndex) {
     n = PAD_EVEN(n);
 
     if (strncasecmp(data, "LIST", 4) == 0) {
-      if (plat_read(AVI->fdes, data, 4) != 4) ERR_EXIT(AVI_ERR_READ);
+      if (avi_read(AVI, data, 4) != 4) ERR_EXIT(AVI_ERR_READ);
       n -= 4;
       if (strncasecmp(data, "hdrl", 4) == 0) {
         hdrl_len = n;
-        hdrl_data = plat_malloc(n);
+        hdrl_data = plat_arena_alloc(AVI->scratch, n);
         if (hdrl_data == 0) ERR_EXIT(AVI_ERR_NO_MEM);
 
         // offset of header
 
-        header_offset = plat_seek(AVI->fdes, 0, SEEK_CUR);
+        header_offset = avi_seek(AVI, 0, SEEK_CUR);
 
-        if (plat_read(AVI->fdes, (char *) hdrl_data, n) != n) ERR_EXIT(AVI_ERR_READ);
+        if (avi_read(AVI, (char *) hdrl_data, n) != n) ERR_EXIT(AVI_ERR_READ);
       } else if (strncasecmp(data, "movi", 4) == 0) {
-        AVI->movi_start = plat_seek(AVI->fdes, 0, SEEK_CUR);
-        if (plat_seek(AVI->fdes, n, SEEK_CUR) == (off_t) -1) break;
-      } else if (plat_seek(AVI->fdes, n, SEEK_CUR) == (off_t) -1) break;
+        AVI->movi_start = avi_seek(AVI, 0, SEEK_CUR);
+        if (avi_seek(AVI, n, SEEK_CUR) == (off_t) -1) break;
+      } else if (avi_seek(AVI, n, SEEK_CUR) == (off_t) -1) break;
     } else if (strncasecmp(data, "idx1", 4) == 0) {
       /* n must be a multiple of 16, but the reading does not
             break if this is not the case */
 
+      t_sub = plat_time_ns();
       AVI->n_idx = AVI->max_idx = n / 16;
-      AVI->idx = (unsigned char ((*)[16])) plat_malloc(n);
+      AVI->idx = (unsigned char ((*)[16])) avi_malloc(AVI, n);
       if (AVI->idx == 0) ERR_EXIT(AVI_ERR_NO_MEM);
-      if (plat_read(AVI->fdes, (char *) AVI->idx, n) != n) {
-        free(AVI->idx);
+      if (avi_read(AVI, (char *) AVI->idx, n) != n) {
+        plat_free(AVI->idx);
         AVI->idx = NULL;
         AVI->n_idx = 0;
       }
+      avi_trace_phase("idx1 load", t_sub, "entries", AVI->n_idx);
     } else
-      plat_seek(AVI->fdes, n, SEEK_CUR);
+      avi_seek(AVI, n, SEEK_CUR);
   }
 
+  avi_trace_phase("header walk", t_phase, NULL, 0);
+
   if (!hdrl_data) ERR_EXIT(AVI_ERR_NO_HDRL);
   if (!AVI->movi_start) ERR_EXIT(AVI_ERR_NO_MOVI);
 
   /* Interpret the header list */
 
+  t_phase = plat_time_ns();
+
   for (i = 0; i < hdrl_len;) {
     /* List tags are completly ignored */
 
@@ -2191,7 +3609,11 @@ static int avi_parse_input_file(avi_t *AVI, int getIndex) {
 
         scale = str2ulong(hdrl_data + i + 20);
         rate = str2ulong(hdrl_data + i + 24);
-        if (scale != 0) AVI->fps = (double) rate / (double) scale;
+        if (scale != 0) {
+          AVI->fps = (double) rate / (double) scale;
+          AVI->fps_rate = rate;
+          AVI->fps_scale = scale;
+        }
         AVI->video_frames = str2ulong(hdrl_data + i + 32);
         AVI->video_strn = num_stream;
         AVI->max_len = 0;
@@ -2240,11 +3662,13 @@ static int avi_parse_input_file(avi_t *AVI, int getIndex) {
         alBITMAPINFOHEADER bih;
 
         memcpy(&bih, hdrl_data + i, sizeof(alBITMAPINFOHEADER));
-        AVI->bitmap_info_header = plat_malloc(str2ulong((unsigned char *) &bih.bi_size));
+        AVI->bitmap_info_header = plat_arena_alloc(AVI->arena, str2ulong((unsigned char *) &bih.bi_size));
         if (AVI->bitmap_info_header != NULL)
           memcpy(AVI->bitmap_info_header, hdrl_data + i,
                  str2ulong((unsigned char *) &bih.bi_size));
 
+        avi_parse_palette(AVI, hdrl_data + i, str2ulong(hdrl_data + i - 4), hdrl_len - i);
+
         AVI->width = str2ulong(hdrl_data + i + 4);
         AVI->height = str2ulong(hdrl_data + i + 8);
         vids_strf_seen = 1;
@@ -2255,30 +3679,27 @@ static int avi_parse_input_file(avi_t *AVI, int getIndex) {
         AVI->compressor2[4] = 0;
 
       } else if (lasttag == 2) {
-        alWAVEFORMATEX *wfe;
-        char *nwfe;
-        int wfes;
+        alWAVEFORMATEX hdr, *wfe;
+        int wfes, cb_size;
 
         if ((hdrl_len - i) < sizeof(alWAVEFORMATEX))
           wfes = hdrl_len - i;
         else
           wfes = sizeof(alWAVEFORMATEX);
-        wfe = plat_zalloc(sizeof(alWAVEFORMATEX));
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(&hdr, hdrl_data + i, wfes);
+        cb_size = str2ushort((unsigned char *) &hdr.cb_size);
+
+        // header and extra bytes in one piece
+        wfe = plat_arena_zalloc(AVI->arena, sizeof(alWAVEFORMATEX) + cb_size);
         if (wfe != NULL) {
-          memcpy(wfe, hdrl_data + i, wfes);
-          if (str2ushort((unsigned char *) &wfe->cb_size) != 0) {
-            nwfe = plat_realloc(wfe, sizeof(alWAVEFORMATEX) +
-                                     str2ushort((unsigned char *) &wfe->cb_size));
-            if (nwfe != 0) {
-              off_t lpos = plat_seek(AVI->fdes, 0, SEEK_CUR);
-              plat_seek(AVI->fdes, header_offset + i + sizeof(alWAVEFORMATEX),
-                        SEEK_SET);
-              wfe = (alWAVEFORMATEX *) nwfe;
-              nwfe = &nwfe[sizeof(alWAVEFORMATEX)];
-              plat_read(AVI->fdes, nwfe,
-                        str2ushort((unsigned char *) &wfe->cb_size));
-              plat_seek(AVI->fdes, lpos, SEEK_SET);
-            }
+          memcpy(wfe, &hdr, sizeof(alWAVEFORMATEX));
+          if (cb_size != 0) {
+            off_t lpos = avi_seek(AVI, 0, SEEK_CUR);
+            avi_seek(AVI, header_offset + i + sizeof(alWAVEFORMATEX),
+                     SEEK_SET);
+            avi_read(AVI, (char *) wfe + sizeof(alWAVEFORMATEX), cb_size);
+            avi_seek(AVI, lpos, SEEK_SET);
           }
           AVI->wave_format_ex[AVI->aptr] = wfe;
         }
@@ -2305,7 +3726,8 @@ static int avi_parse_input_file(avi_t *AVI, int getIndex) {
 
         a = hdrl_data + i;
 
-        AVI->video_superindex = plat_zalloc(sizeof(avisuperindex_chunk));
+        AVI->video_superindex = plat_arena_zalloc(AVI->arena, sizeof(avisuperindex_chunk));
+        if (!AVI->video_superindex) ERR_EXIT(AVI_ERR_NO_MEM);
         memcpy(AVI->video_superindex->fcc, a, 4);
         a += 4;
         AVI->video_superindex->dwSize = str2ulong(a);
@@ -2331,9 +3753,10 @@ static int avi_parse_input_file(avi_t *AVI, int getIndex) {
         }
 
         AVI->video_superindex->aIndex =
-            plat_malloc(
+            plat_arena_alloc(AVI->arena,
                 AVI->video_superindex->wLongsPerEntry * AVI->video_superindex->nEntriesInUse *
                 sizeof(uint32_t));
+        if (!AVI->video_superindex->aIndex) ERR_EXIT(AVI_ERR_NO_MEM);
 
         // position of ix## chunks
         for (j = 0; j < AVI->video_superindex->nEntriesInUse; ++j) {
@@ -2372,9 +3795,10 @@ static int avi_parse_input_file(avi_t *AVI, int getIndex) {
       {
         a = hdrl_data + i;
 
-        AVI->track[AVI->aptr].audio_superindex = plat_zalloc(sizeof(avisuperindex_chunk));
+        AVI->track[AVI->aptr].audio_superindex = plat_arena_zalloc(AVI->arena, sizeof(avisuperindex_chunk));
+        if (!AVI->track[AVI->aptr].audio_superindex) ERR_EXIT(AVI_ERR_NO_MEM);
 
-        a = avi_build_audio_superindex(AVI->track[AVI->aptr].audio_superindex, a);
+        a = avi_build_audio_superindex(AVI, AVI->track[AVI->aptr].audio_superindex, a);
       }
       i += 8;
     } else if ((strncasecmp(hdrl_data + i, "JUNK", 4) == 0) ||
@@ -2391,7 +3815,10 @@ static int avi_parse_input_file(avi_t *AVI, int getIndex) {
     i += n;
   }
 
-  plat_free(hdrl_data);
+  plat_arena_reset(AVI->scratch);
+  hdrl_data = NULL;
+
+  avi_trace_phase("hdrl parse", t_phase, "bytes", hdrl_len);
 
   if (!vids_strh_seen || !vids_strf_seen) ERR_EXIT(AVI_ERR_NO_VIDS);
 
@@ -2415,7 +3842,7 @@ static int avi_parse_input_file(avi_t *AVI, int getIndex) {
     }
   }
 
-  plat_seek(AVI->fdes, AVI->movi_start, SEEK_SET);
+  avi_seek(AVI, AVI->movi_start, SEEK_SET);
 
   /* get index if wanted */
 
@@ -2426,7 +3853,7 @@ static int avi_parse_input_file(avi_t *AVI, int getIndex) {
 
     /* Reposition the file */
 
-    plat_seek(AVI->fdes, AVI->movi_start, SEEK_SET);
+    avi_seek(AVI, AVI->movi_start, SEEK_SET);
     AVI->video_pos = 0;
     return (ret);
 
@@ -2441,6 +3868,8 @@ static int avi_parse_input_file(avi_t *AVI, int getIndex) {
   if (AVI->idx) {
     off_t pos, len;
 
+    t_phase = plat_time_ns();
+
     /* Search the first videoframe in the idx1 and look where
          it is in the file */
 
@@ -2451,38 +3880,41 @@ static int avi_parse_input_file(avi_t *AVI, int getIndex) {
     pos = str2ulong(AVI->idx[i] + 8);
     len = str2ulong(AVI->idx[i] + 12);
 
-    plat_seek(AVI->fdes, pos, SEEK_SET);
-    if (plat_read(AVI->fdes, data, 8) != 8) ERR_EXIT(AVI_ERR_READ);
+    avi_seek(AVI, pos, SEEK_SET);
+    if (avi_read(AVI, data, 8) != 8) ERR_EXIT(AVI_ERR_READ);
     if (strncasecmp(data, (char *) AVI->idx[i], 4) == 0 &&
         str2ulong((unsigned char *) data + 4) == len) {
       idx_type = 1; /* Index from start of file */
     } else {
-      plat_seek(AVI->fdes, pos + AVI->movi_start - 4, SEEK_SET);
-      if (plat_read(AVI->fdes, data, 8) != 8) ERR_EXIT(AVI_ERR_READ);
+      avi_seek(AVI, pos + AVI->movi_start - 4, SEEK_SET);
+      if (avi_read(AVI, data, 8) != 8) ERR_EXIT(AVI_ERR_READ);
       if (strncasecmp(data, (char *) AVI->idx[i], 4) == 0 &&
           str2ulong((unsigned char *) data + 4) == len) {
         idx_type = 2; /* Index from start of movi list */
       }
     }
     /* idx_type remains 0 if neither of the two tests above succeeds */
+
+    avi_trace_phase("idx1 probe", t_phase, "type", idx_type);
   }
 
 
   if (idx_type == 0 && !AVI->is_opendml && !AVI->total_frames) {
     /* we must search through the file to get the index */
 
-    plat_seek(AVI->fdes, AVI->movi_start, SEEK_SET);
+    t_phase = plat_time_ns();
+    avi_seek(AVI, AVI->movi_start, SEEK_SET);
 
     AVI->n_idx = 0;
 
     while (1) {
-      if (plat_read(AVI->fdes, data, 8) != 8) break;
+      if (avi_read(AVI, data, 8) != 8) break;
       n = str2ulong((unsigned char *) data + 4);
 
       /* The movi list may contain sub-lists, ignore them */
 
       if (strncasecmp(data, "LIST", 4) == 0) {
-        plat_seek(AVI->fdes, 4, SEEK_CUR);
+        avi_seek(AVI, 4, SEEK_CUR);
         continue;
       }
 
@@ -2492,13 +3924,15 @@ static int avi_parse_input_file(avi_t *AVI, int getIndex) {
            (data[3] == 'b' || data[3] == 'B' || data[3] == 'c' || data[3] == 'C'))
           || ((data[2] == 'w' || data[2] == 'W') &&
               (data[3] == 'b' || data[3] == 'B'))) {
-        avi_add_index_entry(AVI, (unsigned char *) data, 0, plat_seek(AVI->fdes, 0, SEEK_CUR) - 8,
+        avi_add_index_entry(AVI, (unsigned char *) data, 0, avi_seek(AVI, 0, SEEK_CUR) - 8,
                             n);
       }
 
-      plat_seek(AVI->fdes, PAD_EVEN(n), SEEK_CUR);
+      avi_seek(AVI, PAD_EVEN(n), SEEK_CUR);
     }
     idx_type = 1;
+
+    avi_trace_phase("movi scan", t_phase, "chunks", AVI->n_idx);
   }
 
   // ************************
@@ -2525,21 +3959,23 @@ static int avi_parse_input_file(avi_t *AVI, int getIndex) {
     for (j = 0; j < AVI->video_superindex->nEntriesInUse; j++) {
 
       // read from file
-      chunk_start = en = plat_malloc (AVI->video_superindex->aIndex[j].dwSize + hdrl_len);
+      t_sub = plat_time_ns();
+      chunk_start = en = plat_arena_alloc(AVI->scratch, AVI->video_superindex->aIndex[j].dwSize + hdrl_len);
+      if (!chunk_start) ERR_EXIT(AVI_ERR_NO_MEM);
 
-      if (plat_seek(AVI->fdes, AVI->video_superindex->aIndex[j].qwOffset, SEEK_SET) == (off_t) -1) {
+      if (avi_seek(AVI, AVI->video_superindex->aIndex[j].qwOffset, SEEK_SET) == (off_t) -1) {
         plat_log_send(PLAT_LOG_WARNING, __FILE__, "cannot seek to 0x%llx",
                       (unsigned long long) AVI->video_superindex->aIndex[j].qwOffset);
-        plat_free(chunk_start);
+        plat_arena_reset(AVI->scratch);
         continue;
       }
 
-      if (plat_read(AVI->fdes, en, AVI->video_superindex->aIndex[j].dwSize + hdrl_len) <= 0) {
+      if (avi_read(AVI, en, AVI->video_superindex->aIndex[j].dwSize + hdrl_len) <= 0) {
         plat_log_send(PLAT_LOG_WARNING, __FILE__,
                       "cannot read from offset 0x%llx %ld bytes; broken (incomplete) file?",
                       (unsigned long long) AVI->video_superindex->aIndex[j].qwOffset,
                       (unsigned long) AVI->video_superindex->aIndex[j].dwSize + hdrl_len);
-        plat_free(chunk_start);
+        plat_arena_reset(AVI->scratch);
         continue;
       }
 
@@ -2552,7 +3988,7 @@ static int avi_parse_input_file(avi_t *AVI, int getIndex) {
       // skip header
       en += hdrl_len;
       nvi += nrEntries;
-      AVI->video_index = plat_realloc(AVI->video_index, nvi * sizeof(video_index_entry));
+      AVI->video_index = avi_realloc(AVI, AVI->video_index, nvi * sizeof(video_index_entry));
       if (!AVI->video_index) {
         plat_log_send(PLAT_LOG_ERROR, __FILE__, "out of mem (size = %ld)",
                       nvi * sizeof(video_index_entry));
@@ -2586,7 +4022,8 @@ static int avi_parse_input_file(avi_t *AVI, int getIndex) {
         k++;
       }
 
-      plat_free(chunk_start);
+      plat_arena_reset(AVI->scratch);
+      avi_trace_phase("ix## load", t_sub, "entries", nrEntries);
     }
 
     AVI->video_frames = nvi;
@@ -2610,24 +4047,26 @@ static int avi_parse_input_file(avi_t *AVI, int getIndex) {
       for (j = 0; j < AVI->track[audtr].audio_superindex->nEntriesInUse; j++) {
 
         // read from file
-        chunk_start = en = plat_malloc(
+        t_sub = plat_time_ns();
+        chunk_start = en = plat_arena_alloc(AVI->scratch,
             AVI->track[audtr].audio_superindex->aIndex[j].dwSize + hdrl_len);
+        if (!chunk_start) ERR_EXIT(AVI_ERR_NO_MEM);
 
-        if (plat_seek(AVI->fdes, AVI->track[audtr].audio_superindex->aIndex[j].qwOffset,
+        if (avi_seek(AVI, AVI->track[audtr].audio_superindex->aIndex[j].qwOffset,
                       SEEK_SET) == (off_t) -1) {
           plat_log_send(PLAT_LOG_WARNING, __FILE__,
                         "cannot seek to 0x%llx",
                         (unsigned long long) AVI->track[audtr].audio_superindex->aIndex[j].qwOffset);
-          plat_free(chunk_start);
+          plat_arena_reset(AVI->scratch);
           continue;
         }
 
-        if (plat_read(AVI->fdes, en,
+        if (avi_read(AVI, en,
                       AVI->track[audtr].audio_superindex->aIndex[j].dwSize + hdrl_len) <= 0) {
           plat_log_send(PLAT_LOG_WARNING, __FILE__,
                         "cannot read from offset 0x%llx; broken (incomplete) file?",
                         (unsigned long long) AVI->track[audtr].audio_superindex->aIndex[j].qwOffset);
-          plat_free(chunk_start);
+          plat_arena_reset(AVI->scratch);
           continue;
         }
 
@@ -2641,8 +4080,8 @@ static int avi_parse_input_file(avi_t *AVI, int getIndex) {
         // skip header
         en += hdrl_len;
         nai[audtr] += nrEntries;
-        AVI->track[audtr].audio_index = plat_realloc(AVI->track[audtr].audio_index,
-                                                     nai[audtr] * sizeof(audio_index_entry));
+        AVI->track[audtr].audio_index = avi_realloc(AVI, AVI->track[audtr].audio_index,
+                                                    nai[audtr] * sizeof(audio_index_entry));
 
         while (k < nai[audtr]) {
 
@@ -2665,7 +4104,8 @@ static int avi_parse_input_file(avi_t *AVI, int getIndex) {
           ++k;
         }
 
-        plat_free(chunk_start);
+        plat_arena_reset(AVI->scratch);
+        avi_trace_phase("ix## load", t_sub, "entries", nrEntries);
       }
 
       AVI->track[audtr].audio_chunks = nai[audtr];
@@ -2682,7 +4122,8 @@ static int avi_parse_input_file(avi_t *AVI, int getIndex) {
     long aud_chunks = 0;
     multiple_riff:
 
-    plat_seek(AVI->fdes, AVI->movi_start, SEEK_SET);
+    t_phase = plat_time_ns();
+    avi_seek(AVI, AVI->movi_start, SEEK_SET);
 
     AVI->n_idx = 0;
 
@@ -2693,13 +4134,13 @@ static int avi_parse_input_file(avi_t *AVI, int getIndex) {
     nai[0] = AVI->track[0].audio_chunks = AVI->total_frames;
     for (j = 1; j < AVI->anum; ++j) AVI->track[j].audio_chunks = 0;
 
-    AVI->video_index = plat_malloc(nvi * sizeof(video_index_entry));
+    AVI->video_index = avi_malloc(AVI, nvi * sizeof(video_index_entry));
 
     if (AVI->video_index == 0) ERR_EXIT(AVI_ERR_NO_MEM);
 
     for (j = 0; j < AVI->anum; ++j) {
       if (AVI->track[j].audio_chunks) {
-        AVI->track[j].audio_index = plat_zalloc((nai[j] + 1) * sizeof(audio_index_entry));
+        AVI->track[j].audio_index = avi_zalloc(AVI, (nai[j] + 1) * sizeof(audio_index_entry));
         if (AVI->track[j].audio_index == 0) ERR_EXIT(AVI_ERR_NO_MEM);
       }
     }
@@ -2712,7 +4153,7 @@ static int avi_parse_input_file(avi_t *AVI, int getIndex) {
     while (1) {
       if (nvi >= AVI->total_frames) break;
 
-      if (plat_read(AVI->fdes, data, 8) != 8) break;
+      if (avi_read(AVI, data, 8) != 8) break;
       n = str2ulong((unsigned char *) data + 4);
 
 
@@ -2720,8 +4161,8 @@ static int avi_parse_input_file(avi_t *AVI, int getIndex) {
 
       if (aud_chunks - nai[j] - 1 <= 0) {
         aud_chunks += AVI->total_frames;
-        AVI->track[j].audio_index = plat_realloc(AVI->track[j].audio_index,
-                                                 (aud_chunks + 1) * sizeof(audio_index_entry));
+        AVI->track[j].audio_index = avi_realloc(AVI, AVI->track[j].audio_index,
+                                                (aud_chunks + 1) * sizeof(audio_index_entry));
         if (!AVI->track[j].audio_index) {
           plat_log_send(PLAT_LOG_ERROR, __FILE__, "Internal error -- no mem");
           AVI_errno = AVI_ERR_NO_MEM;
@@ -2738,7 +4179,7 @@ static int avi_parse_input_file(avi_t *AVI, int getIndex) {
           (data[3] == 'b' || data[3] == 'B' || data[3] == 'c' || data[3] == 'C')) {
 
         AVI->video_index[nvi].key = 0x0;
-        AVI->video_index[nvi].pos = plat_seek(AVI->fdes, 0, SEEK_CUR);
+        AVI->video_index[nvi].pos = avi_seek(AVI, 0, SEEK_CUR);
         AVI->video_index[nvi].len = n;
 
         /*
@@ -2746,7 +4187,7 @@ static int avi_parse_input_file(avi_t *AVI, int getIndex) {
 		     nvi, AVI->video_index[nvi].pos,  AVI->video_index[nvi].len, (long)AVI->video_index[nvi].key);
 		     */
         nvi++;
-        plat_seek(AVI->fdes, PAD_EVEN(n), SEEK_CUR);
+        avi_seek(AVI, PAD_EVEN(n), SEEK_CUR);
       }
 
         //AUDIO
@@ -2756,15 +4197,15 @@ static int avi_parse_input_file(avi_t *AVI, int getIndex) {
           (data[3] == 'b' || data[3] == 'B')) {
 
 
-        AVI->track[j].audio_index[nai[j]].pos = plat_seek(AVI->fdes, 0, SEEK_CUR);
+        AVI->track[j].audio_index[nai[j]].pos = avi_seek(AVI, 0, SEEK_CUR);
         AVI->track[j].audio_index[nai[j]].len = n;
         AVI->track[j].audio_index[nai[j]].tot = tot[j];
         tot[j] += AVI->track[j].audio_index[nai[j]].len;
         nai[j]++;
 
-        plat_seek(AVI->fdes, PAD_EVEN(n), SEEK_CUR);
+        avi_seek(AVI, PAD_EVEN(n), SEEK_CUR);
       } else {
-        plat_seek(AVI->fdes, -4, SEEK_CUR);
+        avi_seek(AVI, -4, SEEK_CUR);
       }
 
     }
@@ -2782,6 +4223,7 @@ static int avi_parse_input_file(avi_t *AVI, int getIndex) {
     idx_type = 1;
     plat_log_send(PLAT_LOG_INFO, __FILE__,
                   "done. nvi=%ld nai=%ld tot=%ld", nvi, nai[0], tot[0]);
+    avi_trace_phase("reconstruction", t_phase, "frames", nvi);
 
   } // total_frames but no indx chunk (xawtv does this)
 
@@ -2792,6 +4234,7 @@ static int avi_parse_input_file(avi_t *AVI, int getIndex) {
 
     /* Now generate the video index and audio index arrays */
 
+    t_phase = plat_time_ns();
     nvi = 0;
     for (j = 0; j < AVI->anum; ++j) nai[j] = 0;
 
@@ -2808,12 +4251,12 @@ static int avi_parse_input_file(avi_t *AVI, int getIndex) {
 
 
     if (AVI->video_frames == 0) ERR_EXIT(AVI_ERR_NO_VIDS);
-    AVI->video_index = plat_malloc(nvi * sizeof(video_index_entry));
+    AVI->video_index = avi_malloc(AVI, nvi * sizeof(video_index_entry));
     if (AVI->video_index == 0) ERR_EXIT(AVI_ERR_NO_MEM);
 
     for (j = 0; j < AVI->anum; ++j) {
       if (AVI->track[j].audio_chunks) {
-        AVI->track[j].audio_index = plat_zalloc((nai[j] + 1) * sizeof(audio_index_entry));
+        AVI->track[j].audio_index = avi_zalloc(AVI, (nai[j] + 1) * sizeof(audio_index_entry));
         if (AVI->track[j].audio_index == 0) ERR_EXIT(AVI_ERR_NO_MEM);
       }
     }
@@ -2849,11 +4292,12 @@ static int avi_parse_input_file(avi_t *AVI, int getIndex) {
 
     for (j = 0; j < AVI->anum; ++j) AVI->track[j].audio_bytes = tot[j];
 
+    avi_trace_phase("idx1 classify", t_phase, "entries", AVI->n_idx);
   } // is no opendml
 
   /* Reposition the file */
 
-  plat_seek(AVI->fdes, AVI->movi_start, SEEK_SET);
+  avi_seek(AVI, AVI->movi_start, SEEK_SET);
   AVI->video_pos = 0;
 
   return 0;
@@ -2875,10 +4319,39 @@ double AVI_frame_rate(avi_t *AVI) {
   return AVI->fps;
 }
 
+/*
+   AVI_frame_rate_rational: The frame rate as stored in the file,
+                            rate / scale frames per second. Players
+                            should time frames with it, AVI_frame_rate
+                            is rounded (29.97 is 30000 / 1001).
+*/
+
+int AVI_frame_rate_rational(avi_t *AVI, uint32_t *rate, uint32_t *scale) {
+  if (!AVI->fps_rate || !AVI->fps_scale) {
+    AVI_errno = AVI_ERR_NO_VIDS;
+    return -1;
+  }
+  *rate = AVI->fps_rate;
+  *scale = AVI->fps_scale;
+  return 0;
+}
+
 char *AVI_video_compressor(avi_t *AVI) {
   return AVI->compressor2;
 }
 
+/*
+   AVI_video_palette: The colour table of a palettized (8 bit and less,
+                      RLE8, RLE4) video stream as its strf holds it,
+                      RGBQUADs of B G R and a zero byte. Returns the
+                      number of colours, 0 if the stream has none.
+*/
+
+int AVI_video_palette(avi_t *AVI, const uint8_t **bgrx) {
+  *bgrx = AVI->palette;
+  return AVI->palette_colors;
+}
+
 long AVI_max_video_chunk(avi_t *AVI) {
   return AVI->max_len;
 }
@@ -2949,6 +4422,21 @@ long AVI_frame_size(avi_t *AVI, long frame) {
   return (AVI->video_index[frame].len);
 }
 
+/* 1 if frame is a keyframe, 0 if not or out of range */
+int AVI_frame_is_keyframe(avi_t *AVI, long frame) {
+  if (AVI->mode == AVI_MODE_WRITE) {
+    AVI_errno = AVI_ERR_NOT_PERM;
+    return -1;
+  }
+  if (!AVI->video_index) {
+    AVI_errno = AVI_ERR_NO_IDX;
+    return -1;
+  }
+
+  if (frame < 0 || frame >= AVI->video_frames) return 0;
+  return AVI->video_index[frame].key == 0x10;
+}
+
 long AVI_audio_size(avi_t *AVI, long frame) {
   if (AVI->mode == AVI_MODE_WRITE) {
     AVI_errno = AVI_ERR_NOT_PERM;
@@ -2979,12 +4467,13 @@ long AVI_get_video_position(avi_t *AVI, long frame) {
 
 
 int AVI_seek_start(avi_t *AVI) {
+  avi_enter(AVI, AVI_IO_OTHER);
   if (AVI->mode == AVI_MODE_WRITE) {
     AVI_errno = AVI_ERR_NOT_PERM;
     return -1;
   }
 
-  plat_seek(AVI->fdes, AVI->movi_start, SEEK_SET);
+  avi_seek(AVI, AVI->movi_start, SEEK_SET);
   AVI->video_pos = 0;
   return 0;
 }
@@ -3018,6 +4507,7 @@ int AVI_set_audio_bitrate(avi_t *AVI, long bitrate) {
 long AVI_read_video(avi_t *AVI, char *vidbuf, long bytes, int *keyframe) {
   long n;
 
+  avi_enter(AVI, AVI_IO_READ_VIDEO);
   if (AVI->mode == AVI_MODE_WRITE) {
     AVI_errno = AVI_ERR_NOT_PERM;
     return -1;
@@ -3042,9 +4532,18 @@ long AVI_read_video(avi_t *AVI, char *vidbuf, long bytes, int *keyframe) {
     return n;
   }
 
-  plat_seek(AVI->fdes, AVI->video_index[AVI->video_pos].pos, SEEK_SET);
+  if (AVI->direct_buf) {
+    if (avi_read_direct(AVI, vidbuf, AVI->video_index[AVI->video_pos].pos, n) != n) {
+      AVI_errno = AVI_ERR_READ;
+      return -1;
+    }
+    AVI->video_pos++;
+    return n;
+  }
+
+  avi_seek(AVI, AVI->video_index[AVI->video_pos].pos, SEEK_SET);
 
-  if (plat_read(AVI->fdes, vidbuf, n) != n) {
+  if (avi_read(AVI, vidbuf, n) != n) {
     AVI_errno = AVI_ERR_READ;
     return -1;
   }
@@ -3058,6 +4557,53 @@ long AVI_read_frame(avi_t *AVI, char *vidbuf, int *keyframe) {
   return AVI_read_video(AVI, vidbuf, -1, keyframe);
 }
 
+/*
+   AVI_peek_frame: Like AVI_read_frame, but returns a pointer to the
+                   frame data inside the backend instead of copying it.
+                   Only backends with peek (AVI_open_memory) can do that,
+                   NULL is returned otherwise, AVI_can_peek tells.
+*/
+
+const char *AVI_peek_frame(avi_t *AVI, long *len, int *keyframe) {
+  const char *p;
+  long n;
+
+  avi_enter(AVI, AVI_IO_READ_VIDEO);
+  if (AVI->mode == AVI_MODE_WRITE || !AVI->io.peek) {
+    AVI_errno = AVI_ERR_NOT_PERM;
+    return NULL;
+  }
+  if (!AVI->video_index) {
+    AVI_errno = AVI_ERR_NO_IDX;
+    return NULL;
+  }
+
+  if (AVI->video_pos < 0 || AVI->video_pos >= AVI->video_frames) return NULL;
+  n = AVI->video_index[AVI->video_pos].len;
+
+  p = AVI->io.peek(AVI->io.opaque, AVI->video_index[AVI->video_pos].pos, n);
+  if (!p) {
+    AVI_errno = AVI_ERR_READ;
+    return NULL;
+  }
+
+  *keyframe = (AVI->video_index[AVI->video_pos].key == 0x10) ? 1 : 0;
+  *len = n;
+  AVI->video_pos++;
+
+  return p;
+}
+
+/*
+   AVI_can_peek: 1 if AVI_peek_frame works on this handle, which reads
+                 through a backend with peek, 0 if frames must be read
+                 with AVI_read_frame.
+*/
+
+int AVI_can_peek(avi_t *AVI) {
+  return AVI->mode != AVI_MODE_WRITE && AVI->io.peek != NULL;
+}
+
 
 long AVI_get_audio_position_index(avi_t *AVI) {
   if (AVI->mode == AVI_MODE_WRITE) {
@@ -3130,6 +4676,7 @@ long AVI_read_audio(avi_t *AVI, char *audbuf, long bytes) {
   long nr, left, todo;
   off_t pos;
 
+  avi_enter(AVI, AVI_IO_READ_AUDIO);
   if (AVI->mode == AVI_MODE_WRITE) {
     AVI_errno = AVI_ERR_NOT_PERM;
     return -1;
@@ -3144,7 +4691,7 @@ long AVI_read_audio(avi_t *AVI, char *audbuf, long bytes) {
   if (bytes == 0) {
     AVI->track[AVI->aptr].audio_posc++;
     AVI->track[AVI->aptr].audio_posb = 0;
-    plat_seek(AVI->fdes, 0LL, SEEK_CUR);
+    avi_seek(AVI, 0LL, SEEK_CUR);
   }
   while (bytes > 0) {
     off_t ret;
@@ -3162,8 +4709,8 @@ long AVI_read_audio(avi_t *AVI, char *audbuf, long bytes) {
       todo = left;
     pos = AVI->track[AVI->aptr].audio_index[AVI->track[AVI->aptr].audio_posc].pos +
           AVI->track[AVI->aptr].audio_posb;
-    plat_seek(AVI->fdes, pos, SEEK_SET);
-    if ((ret = plat_read(AVI->fdes, audbuf + nr, todo)) != todo) {
+    avi_seek(AVI, pos, SEEK_SET);
+    if ((ret = avi_read(AVI, audbuf + nr, todo)) != todo) {
       plat_log_send(PLAT_LOG_DEBUG, __FILE__, "XXX pos = %lld, ret = %lld, todo = %ld",
                     (long long) pos, (long long) ret, todo);
       AVI_errno = AVI_ERR_READ;
@@ -3181,6 +4728,7 @@ long AVI_read_audio_chunk(avi_t *AVI, char *audbuf) {
   long left;
   off_t pos;
 
+  avi_enter(AVI, AVI_IO_READ_AUDIO);
   if (AVI->mode == AVI_MODE_WRITE) {
     AVI_errno = AVI_ERR_NOT_PERM;
     return -1;
@@ -3205,8 +4753,8 @@ long AVI_read_audio_chunk(avi_t *AVI, char *audbuf) {
 
   pos = AVI->track[AVI->aptr].audio_index[AVI->track[AVI->aptr].audio_posc].pos +
         AVI->track[AVI->aptr].audio_posb;
-  plat_seek(AVI->fdes, pos, SEEK_SET);
-  if (plat_read(AVI->fdes, audbuf, left) != left) {
+  avi_seek(AVI, pos, SEEK_SET);
+  if (avi_read(AVI, audbuf, left) != left) {
     AVI_errno = AVI_ERR_READ;
     return -1;
   }
@@ -3216,6 +4764,59 @@ long AVI_read_audio_chunk(avi_t *AVI, char *audbuf) {
   return left;
 }
 
+/*
+   AVI_read_audio_at: Read bytes of the audio stream of track from
+                      byte on. Only the index and positional reads are
+                      used, neither the file position nor the track
+                      positions move, so one thread may read audio this
+                      way while another reads video (or runs a frame
+                      ring). These reads are not counted in the I/O
+                      statistics, which belong to the other thread.
+                      Returns the bytes read, fewer at the end.
+*/
+
+long AVI_read_audio_at(avi_t *AVI, int track, long byte, char *audbuf, long bytes) {
+  const track_t *t;
+  long n0, n1, n, nr = 0;
+
+  if (AVI->mode == AVI_MODE_WRITE) {
+    AVI_errno = AVI_ERR_NOT_PERM;
+    return -1;
+  }
+  if (track < 0 || track >= AVI->anum || !AVI->track[track].audio_index) {
+    AVI_errno = AVI_ERR_NO_IDX;
+    return -1;
+  }
+  t = &AVI->track[track];
+  if (byte < 0 || bytes < 0 || !t->audio_chunks) return 0;
+
+  // the chunk holding byte, as in AVI_set_audio_position
+  n0 = 0;
+  n1 = t->audio_chunks;
+  while (n0 < n1 - 1) {
+    n = (n0 + n1) / 2;
+    if (t->audio_index[n].tot > byte)
+      n1 = n;
+    else
+      n0 = n;
+  }
+
+  for (n = n0; n < t->audio_chunks && bytes > 0; n++) {
+    off_t skip = byte + nr - t->audio_index[n].tot;
+    long todo;
+
+    if (skip >= t->audio_index[n].len) continue;
+    todo = (long) (t->audio_index[n].len - skip) < bytes ? (long) (t->audio_index[n].len - skip) : bytes;
+    if (avi_io_pread(AVI, audbuf + nr, todo, t->audio_index[n].pos + skip) != todo) {
+      AVI_errno = AVI_ERR_READ;
+      return -1;
+    }
+    bytes -= todo;
+    nr += todo;
+  }
+  return nr;
+}
+
 /* AVI_print_error: Print most recent error (similar to perror) */
 
 static const char *avi_errors[] =
@@ -3235,7 +4836,8 @@ static const char *avi_errors[] =
         /* 12 */ "avilib - AVI file has no video data",
         /* 13 */ "avilib - operation needs an index",
         /* 14 */ "avilib - destination buffer is too small",
-        /* 15 */ "avilib - Unkown Error"
+        /* 15 */ "avilib - feature not available in this build",
+        /* 16 */ "avilib - Unkown Error"
     };
 static int num_avi_errors = sizeof(avi_errors) / sizeof(char *);
 
@@ -147,6 +147,10 @@ typedef struct track_s
   audio_index_entry *audio_index;
   avisuperindex_chunk *audio_superindex;
 
+  char  *agg_buf;           /* audio not yet written (aggregation) */
+  long   agg_len;
+  long   agg_size;
+
 } track_t;
 
 typedef struct
@@ -200,6 +204,90 @@ typedef struct __attribute__((__packed__))
   char     sz_name[64];
 } alAVISTREAMINFO;
 
+/* I/O backend of a handle. All offsets are absolute. read_at and
+   write_at transfer the whole request unless EOF or an error is hit
+   and return the number of bytes transferred, -1 on error. */
+
+typedef struct avi_io_s
+{
+  ssize_t (*read_at)(void *opaque, void *buf, size_t count, int64_t offset);
+  ssize_t (*write_at)(void *opaque, const void *buf, size_t count,
+                      int64_t offset);       /* NULL for read only */
+  int64_t (*size)(void *opaque);
+  const void *(*peek)(void *opaque, int64_t offset,
+                      size_t count);         /* optional, zero-copy */
+  int     (*truncate)(void *opaque, int64_t length);  /* optional */
+  int     (*close)(void *opaque);                     /* optional */
+  void    *opaque;
+} avi_io_t;
+
+/* I/O statistics of a handle, split by the API call that caused the I/O */
+
+enum {
+  AVI_IO_OPEN = 0,          /* AVI_open_* (parsing, index building) */
+  AVI_IO_READ_VIDEO,        /* AVI_read_frame, AVI_read_video, AVI_peek_frame */
+  AVI_IO_READ_AUDIO,        /* AVI_read_audio, AVI_read_audio_chunk */
+  AVI_IO_WRITE_FRAME,       /* AVI_write_frame, AVI_dup_frame */
+  AVI_IO_WRITE_AUDIO,       /* AVI_write_audio */
+  AVI_IO_CLOSE,             /* AVI_close (header and index) */
+  AVI_IO_OTHER,
+  AVI_IO_OPS
+};
+
+#define AVI_IO_HIST_BUCKETS 32  /* bucket k counts calls of 2^k..2^(k+1)-1 ns */
+
+typedef struct
+{
+  unsigned long calls;
+  uint64_t bytes;
+  uint64_t ns;              /* time spent in the calls */
+  unsigned long hist[AVI_IO_HIST_BUCKETS];
+} avi_io_counter_t;
+
+typedef struct
+{
+  avi_io_counter_t read;
+  avi_io_counter_t write;
+  unsigned long seeks;
+  uint64_t seek_ns;
+  uint64_t seek_distance;   /* bytes the file position moved by seeks and
+                               positional reads */
+} avi_io_op_stats_t;
+
+/* Read traces, see AVI_record_start. A trace is one avi_rec_header_t
+   followed by avi_rec_entry_t records, in host byte order. */
+
+#define AVI_REC_MAGIC   "AVRT"
+#define AVI_REC_VERSION 1
+
+typedef struct
+{
+  char     magic[4];        /* AVI_REC_MAGIC */
+  uint32_t version;
+  uint64_t file_size;       /* of the traced file, 0 if unknown */
+  uint64_t start_ns;        /* plat_time_ns() at AVI_record_start */
+} avi_rec_header_t;
+
+#define AVI_REC_PREAD 0x01  /* flags: positional read */
+
+typedef struct
+{
+  uint64_t offset;
+  uint32_t length;          /* bytes read */
+  uint32_t delta_us;        /* since the start of the previous read */
+  uint32_t id;              /* frame or audio chunk that was read */
+  uint8_t  op;              /* AVI_IO_* of the API call */
+  uint8_t  flags;
+  uint16_t track;           /* audio track of AVI_IO_READ_AUDIO */
+} avi_rec_entry_t;
+
+typedef struct
+{
+  avi_io_op_stats_t op[AVI_IO_OPS];
+  avi_io_counter_t riff;    /* RIFF rotations of the writer: index bytes
+                               flushed and the time the rotation took */
+} avi_io_stats_t;
+
 typedef struct
 {
 
@@ -209,6 +297,8 @@ typedef struct
   long   width;             /* Width  of a video frame */
   long   height;            /* Height of a video frame */
   double fps;               /* Frames per second */
+  uint32_t fps_rate;        /* fps exactly, dwRate / dwScale of the */
+  uint32_t fps_scale;       /* video strh, 0 / 0 if unknown */
   char   compressor[8];     /* Type of compressor, 4 bytes + padding for 0 byte */
   char   compressor2[8];     /* Type of compressor, 4 bytes + padding for 0 byte */
   long   video_strn;        /* Video stream number */
@@ -236,6 +326,7 @@ typedef struct
 
   off_t  last_pos;          /* Position of last frame written */
   uint32_t last_len;   /* Length of last frame written */
+  int last_key;             /* Last frame written was a keyframe */
   int must_use_index;       /* Flag if frames are duplicated */
   off_t  movi_start;
   int total_frames;         /* total number of frames if dmlh is present */
@@ -246,12 +337,53 @@ typedef struct
   char *index_file;    // read the avi index from this file
 
   alBITMAPINFOHEADER *bitmap_info_header;
+  uint8_t *palette;         /* RGBQUADs after it in strf, NULL if none */
+  int    palette_colors;
   alWAVEFORMATEX *wave_format_ex[AVI_MAX_TRACKS];
 
   void*     extradata;
   unsigned long extradata_size;
+
+  struct platarena_ *arena;   /* header and index structures, freed by AVI_close */
+  struct platarena_ *scratch; /* temporary buffers, reset after each use */
+
+  avi_io_t io;              /* backend, io.read_at == NULL for fdes */
+  avi_io_stats_t *io_stats; /* NULL unless statistics are on */
+  int      io_op;           /* AVI_IO_* of the running API call */
+  int64_t  io_stat_pos;     /* file position as seen by the statistics */
+  int64_t  io_pos;          /* file position within the backend */
+  struct avi_recorder_s *rec; /* read trace, see AVI_record_start */
+
+  int    dup_detect;        /* write repeated frames as duplicates */
+  long   dup_max_sad;       /* max. sum of abs. differences for a dup */
+  char  *dup_buf;           /* copy of the last frame written */
+  long   dup_buf_size;
+  int    dup_valid;         /* dup_buf holds the last frame written */
+
+  long   agg_bytes;         /* flush buffered audio at this size */
+  long   agg_ms;            /* or at this duration */
+
+  long   chunk_align;       /* video payloads start at multiples of this */
+  char  *pad_buf;           /* zeros for the JUNK padding */
+
+  int    direct_fd;         /* O_DIRECT fd for video reads */
+  char  *direct_buf;        /* aligned bounce buffer, NULL if unused */
+  long   direct_size;
+
+  int    ckpt_fd;           /* checkpoint index journal, 0 if unused */
+  long   ckpt_frames;       /* checkpoint every ckpt_frames frames */
+  long   ckpt_pending;      /* frames since the last checkpoint */
+  int    ckpt_sync;         /* flush to the device at checkpoints */
+  char  *ckpt_buf;          /* journal lines not yet written */
+  long   ckpt_len;
+  long   ckpt_size;
+  long   ckpt_count;        /* checkpoint cost accounting */
+  uint64_t ckpt_total_ns;
+  uint64_t ckpt_max_ns;
 } avi_t;
 
+#define AVI_DIRECT_ALIGN 4096  /* block size assumed for O_DIRECT reads */
+
 #define AVI_MODE_WRITE  0
 #define AVI_MODE_READ   1
 
@@ -300,6 +432,8 @@ typedef struct
 #define AVI_ERR_NO_BUFSIZE  14     /* Given buffer is not large enough
                                       to hold the requested data */
 
+#define AVI_ERR_UNSUPPORTED 15     /* Feature was not compiled in */
+
 /* Possible Audio formats */
 
 #ifndef WAVE_FORMAT_PCM
@@ -322,13 +456,22 @@ typedef struct
 #endif
 
 avi_t *AVI_open_output_file(const char *filename);
+avi_t *AVI_open_output_io(const avi_io_t *io);
 void AVI_set_video(avi_t *AVI, int width, int height, double fps,
                    const char *compressor);
 void AVI_set_audio(avi_t *AVI, int channels, long rate, int bits, int format,
                    long mp3rate);
 int  AVI_write_frame(avi_t *AVI, const char *data, long bytes, int keyframe);
+int  AVI_dup_frame(avi_t *AVI);
+void AVI_set_dup_detection(avi_t *AVI, int enable, long max_sad);
 int  AVI_write_audio(avi_t *AVI, const char *data, long bytes);
+int  AVI_set_chunk_alignment(avi_t *AVI, long align);
+int  AVI_set_checkpoint(avi_t *AVI, long frames, const char *journal, int sync);
+int  AVI_checkpoint_stats(avi_t *AVI, long *count, uint64_t *total_us, uint64_t *max_us);
+int  AVI_set_audio_aggregation(avi_t *AVI, long bytes, long ms);
 long AVI_bytes_remain(avi_t *AVI);
+int  AVI_cut(avi_t *AVI, long first_frame, long last_frame, const char *filename);
+int  AVI_join(avi_t **inputs, int n, const char *filename);
 int  AVI_close(avi_t *AVI);
 long AVI_bytes_written(avi_t *AVI);
 
@@ -336,6 +479,9 @@ avi_t *AVI_open_input_file(const char *filename, int getIndex);
 avi_t *AVI_open_input_indexfile(const char *filename, int getIndex,
                                 const char *indexfile);
 avi_t *AVI_open_fd(int fd, int getIndex);
+avi_t *AVI_open_input_file_direct(const char *filename, int getIndex);
+avi_t *AVI_open_io(const avi_io_t *io, int getIndex);
+avi_t *AVI_open_memory(const void *buf, size_t len, int getIndex);
 avi_t *AVI_open_indexfd(int fd, int getIndex, const char *indexfile);
 
 long AVI_audio_mp3rate(avi_t *AVI);
@@ -344,7 +490,9 @@ long AVI_video_frames(avi_t *AVI);
 int  AVI_video_width(avi_t *AVI);
 int  AVI_video_height(avi_t *AVI);
 double AVI_frame_rate(avi_t *AVI);
+int  AVI_frame_rate_rational(avi_t *AVI, uint32_t *rate, uint32_t *scale);
 char* AVI_video_compressor(avi_t *AVI);
+int  AVI_video_palette(avi_t *AVI, const uint8_t **bgrx);
 
 int  AVI_audio_channels(avi_t *AVI);
 int  AVI_audio_bits(avi_t *AVI);
@@ -357,12 +505,15 @@ int  AVI_can_read_audio(avi_t *AVI);
 long AVI_max_video_chunk(avi_t *AVI);
 
 long AVI_frame_size(avi_t *AVI, long frame);
+int  AVI_frame_is_keyframe(avi_t *AVI, long frame);
 long AVI_audio_size(avi_t *AVI, long frame);
 int  AVI_seek_start(avi_t *AVI);
 int  AVI_set_video_position(avi_t *AVI, long frame);
 long AVI_get_video_position(avi_t *AVI, long frame);
 long AVI_read_frame(avi_t *AVI, char *vidbuf, int *keyframe);
 long AVI_read_video(avi_t *AVI, char *vidbuf, long bytes, int *keyframe);
+const char *AVI_peek_frame(avi_t *AVI, long *len, int *keyframe);
+int  AVI_can_peek(avi_t *AVI);
 
 int  AVI_set_audio_position(avi_t *AVI, long byte);
 int  AVI_set_audio_bitrate(avi_t *AVI, long bitrate);
@@ -372,6 +523,7 @@ int  AVI_set_audio_position_index(avi_t *AVI, long indexpos);
 
 long AVI_read_audio(avi_t *AVI, char *audbuf, long bytes);
 long AVI_read_audio_chunk(avi_t *AVI, char *audbuf);
+long AVI_read_audio_at(avi_t *AVI, int track, long byte, char *audbuf, long bytes);
 
 long AVI_audio_codech_offset(avi_t *AVI);
 long AVI_audio_codecf_offset(avi_t *AVI);
@@ -396,6 +548,24 @@ long AVI_get_audio_vbr(avi_t *AVI);
 void AVI_set_comment_fd(avi_t *AVI, int fd);
 int  AVI_get_comment_fd(avi_t *AVI);
 
+typedef struct
+{
+  uint64_t live_bytes;      /* allocated right now */
+  uint64_t peak_bytes;      /* high water mark of live_bytes */
+  unsigned long allocs;
+  unsigned long frees;
+} avi_mem_stats_t;
+
+int  AVI_memory_stats(avi_t *AVI, avi_mem_stats_t *st);
+int  AVI_set_io_stats(avi_t *AVI, int enable);
+void AVI_set_io_stats_default(int enable);
+int  AVI_get_io_stats(avi_t *AVI, avi_io_stats_t *st);
+int  AVI_trace_start(const char *filename);
+int  AVI_trace_stop(void);
+int  AVI_record_start(avi_t *AVI, const char *filename);
+int  AVI_record_stop(avi_t *AVI);
+int  AVI_memory_dump(FILE *f);
+
 struct riff_struct
 {
   uint8_t id[4];   /* RIFF */
@@ -0,0 +1,126 @@
+/*
+ * avialign.c -- check of AVI_set_chunk_alignment
+ *
+ * Writes frames of random size under one chunk alignment after the
+ * other, changing it between frames (to a larger one, a smaller one,
+ * none and back), then reads the file back: every frame must have its
+ * bytes and its payload must start at a multiple of the alignment it
+ * was written with. Exits 1 on the first difference.
+ *
+ *   avialign [-o file] [-n frames] [-S seed]
+ *
+ * ctest runs it with the defaults.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "avilib.h"
+#include "benchutil.h"
+
+#define MAX_FRAME 100000
+
+/* alignment of each run of frames, in order */
+static const long aligns[] = { 4096, 512, 8192, 0, 4096, 16, 65536, 512 };
+#define RUNS ((int) (sizeof(aligns) / sizeof(aligns[0])))
+
+static void fill(char *buf, long len, long frame) {
+  long k;
+
+  for (k = 0; k < len; k++) buf[k] = (char) (frame * 7 + k);
+}
+
+static void usage(void) {
+  fprintf(stderr,
+          "usage: avialign [options]\n"
+          "  -o FILE   AVI to write and read back (avialign.avi)\n"
+          "  -n N      frames per alignment (20)\n"
+          "  -S SEED   random seed (1)\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  const char *name = "avialign.avi";
+  long per_run = 20, *sizes, frames, f, len;
+  uint64_t seed = 1;
+  char *buf, *back;
+  avi_t *avi;
+  int c, run, fail = 0;
+
+  while ((c = getopt(argc, argv, "o:n:S:")) != -1) {
+    switch (c) {
+      case 'o': name = optarg; break;
+      case 'n': per_run = atol(optarg); break;
+      case 'S': seed = strtoull(optarg, NULL, 0); break;
+      default: usage();
+    }
+  }
+  if (per_run < 1 || !seed) usage();
+
+  frames = per_run * RUNS;
+  sizes = malloc(frames * sizeof(*sizes));
+  buf = malloc(MAX_FRAME);
+  back = malloc(MAX_FRAME);
+  if (!sizes || !buf || !back) {
+    perror("avialign");
+    return 1;
+  }
+
+  avi = AVI_open_output_file(name);
+  if (!avi) {
+    AVI_print_error(name);
+    return 1;
+  }
+  AVI_set_video(avi, 320, 240, 25, "MJPG");
+  for (f = 0; f < frames; f++) {
+    if (f % per_run == 0 && AVI_set_chunk_alignment(avi, aligns[f / per_run]) < 0) {
+      fprintf(stderr, "avialign: cannot set alignment %ld\n", aligns[f / per_run]);
+      return 1;
+    }
+    sizes[f] = 1 + (long) (bench_rand(&seed) % MAX_FRAME);
+    fill(buf, sizes[f], f);
+    if (AVI_write_frame(avi, buf, sizes[f], 1) < 0) {
+      AVI_print_error("avialign: write");
+      return 1;
+    }
+  }
+  if (AVI_close(avi) < 0) {
+    AVI_print_error("avialign: close");
+    return 1;
+  }
+
+  avi = AVI_open_input_file(name, 1);
+  if (!avi) {
+    AVI_print_error(name);
+    return 1;
+  }
+  if (AVI_video_frames(avi) != frames) {
+    fprintf(stderr, "avialign: %ld frames read back, %ld written\n", AVI_video_frames(avi), frames);
+    fail = 1;
+  }
+  for (f = 0; !fail && f < frames; f++) {
+    const long align = aligns[f / per_run];
+    int key;
+
+    run = (int) (f / per_run);
+    len = AVI_read_frame(avi, back, &key);
+    fill(buf, sizes[f], f);
+    if (len != sizes[f] || memcmp(back, buf, len)) {
+      fprintf(stderr, "avialign: frame %ld (alignment %ld, run %d) differs\n", f, align, run);
+      fail = 1;
+    } else if (align && AVI_get_video_position(avi, f) % align) {
+      fprintf(stderr, "avialign: frame %ld at %ld, not a multiple of %ld\n",
+              f, AVI_get_video_position(avi, f), align);
+      fail = 1;
+    }
+  }
+  AVI_close(avi);
+
+  if (!fail) printf("avialign: %ld frames under %d alignments ok\n", frames, RUNS);
+  free(sizes);
+  free(buf);
+  free(back);
+  return fail;
+}
@@ -0,0 +1,392 @@
+/*
+ * avibench.c -- read side benchmark of avilib on the host
+ *
+ * Generates a test file with AVI_write_frame/AVI_write_audio (or takes
+ * an existing one) and measures opening, sequential frame reads,
+ * random seeks + frame reads, audio byte range reads and interleaved
+ * A/V reads as a player would do them. Every workload runs with a
+ * warm and/or a cold page cache. Results are written as JSON.
+ *
+ *   avibench [-f file | -o out -n frames -s size -F fps -k keyint -r rate]
+ *            [-R reads] [-A bytes] [-S seed] [-c warm|cold|both] [-D]
+ *            [-t storage] [-j result.json]
+ *
+ * With -t the file is read through an emulated device, e.g. -t sdcard
+ * or -t usb2,virtual=1 (see plat_throttle_parse), and every result
+ * carries what the device did.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "avilib.h"
+#include "benchthrottle.h"
+#include "benchutil.h"
+
+typedef struct {
+  const char *file;
+  int generate;
+  long frames;
+  long frame_size;
+  double fps;
+  long keyint;
+  long rate;
+  long reads;
+  long audio_len;
+  uint64_t seed;
+  int warm, cold;
+  int direct;
+  PlatThrottle *dev;   /* -t, NULL for the plain file */
+} bench_opts_t;
+
+typedef struct {
+  bench_lat_t lat;
+  uint64_t bytes;
+  uint64_t ns;       /* wall time of the whole run */
+  int cold;          /* page cache dropped before the run */
+} bench_run_t;
+
+static void usage(void) {
+  fprintf(stderr,
+          "usage: avibench [options]\n"
+          "  -f FILE   benchmark an existing file\n"
+          "  -o FILE   generate the test file here (avibench.avi)\n"
+          "  -n N      frames to generate (3000)\n"
+          "  -s N      bytes per video frame (100000)\n"
+          "  -F FPS    frame rate (25)\n"
+          "  -k N      keyframe interval (12)\n"
+          "  -r RATE   16 bit stereo audio rate, 0 for none (44100)\n"
+          "  -R N      random reads per workload (1000)\n"
+          "  -A N      bytes per audio range read (16384)\n"
+          "  -S SEED   random seed (1)\n"
+          "  -c MODE   page cache: warm, cold or both (both)\n"
+          "  -D        read frames with O_DIRECT\n"
+          "  -t SPEC   read through emulated storage: sdcard, usb2, hdd, nvme\n"
+          "            and/or key=value,... (lat bw seek gap spike spike_us seed virtual)\n"
+          "  -j FILE   write the JSON result here (stdout)\n");
+  exit(1);
+}
+
+/*************************************************************************/
+
+static int generate(const bench_opts_t *o) {
+  avi_t *AVI;
+  char *frame, *audio;
+  long i, abytes = 0, adone = 0;
+  long asize = (long) (o->rate * 4 / o->fps) + 8;
+
+  AVI = AVI_open_output_file(o->file);
+  if (!AVI) {
+    AVI_print_error("avibench: generate");
+    return -1;
+  }
+  AVI_set_video(AVI, 320, 240, o->fps, "MJPG");
+  if (o->rate > 0)
+    AVI_set_audio(AVI, 2, o->rate, 16, WAVE_FORMAT_PCM, 0);
+
+  frame = malloc(o->frame_size);
+  audio = calloc(1, asize);
+  if (!frame || !audio) return -1;
+
+  for (i = 0; i < o->frames; i++) {
+    memset(frame, (int) i, o->frame_size);
+    if (AVI_write_frame(AVI, frame, o->frame_size, i % o->keyint == 0) < 0)
+      break;
+    if (o->rate > 0) {
+      // keep audio exactly in step with the frames
+      abytes = (long) ((i + 1) * o->rate / o->fps) * 4 - adone;
+      if (abytes > asize) abytes = asize;
+      if (AVI_write_audio(AVI, audio, abytes) < 0)
+        break;
+      adone += abytes;
+    }
+  }
+
+  free(frame);
+  free(audio);
+  if (AVI_close(AVI) < 0 || i < o->frames) {
+    AVI_print_error("avibench: generate");
+    return -1;
+  }
+  return 0;
+}
+
+static avi_t *open_input(const bench_opts_t *o) {
+  avi_t *AVI;
+
+  if (o->dev)
+    AVI = bench_throttle_input(o->dev, o->file);
+  else if (o->direct)
+    AVI = AVI_open_input_file_direct(o->file, 1);
+  else
+    AVI = AVI_open_input_file(o->file, 1);
+  if (!AVI)
+    AVI_print_error("avibench: open");
+  return AVI;
+}
+
+/* AVI_max_video_chunk is only maintained while writing */
+static long max_frame(avi_t *AVI) {
+  long i, n = AVI_video_frames(AVI), m = 0;
+
+  for (i = 0; i < n; i++)
+    if (AVI_frame_size(AVI, i) > m) m = AVI_frame_size(AVI, i);
+  return m;
+}
+
+/*************************************************************************/
+/* workloads, each fills run and returns -1 on a read error              */
+
+static int run_open(const bench_opts_t *o, avi_t *AVI, char *buf, bench_run_t *run) {
+  long i;
+
+  (void) AVI;
+  (void) buf;
+  for (i = 0; i < 5; i++) {
+    uint64_t t0 = bench_now_ns();
+    avi_t *a = open_input(o);
+
+    if (!a) return -1;
+    bench_lat_add(&run->lat, bench_now_ns() - t0);
+    AVI_close(a);
+    if (run->cold) bench_drop_cache(o->file);
+  }
+  return 0;
+}
+
+static int run_sequential(const bench_opts_t *o, avi_t *AVI, char *buf, bench_run_t *run) {
+  long i, n = AVI_video_frames(AVI);
+  int key;
+
+  (void) o;
+  AVI_seek_start(AVI);
+  AVI_set_video_position(AVI, 0);
+  for (i = 0; i < n; i++) {
+    uint64_t t0 = bench_now_ns();
+    long r = AVI_read_frame(AVI, buf, &key);
+
+    if (r < 0) return -1;
+    bench_lat_add(&run->lat, bench_now_ns() - t0);
+    run->bytes += r;
+  }
+  return 0;
+}
+
+static int run_random(const bench_opts_t *o, avi_t *AVI, char *buf, bench_run_t *run) {
+  uint64_t rnd = o->seed;
+  long i, n = AVI_video_frames(AVI);
+  int key;
+
+  for (i = 0; i < o->reads; i++) {
+    long f = (long) (bench_rand(&rnd) % n);
+    uint64_t t0 = bench_now_ns();
+    long r;
+
+    AVI_set_video_position(AVI, f);
+    r = AVI_read_frame(AVI, buf, &key);
+    if (r < 0) return -1;
+    bench_lat_add(&run->lat, bench_now_ns() - t0);
+    run->bytes += r;
+  }
+  return 0;
+}
+
+static int run_audio_range(const bench_opts_t *o, avi_t *AVI, char *buf, bench_run_t *run) {
+  uint64_t rnd = o->seed;
+  long total = AVI_audio_bytes(AVI), i;
+
+  if (total <= o->audio_len) return 0;
+
+  for (i = 0; i < o->reads; i++) {
+    long pos = (long) (bench_rand(&rnd) % (total - o->audio_len)) & ~3L;
+    uint64_t t0 = bench_now_ns();
+    long r;
+
+    AVI_set_audio_position(AVI, pos);
+    r = AVI_read_audio(AVI, buf, o->audio_len);
+    if (r < 0) return -1;
+    bench_lat_add(&run->lat, bench_now_ns() - t0);
+    run->bytes += r;
+  }
+  return 0;
+}
+
+/* one video frame and the audio belonging to it per step */
+static int run_interleaved(const bench_opts_t *o, avi_t *AVI, char *buf, bench_run_t *run) {
+  long i, n = AVI_video_frames(AVI);
+  double fps = AVI_frame_rate(AVI);
+  long abps = AVI_audio_rate(AVI) * AVI_audio_channels(AVI) * ((AVI_audio_bits(AVI) + 7) / 8);
+  long adone = 0;
+  int key;
+
+  (void) o;
+  AVI_seek_start(AVI);
+  AVI_set_video_position(AVI, 0);
+  AVI_set_audio_position(AVI, 0);
+  for (i = 0; i < n; i++) {
+    uint64_t t0 = bench_now_ns();
+    long r = AVI_read_frame(AVI, buf, &key);
+
+    if (r < 0) return -1;
+    run->bytes += r;
+    if (abps > 0 && fps > 0) {
+      long want = (long) ((i + 1) * abps / fps) - adone;
+      want &= ~3L;
+      if (want > 0) {
+        r = AVI_read_audio(AVI, buf, want);
+        if (r < 0) return -1;
+        run->bytes += r;
+        adone += r;
+      }
+    }
+    bench_lat_add(&run->lat, bench_now_ns() - t0);
+  }
+  return 0;
+}
+
+typedef struct {
+  const char *name;
+  int (*run)(const bench_opts_t *, avi_t *, char *, bench_run_t *);
+} bench_workload_t;
+
+static const bench_workload_t workloads[] = {
+  { "open",        run_open },
+  { "sequential",  run_sequential },
+  { "random",      run_random },
+  { "audio_range", run_audio_range },
+  { "interleaved", run_interleaved },
+};
+
+/*************************************************************************/
+
+int main(int argc, char **argv) {
+  bench_opts_t o;
+  bench_json_t j;
+  FILE *out = stdout;
+  avi_t *AVI;
+  char *buf;
+  size_t k;
+  long maxlen;
+  int c, cold;
+
+  memset(&o, 0, sizeof(o));
+  o.file = "avibench.avi";
+  o.generate = 1;
+  o.frames = 3000;
+  o.frame_size = 100000;
+  o.fps = 25;
+  o.keyint = 12;
+  o.rate = 44100;
+  o.reads = 1000;
+  o.audio_len = 16384;
+  o.seed = 1;
+  o.warm = o.cold = 1;
+
+  while ((c = getopt(argc, argv, "f:o:n:s:F:k:r:R:A:S:c:Dt:j:h")) != -1) {
+    switch (c) {
+      case 'f': o.file = optarg; o.generate = 0; break;
+      case 'o': o.file = optarg; break;
+      case 'n': o.frames = atol(optarg); break;
+      case 's': o.frame_size = atol(optarg); break;
+      case 'F': o.fps = atof(optarg); break;
+      case 'k': o.keyint = atol(optarg); break;
+      case 'r': o.rate = atol(optarg); break;
+      case 'R': o.reads = atol(optarg); break;
+      case 'A': o.audio_len = atol(optarg); break;
+      case 'S': o.seed = strtoull(optarg, NULL, 0); break;
+      case 'c':
+        o.warm = strcmp(optarg, "cold") != 0;
+        o.cold = strcmp(optarg, "warm") != 0;
+        break;
+      case 'D': o.direct = 1; break;
+      case 't':
+        o.dev = bench_throttle_new(optarg);
+        if (!o.dev) return 1;
+        break;
+      case 'j':
+        out = fopen(optarg, "w");
+        if (!out) {
+          perror(optarg);
+          return 1;
+        }
+        break;
+      default: usage();
+    }
+  }
+  if (o.frames <= 0 || o.frame_size <= 0 || o.fps <= 0 || o.keyint <= 0 || !o.seed)
+    usage();
+
+  if (o.generate && generate(&o) < 0)
+    return 1;
+
+  AVI = open_input(&o);
+  if (!AVI) return 1;
+  maxlen = max_frame(AVI);
+  buf = malloc((maxlen > o.audio_len ? maxlen : o.audio_len) + 1024 * 1024);
+  if (!buf) return 1;
+
+  memset(&j, 0, sizeof(j));
+  j.f = out;
+  bench_json_obj(&j, NULL);
+  bench_json_str(&j, "bench", "avibench");
+  bench_json_str(&j, "file", o.file);
+  bench_json_int(&j, "frames", AVI_video_frames(AVI));
+  bench_json_int(&j, "max_frame_bytes", maxlen);
+  bench_json_int(&j, "audio_bytes", AVI_audio_bytes(AVI));
+  bench_json_int(&j, "direct", o.direct);
+  bench_json_int(&j, "throttled", o.dev != NULL);
+  bench_json_arr(&j, "results");
+
+  for (k = 0; k < sizeof(workloads) / sizeof(workloads[0]); k++) {
+    for (cold = 0; cold < 2; cold++) {
+      bench_run_t run;
+      PlatThrottleStats d0, d1;
+      uint64_t t0;
+      int r;
+
+      if ((cold && !o.cold) || (!cold && !o.warm)) continue;
+
+      memset(&run, 0, sizeof(run));
+      if (cold && bench_drop_cache(o.file) < 0) {
+        fprintf(stderr, "avibench: can't drop %s from the page cache\n", o.file);
+        continue;
+      }
+      run.cold = cold;
+
+      if (o.dev) plat_throttle_stats(o.dev, &d0);
+      t0 = bench_now_ns();
+      r = workloads[k].run(&o, AVI, buf, &run);
+      run.ns = bench_now_ns() - t0;
+      if (o.dev) plat_throttle_stats(o.dev, &d1);
+
+      if (r < 0) {
+        AVI_print_error(workloads[k].name);
+        continue;
+      }
+      if (!run.lat.n) continue;
+
+      bench_json_obj(&j, NULL);
+      bench_json_str(&j, "workload", workloads[k].name);
+      bench_json_str(&j, "cache", cold ? "cold" : "warm");
+      bench_json_int(&j, "bytes", (long long) run.bytes);
+      bench_json_num(&j, "seconds", run.ns / 1e9);
+      bench_json_num(&j, "mb_per_s", run.ns ? run.bytes / 1e6 / (run.ns / 1e9) : 0);
+      bench_json_num(&j, "ops_per_s", run.ns ? run.lat.n / (run.ns / 1e9) : 0);
+      bench_json_lat(&j, &run.lat);
+      if (o.dev) bench_json_device(&j, &d0, &d1);
+      bench_json_end(&j);
+      bench_lat_free(&run.lat);
+    }
+  }
+
+  bench_json_arr_end(&j);
+  bench_json_end(&j);
+
+  AVI_close(AVI);
+  plat_throttle_free(o.dev);
+  free(buf);
+  if (out != stdout) fclose(out);
+  return 0;
+}
@@ -0,0 +1,114 @@
+/*
+ * avidup.c -- check of AVI_set_dup_detection
+ *
+ * Turns duplicate detection on after frames are already written, off
+ * and on again, then reads the file back: every frame must have the
+ * bytes it was written with, and only the frames repeating the one
+ * written just before them may share its chunk. Exits 1 on the first
+ * difference.
+ *
+ *   avidup [-o file]
+ *
+ * ctest runs it with the defaults.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "avilib.h"
+
+#define FRAME_SIZE 4096
+
+/* the picture of each frame, what to do before writing it and whether
+   it must come back as a duplicate of the frame before */
+static const struct {
+  int picture;
+  int detect;       /* -1 leave as is, 0 off, 1 on */
+  int dup;
+} steps[] = {
+  { 0, -1, 0 }, { 1, -1, 0 }, { 2, -1, 0 },
+  { 2,  1, 0 },     // on mid-stream: nothing to compare with yet
+  { 2, -1, 1 },
+  { 3,  0, 0 },
+  { 2,  1, 0 },     // on again: picture 2 is no longer the last frame
+  { 2, -1, 1 },
+  { 4, -1, 0 },
+};
+#define STEPS ((int) (sizeof(steps) / sizeof(steps[0])))
+
+static void fill(char *buf, int picture) {
+  long k;
+
+  for (k = 0; k < FRAME_SIZE; k++) buf[k] = (char) (picture * 31 + k * 7);
+}
+
+static void usage(void) {
+  fprintf(stderr,
+          "usage: avidup [options]\n"
+          "  -o FILE   AVI to write and read back (avidup.avi)\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  const char *name = "avidup.avi";
+  char buf[FRAME_SIZE], back[FRAME_SIZE];
+  avi_t *avi;
+  long f, len;
+  int c, fail = 0;
+
+  while ((c = getopt(argc, argv, "o:")) != -1) {
+    switch (c) {
+      case 'o': name = optarg; break;
+      default: usage();
+    }
+  }
+
+  avi = AVI_open_output_file(name);
+  if (!avi) {
+    AVI_print_error(name);
+    return 1;
+  }
+  AVI_set_video(avi, 64, 16, 25, "RGB");
+  for (f = 0; f < STEPS; f++) {
+    if (steps[f].detect >= 0) AVI_set_dup_detection(avi, steps[f].detect, 0);
+    fill(buf, steps[f].picture);
+    if (AVI_write_frame(avi, buf, FRAME_SIZE, 1) < 0) {
+      AVI_print_error("avidup: write");
+      return 1;
+    }
+  }
+  if (AVI_close(avi) < 0) {
+    AVI_print_error("avidup: close");
+    return 1;
+  }
+
+  avi = AVI_open_input_file(name, 1);
+  if (!avi) {
+    AVI_print_error(name);
+    return 1;
+  }
+  if (AVI_video_frames(avi) != STEPS) {
+    fprintf(stderr, "avidup: %ld frames read back, %d written\n", AVI_video_frames(avi), STEPS);
+    fail = 1;
+  }
+  for (f = 0; !fail && f < STEPS; f++) {
+    int key, dup;
+
+    len = AVI_read_frame(avi, back, &key);
+    fill(buf, steps[f].picture);
+    dup = f > 0 && AVI_get_video_position(avi, f) == AVI_get_video_position(avi, f - 1);
+    if (len != FRAME_SIZE || memcmp(back, buf, len)) {
+      fprintf(stderr, "avidup: frame %ld differs\n", f);
+      fail = 1;
+    } else if (dup != steps[f].dup) {
+      fprintf(stderr, "avidup: frame %ld is %sa duplicate\n", f, dup ? "" : "not ");
+      fail = 1;
+    }
+  }
+  AVI_close(avi);
+
+  if (!fail) printf("avidup: %d frames ok\n", STEPS);
+  return fail;
+}
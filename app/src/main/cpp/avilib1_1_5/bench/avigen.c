@@ -0,0 +1,610 @@
+/*
+ * avigen.c -- synthetic AVI files for the benchmarks
+ *
+ * The file is laid out in two steps. A dry run walks the frames only
+ * to count the RIFF segments, which fixes the size of the superindexes
+ * in the header. The second run writes the chunks and indices and
+ * patches the list sizes when a segment is closed. The header goes
+ * last, when all totals are known.
+ *
+ * Writes go through a buffer that absorbs small gaps with zeros; a gap
+ * larger than AVIGEN_GAP is left as a hole.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "avilib.h"
+#include "avigen.h"
+
+enum {
+  AVIGEN_BUF = 4 * 1024 * 1024,   /* write buffer */
+  AVIGEN_GAP = 8 * 1024,          /* smaller gaps are written as zeros */
+  AVIGEN_STAMP = 4096,            /* upper limit of real bytes per chunk */
+  AVIGEN_FRAME_SCALE = 1000000,   /* dwScale of the video stream, as avilib */
+  AVIGEN_STREAMS = 1 + AVI_MAX_TRACKS,
+};
+
+#define PAD_EVEN(x) ( ((x)+1) & ~1 )
+
+static const char *layout_names[AVIGEN_LAYOUTS] = { "odml", "idx1", "scan", "xawtv" };
+
+typedef struct {
+  uint8_t *p;
+  size_t len, cap;
+} gen_buf_t;
+
+typedef struct {
+  uint64_t qwOffset;
+  uint32_t dwSize;
+  uint32_t dwDuration;
+} gen_super_t;
+
+typedef struct {
+  const avigen_opts_t *o;
+  int dry;
+
+  /* output */
+  int fd;
+  uint8_t *buf;
+  size_t len;
+  uint64_t boff;            /* file offset of buf[0] */
+  uint64_t end;             /* file size so far */
+  int err;
+
+  /* layout */
+  uint64_t hdr_len;         /* RIFF AVI header and hdrl */
+  uint64_t pos;             /* next chunk goes here */
+  uint64_t riff_pos;        /* RIFF of the current segment */
+  uint64_t movi_pos;        /* LIST movi of the current segment */
+  long seg, seg_cap;
+  long seg_frames;          /* frames in the current segment */
+  long frames0;             /* frames in the first segment */
+  long chunks;
+
+  /* ix## of the current segment per stream, 2 words per entry */
+  gen_buf_t ix[AVIGEN_STREAMS];
+  long ix_bytes[AVIGEN_STREAMS];
+  gen_super_t *super[AVIGEN_STREAMS];
+  /* idx1, 16 bytes per entry */
+  gen_buf_t idx1;
+  int idx1_open;
+  uint64_t audio_bytes;
+} gen_t;
+
+static uint8_t stamp_data[AVIGEN_STAMP];
+
+/*************************************************************************/
+/* little endian byte buffers                                            */
+
+static int buf_grow(gen_buf_t *b, size_t n) {
+  if (b->len + n > b->cap) {
+    size_t cap = b->cap ? b->cap * 2 : 4096;
+    uint8_t *p;
+
+    while (cap < b->len + n) cap *= 2;
+    p = realloc(b->p, cap);
+    if (!p) return -1;
+    b->p = p;
+    b->cap = cap;
+  }
+  return 0;
+}
+
+static void le32(uint8_t *p, uint32_t v) {
+  p[0] = v & 0xff;
+  p[1] = (v >> 8) & 0xff;
+  p[2] = (v >> 16) & 0xff;
+  p[3] = (v >> 24) & 0xff;
+}
+
+static void buf_mem(gen_buf_t *b, const void *s, size_t n) {
+  if (buf_grow(b, n) < 0) return;
+  if (s) memcpy(b->p + b->len, s, n);
+  else memset(b->p + b->len, 0, n);
+  b->len += n;
+}
+
+static void buf_32(gen_buf_t *b, uint32_t v) {
+  uint8_t t[4];
+
+  le32(t, v);
+  buf_mem(b, t, 4);
+}
+
+static void buf_16(gen_buf_t *b, uint16_t v) {
+  uint8_t t[2] = { v & 0xff, v >> 8 };
+
+  buf_mem(b, t, 2);
+}
+
+#define buf_4cc(b, s) buf_mem(b, s, 4)
+
+/* starts a chunk or list, returns the offset of its size field */
+static size_t buf_open(gen_buf_t *b, const char *fcc, const char *type) {
+  size_t at;
+
+  buf_4cc(b, fcc);
+  at = b->len;
+  buf_32(b, 0);
+  if (type) buf_4cc(b, type);
+  return at;
+}
+
+static void buf_close(gen_buf_t *b, size_t at) {
+  if (b->len & 1) buf_mem(b, NULL, 1);
+  if (b->p) le32(b->p + at, b->len - at - 4);
+}
+
+/*************************************************************************/
+/* positioned output                                                     */
+
+static void out_write(gen_t *g, uint64_t off, const uint8_t *p, size_t n) {
+  size_t done = 0;
+
+  while (done < n && !g->err) {
+    ssize_t r = pwrite(g->fd, p + done, n - done, off + done);
+
+    if (r < 0) {
+      if (errno != EINTR) g->err = errno;
+      continue;
+    }
+    done += r;
+  }
+}
+
+static void out_flush(gen_t *g) {
+  out_write(g, g->boff, g->buf, g->len);
+  g->boff += g->len;
+  g->len = 0;
+}
+
+static void out_put(gen_t *g, uint64_t off, const void *p, size_t n) {
+  uint64_t bend = g->boff + g->len, front = g->end;
+
+  if (off + n > g->end) g->end = off + n;
+  if (g->dry || g->err) return;
+
+  if (off >= g->boff && off + n <= bend) {
+    // patch inside the buffer
+    memcpy(g->buf + (off - g->boff), p, n);
+    return;
+  }
+  // gaps are only zero filled at the end of the file, never over
+  // data that is already written
+  if (!g->len || off < bend || bend != front || off - bend > AVIGEN_GAP ||
+      g->len + (off - bend) + n > AVIGEN_BUF) {
+    out_flush(g);
+    if (n > AVIGEN_BUF) {
+      out_write(g, off, p, n);
+      return;
+    }
+    g->boff = bend = off;
+  }
+  memset(g->buf + g->len, 0, off - bend);
+  g->len += off - bend;
+  memcpy(g->buf + g->len, p, n);
+  g->len += n;
+}
+
+static void out_32(gen_t *g, uint64_t off, uint32_t v) {
+  uint8_t t[4];
+
+  le32(t, v);
+  out_put(g, off, t, 4);
+}
+
+/*************************************************************************/
+/* chunks and segments                                                   */
+
+static int is_segmented(const avigen_opts_t *o) {
+  return o->layout == AVIGEN_ODML || o->layout == AVIGEN_XAWTV;
+}
+
+static void stream_tag(char *tag, int s) {
+  tag[0] = '0' + s / 10;
+  tag[1] = '0' + s % 10;
+  tag[2] = s ? 'w' : 'd';
+  tag[3] = 'b';
+}
+
+/* header and `stamp' real bytes of a chunk, the rest stays a hole */
+static void put_chunk(gen_t *g, int s, uint32_t size, int key, long seq) {
+  uint8_t hdr[8 + AVIGEN_STAMP];
+  uint32_t real = size < (uint32_t) g->o->stamp ? size : (uint32_t) g->o->stamp;
+  char tag[4];
+
+  stream_tag(tag, s);
+  memcpy(hdr, tag, 4);
+  le32(hdr + 4, size);
+  if (real) {
+    memcpy(hdr + 8, stamp_data, real);
+    if (real >= 4) le32(hdr + 8, (uint32_t) seq);
+  }
+  out_put(g, g->pos, hdr, 8 + real);
+
+  if (g->o->layout == AVIGEN_ODML) {
+    g->ix_bytes[s] += 8;
+    if (!g->dry) {
+      buf_32(&g->ix[s], (uint32_t) (g->pos + 8 - g->riff_pos));
+      buf_32(&g->ix[s], size | (key ? 0 : 0x80000000u));
+    }
+  }
+  if (g->idx1_open) {
+    if (g->dry) g->idx1.len += 16;
+    else {
+      buf_4cc(&g->idx1, tag);
+      buf_32(&g->idx1, key ? 0x10 : 0);
+      buf_32(&g->idx1, (uint32_t) (g->pos - (g->movi_pos + 8)));
+      buf_32(&g->idx1, size);
+    }
+  }
+
+  g->pos += 8 + PAD_EVEN((uint64_t) size);
+  g->chunks++;
+}
+
+static void open_segment(gen_t *g) {
+  uint8_t hdr[12];
+
+  g->riff_pos = g->pos;
+  memcpy(hdr, "RIFF\0\0\0\0", 8);
+  memcpy(hdr + 8, g->seg ? "AVIX" : "AVI ", 4);
+  out_put(g, g->riff_pos, hdr, 12);
+
+  // the first segment leaves room for the header, it is written last
+  g->movi_pos = g->seg ? g->riff_pos + 12 : g->hdr_len;
+  out_put(g, g->movi_pos, "LIST\0\0\0\0movi", 12);
+  g->pos = g->movi_pos + 12;
+
+  g->seg_frames = 0;
+  g->idx1_open = !g->seg && g->o->layout != AVIGEN_SCAN && g->o->layout != AVIGEN_XAWTV;
+}
+
+/* bytes the segment still needs for its indices, with one more frame */
+static uint64_t index_reserve(gen_t *g) {
+  uint64_t r = 0;
+  int s;
+
+  if (g->o->layout == AVIGEN_ODML)
+    for (s = 0; s <= g->o->tracks; s++)
+      r += 8 + 24 + g->ix_bytes[s] + 8;
+  if (g->idx1_open)
+    r += 8 + g->idx1.len + 16 * (1 + g->o->tracks);
+  return r;
+}
+
+static void close_segment(gen_t *g) {
+  int s;
+
+  if (g->o->layout == AVIGEN_ODML) {
+    for (s = 0; s <= g->o->tracks; s++) {
+      uint32_t n = g->ix_bytes[s] / 8;
+      uint32_t size = 24 + 8 * n;
+
+      if (!g->dry) {
+        gen_buf_t b = { 0 };
+        char fcc[5], tag[4];
+
+        snprintf(fcc, sizeof(fcc), "ix%02d", s);
+        stream_tag(tag, s);
+        buf_4cc(&b, fcc);
+        buf_32(&b, size);
+        buf_16(&b, 2);                  /* wLongsPerEntry */
+        buf_mem(&b, "\0\1", 2);         /* sub type, AVI_INDEX_OF_CHUNKS */
+        buf_32(&b, n);
+        buf_4cc(&b, tag);
+        buf_32(&b, (uint32_t) g->riff_pos);
+        buf_32(&b, (uint32_t) (g->riff_pos >> 32));
+        buf_32(&b, 0);
+        buf_mem(&b, g->ix[s].p, g->ix[s].len);
+        out_put(g, g->pos, b.p, b.len);
+        free(b.p);
+
+        g->super[s][g->seg].qwOffset = g->pos;
+        g->super[s][g->seg].dwSize = size;
+        g->super[s][g->seg].dwDuration = s ? 0 : n;
+        g->ix[s].len = 0;
+      }
+      g->ix_bytes[s] = 0;
+      g->pos += 8 + size;
+    }
+  }
+  out_32(g, g->movi_pos + 4, (uint32_t) (g->pos - g->movi_pos - 8));
+
+  if (g->idx1_open) {
+    uint8_t hdr[8];
+
+    memcpy(hdr, "idx1", 4);
+    le32(hdr + 4, g->idx1.len);
+    out_put(g, g->pos, hdr, 8);
+    if (!g->dry) out_put(g, g->pos + 8, g->idx1.p, g->idx1.len);
+    g->pos += 8 + g->idx1.len;
+    g->idx1_open = 0;
+  }
+  out_32(g, g->riff_pos + 4, (uint32_t) (g->pos - g->riff_pos - 8));
+
+  if (!g->seg) g->frames0 = g->seg_frames;
+  g->seg++;
+}
+
+static long audio_per_frame(const avigen_opts_t *o, long i) {
+  if (!o->tracks || o->audio_rate <= 0) return 0;
+  return ((long) ((i + 1) * o->audio_rate / o->fps) - (long) (i * o->audio_rate / o->fps)) * 4;
+}
+
+static int layout_frames(gen_t *g) {
+  const avigen_opts_t *o = g->o;
+  long i;
+  int t;
+
+  g->pos = 0;
+  g->seg = 0;
+  g->chunks = 0;
+  g->audio_bytes = 0;
+  g->idx1.len = 0;
+  open_segment(g);
+
+  for (i = 0; i < o->frames; i++) {
+    long abytes = audio_per_frame(o, i);
+    uint64_t group = 8 + PAD_EVEN(o->frame_size) + o->tracks * (8 + PAD_EVEN(abytes));
+
+    if (is_segmented(o) && g->seg_frames &&
+        g->pos + group + index_reserve(g) - g->riff_pos > o->riff_size) {
+      close_segment(g);
+      open_segment(g);
+    }
+    if (!is_segmented(o) && g->pos + group + index_reserve(g) > 0xfffffff0ULL) {
+      fprintf(stderr, "avigen: a %s file can't hold %ld frames (4 GB), use odml or xawtv\n",
+              layout_names[o->layout], o->frames);
+      return -1;
+    }
+
+    put_chunk(g, 0, o->frame_size, i % o->keyint == 0, i);
+    for (t = 1; t <= o->tracks; t++)
+      if (abytes) put_chunk(g, t, abytes, 1, i);
+    g->audio_bytes += abytes;
+    g->seg_frames++;
+  }
+  close_segment(g);
+  return g->err ? -1 : 0;
+}
+
+/*************************************************************************/
+/* header                                                                */
+
+static void build_header(gen_t *g, gen_buf_t *b) {
+  const avigen_opts_t *o = g->o;
+  long frame_rate = (long) (o->fps * AVIGEN_FRAME_SCALE + 0.5);
+  uint64_t abytes = g->audio_bytes;
+  size_t hdrl, strl, ck, odml;
+  int s, k;
+
+  hdrl = buf_open(b, "LIST", "hdrl");
+
+  ck = buf_open(b, "avih", NULL);
+  buf_32(b, (uint32_t) (1000000 / o->fps));
+  buf_32(b, (uint32_t) (o->frame_size * o->fps + o->tracks * o->audio_rate * 4));
+  buf_32(b, 0);
+  buf_32(b, (o->layout == AVIGEN_SCAN || o->layout == AVIGEN_XAWTV ? 0 : 0x10) | 0x100);
+  buf_32(b, o->layout == AVIGEN_ODML || o->layout == AVIGEN_XAWTV ? g->frames0 : o->frames);
+  buf_32(b, 0);
+  buf_32(b, 1 + o->tracks);
+  buf_32(b, o->frame_size);
+  buf_32(b, 320);
+  buf_32(b, 240);
+  buf_mem(b, NULL, 16);
+  buf_close(b, ck);
+
+  for (s = 0; s <= o->tracks; s++) {
+    char tag[4];
+
+    stream_tag(tag, s);
+    strl = buf_open(b, "LIST", "strl");
+    ck = buf_open(b, "strh", NULL);
+    if (!s) {
+      buf_4cc(b, "vids");
+      buf_4cc(b, "MJPG");
+      buf_mem(b, NULL, 12);             /* flags, priority, language, initial */
+      buf_32(b, AVIGEN_FRAME_SCALE);
+      buf_32(b, frame_rate);
+      buf_32(b, 0);
+      buf_32(b, o->frames);
+      buf_32(b, o->frame_size);
+      buf_32(b, (uint32_t) -1);
+      buf_32(b, 0);
+    } else {
+      buf_4cc(b, "auds");
+      buf_mem(b, NULL, 16);             /* handler, flags, priority, language, initial */
+      buf_32(b, 4);                     /* block align */
+      buf_32(b, o->audio_rate * 4);
+      buf_32(b, 0);
+      buf_32(b, abytes / 4);
+      buf_32(b, 4 * o->audio_rate / 5);
+      buf_32(b, (uint32_t) -1);
+      buf_32(b, 4);
+    }
+    buf_mem(b, NULL, 8);                /* rcFrame */
+    buf_close(b, ck);
+
+    ck = buf_open(b, "strf", NULL);
+    if (!s) {
+      buf_32(b, 40);
+      buf_32(b, 320);
+      buf_32(b, 240);
+      buf_16(b, 1);
+      buf_16(b, 24);
+      buf_4cc(b, "MJPG");
+      buf_32(b, 320 * 240 * 3);
+      buf_mem(b, NULL, 16);
+    } else {
+      buf_16(b, WAVE_FORMAT_PCM);
+      buf_16(b, 2);
+      buf_32(b, o->audio_rate);
+      buf_32(b, o->audio_rate * 4);
+      buf_16(b, 4);
+      buf_16(b, 16);
+      buf_16(b, 0);
+    }
+    buf_close(b, ck);
+
+    if (o->layout == AVIGEN_ODML) {
+      ck = buf_open(b, "indx", NULL);
+      buf_16(b, 4);                     /* wLongsPerEntry */
+      buf_mem(b, NULL, 2);              /* sub type, AVI_INDEX_OF_INDEXES */
+      buf_32(b, g->seg);
+      buf_4cc(b, tag);
+      buf_mem(b, NULL, 12);
+      for (k = 0; k < g->seg_cap; k++) {
+        gen_super_t *e = g->super[s] ? &g->super[s][k] : NULL;
+
+        if (e && k < g->seg) {
+          buf_32(b, (uint32_t) e->qwOffset);
+          buf_32(b, (uint32_t) (e->qwOffset >> 32));
+          buf_32(b, e->dwSize);
+          buf_32(b, e->dwDuration);
+        } else {
+          buf_mem(b, NULL, 16);
+        }
+      }
+      buf_close(b, ck);
+    }
+    buf_close(b, strl);
+  }
+
+  if (is_segmented(o)) {
+    odml = buf_open(b, "LIST", "odml");
+    ck = buf_open(b, "dmlh", NULL);
+    buf_32(b, o->frames);
+    buf_mem(b, NULL, 244);
+    buf_close(b, ck);
+    buf_close(b, odml);
+  }
+  buf_close(b, hdrl);
+}
+
+static uint64_t header_len(gen_t *g) {
+  gen_buf_t b = { 0 };
+  uint64_t n;
+
+  build_header(g, &b);
+  n = 12 + b.len;
+  free(b.p);
+  return n;
+}
+
+/*************************************************************************/
+
+void avigen_defaults(avigen_opts_t *o) {
+  memset(o, 0, sizeof(*o));
+  o->layout = AVIGEN_ODML;
+  o->frames = 1000;
+  o->frame_size = 100000;
+  o->fps = 25;
+  o->keyint = 12;
+  o->tracks = 1;
+  o->audio_rate = 44100;
+  o->riff_size = 1900ULL * 1024 * 1024;
+  o->stamp = 16;
+}
+
+const char *avigen_layout_name(avigen_layout_t l) {
+  return l < AVIGEN_LAYOUTS ? layout_names[l] : "?";
+}
+
+int avigen_layout_parse(const char *name) {
+  int l;
+
+  for (l = 0; l < AVIGEN_LAYOUTS; l++)
+    if (strcmp(name, layout_names[l]) == 0) return l;
+  return -1;
+}
+
+int avigen_write(const char *path, const avigen_opts_t *o, avigen_info_t *info) {
+  gen_t g;
+  gen_buf_t hdr = { 0 };
+  struct stat st;
+  long cap;
+  int s, ret = -1;
+
+  if (o->frames <= 0 || o->frame_size < 0 || o->fps <= 0 || o->keyint <= 0 ||
+      o->tracks < 0 || o->tracks > AVI_MAX_TRACKS || o->stamp < 0 ||
+      o->stamp > AVIGEN_STAMP || o->riff_size < 64 * 1024 ||
+      o->riff_size > 0xfff00000ULL) {
+    fprintf(stderr, "avigen: invalid parameters\n");
+    return -1;
+  }
+  for (s = 0; s < AVIGEN_STAMP; s++)
+    stamp_data[s] = (uint8_t) (s * 37 + 11);
+
+  memset(&g, 0, sizeof(g));
+  g.o = o;
+  g.fd = -1;
+
+  /* find the number of segments; a longer header can push frames out of
+     the first segment, so repeat until the superindexes are big enough */
+  g.dry = 1;
+  g.seg_cap = 1;
+  for (;;) {
+    g.hdr_len = header_len(&g);
+    if (layout_frames(&g) < 0) goto out;
+    if (g.seg <= g.seg_cap) break;
+    g.seg_cap = g.seg;
+  }
+  cap = g.seg_cap;
+
+  g.dry = 0;
+  g.end = 0;
+  for (s = 0; s <= o->tracks; s++) {
+    g.super[s] = calloc(cap, sizeof(gen_super_t));
+    if (!g.super[s]) goto out;
+  }
+  g.buf = malloc(AVIGEN_BUF);
+  if (!g.buf) goto out;
+
+  g.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (g.fd < 0) {
+    perror(path);
+    goto out;
+  }
+
+  if (layout_frames(&g) < 0) goto fail;
+
+  build_header(&g, &hdr);
+  if (12 + hdr.len != g.hdr_len) {
+    fprintf(stderr, "avigen: header changed size\n");
+    goto out;
+  }
+  out_put(&g, 12, hdr.p, hdr.len);
+  out_flush(&g);
+  if (!g.err && ftruncate(g.fd, g.end) < 0) g.err = errno;
+  if (g.err) goto fail;
+
+  if (info) {
+    memset(info, 0, sizeof(*info));
+    info->file_size = g.end;
+    info->segments = g.seg;
+    info->chunks = g.chunks;
+    if (fstat(g.fd, &st) == 0) info->disk_bytes = (uint64_t) st.st_blocks * 512;
+  }
+  ret = 0;
+  goto out;
+
+fail:
+  fprintf(stderr, "avigen: %s: %s\n", path, strerror(g.err ? g.err : EIO));
+out:
+  if (g.fd >= 0) close(g.fd);
+  for (s = 0; s < AVIGEN_STREAMS; s++) {
+    free(g.ix[s].p);
+    free(g.super[s]);
+  }
+  free(g.idx1.p);
+  free(g.buf);
+  free(hdr.p);
+  return ret;
+}
@@ -0,0 +1,54 @@
+/*
+ * avigen.h -- synthetic AVI files for the benchmarks
+ *
+ * avigen writes the RIFF structure itself instead of going through
+ * the avilib writer, so it can lay out files avilib never produces
+ * (more than NR_IXNN_CHUNKS segments, unindexed multi RIFF files) and
+ * can leave the frame payloads as holes. A chunk only carries `stamp'
+ * real bytes, the rest is sparse, so a file of tens of GB costs little
+ * more than its chunk headers and indices on disk.
+ */
+
+#ifndef AVIGEN_H
+#define AVIGEN_H
+
+#include <stdint.h>
+
+typedef enum {
+  AVIGEN_ODML,          /* RIFF AVI + AVIX segments, indx + ix## chunks, idx1 in the first */
+  AVIGEN_IDX1,          /* one RIFF, idx1 relative to movi */
+  AVIGEN_SCAN,          /* one RIFF, no index at all: movi scan on open */
+  AVIGEN_XAWTV,         /* RIFF segments and dmlh, but no index: reconstruction */
+  AVIGEN_LAYOUTS
+} avigen_layout_t;
+
+typedef struct {
+  avigen_layout_t layout;
+  long     frames;
+  long     frame_size;  /* bytes every video chunk claims */
+  double   fps;
+  long     keyint;      /* every keyint'th frame is a keyframe */
+  int      tracks;      /* 16 bit stereo PCM tracks */
+  long     audio_rate;
+  uint64_t riff_size;   /* segment size of ODML and XAWTV layouts */
+  long     stamp;       /* real bytes at the start of every chunk */
+} avigen_opts_t;
+
+typedef struct {
+  uint64_t file_size;
+  uint64_t disk_bytes;  /* what the file really occupies */
+  long     segments;
+  long     chunks;
+} avigen_info_t;
+
+void avigen_defaults(avigen_opts_t *o);
+
+/* name of a layout and the reverse, -1 for an unknown name */
+const char *avigen_layout_name(avigen_layout_t l);
+int avigen_layout_parse(const char *name);
+
+/* Writes the file, returns 0 or -1 after printing the reason. info may
+   be NULL. */
+int avigen_write(const char *path, const avigen_opts_t *o, avigen_info_t *info);
+
+#endif
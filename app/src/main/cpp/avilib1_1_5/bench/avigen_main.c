@@ -0,0 +1,80 @@
+/*
+ * avigen_main.c -- command line front end of avigen
+ *
+ *   avigen [-t odml|idx1|scan|xawtv] [-n frames | -g GiB] [-s size]
+ *          [-F fps] [-k keyint] [-a tracks] [-r rate] [-R riff MiB]
+ *          [-p stamp] file
+ *
+ * A 24 hour recording at 25 fps with 200 kB frames and one audio track:
+ *
+ *   avigen -n 2160000 -s 200000 day.avi
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "avigen.h"
+#include "benchutil.h"
+
+static void usage(void) {
+  fprintf(stderr,
+          "usage: avigen [options] file\n"
+          "  -t LAYOUT  odml, idx1, scan or xawtv (odml)\n"
+          "  -n N       frames (1000)\n"
+          "  -g GIB     as many frames as fit in GIB gigabytes\n"
+          "  -s N       bytes per video frame (100000)\n"
+          "  -F FPS     frame rate (25)\n"
+          "  -k N       keyframe interval (12)\n"
+          "  -a N       16 bit stereo audio tracks (1)\n"
+          "  -r RATE    audio rate (44100)\n"
+          "  -R MIB     RIFF segment size (1900)\n"
+          "  -p N       real bytes per chunk, the rest is a hole (16)\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  avigen_opts_t o;
+  avigen_info_t info;
+  double gib = 0;
+  uint64_t t0;
+  int c, l;
+
+  avigen_defaults(&o);
+
+  while ((c = getopt(argc, argv, "t:n:g:s:F:k:a:r:R:p:h")) != -1) {
+    switch (c) {
+      case 't':
+        l = avigen_layout_parse(optarg);
+        if (l < 0) usage();
+        o.layout = l;
+        break;
+      case 'n': o.frames = atol(optarg); break;
+      case 'g': gib = atof(optarg); break;
+      case 's': o.frame_size = atol(optarg); break;
+      case 'F': o.fps = atof(optarg); break;
+      case 'k': o.keyint = atol(optarg); break;
+      case 'a': o.tracks = atoi(optarg); break;
+      case 'r': o.audio_rate = atol(optarg); break;
+      case 'R': o.riff_size = strtoull(optarg, NULL, 0) * 1024 * 1024; break;
+      case 'p': o.stamp = atol(optarg); break;
+      default: usage();
+    }
+  }
+  if (optind + 1 != argc) usage();
+
+  if (gib > 0 && o.fps > 0) {
+    double per_frame = 8 + o.frame_size + o.tracks * (8 + 4 * o.audio_rate / o.fps);
+
+    o.frames = (long) (gib * 1024 * 1024 * 1024 / per_frame);
+  }
+
+  t0 = bench_now_ns();
+  if (avigen_write(argv[optind], &o, &info) < 0)
+    return 1;
+
+  printf("%s: %s, %ld frames, %ld segments, %ld chunks, %.2f GB (%.1f MB on disk) in %.2f s\n",
+         argv[optind], avigen_layout_name(o.layout), o.frames, info.segments, info.chunks,
+         info.file_size / 1e9, info.disk_bytes / 1e6, (bench_now_ns() - t0) / 1e9);
+  return 0;
+}
@@ -0,0 +1,427 @@
+/*
+ * avireplay.c -- replay a read trace of AVI_record_start
+ *
+ * Issues the reads of a trace against the file again, once per I/O
+ * strategy, and reports the time a read kept the caller waiting:
+ *
+ *   read     lseek + read, what avilib does
+ *   pread    positional reads
+ *   mmap     the file mapped once, reads are copies out of the mapping
+ *   fadvise  pread, with POSIX_FADV_WILLNEED for the next -d reads
+ *   random   pread after POSIX_FADV_RANDOM, i.e. without readahead
+ *   uring    io_uring with the next -d reads in flight (needs liburing)
+ *
+ * With -t the gaps between the recorded reads are kept, so that
+ * prefetching has the time it had in the recorded session.
+ *
+ *   avireplay [-s strategies] [-d depth] [-t] [-c warm|cold|both]
+ *             [-j result.json] trace file
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef AVIREPLAY_URING
+#include <liburing.h>
+#endif
+
+#include "avilib.h"
+#include "benchutil.h"
+
+typedef struct {
+  const char *file;
+  int fd;
+  uint64_t size;
+  avi_rec_entry_t *rec;
+  long n;
+  uint32_t max_len;
+  int depth;
+  int pace;
+  char *buf;
+} replay_t;
+
+/*************************************************************************/
+
+static int load_trace(replay_t *r, const char *path) {
+  avi_rec_header_t h;
+  FILE *f = fopen(path, "rb");
+  long cap = 0;
+
+  if (!f) {
+    perror(path);
+    return -1;
+  }
+  if (fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, AVI_REC_MAGIC, 4) != 0 ||
+      h.version != AVI_REC_VERSION) {
+    fprintf(stderr, "avireplay: %s is no read trace\n", path);
+    fclose(f);
+    return -1;
+  }
+  if (h.file_size && h.file_size != r->size)
+    fprintf(stderr, "avireplay: warning, the trace was taken on a file of %llu bytes\n",
+            (unsigned long long) h.file_size);
+
+  for (;;) {
+    if (r->n == cap) {
+      avi_rec_entry_t *p;
+
+      cap = cap ? cap * 2 : 4096;
+      p = realloc(r->rec, cap * sizeof(*p));
+      if (!p) break;
+      r->rec = p;
+    }
+    if (fread(&r->rec[r->n], sizeof(avi_rec_entry_t), 1, f) != 1) break;
+    // drop what lies outside this file
+    if (r->rec[r->n].offset + r->rec[r->n].length > r->size) continue;
+    if (r->rec[r->n].length > r->max_len) r->max_len = r->rec[r->n].length;
+    r->n++;
+  }
+  fclose(f);
+  return r->n ? 0 : -1;
+}
+
+static void json_trace(bench_json_t *j, const replay_t *r) {
+  uint64_t bytes = 0, us = 0, seq = 0, jump = 0;
+  long i, per_op[AVI_IO_OPS] = { 0 };
+
+  for (i = 0; i < r->n; i++) {
+    const avi_rec_entry_t *e = &r->rec[i];
+
+    bytes += e->length;
+    us += e->delta_us;
+    if (e->op < AVI_IO_OPS) per_op[e->op]++;
+    if (i && e->offset == r->rec[i - 1].offset + r->rec[i - 1].length) seq++;
+    else if (i) jump += e->offset > r->rec[i - 1].offset ? e->offset - r->rec[i - 1].offset
+                                                         : r->rec[i - 1].offset - e->offset;
+  }
+  bench_json_obj(j, "trace");
+  bench_json_int(j, "reads", r->n);
+  bench_json_int(j, "bytes", (long long) bytes);
+  bench_json_num(j, "recorded_s", us / 1e6);
+  bench_json_num(j, "sequential_share", r->n > 1 ? (double) seq / (r->n - 1) : 0);
+  bench_json_num(j, "mean_jump_bytes", r->n - 1 > (long) seq ? (double) jump / (r->n - 1 - seq) : 0);
+  bench_json_int(j, "open_reads", per_op[AVI_IO_OPEN]);
+  bench_json_int(j, "video_reads", per_op[AVI_IO_READ_VIDEO]);
+  bench_json_int(j, "audio_reads", per_op[AVI_IO_READ_AUDIO]);
+  bench_json_end(j);
+}
+
+/* waits until read i is due when pacing, returns the time it is issued */
+static uint64_t pace(replay_t *r, long i, uint64_t *due) {
+  uint64_t now = bench_now_ns();
+
+  if (!r->pace) return now;
+  *due += (uint64_t) r->rec[i].delta_us * 1000;
+  if (*due > now) {
+    struct timespec ts;
+
+    ts.tv_sec = (*due - now) / 1000000000;
+    ts.tv_nsec = (*due - now) % 1000000000;
+    nanosleep(&ts, NULL);
+    now = bench_now_ns();
+  }
+  return now;
+}
+
+static int read_full(int fd, char *buf, size_t len, off_t off, int positional) {
+  size_t done = 0;
+
+  if (!positional && lseek(fd, off, SEEK_SET) < 0) return -1;
+  while (done < len) {
+    ssize_t n = positional ? pread(fd, buf + done, len - done, off + done)
+                           : read(fd, buf + done, len - done);
+
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+    done += n;
+  }
+  return 0;
+}
+
+/*************************************************************************/
+/* strategies                                                            */
+
+static int replay_read(replay_t *r, bench_lat_t *lat) {
+  uint64_t due = bench_now_ns();
+  long i;
+
+  for (i = 0; i < r->n; i++) {
+    uint64_t t0 = pace(r, i, &due);
+
+    if (read_full(r->fd, r->buf, r->rec[i].length, r->rec[i].offset, 0) < 0) return -1;
+    bench_lat_add(lat, bench_now_ns() - t0);
+  }
+  return 0;
+}
+
+static int replay_pread(replay_t *r, bench_lat_t *lat) {
+  uint64_t due = bench_now_ns();
+  long i;
+
+  for (i = 0; i < r->n; i++) {
+    uint64_t t0 = pace(r, i, &due);
+
+    if (read_full(r->fd, r->buf, r->rec[i].length, r->rec[i].offset, 1) < 0) return -1;
+    bench_lat_add(lat, bench_now_ns() - t0);
+  }
+  return 0;
+}
+
+static int replay_mmap(replay_t *r, bench_lat_t *lat) {
+  uint64_t due = bench_now_ns();
+  char *map;
+  long i;
+
+  map = mmap(NULL, r->size, PROT_READ, MAP_SHARED, r->fd, 0);
+  if (map == MAP_FAILED) return -1;
+
+  for (i = 0; i < r->n; i++) {
+    uint64_t t0 = pace(r, i, &due);
+
+    memcpy(r->buf, map + r->rec[i].offset, r->rec[i].length);
+    bench_lat_add(lat, bench_now_ns() - t0);
+  }
+  munmap(map, r->size);
+  return 0;
+}
+
+static int replay_fadvise(replay_t *r, bench_lat_t *lat) {
+  uint64_t due = bench_now_ns();
+  long i, next = 0;
+
+  for (i = 0; i < r->n; i++) {
+    uint64_t t0 = pace(r, i, &due);
+
+    for (; next < r->n && next <= i + r->depth; next++)
+      posix_fadvise(r->fd, r->rec[next].offset, r->rec[next].length, POSIX_FADV_WILLNEED);
+    if (read_full(r->fd, r->buf, r->rec[i].length, r->rec[i].offset, 1) < 0) return -1;
+    bench_lat_add(lat, bench_now_ns() - t0);
+  }
+  return 0;
+}
+
+static int replay_random(replay_t *r, bench_lat_t *lat) {
+  int ret;
+
+  posix_fadvise(r->fd, 0, 0, POSIX_FADV_RANDOM);
+  ret = replay_pread(r, lat);
+  posix_fadvise(r->fd, 0, 0, POSIX_FADV_NORMAL);
+  return ret;
+}
+
+#ifdef AVIREPLAY_URING
+/* read i goes to slot i % slots; its completion carries i */
+static int replay_uring(replay_t *r, bench_lat_t *lat) {
+  struct io_uring ring;
+  uint64_t due = bench_now_ns();
+  int slots = r->depth + 1, n;
+  char *bufs;
+  unsigned char *done;
+  long i, next = 0, inflight = 0;
+  int ret = -1;
+
+  if (io_uring_queue_init(slots, &ring, 0) < 0) return -1;
+  bufs = malloc((size_t) slots * r->max_len);
+  done = calloc(r->n, 1);
+  if (!bufs || !done) goto out;
+
+  for (i = 0; i < r->n; i++) {
+    uint64_t t0 = pace(r, i, &due);
+
+    for (; next < r->n && next <= i + r->depth; next++) {
+      struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+
+      if (!sqe) break;
+      io_uring_prep_read(sqe, r->fd, bufs + (size_t) (next % slots) * r->max_len,
+                         r->rec[next].length, r->rec[next].offset);
+      io_uring_sqe_set_data64(sqe, next);
+    }
+    n = io_uring_submit(&ring);
+    if (n < 0) goto out;
+    inflight += n;
+
+    while (!done[i]) {
+      struct io_uring_cqe *cqe;
+
+      if (io_uring_wait_cqe(&ring, &cqe) < 0) goto out;
+      inflight--;
+      if (cqe->res < 0) {
+        io_uring_cqe_seen(&ring, cqe);
+        goto out;
+      }
+      done[io_uring_cqe_get_data64(cqe)] = 1;
+      io_uring_cqe_seen(&ring, cqe);
+    }
+    bench_lat_add(lat, bench_now_ns() - t0);
+  }
+  ret = 0;
+
+out:
+  // reap what is still in flight before the buffers go
+  while (inflight > 0) {
+    struct io_uring_cqe *cqe;
+
+    if (io_uring_wait_cqe(&ring, &cqe) < 0) break;
+    io_uring_cqe_seen(&ring, cqe);
+    inflight--;
+  }
+  io_uring_queue_exit(&ring);
+  free(bufs);
+  free(done);
+  return ret;
+}
+#endif
+
+typedef struct {
+  const char *name;
+  int (*run)(replay_t *, bench_lat_t *);
+} replay_strategy_t;
+
+static const replay_strategy_t strategies[] = {
+  { "read",    replay_read },
+  { "pread",   replay_pread },
+  { "mmap",    replay_mmap },
+  { "fadvise", replay_fadvise },
+  { "random",  replay_random },
+#ifdef AVIREPLAY_URING
+  { "uring",   replay_uring },
+#endif
+};
+
+/*************************************************************************/
+
+static void usage(void) {
+  size_t k;
+
+  fprintf(stderr,
+          "usage: avireplay [options] trace file\n"
+          "  -s LIST   comma separated strategies (all)\n"
+          "  -d N      prefetch depth of fadvise and uring (8)\n"
+          "  -t        keep the recorded time between reads\n"
+          "  -c MODE   page cache: warm, cold or both (cold)\n"
+          "  -j FILE   write the JSON result here (stdout)\n"
+          "strategies:");
+  for (k = 0; k < sizeof(strategies) / sizeof(strategies[0]); k++)
+    fprintf(stderr, " %s", strategies[k].name);
+  fprintf(stderr, "\n");
+  exit(1);
+}
+
+static int selected(const char *list, const char *name) {
+  size_t n = strlen(name);
+  const char *p = list;
+
+  if (!list) return 1;
+  while ((p = strstr(p, name)) != NULL) {
+    if ((p == list || p[-1] == ',') && (p[n] == ',' || p[n] == 0)) return 1;
+    p += n;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  const char *list = NULL;
+  int warm = 0, cold = 1, c, pass;
+  replay_t r;
+  bench_json_t j;
+  FILE *out = stdout;
+  struct stat st;
+  size_t k;
+
+  memset(&r, 0, sizeof(r));
+  r.depth = 8;
+
+  while ((c = getopt(argc, argv, "s:d:tc:j:h")) != -1) {
+    switch (c) {
+      case 's': list = optarg; break;
+      case 'd': r.depth = atoi(optarg); break;
+      case 't': r.pace = 1; break;
+      case 'c':
+        warm = strcmp(optarg, "cold") != 0;
+        cold = strcmp(optarg, "warm") != 0;
+        break;
+      case 'j':
+        out = fopen(optarg, "w");
+        if (!out) {
+          perror(optarg);
+          return 1;
+        }
+        break;
+      default: usage();
+    }
+  }
+  if (optind + 2 != argc || r.depth < 0) usage();
+
+  r.file = argv[optind + 1];
+  r.fd = open(r.file, O_RDONLY);
+  if (r.fd < 0 || fstat(r.fd, &st) < 0) {
+    perror(r.file);
+    return 1;
+  }
+  r.size = st.st_size;
+  if (load_trace(&r, argv[optind]) < 0) return 1;
+  r.buf = malloc(r.max_len ? r.max_len : 1);
+  if (!r.buf) return 1;
+
+  memset(&j, 0, sizeof(j));
+  j.f = out;
+  bench_json_obj(&j, NULL);
+  bench_json_str(&j, "bench", "avireplay");
+  bench_json_str(&j, "file", r.file);
+  bench_json_int(&j, "depth", r.depth);
+  bench_json_int(&j, "paced", r.pace);
+  json_trace(&j, &r);
+  bench_json_arr(&j, "results");
+
+  for (k = 0; k < sizeof(strategies) / sizeof(strategies[0]); k++) {
+    if (!selected(list, strategies[k].name)) continue;
+
+    for (pass = 0; pass < 2; pass++) {
+      bench_lat_t lat;
+      uint64_t t0, ns, bytes = 0;
+      long i;
+
+      if ((pass && !cold) || (!pass && !warm)) continue;
+      if (pass && bench_drop_cache(r.file) < 0) {
+        fprintf(stderr, "avireplay: can't drop %s from the page cache\n", r.file);
+        continue;
+      }
+
+      memset(&lat, 0, sizeof(lat));
+      t0 = bench_now_ns();
+      if (strategies[k].run(&r, &lat) < 0) {
+        fprintf(stderr, "avireplay: %s: %s\n", strategies[k].name, strerror(errno));
+        bench_lat_free(&lat);
+        continue;
+      }
+      ns = bench_now_ns() - t0;
+      for (i = 0; i < r.n; i++) bytes += r.rec[i].length;
+
+      bench_json_obj(&j, NULL);
+      bench_json_str(&j, "strategy", strategies[k].name);
+      bench_json_str(&j, "cache", pass ? "cold" : "warm");
+      bench_json_num(&j, "seconds", ns / 1e9);
+      bench_json_num(&j, "mb_per_s", bytes / 1e6 / (ns / 1e9));
+      bench_json_num(&j, "wait_s", bench_lat_sum(&lat) / 1e9);
+      bench_json_lat(&j, &lat);
+      bench_json_end(&j);
+      bench_lat_free(&lat);
+    }
+  }
+
+  bench_json_arr_end(&j);
+  bench_json_end(&j);
+
+  close(r.fd);
+  free(r.rec);
+  free(r.buf);
+  if (out != stdout) fclose(out);
+  return 0;
+}
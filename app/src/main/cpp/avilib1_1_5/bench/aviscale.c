@@ -0,0 +1,234 @@
+/*
+ * aviscale.c -- how AVI_open_input_file scales with the file length
+ *
+ * For every index path of avi_parse_input_file a file of growing frame
+ * count is generated with avigen and opened a few times. Reported are
+ * the open time and the memory the open handle holds, per file and per
+ * frame. heap_bytes is what malloc handed out during the open; the
+ * handle arenas are mmap'd and only show up in avi_live_bytes, which
+ * needs a build with AVILIB_MEM_STATS.
+ *
+ *   aviscale [-d dir] [-m min] [-N max] [-x step] [-s size] [-i reps]
+ *            [-L variants] [-c warm|cold|both] [-t storage] [-T trace.json]
+ *            [-j out.json]
+ *
+ * With -t the files are opened on an emulated device, which shows how
+ * much the index path costs on an SD card rather than on the page cache.
+ */
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "avilib.h"
+#include "avigen.h"
+#include "benchthrottle.h"
+#include "benchutil.h"
+
+typedef struct {
+  const char *name;
+  avigen_layout_t layout;
+  int tracks;
+  uint64_t riff_size;   /* 0 for the avigen default */
+} scale_variant_t;
+
+/* one variant per parser path, plus the ODML cases that stress it */
+static const scale_variant_t variants[] = {
+  { "odml",        AVIGEN_ODML,  1, 0 },
+  { "odml-64m",    AVIGEN_ODML,  1, 64 * 1024 * 1024 },  /* many segments */
+  { "odml-4audio", AVIGEN_ODML,  4, 0 },
+  { "idx1",        AVIGEN_IDX1,  1, 0 },
+  { "scan",        AVIGEN_SCAN,  1, 0 },
+  { "xawtv",       AVIGEN_XAWTV, 1, 0 },
+};
+
+static uint64_t heap_bytes(void) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+  struct mallinfo2 mi = mallinfo2();
+
+  return mi.uordblks + mi.hblkhd;
+#else
+  return 0;
+#endif
+}
+
+static void usage(void) {
+  fprintf(stderr,
+          "usage: aviscale [options]\n"
+          "  -d DIR    directory for the generated files (.)\n"
+          "  -m N      smallest frame count (1000)\n"
+          "  -N N      largest frame count (1000000)\n"
+          "  -x F      frame count factor between steps (10)\n"
+          "  -s N      bytes per video frame (2000)\n"
+          "  -r RATE   audio rate per track (8000)\n"
+          "  -i N      opens per file (3)\n"
+          "  -L LIST   comma separated variants (all):\n"
+          "            odml odml-64m odml-4audio idx1 scan xawtv\n"
+          "  -c MODE   page cache: warm, cold or both (warm)\n"
+          "  -t SPEC   open on emulated storage: sdcard, usb2, hdd, nvme\n"
+          "            and/or key=value,... (lat bw seek gap spike spike_us seed virtual)\n"
+          "  -T FILE   Chrome trace of all opens\n"
+          "  -j FILE   write the JSON result here (stdout)\n");
+  exit(1);
+}
+
+static int selected(const char *list, const char *name) {
+  size_t n = strlen(name);
+  const char *p = list;
+
+  if (!list) return 1;
+  while ((p = strstr(p, name)) != NULL) {
+    if ((p == list || p[-1] == ',') && (p[n] == ',' || p[n] == 0)) return 1;
+    p += n;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  const char *dir = ".", *list = NULL, *trace = NULL;
+  long min = 1000, max = 1000000, frame_size = 2000, rate = 8000;
+  double step = 10;
+  int reps = 3, warm = 1, cold = 0;
+  char path[4096];
+  bench_json_t j;
+  FILE *out = stdout;
+  PlatThrottle *dev = NULL;
+  size_t v;
+  int c;
+
+  while ((c = getopt(argc, argv, "d:m:N:x:s:r:i:L:c:t:T:j:h")) != -1) {
+    switch (c) {
+      case 'd': dir = optarg; break;
+      case 'm': min = atol(optarg); break;
+      case 'N': max = atol(optarg); break;
+      case 'x': step = atof(optarg); break;
+      case 's': frame_size = atol(optarg); break;
+      case 'r': rate = atol(optarg); break;
+      case 'i': reps = atoi(optarg); break;
+      case 'L': list = optarg; break;
+      case 'c':
+        warm = strcmp(optarg, "cold") != 0;
+        cold = strcmp(optarg, "warm") != 0;
+        break;
+      case 't':
+        dev = bench_throttle_new(optarg);
+        if (!dev) return 1;
+        break;
+      case 'T': trace = optarg; break;
+      case 'j':
+        out = fopen(optarg, "w");
+        if (!out) {
+          perror(optarg);
+          return 1;
+        }
+        break;
+      default: usage();
+    }
+  }
+  if (min <= 0 || max < min || step <= 1 || reps <= 0) usage();
+  snprintf(path, sizeof(path), "%s/aviscale.avi", dir);
+
+  if (trace && AVI_trace_start(trace) < 0) {
+    AVI_print_error("aviscale: trace");
+    return 1;
+  }
+
+  memset(&j, 0, sizeof(j));
+  j.f = out;
+  bench_json_obj(&j, NULL);
+  bench_json_str(&j, "bench", "aviscale");
+  bench_json_int(&j, "frame_size", frame_size);
+  bench_json_int(&j, "audio_rate", rate);
+  bench_json_int(&j, "throttled", dev != NULL);
+  bench_json_arr(&j, "results");
+
+  for (v = 0; v < sizeof(variants) / sizeof(variants[0]); v++) {
+    const scale_variant_t *var = &variants[v];
+    double f;
+
+    if (!selected(list, var->name)) continue;
+
+    for (f = min; f <= max * 1.0001; f *= step) {
+      avigen_opts_t o;
+      avigen_info_t info;
+      uint64_t t0, gen_ns;
+      int pass;
+
+      avigen_defaults(&o);
+      o.layout = var->layout;
+      o.frames = (long) f;
+      o.frame_size = frame_size;
+      o.tracks = var->tracks;
+      o.audio_rate = rate;
+      if (var->riff_size) o.riff_size = var->riff_size;
+
+      t0 = bench_now_ns();
+      if (avigen_write(path, &o, &info) < 0) break;
+      gen_ns = bench_now_ns() - t0;
+
+      for (pass = 0; pass < 2; pass++) {
+        bench_lat_t lat;
+        PlatThrottleStats d0, d1;
+        uint64_t heap = 0, live = 0;
+        long frames = 0;
+        int r;
+
+        if ((pass && !cold) || (!pass && !warm)) continue;
+
+        memset(&lat, 0, sizeof(lat));
+        if (dev) plat_throttle_stats(dev, &d0);
+        for (r = 0; r < reps; r++) {
+          avi_mem_stats_t st;
+          uint64_t h0;
+          avi_t *AVI;
+
+          if (pass && bench_drop_cache(path) < 0) break;
+          h0 = heap_bytes();
+          t0 = bench_now_ns();
+          AVI = dev ? bench_throttle_input(dev, path) : AVI_open_input_file(path, 1);
+          if (!AVI) {
+            AVI_print_error("aviscale: open");
+            break;
+          }
+          bench_lat_add(&lat, bench_now_ns() - t0);
+          heap = heap_bytes() - h0;
+          if (AVI_memory_stats(AVI, &st) == 0) live = st.live_bytes;
+          frames = AVI_video_frames(AVI);
+          AVI_close(AVI);
+        }
+        if (!lat.n) continue;
+        if (dev) plat_throttle_stats(dev, &d1);
+
+        bench_json_obj(&j, NULL);
+        bench_json_str(&j, "variant", var->name);
+        bench_json_str(&j, "cache", pass ? "cold" : "warm");
+        bench_json_int(&j, "frames", o.frames);
+        bench_json_int(&j, "frames_read", frames);
+        bench_json_int(&j, "segments", info.segments);
+        bench_json_int(&j, "file_bytes", (long long) info.file_size);
+        bench_json_int(&j, "disk_bytes", (long long) info.disk_bytes);
+        bench_json_num(&j, "generate_s", gen_ns / 1e9);
+        bench_json_num(&j, "open_ms", bench_lat_pct(&lat, 0.5) / 1e6);
+        bench_json_num(&j, "open_ns_per_frame", (double) bench_lat_pct(&lat, 0.5) / o.frames);
+        bench_json_int(&j, "heap_bytes", (long long) heap);
+        bench_json_num(&j, "heap_bytes_per_frame", (double) heap / o.frames);
+        bench_json_int(&j, "avi_live_bytes", (long long) live);
+        bench_json_lat(&j, &lat);
+        if (dev) bench_json_device(&j, &d0, &d1);
+        bench_json_end(&j);
+        bench_lat_free(&lat);
+      }
+    }
+  }
+
+  bench_json_arr_end(&j);
+  bench_json_end(&j);
+
+  unlink(path);
+  plat_throttle_free(dev);
+  if (trace) AVI_trace_stop();
+  if (out != stdout) fclose(out);
+  return 0;
+}
@@ -0,0 +1,295 @@
+/*
+ * aviwrite.c -- write side benchmark of avilib on the host
+ *
+ * Drives AVI_write_frame/AVI_write_audio like a capture would, one
+ * profile at a time, and reports the sustained rate, the latency of
+ * every call with its tail, how many steps (a frame with its audio)
+ * missed the frame period, the file I/O the writer issued per call
+ * type, the RIFF rotations and how long AVI_close took.
+ *
+ *   aviwrite [-p profiles] [-d seconds] [-a tracks] [-o file]
+ *            [-S seed] [-k] [-t storage] [-j result.json]
+ *
+ * -t writes to an emulated device instead, -t sdcard,virtual=1 gives
+ * the same device numbers on every machine.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "avilib.h"
+#include "benchthrottle.h"
+#include "benchutil.h"
+
+typedef struct {
+  const char *name;
+  int width, height;
+  const char *compressor;
+  long frame_min, frame_max;    /* bytes per frame, random in between */
+  double fps;
+  int tracks;
+  long audio_rate;              /* 16 bit stereo */
+  int audio_split;              /* > 0: chunks per frame, < 0: one chunk every -n frames */
+} capture_profile_t;
+
+static const capture_profile_t profiles[] = {
+  { "raw1080",     1920, 1080, "RGB",  1920 * 1080 * 3, 1920 * 1080 * 3, 30, 1, 48000, 1 },
+  { "mjpeg720",    1280,  720, "MJPG", 40000, 160000, 30, 1, 48000, 1 },
+  { "mjpeg720-8a", 1280,  720, "MJPG", 40000, 160000, 30, 8, 48000, 1 },
+  { "tiny-audio",  1280,  720, "MJPG", 40000, 160000, 30, 1, 48000, 16 },
+  { "large-audio", 1280,  720, "MJPG", 40000, 160000, 30, 1, 48000, -30 },
+};
+
+static void usage(void) {
+  size_t k;
+
+  fprintf(stderr,
+          "usage: aviwrite [options]\n"
+          "  -p LIST   comma separated profiles (all)\n"
+          "  -d SEC    seconds of capture per profile (20)\n"
+          "  -a N      audio tracks, overrides the profile\n"
+          "  -o FILE   output file (aviwrite.avi)\n"
+          "  -S SEED   random seed (1)\n"
+          "  -k        keep the output file\n"
+          "  -t SPEC   write to emulated storage: sdcard, usb2, hdd, nvme\n"
+          "            and/or key=value,... (lat bw seek gap spike spike_us seed virtual)\n"
+          "  -j FILE   write the JSON result here (stdout)\n"
+          "profiles:");
+  for (k = 0; k < sizeof(profiles) / sizeof(profiles[0]); k++)
+    fprintf(stderr, " %s", profiles[k].name);
+  fprintf(stderr, "\n");
+  exit(1);
+}
+
+static int selected(const char *list, const char *name) {
+  size_t n = strlen(name);
+  const char *p = list;
+
+  if (!list) return 1;
+  while ((p = strstr(p, name)) != NULL) {
+    if ((p == list || p[-1] == ',') && (p[n] == ',' || p[n] == 0)) return 1;
+    p += n;
+  }
+  return 0;
+}
+
+static void json_io(bench_json_t *j, const char *key, const avi_io_op_stats_t *op) {
+  bench_json_obj(j, key);
+  bench_json_int(j, "writes", op->write.calls);
+  bench_json_int(j, "write_bytes", (long long) op->write.bytes);
+  bench_json_num(j, "write_ms", op->write.ns / 1e6);
+  bench_json_int(j, "reads", op->read.calls);
+  bench_json_int(j, "seeks", op->seeks);
+  bench_json_end(j);
+}
+
+/* upper bound of the slowest call from a latency histogram */
+static double hist_max_ms(const avi_io_counter_t *c) {
+  int b;
+
+  for (b = AVI_IO_HIST_BUCKETS - 1; b >= 0; b--)
+    if (c->hist[b]) return (double) (2ULL << b) / 1e6;
+  return 0;
+}
+
+static int run_profile(const capture_profile_t *p, const char *file, double seconds,
+                       uint64_t seed, const char *data, PlatThrottle *dev,
+                       bench_json_t *j) {
+  bench_lat_t lat_frame, lat_audio, lat_step;
+  avi_io_stats_t st;
+  PlatThrottleStats d0, d1;
+  uint64_t rnd = seed, t_start, t_write, t_close, bytes = 0;
+  uint64_t period = (uint64_t) (1e9 / p->fps);
+  long frames = (long) (seconds * p->fps), i, misses = 0, done = 0;
+  int t, have_stats;
+  avi_t *AVI;
+
+  memset(&lat_frame, 0, sizeof(lat_frame));
+  memset(&lat_audio, 0, sizeof(lat_audio));
+  memset(&lat_step, 0, sizeof(lat_step));
+
+  if (dev) plat_throttle_stats(dev, &d0);
+  t_start = bench_now_ns();
+  AVI = dev ? bench_throttle_output(dev, file) : AVI_open_output_file(file);
+  if (!AVI) {
+    AVI_print_error("aviwrite: open");
+    return -1;
+  }
+  AVI_set_video(AVI, p->width, p->height, p->fps, p->compressor);
+  for (t = 0; t < p->tracks; t++)
+    AVI_set_audio(AVI, 2, p->audio_rate, 16, WAVE_FORMAT_PCM, 0);
+
+  for (i = 0; i < frames; i++) {
+    long len = p->frame_min;
+    uint64_t t0 = bench_now_ns(), t1;
+    int chunks = 0, c;
+
+    if (p->frame_max > p->frame_min)
+      len += (long) (bench_rand(&rnd) % (p->frame_max - p->frame_min + 1));
+    if (AVI_write_frame(AVI, (char *) data, len, i % 12 == 0) < 0) break;
+    t1 = bench_now_ns();
+    bench_lat_add(&lat_frame, t1 - t0);
+    bytes += len;
+
+    if (p->audio_split > 0) chunks = p->audio_split;
+    else if ((i + 1) % -p->audio_split == 0) chunks = 1;
+
+    if (chunks && p->tracks) {
+      // audio up to the end of this frame, split into `chunks' pieces
+      long total = (long) ((i + 1) * p->audio_rate / p->fps) * 4 - done;
+
+      for (c = 0; c < chunks; c++) {
+        long part = (total / chunks) & ~3L;
+
+        if (c == chunks - 1) part = total - part * (chunks - 1);
+        for (t = 0; t < p->tracks; t++) {
+          uint64_t ta = bench_now_ns();
+
+          AVI_set_audio_track(AVI, t);
+          if (AVI_write_audio(AVI, (char *) data, part) < 0) goto fail;
+          bench_lat_add(&lat_audio, bench_now_ns() - ta);
+          bytes += part;
+        }
+      }
+      done += total;
+    }
+
+    t1 = bench_now_ns() - t0;
+    bench_lat_add(&lat_step, t1);
+    if (t1 > period) misses++;
+  }
+  if (i < frames) goto fail;
+
+  t_write = bench_now_ns();
+  have_stats = AVI_get_io_stats(AVI, &st) == 0;
+  if (AVI_close(AVI) < 0) {
+    AVI_print_error("aviwrite: close");
+    return -1;
+  }
+  t_close = bench_now_ns();
+  if (dev) plat_throttle_stats(dev, &d1);
+
+  bench_json_obj(j, NULL);
+  bench_json_str(j, "profile", p->name);
+  bench_json_int(j, "frames", frames);
+  bench_json_int(j, "tracks", p->tracks);
+  bench_json_int(j, "bytes", (long long) bytes);
+  bench_json_num(j, "seconds", (t_write - t_start) / 1e9);
+  bench_json_num(j, "mb_per_s", bytes / 1e6 / ((t_write - t_start) / 1e9));
+  bench_json_num(j, "realtime_factor", seconds / ((t_write - t_start) / 1e9));
+  bench_json_num(j, "close_ms", (t_close - t_write) / 1e6);
+
+  bench_json_obj(j, "write_frame");
+  bench_json_lat(j, &lat_frame);
+  bench_json_end(j);
+  if (lat_audio.n) {
+    bench_json_obj(j, "write_audio");
+    bench_json_lat(j, &lat_audio);
+    bench_json_end(j);
+  }
+  bench_json_obj(j, "step");
+  bench_json_lat(j, &lat_step);
+  bench_json_int(j, "deadline_misses", misses);
+  bench_json_end(j);
+
+  if (have_stats) {
+    json_io(j, "io_write_frame", &st.op[AVI_IO_WRITE_FRAME]);
+    json_io(j, "io_write_audio", &st.op[AVI_IO_WRITE_AUDIO]);
+    json_io(j, "io_open", &st.op[AVI_IO_OPEN]);
+    bench_json_obj(j, "riff_rotation");
+    bench_json_int(j, "count", st.riff.calls);
+    bench_json_int(j, "index_bytes", (long long) st.riff.bytes);
+    bench_json_num(j, "total_ms", st.riff.ns / 1e6);
+    bench_json_num(j, "mean_ms", st.riff.calls ? st.riff.ns / 1e6 / st.riff.calls : 0);
+    bench_json_num(j, "max_ms_bound", hist_max_ms(&st.riff));
+    bench_json_end(j);
+  }
+  if (dev) bench_json_device(j, &d0, &d1);
+  bench_json_end(j);
+
+  bench_lat_free(&lat_frame);
+  bench_lat_free(&lat_audio);
+  bench_lat_free(&lat_step);
+  return 0;
+
+fail:
+  AVI_print_error("aviwrite: write");
+  AVI_close(AVI);
+  bench_lat_free(&lat_frame);
+  bench_lat_free(&lat_audio);
+  bench_lat_free(&lat_step);
+  return -1;
+}
+
+int main(int argc, char **argv) {
+  const char *file = "aviwrite.avi", *list = NULL;
+  double seconds = 20;
+  uint64_t seed = 1;
+  int tracks = -1, keep = 0, c;
+  bench_json_t j;
+  FILE *out = stdout;
+  PlatThrottle *dev = NULL;
+  char *data;
+  size_t k, max = 0;
+
+  while ((c = getopt(argc, argv, "p:d:a:o:S:kt:j:h")) != -1) {
+    switch (c) {
+      case 'p': list = optarg; break;
+      case 'd': seconds = atof(optarg); break;
+      case 'a': tracks = atoi(optarg); break;
+      case 'o': file = optarg; break;
+      case 'S': seed = strtoull(optarg, NULL, 0); break;
+      case 'k': keep = 1; break;
+      case 't':
+        dev = bench_throttle_new(optarg);
+        if (!dev) return 1;
+        break;
+      case 'j':
+        out = fopen(optarg, "w");
+        if (!out) {
+          perror(optarg);
+          return 1;
+        }
+        break;
+      default: usage();
+    }
+  }
+  if (seconds <= 0 || !seed || tracks > AVI_MAX_TRACKS) usage();
+
+  for (k = 0; k < sizeof(profiles) / sizeof(profiles[0]); k++)
+    if (profiles[k].frame_max > (long) max) max = profiles[k].frame_max;
+  data = malloc(max);
+  if (!data) return 1;
+  for (k = 0; k < max; k++)
+    data[k] = (char) (k * 131 + (k >> 8));
+
+  // every handle counts its I/O from the start
+  AVI_set_io_stats_default(1);
+
+  memset(&j, 0, sizeof(j));
+  j.f = out;
+  bench_json_obj(&j, NULL);
+  bench_json_str(&j, "bench", "aviwrite");
+  bench_json_num(&j, "capture_seconds", seconds);
+  bench_json_int(&j, "throttled", dev != NULL);
+  bench_json_arr(&j, "results");
+
+  for (k = 0; k < sizeof(profiles) / sizeof(profiles[0]); k++) {
+    capture_profile_t p = profiles[k];
+
+    if (!selected(list, p.name)) continue;
+    if (tracks >= 0) p.tracks = tracks;
+    run_profile(&p, file, seconds, seed, data, dev, &j);
+  }
+
+  bench_json_arr_end(&j);
+  bench_json_end(&j);
+
+  if (!keep) unlink(file);
+  plat_throttle_free(dev);
+  free(data);
+  if (out != stdout) fclose(out);
+  return 0;
+}
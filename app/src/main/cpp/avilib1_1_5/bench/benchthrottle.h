@@ -0,0 +1,70 @@
+/*
+ * benchthrottle.h -- run the benchmarks on emulated slow storage
+ *
+ * Every bench that takes -t SPEC (see plat_throttle_parse) opens its
+ * files on one PlatThrottle device through these helpers and reports
+ * what the device saw during each run with bench_json_device. The
+ * open helpers print why the file itself could not be opened.
+ */
+
+#ifndef BENCHTHROTTLE_H
+#define BENCHTHROTTLE_H
+
+#include <fcntl.h>
+#include <stdio.h>
+
+#include "avilib.h"
+#include "benchutil.h"
+#include "platform_throttle.h"
+
+static inline PlatThrottle *bench_throttle_new(const char *spec) {
+  PlatThrottleConfig cfg;
+  PlatThrottle *dev;
+
+  if (plat_throttle_parse(spec, &cfg) < 0) {
+    fprintf(stderr, "bad storage spec '%s'\n", spec);
+    return NULL;
+  }
+  dev = plat_throttle_new(&cfg);
+  if (!dev) perror("throttle");
+  return dev;
+}
+
+static inline avi_t *bench_throttle_input(PlatThrottle *dev, const char *path) {
+  avi_io_t io = { plat_throttle_read_at, NULL, plat_throttle_size,
+                  NULL, NULL, plat_throttle_close, NULL };
+
+  io.opaque = plat_throttle_open(dev, path, O_RDONLY);
+  if (!io.opaque) {
+    perror(path);
+    return NULL;
+  }
+  return AVI_open_io(&io, 1);
+}
+
+static inline avi_t *bench_throttle_output(PlatThrottle *dev, const char *path) {
+  avi_io_t io = { plat_throttle_read_at, plat_throttle_write_at, plat_throttle_size,
+                  NULL, plat_throttle_truncate, plat_throttle_close, NULL };
+
+  io.opaque = plat_throttle_open(dev, path, O_RDWR | O_CREAT | O_TRUNC);
+  if (!io.opaque) {
+    perror(path);
+    return NULL;
+  }
+  return AVI_open_output_io(&io);
+}
+
+/* what the device did between the snapshots a and b */
+static inline void bench_json_device(bench_json_t *j, const PlatThrottleStats *a,
+                                     const PlatThrottleStats *b) {
+  bench_json_obj(j, "device");
+  bench_json_int(j, "requests", (long long) (b->requests - a->requests));
+  bench_json_int(j, "bytes", (long long) (b->bytes - a->bytes));
+  bench_json_int(j, "seeks", (long long) (b->seeks - a->seeks));
+  bench_json_int(j, "spikes", (long long) (b->spikes - a->spikes));
+  bench_json_num(j, "busy_ms", (b->busy_ns - a->busy_ns) / 1e6);
+  bench_json_num(j, "wait_ms", (b->wait_ns - a->wait_ns) / 1e6);
+  bench_json_end(j);
+}
+
+#endif /* BENCHTHROTTLE_H */
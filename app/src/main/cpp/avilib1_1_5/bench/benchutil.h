@@ -0,0 +1,186 @@
+/*
+ * benchutil.h -- helpers shared by the avilib host benchmarks:
+ *                clock, latency percentiles, JSON output, page cache
+ *                control and a small PRNG.
+ */
+
+#ifndef BENCHUTIL_H
+#define BENCHUTIL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*************************************************************************/
+
+static inline uint64_t bench_now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* xorshift64*, reproducible across runs for a given seed */
+static inline uint64_t bench_rand(uint64_t *state) {
+  uint64_t x = *state;
+
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  *state = x;
+  return x * 2685821657736338717ULL;
+}
+
+/*************************************************************************/
+/* latency samples                                                       */
+
+typedef struct {
+  uint64_t *ns;
+  size_t n, size;
+  int sorted;
+} bench_lat_t;
+
+static inline void bench_lat_add(bench_lat_t *l, uint64_t ns) {
+  if (l->n == l->size) {
+    size_t size = l->size ? l->size * 2 : 1024;
+    uint64_t *p = realloc(l->ns, size * sizeof(uint64_t));
+    if (!p) return;
+    l->ns = p;
+    l->size = size;
+  }
+  l->ns[l->n++] = ns;
+  l->sorted = 0;
+}
+
+static int bench_cmp_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+  return (x > y) - (x < y);
+}
+
+/* q in 0..1, nearest rank */
+static inline uint64_t bench_lat_pct(bench_lat_t *l, double q) {
+  size_t k;
+
+  if (!l->n) return 0;
+  if (!l->sorted) {
+    qsort(l->ns, l->n, sizeof(uint64_t), bench_cmp_u64);
+    l->sorted = 1;
+  }
+  k = (size_t) (q * l->n);
+  return l->ns[k < l->n ? k : l->n - 1];
+}
+
+static inline uint64_t bench_lat_sum(const bench_lat_t *l) {
+  uint64_t s = 0;
+  size_t k;
+
+  for (k = 0; k < l->n; k++) s += l->ns[k];
+  return s;
+}
+
+static inline void bench_lat_reset(bench_lat_t *l) {
+  l->n = 0;
+  l->sorted = 0;
+}
+
+static inline void bench_lat_free(bench_lat_t *l) {
+  free(l->ns);
+  memset(l, 0, sizeof(*l));
+}
+
+/*************************************************************************/
+/* minimal JSON writer, keeps track of the commas                        */
+
+#define BENCH_JSON_DEPTH 16
+
+typedef struct {
+  FILE *f;
+  int depth;
+  int count[BENCH_JSON_DEPTH];
+} bench_json_t;
+
+static inline void bench_json_key(bench_json_t *j, const char *key) {
+  if (j->count[j->depth]++) fputc(',', j->f);
+  fputc('\n', j->f);
+  fprintf(j->f, "%*s", 2 * j->depth, "");
+  if (key) fprintf(j->f, "\"%s\": ", key);
+}
+
+static inline void bench_json_open(bench_json_t *j, const char *key, char c) {
+  if (j->depth == 0 && j->count[0] == 0 && !key) {
+    j->count[0]++;
+  } else {
+    bench_json_key(j, key);
+  }
+  fputc(c, j->f);
+  j->count[++j->depth] = 0;
+}
+
+static inline void bench_json_close(bench_json_t *j, char c) {
+  int had = j->count[j->depth--];
+
+  if (had) fprintf(j->f, "\n%*s", 2 * j->depth, "");
+  fputc(c, j->f);
+  if (j->depth == 0) fputc('\n', j->f);
+}
+
+#define bench_json_obj(j, key)   bench_json_open(j, key, '{')
+#define bench_json_end(j)        bench_json_close(j, '}')
+#define bench_json_arr(j, key)   bench_json_open(j, key, '[')
+#define bench_json_arr_end(j)    bench_json_close(j, ']')
+
+static inline void bench_json_int(bench_json_t *j, const char *key, long long v) {
+  bench_json_key(j, key);
+  fprintf(j->f, "%lld", v);
+}
+
+static inline void bench_json_num(bench_json_t *j, const char *key, double v) {
+  bench_json_key(j, key);
+  fprintf(j->f, "%.6g", v);
+}
+
+static inline void bench_json_str(bench_json_t *j, const char *key, const char *v) {
+  const char *c;
+
+  bench_json_key(j, key);
+  fputc('"', j->f);
+  for (c = v; *c; c++) {
+    if (*c == '"' || *c == '\\') fputc('\\', j->f);
+    fputc(*c, j->f);
+  }
+  fputc('"', j->f);
+}
+
+/* the usual latency summary of a run, in microseconds */
+static inline void bench_json_lat(bench_json_t *j, bench_lat_t *l) {
+  bench_json_int(j, "ops", (long long) l->n);
+  bench_json_num(j, "mean_us", l->n ? bench_lat_sum(l) / 1e3 / l->n : 0);
+  bench_json_num(j, "p50_us", bench_lat_pct(l, 0.50) / 1e3);
+  bench_json_num(j, "p99_us", bench_lat_pct(l, 0.99) / 1e3);
+  bench_json_num(j, "p999_us", bench_lat_pct(l, 0.999) / 1e3);
+  bench_json_num(j, "max_us", l->n ? l->ns[l->n - 1] / 1e3 : 0);
+}
+
+/*************************************************************************/
+
+/* Push path out of the page cache, so the next reads hit the device.
+   returns -1 where that is not possible (no posix_fadvise) */
+static inline int bench_drop_cache(const char *path) {
+#ifdef POSIX_FADV_DONTNEED
+  int fd = open(path, O_RDONLY), r;
+
+  if (fd < 0) return -1;
+  fdatasync(fd);
+  r = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  close(fd);
+  return r == 0 ? 0 : -1;
+#else
+  return -1;
+#endif
+}
+
+#endif /* BENCHUTIL_H */
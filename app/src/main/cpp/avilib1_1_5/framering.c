@@ -0,0 +1,317 @@
+/*
+ *  framering.c
+ *
+ *  Read-ahead ring of video frames, see framering.h.
+ *
+ *  This file is part of transcode, a video stream processing tool
+ *
+ *  transcode is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  transcode is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GNU Make; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+
+#include "framering.h"
+#include "platform.h"
+
+/*
+ * The consumer moves the reader by publishing a request (generation,
+ * frame) in one atomic word; the reader stamps every slot with the
+ * generation it read it for, so slots read before a jump are told
+ * apart from the ones after it. The reader's progress is published
+ * the same way.
+ */
+#define RING_FRAME_BITS 40
+#define RING_PACK(gen, frame) (((uint64_t) (gen) << RING_FRAME_BITS) | (uint64_t) (frame))
+#define RING_GEN(v)           ((unsigned long) ((v) >> RING_FRAME_BITS))
+#define RING_FRAME(v)         ((long) ((v) & ((1ULL << RING_FRAME_BITS) - 1)))
+#define RING_GEN_MASK         ((1UL << (64 - RING_FRAME_BITS)) - 1)
+
+typedef struct
+{
+  avi_ring_slot_t s;
+  unsigned long gen;
+} ring_slot_t;
+
+struct avi_ring_s
+{
+  avi_t *AVI;
+  long frames;
+  int n;
+  ring_slot_t *slot;
+
+  atomic_ulong head;        /* slots published by the reader */
+  unsigned long tail;       /* slots released by the consumer */
+  sem_t filled;             /* published, not yet taken */
+  sem_t free;               /* free for the reader */
+  sem_t kick;               /* wakes a reader parked at the end */
+
+  atomic_uint_least64_t request;   /* RING_PACK(gen, first frame) */
+  atomic_uint_least64_t progress;  /* RING_PACK(gen, next frame) */
+  atomic_int stop;
+  pthread_t thread;
+  int running;
+
+  /* consumer side */
+  unsigned long gen;        /* of the last request */
+  long floor;               /* lowest frame still to come in gen */
+  int held;
+  long end_frame;           /* end marker of gen seen, -1 if not */
+
+  /* reader side */
+  atomic_ulong produced, full_waits;
+
+  avi_ring_stats_t st;      /* consumer side counters */
+};
+
+/*************************************************************************/
+
+static void ring_sem_wait(sem_t *s) {
+  while (sem_wait(s) < 0 && errno == EINTR)
+    ;
+}
+
+/* hands the slot at head to the consumer, only the reader moves head */
+static void ring_publish(avi_ring_t *r) {
+  atomic_store_explicit(&r->head, atomic_load(&r->head) + 1, memory_order_release);
+  sem_post(&r->filled);
+}
+
+static void *ring_reader(void *arg) {
+  avi_ring_t *r = arg;
+  unsigned long gen = 0;
+  long next = 0;
+
+  for (;;) {
+    uint64_t req = atomic_load(&r->request);
+    ring_slot_t *sl;
+
+    if (RING_GEN(req) != gen) {
+      gen = RING_GEN(req);
+      next = RING_FRAME(req);
+    }
+    if (atomic_load(&r->stop)) break;
+
+    if (sem_trywait(&r->free) < 0) {
+      atomic_fetch_add(&r->full_waits, 1);
+      ring_sem_wait(&r->free);
+      if (atomic_load(&r->stop)) break;
+      // the consumer may have jumped while we waited
+      req = atomic_load(&r->request);
+      if (RING_GEN(req) != gen) {
+        gen = RING_GEN(req);
+        next = RING_FRAME(req);
+      }
+    }
+
+    sl = &r->slot[atomic_load(&r->head) % r->n];
+    sl->gen = gen;
+    sl->s.frame = next;
+    // len < 0 marks the end of the stream or a read error
+    sl->s.len = -1;
+    if (next < r->frames && AVI_set_video_position(r->AVI, next) == 0)
+      sl->s.len = AVI_read_frame(r->AVI, sl->s.data, &sl->s.keyframe);
+
+    if (sl->s.len < 0) {
+      ring_publish(r);
+      // end or error: nothing to read until the consumer jumps
+      while (!atomic_load(&r->stop) && RING_GEN(atomic_load(&r->request)) == gen)
+        ring_sem_wait(&r->kick);
+      continue;
+    }
+    // progress first, a consumer that got the slot must not think the
+    // reader is behind it
+    next++;
+    atomic_store(&r->progress, RING_PACK(gen, next));
+    atomic_fetch_add(&r->produced, 1);
+    ring_publish(r);
+  }
+  return NULL;
+}
+
+/*************************************************************************/
+
+avi_ring_t *AVI_ring_new(avi_t *AVI, int slots) {
+  avi_ring_t *r;
+  long i, max = 0;
+
+  if (!AVI || slots < 2 || AVI_video_frames(AVI) <= 0) {
+    errno = EINVAL;
+    return NULL;
+  }
+  for (i = 0; i < AVI_video_frames(AVI); i++)
+    if (AVI_frame_size(AVI, i) > max) max = AVI_frame_size(AVI, i);
+
+  r = plat_zalloc(sizeof(*r));
+  if (!r) return NULL;
+  r->slot = plat_zalloc(slots * sizeof(*r->slot));
+  if (!r->slot) {
+    plat_free(r);
+    return NULL;
+  }
+  r->AVI = AVI;
+  r->frames = AVI_video_frames(AVI);
+  r->n = slots;
+  for (i = 0; i < slots; i++) {
+    r->slot[i].s.data = plat_malloc(max + 1);
+    if (!r->slot[i].s.data) {
+      AVI_ring_free(r);
+      return NULL;
+    }
+  }
+  r->st.slots = slots;
+  r->end_frame = -1;
+  return r;
+}
+
+void AVI_ring_free(avi_ring_t *r) {
+  int i;
+
+  if (!r) return;
+  AVI_ring_stop(r);
+  for (i = 0; i < r->n; i++)
+    plat_free(r->slot[i].s.data);
+  plat_free(r->slot);
+  plat_free(r);
+}
+
+int AVI_ring_start(avi_ring_t *r, long frame) {
+  if (r->running) AVI_ring_stop(r);
+  if (frame < 0) frame = 0;
+
+  atomic_store(&r->head, 0);
+  r->tail = 0;
+  r->held = 0;
+  sem_init(&r->filled, 0, 0);
+  sem_init(&r->free, 0, r->n);
+  sem_init(&r->kick, 0, 0);
+  r->gen = 1;
+  r->floor = frame;
+  r->end_frame = -1;
+  atomic_store(&r->request, RING_PACK(r->gen, frame));
+  atomic_store(&r->progress, RING_PACK(r->gen, frame));
+  atomic_store(&r->stop, 0);
+
+  if (pthread_create(&r->thread, NULL, ring_reader, r) != 0) {
+    sem_destroy(&r->filled);
+    sem_destroy(&r->free);
+    sem_destroy(&r->kick);
+    return -1;
+  }
+  r->running = 1;
+  return 0;
+}
+
+int AVI_ring_stop(avi_ring_t *r) {
+  if (!r->running) return 0;
+  atomic_store(&r->stop, 1);
+  sem_post(&r->free);
+  sem_post(&r->kick);
+  pthread_join(r->thread, NULL);
+  sem_destroy(&r->filled);
+  sem_destroy(&r->free);
+  sem_destroy(&r->kick);
+  r->running = 0;
+  return 0;
+}
+
+/* hands slot tail back to the reader */
+static void ring_drop(avi_ring_t *r) {
+  r->tail++;
+  sem_post(&r->free);
+}
+
+void AVI_ring_release(avi_ring_t *r) {
+  if (!r->held) return;
+  r->held = 0;
+  ring_drop(r);
+}
+
+const avi_ring_slot_t *AVI_ring_get(avi_ring_t *r, long frame) {
+  uint64_t prog;
+  long next;
+  int sampled = 0;
+
+  if (!r->running || frame < 0) return NULL;
+  AVI_ring_release(r);
+
+  if (r->end_frame >= 0 && frame >= r->end_frame) return NULL;
+
+  // where will the reader be? Move it unless frame is on its way
+  prog = atomic_load(&r->progress);
+  next = RING_GEN(prog) == r->gen ? RING_FRAME(prog) : r->floor;
+  if (frame < r->floor || frame > next) {
+    // 0 is what the reader starts from
+    r->gen = (r->gen + 1) & RING_GEN_MASK;
+    if (!r->gen) r->gen = 1;
+    r->floor = frame;
+    r->end_frame = -1;
+    atomic_store(&r->request, RING_PACK(r->gen, frame));
+    sem_post(&r->kick);
+    r->st.seeks++;
+  }
+
+  for (;;) {
+    ring_slot_t *sl;
+
+    if (!sampled) {
+      unsigned long fill = atomic_load_explicit(&r->head, memory_order_acquire) - r->tail;
+
+      r->st.fill_sum += fill;
+      if (!r->st.consumed || fill < r->st.fill_min) r->st.fill_min = fill;
+      sampled = 1;
+    }
+    if (sem_trywait(&r->filled) < 0) {
+      uint64_t t = plat_time_ns();
+
+      ring_sem_wait(&r->filled);
+      r->st.underruns++;
+      r->st.underrun_ns += plat_time_ns() - t;
+    }
+    atomic_thread_fence(memory_order_acquire);
+    sl = &r->slot[r->tail % r->n];
+
+    if (sl->gen != r->gen) {
+      // read for a position the consumer has left since
+      r->st.discarded += sl->s.len >= 0;
+      ring_drop(r);
+      continue;
+    }
+    if (sl->s.len >= 0 && sl->s.frame < frame) {
+      r->st.discarded++;
+      r->floor = sl->s.frame + 1;
+      ring_drop(r);
+      continue;
+    }
+    if (sl->s.len < 0) {
+      // the reader is parked, anything in front of it is gone
+      r->end_frame = r->floor = sl->s.frame;
+      ring_drop(r);
+      return NULL;
+    }
+    r->held = 1;
+    r->floor = sl->s.frame + 1;
+    r->st.consumed++;
+    return &sl->s;
+  }
+}
+
+void AVI_ring_stats(avi_ring_t *r, avi_ring_stats_t *st) {
+  *st = r->st;
+  st->produced = atomic_load(&r->produced);
+  st->full_waits = atomic_load(&r->full_waits);
+}
@@ -0,0 +1,71 @@
+/*
+ *  framering.h
+ *
+ *  This file is part of transcode, a video stream processing tool,
+ *  and is distributed under the terms of the GNU General Public
+ *  License version 2 or later, see avilib.h.
+ *
+ *  Read-ahead of video frames: a reader thread fills a fixed ring of
+ *  preallocated frame buffers from an avi_t, one consumer takes them
+ *  out in order. Every buffer holds the largest chunk of the index, so
+ *  nothing is allocated while playing.
+ *
+ *  The ring is single producer / single consumer. Handing a slot over
+ *  is one atomic counter update and a semaphore post, which only enters
+ *  the kernel when the other side sleeps on an empty or full ring.
+ *
+ *  While the ring runs, its reader thread owns the avi_t: the consumer
+ *  must not read from the handle until AVI_ring_stop.
+ */
+
+#ifndef FRAMERING_H
+#define FRAMERING_H
+
+#include "avilib.h"
+
+typedef struct
+{
+  long  frame;              /* index in the file */
+  char *data;
+  long  len;
+  int   keyframe;
+} avi_ring_slot_t;
+
+typedef struct
+{
+  unsigned long produced;   /* frames read into the ring */
+  unsigned long consumed;   /* slots handed to the consumer */
+  unsigned long discarded;  /* read ahead but skipped by the consumer */
+  unsigned long seeks;      /* reader moved because the consumer jumped */
+  unsigned long underruns;  /* consumer found no frame and had to wait */
+  uint64_t underrun_ns;     /* ... for this long in total */
+  unsigned long full_waits; /* reader found every slot taken */
+  unsigned long fill_sum;   /* frames ready at each AVI_ring_get, summed: */
+  unsigned long fill_min;   /* fill_sum / consumed is the mean fill */
+  int slots;
+} avi_ring_stats_t;
+
+typedef struct avi_ring_s avi_ring_t;
+
+/* slots buffers of the size of the largest video chunk in the index */
+avi_ring_t *AVI_ring_new(avi_t *AVI, int slots);
+void AVI_ring_free(avi_ring_t *ring);
+
+/* start reading ahead from frame */
+int  AVI_ring_start(avi_ring_t *ring, long frame);
+/* stop and join the reader, the avi_t is the caller's again */
+int  AVI_ring_stop(avi_ring_t *ring);
+
+/*
+ * The slot of frame, waiting for the reader if needed. Frames in front
+ * of it are dropped; if frame is not coming up soon the reader is moved
+ * there. NULL after the last frame or a read error. The slot stays
+ * valid until AVI_ring_release, which must come before the next get.
+ */
+const avi_ring_slot_t *AVI_ring_get(avi_ring_t *ring, long frame);
+void AVI_ring_release(avi_ring_t *ring);
+
+/* from the consumer's thread */
+void AVI_ring_stats(avi_ring_t *ring, avi_ring_stats_t *st);
+
+#endif /* FRAMERING_H */
@@ -48,6 +48,27 @@ ssize_t plat_write(int fd, const void *buf, size_t count);
 int64_t plat_seek(int fd, int64_t offset, int whence);
 int plat_ftruncate(int fd, int64_t length);
 
+/* copy count bytes starting at offset of fd_in to the current position
+   of fd_out, keeping the payload in the kernel when possible */
+ssize_t plat_copy(int fd_out, int fd_in, int64_t offset, size_t count);
+
+/* flush the file data to the storage device */
+int plat_fsync(int fd);
+
+/* positional read, does not move the file offset */
+ssize_t plat_pread(int fd, void *buf, size_t count, int64_t offset);
+
+/* read only open bypassing the page cache (O_DIRECT), -1 if the
+   platform can't do that. Buffers, offsets and sizes must be aligned */
+int plat_open_direct(const char *pathname);
+
+/*************************************************************************/
+/* time                                                                  */
+/*************************************************************************/
+
+/* monotonic clock in nanoseconds, for measurements only */
+uint64_t plat_time_ns(void);
+
 /*************************************************************************/
 /* libc-like memory handling                                             */
 /*************************************************************************/
@@ -57,6 +78,9 @@ void *_plat_zalloc(const char *file, int line, size_t size);
 void *_plat_realloc(const char *file, int line, void *ptr, size_t size);
 void plat_free(void *ptr);
 
+void *plat_aligned_alloc(size_t alignment, size_t size);
+void plat_aligned_free(void *ptr);
+
 #define plat_malloc(size) \
             _plat_malloc(__FILE__, __LINE__, size)
 #define plat_zalloc(size) \
@@ -64,6 +88,84 @@ void plat_free(void *ptr);
 #define plat_realloc(p,size) \
             _plat_realloc(__FILE__, __LINE__, p, size)
 
+/*************************************************************************/
+/* allocation statistics (build with PLAT_MEM_STATS)                     */
+/*************************************************************************/
+
+/* With PLAT_MEM_STATS every block carries a small header and is charged
+   to its allocation site (file/line), and to an owner once it is given
+   one with plat_mem_adopt. Arena blocks are charged the same way. Without
+   it the owner calls compile away and the queries fail with -1. */
+
+typedef struct platmemstats_ {
+    uint64_t live_bytes;
+    uint64_t peak_bytes;
+    unsigned long allocs;
+    unsigned long frees;
+} PlatMemStats;
+
+#ifdef PLAT_MEM_STATS
+/* charge the block ptr (may be NULL) to owner, it stays with it through
+   plat_realloc */
+void plat_mem_adopt(void *ptr, const void *owner);
+/* forget the owner's record, once all of its blocks are gone */
+void plat_mem_release(const void *owner);
+#else
+#define plat_mem_adopt(ptr, owner)  ((void) (ptr), (void) (owner))
+#define plat_mem_release(owner)     ((void) (owner))
+#endif
+
+/* owner == NULL: all allocations */
+int plat_mem_stats(const void *owner, PlatMemStats *st);
+/* per site table, highest peak first */
+int plat_mem_dump(FILE *f);
+
+/*************************************************************************/
+/* tracing                                                               */
+/*************************************************************************/
+
+/* Spans are collected in memory between plat_trace_open and
+   plat_trace_close, which writes them to path as Chrome trace event
+   JSON (chrome://tracing, ui.perfetto.dev). name, cat and arg_name
+   must be string literals. At most max_events are kept. */
+
+int plat_trace_open(const char *path, size_t max_events);
+int plat_trace_close(void);
+int plat_trace_enabled(void);
+/* a span that started at start_ns (plat_time_ns) and took dur_ns,
+   arg_name may be NULL */
+void plat_trace_span(const char *name, const char *cat,
+                     uint64_t start_ns, uint64_t dur_ns,
+                     const char *arg_name, int64_t arg);
+
+/*************************************************************************/
+/* arena (bump) allocation                                               */
+/*************************************************************************/
+
+/* Memory is taken from big mmap()ed blocks and given back all at once
+   by plat_arena_free. plat_arena_reset makes the whole arena reusable
+   without unmapping, for short lived scratch data. */
+
+typedef struct platarena_ PlatArena;
+
+PlatArena *_plat_arena_new(const char *file, int line, size_t block_size);
+void *plat_arena_alloc(PlatArena *arena, size_t size);
+void *plat_arena_zalloc(PlatArena *arena, size_t size);
+char *plat_arena_strdup(PlatArena *arena, const char *str);
+void plat_arena_reset(PlatArena *arena);
+void plat_arena_free(PlatArena *arena);
+
+/* the blocks of an arena are charged to the site that created it */
+#define plat_arena_new(block_size) \
+            _plat_arena_new(__FILE__, __LINE__, block_size)
+
+#ifdef PLAT_MEM_STATS
+/* charge the arena's blocks, those it has and those to come, to owner */
+void plat_arena_adopt(PlatArena *arena, const void *owner);
+#else
+#define plat_arena_adopt(arena, owner)  ((void) (arena), (void) (owner))
+#endif
+
 /*************************************************************************/
 /* simple logging facility                                               */ 
 /*************************************************************************/
@@ -76,9 +178,28 @@ enum platloglevel_ {
     PLAT_LOG_ERROR,
 };
 
+/* receives every message that passes the level filter; tag has
+   static storage (callers pass __FILE__) */
+typedef void (*PlatLogSink)(PlatLogLevel level, const char *tag,
+                            const char *msg, void *userdata);
+
+/* messages below level are not even formatted, default PLAT_LOG_DEBUG */
+void plat_log_set_level(PlatLogLevel level);
+PlatLogLevel plat_log_get_level(void);
+/* NULL restores the default sink (stderr). Set it before plat_log_open */
+void plat_log_set_sink(PlatLogSink sink, void *userdata);
+
+/* start the asynchronous mode: messages are queued and written by a
+   background thread. Without it plat_log_send calls the sink directly */
 int plat_log_open(void);
+/* returns -1 if the message was dropped because the queue was full */
 int plat_log_send(PlatLogLevel level,
                   const char *tag, const char *fmt, ...);
+/* flush the queue and stop the thread. Calls of plat_log_send running
+   meanwhile are waited for, later ones go to the sink directly. Not to
+   be called at the same time as plat_log_open */
 int plat_log_close(void);
+/* messages lost to a full queue */
+unsigned long plat_log_dropped(void);
 
 #endif /* PLATFORM_H */
@@ -19,11 +19,26 @@
  * 3. This notice may not be removed or altered from any source distribution.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include "platform.h"
 
 #include <string.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/sendfile.h>
+#endif
 
 
 /*************************************************************************/
@@ -91,24 +106,152 @@ int plat_ftruncate(int fd, int64_t length)
     return ftruncate(fd, length);
 }
 
+int plat_fsync(int fd)
+{
+#if defined(_POSIX_SYNCHRONIZED_IO) && _POSIX_SYNCHRONIZED_IO > 0
+    return fdatasync(fd);
+#else
+    return fsync(fd);
+#endif
+}
+
+/* 
+ * automatically restart after a recoverable interruption
+ */
+ssize_t plat_pread(int fd, void *buf, size_t count, int64_t offset)
+{
+    ssize_t n = 0;
+    size_t r = 0;
+
+    while (r < count) {
+        n = pread(fd, (char *)buf + r, count - r, offset + (int64_t) r);
+        if (n == 0)
+            break;
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            else
+                break;
+        }
+
+        r += (size_t) n;
+    }
+    return (ssize_t) r;
+}
+
+int plat_open_direct(const char *pathname)
+{
+#ifdef O_DIRECT
+    return open(pathname, O_RDONLY | O_DIRECT);
+#else
+    errno = EINVAL;
+    return -1;
+#endif
+}
+
+/*
+ * try copy_file_range() first, then sendfile(), and finally fall back
+ * to a plain read/write loop with a large bounce buffer.
+ * Returns the number of bytes copied (short only on EOF or error).
+ */
+#define PLAT_COPY_BUFSIZE   (1024 * 1024)
+
+ssize_t plat_copy(int fd_out, int fd_in, int64_t offset, size_t count)
+{
+    ssize_t n = 0;
+    size_t r = 0;
+    char *buf = NULL;
+
+#if defined(__linux__) && defined(SYS_copy_file_range)
+    while (r < count) {
+        loff_t off_in = offset + (int64_t) r;
+        n = syscall(SYS_copy_file_range, fd_in, &off_in, fd_out, NULL,
+                    count - r, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        r += (size_t) n;
+    }
+    if (r == count || n == 0)
+        return (ssize_t) r;
+#endif
+
+#ifdef __linux__
+    while (r < count) {
+        off_t off_in = offset + (int64_t) r;
+        n = sendfile(fd_out, fd_in, &off_in, count - r);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        r += (size_t) n;
+    }
+    if (r == count || n == 0)
+        return (ssize_t) r;
+#endif
+
+    buf = plat_malloc(PLAT_COPY_BUFSIZE);
+    if (!buf)
+        return (ssize_t) r;
+
+    while (r < count) {
+        size_t todo = count - r;
+        if (todo > PLAT_COPY_BUFSIZE)
+            todo = PLAT_COPY_BUFSIZE;
+        n = pread(fd_in, buf, todo, offset + (int64_t) r);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        if (plat_write(fd_out, buf, (size_t) n) != n)
+            break;
+        r += (size_t) n;
+    }
+    plat_free(buf);
+    return (ssize_t) r;
+}
+
+
+
+/*************************************************************************/
+/* Time comes from the monotonic clock.                                  */
+/*************************************************************************/
+
+uint64_t plat_time_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 
 
 /*************************************************************************/
 /* Memory management is straightforward too.                             */
 /*************************************************************************/
 
+#ifndef PLAT_MEM_STATS
+
 void *_plat_malloc(const char *file, int line, size_t size)
 {
+    (void) file;
+    (void) line;
     return malloc(size);
 }
 
 void *_plat_zalloc(const char *file, int line, size_t size)
 {
+    (void) file;
+    (void) line;
     return calloc(1, size);
 }
 
 void *_plat_realloc(const char *file, int line, void *ptr, size_t size)
 {
+    (void) file;
+    (void) line;
     return realloc(ptr, size);
 }
 
@@ -117,14 +260,759 @@ void plat_free(void *ptr)
     free(ptr);
 }
 
+void *plat_aligned_alloc(size_t alignment, size_t size)
+{
+    void *ptr = NULL;
+
+    if (posix_memalign(&ptr, alignment, size) != 0)
+        return NULL;
+    return ptr;
+}
+
+void plat_aligned_free(void *ptr)
+{
+    free(ptr);
+}
+
+int plat_mem_stats(const void *owner, PlatMemStats *st)
+{
+    (void) owner;
+    (void) st;
+    return -1;
+}
+
+int plat_mem_dump(FILE *f)
+{
+    (void) f;
+    return -1;
+}
+
+#else /* PLAT_MEM_STATS */
+
+#define PLAT_MEM_SITES      1024    /* power of two */
+#define PLAT_MEM_OWNERS     256
+
+typedef struct {
+    const char *file;       /* NULL if unused */
+    int line;
+    PlatMemStats st;
+} PlatMemSite;
+
+typedef struct {
+    const void *owner;      /* NULL if unused */
+    PlatMemStats st;
+} PlatMemOwner;
+
+/* in front of every block, keeps the user pointer 16 byte aligned */
+typedef struct {
+    size_t size;
+    PlatMemSite *site;
+    PlatMemOwner *owner;
+    void *raw;              /* what malloc returned */
+} PlatMemHdr;
+
+#define PLAT_MEM_HDR    ((sizeof(PlatMemHdr) + 15) & ~(size_t)15)
+
+static PlatMemSite mem_sites[PLAT_MEM_SITES];
+static PlatMemSite mem_site_other = { .file = "(other)" };
+static PlatMemOwner mem_owners[PLAT_MEM_OWNERS];
+static PlatMemStats mem_total;
+static pthread_mutex_t mem_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* all of the helpers below run under mem_lock */
+
+static PlatMemSite *mem_site(const char *file, int line)
+{
+    unsigned h = ((uintptr_t)file >> 4) * 31 + (unsigned)line * 2654435761u;
+    int k;
+
+    for (k = 0; k < PLAT_MEM_SITES; k++) {
+        PlatMemSite *s = &mem_sites[(h + k) & (PLAT_MEM_SITES - 1)];
+        if (!s->file) {
+            s->file = file;
+            s->line = line;
+        }
+        if (s->file == file && s->line == line)
+            return s;
+    }
+    return &mem_site_other;
+}
+
+static PlatMemOwner *mem_owner(const void *owner)
+{
+    PlatMemOwner *free_slot = NULL;
+    int k;
+
+    if (!owner)
+        return NULL;
+    for (k = 0; k < PLAT_MEM_OWNERS; k++) {
+        if (mem_owners[k].owner == owner)
+            return &mem_owners[k];
+        if (!mem_owners[k].owner && !free_slot)
+            free_slot = &mem_owners[k];
+    }
+    if (free_slot)
+        free_slot->owner = owner;
+    return free_slot;
+}
+
+static void mem_add(PlatMemStats *st, size_t size)
+{
+    st->live_bytes += size;
+    if (st->live_bytes > st->peak_bytes)
+        st->peak_bytes = st->live_bytes;
+    st->allocs++;
+}
+
+static void mem_sub(PlatMemStats *st, size_t size)
+{
+    st->live_bytes -= size;
+    st->frees++;
+}
+
+static void mem_charge(PlatMemSite *site, PlatMemOwner *owner, size_t size)
+{
+    mem_add(&site->st, size);
+    if (owner)
+        mem_add(&owner->st, size);
+    mem_add(&mem_total, size);
+}
+
+static void mem_uncharge(PlatMemSite *site, PlatMemOwner *owner, size_t size)
+{
+    mem_sub(&site->st, size);
+    if (owner)
+        mem_sub(&owner->st, size);
+    mem_sub(&mem_total, size);
+}
+
+static void *mem_attach(void *raw, void *ptr, size_t size,
+                        const char *file, int line)
+{
+    PlatMemHdr *hdr = (PlatMemHdr *)((char *)ptr - PLAT_MEM_HDR);
+
+    hdr->size = size;
+    hdr->raw = raw;
+    pthread_mutex_lock(&mem_lock);
+    hdr->site = mem_site(file, line);
+    hdr->owner = NULL;
+    mem_charge(hdr->site, hdr->owner, size);
+    pthread_mutex_unlock(&mem_lock);
+    return ptr;
+}
+
+static void mem_detach(PlatMemHdr *hdr)
+{
+    pthread_mutex_lock(&mem_lock);
+    mem_uncharge(hdr->site, hdr->owner, hdr->size);
+    pthread_mutex_unlock(&mem_lock);
+}
+
+void *_plat_malloc(const char *file, int line, size_t size)
+{
+    char *raw = malloc(PLAT_MEM_HDR + size);
+
+    if (!raw)
+        return NULL;
+    return mem_attach(raw, raw + PLAT_MEM_HDR, size, file, line);
+}
+
+void *_plat_zalloc(const char *file, int line, size_t size)
+{
+    char *raw = calloc(1, PLAT_MEM_HDR + size);
+
+    if (!raw)
+        return NULL;
+    return mem_attach(raw, raw + PLAT_MEM_HDR, size, file, line);
+}
+
+void *_plat_realloc(const char *file, int line, void *ptr, size_t size)
+{
+    PlatMemHdr *hdr;
+    char *raw;
+
+    if (!ptr)
+        return _plat_malloc(file, line, size);
+
+    hdr = (PlatMemHdr *)((char *)ptr - PLAT_MEM_HDR);
+    raw = realloc(hdr->raw, PLAT_MEM_HDR + size);
+    if (!raw)
+        return NULL;
+
+    /* the block stays with its owner, but moves to the new site */
+    hdr = (PlatMemHdr *)raw;
+    pthread_mutex_lock(&mem_lock);
+    mem_uncharge(hdr->site, hdr->owner, hdr->size);
+    hdr->site = mem_site(file, line);
+    hdr->size = size;
+    hdr->raw = raw;
+    mem_charge(hdr->site, hdr->owner, size);
+    pthread_mutex_unlock(&mem_lock);
+    return raw + PLAT_MEM_HDR;
+}
+
+void plat_free(void *ptr)
+{
+    PlatMemHdr *hdr;
+
+    if (!ptr)
+        return;
+    hdr = (PlatMemHdr *)((char *)ptr - PLAT_MEM_HDR);
+    mem_detach(hdr);
+    free(hdr->raw);
+}
+
+void *plat_aligned_alloc(size_t alignment, size_t size)
+{
+    char *raw = malloc(PLAT_MEM_HDR + alignment + size);
+    uintptr_t p;
+
+    if (!raw)
+        return NULL;
+    p = ((uintptr_t)raw + PLAT_MEM_HDR + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    return mem_attach(raw, (void *)p, size, __FILE__, __LINE__);
+}
+
+void plat_aligned_free(void *ptr)
+{
+    plat_free(ptr);
+}
+
+void plat_mem_adopt(void *ptr, const void *owner)
+{
+    PlatMemHdr *hdr;
+    PlatMemOwner *o;
+
+    if (!ptr)
+        return;
+    hdr = (PlatMemHdr *)((char *)ptr - PLAT_MEM_HDR);
+    pthread_mutex_lock(&mem_lock);
+    /* a move between owners, the site keeps the block */
+    o = mem_owner(owner);
+    if (o != hdr->owner) {
+        if (hdr->owner)
+            mem_sub(&hdr->owner->st, hdr->size);
+        if (o)
+            mem_add(&o->st, hdr->size);
+        hdr->owner = o;
+    }
+    pthread_mutex_unlock(&mem_lock);
+}
+
+void plat_mem_release(const void *owner)
+{
+    int k;
+
+    pthread_mutex_lock(&mem_lock);
+    for (k = 0; k < PLAT_MEM_OWNERS; k++) {
+        if (mem_owners[k].owner == owner) {
+            memset(&mem_owners[k], 0, sizeof(PlatMemOwner));
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mem_lock);
+}
+
+int plat_mem_stats(const void *owner, PlatMemStats *st)
+{
+    int k, ret = -1;
+
+    pthread_mutex_lock(&mem_lock);
+    if (!owner) {
+        *st = mem_total;
+        ret = 0;
+    }
+    for (k = 0; owner && k < PLAT_MEM_OWNERS; k++) {
+        if (mem_owners[k].owner == owner) {
+            *st = mem_owners[k].st;
+            ret = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mem_lock);
+    return ret;
+}
+
+static int mem_site_cmp(const void *a, const void *b)
+{
+    const PlatMemSite *sa = a, *sb = b;
+
+    if (sa->st.peak_bytes != sb->st.peak_bytes)
+        return (sa->st.peak_bytes < sb->st.peak_bytes) ? 1 : -1;
+    return 0;
+}
+
+int plat_mem_dump(FILE *f)
+{
+    PlatMemSite *sites;
+    int k, n = 0;
+
+    sites = malloc(sizeof(mem_sites) + sizeof(PlatMemSite));
+    if (!sites)
+        return -1;
+
+    pthread_mutex_lock(&mem_lock);
+    for (k = 0; k < PLAT_MEM_SITES; k++)
+        if (mem_sites[k].file)
+            sites[n++] = mem_sites[k];
+    if (mem_site_other.st.allocs)
+        sites[n++] = mem_site_other;
+    pthread_mutex_unlock(&mem_lock);
+
+    qsort(sites, n, sizeof(PlatMemSite), mem_site_cmp);
+
+    fprintf(f, "%12s %12s %10s %10s  %s\n",
+            "live", "peak", "allocs", "frees", "site");
+    for (k = 0; k < n; k++)
+        fprintf(f, "%12llu %12llu %10lu %10lu  %s:%d\n",
+                (unsigned long long)sites[k].st.live_bytes,
+                (unsigned long long)sites[k].st.peak_bytes,
+                sites[k].st.allocs, sites[k].st.frees,
+                sites[k].file, sites[k].line);
+    fprintf(f, "%12llu %12llu %10lu %10lu  total\n",
+            (unsigned long long)mem_total.live_bytes,
+            (unsigned long long)mem_total.peak_bytes,
+            mem_total.allocs, mem_total.frees);
+
+    free(sites);
+    return 0;
+}
+
+#endif /* PLAT_MEM_STATS */
+
 
 
 /*************************************************************************/
-/* Trivial logging support.                                              */
+/* Trace events go to a preallocated array, writers claim slots with an  */
+/* atomic counter. The file is written when tracing stops.               */
 /*************************************************************************/
 
+typedef struct {
+    const char *name;       /* NULL until the slot is filled */
+    const char *cat;
+    const char *arg_name;
+    uint64_t start;
+    uint64_t dur;
+    int64_t arg;
+    long tid;
+} PlatTraceEvent;
+
+static PlatTraceEvent *trace_events;
+static size_t trace_max;
+static atomic_size_t trace_count;
+static atomic_int trace_on;
+static atomic_int trace_busy;   /* writers inside plat_trace_span */
+static uint64_t trace_t0;
+static char *trace_path;
+
+static long plat_thread_id(void)
+{
+    static __thread long tid;
+
+    if (!tid) {
+#ifdef __linux__
+        tid = (long)syscall(SYS_gettid);
+#else
+        tid = (long)(uintptr_t)pthread_self();
+#endif
+    }
+    return tid;
+}
+
+int plat_trace_open(const char *path, size_t max_events)
+{
+    if (trace_events)
+        return -1;
+
+    trace_path = strdup(path);
+    trace_events = calloc(max_events, sizeof(PlatTraceEvent));
+    if (!trace_path || !trace_events) {
+        free(trace_path);
+        free(trace_events);
+        trace_events = NULL;
+        return -1;
+    }
+    trace_max = max_events;
+    atomic_store(&trace_count, 0);
+    trace_t0 = plat_time_ns();
+    atomic_store(&trace_on, 1);
+    return 0;
+}
+
+int plat_trace_enabled(void)
+{
+    return atomic_load_explicit(&trace_on, memory_order_relaxed);
+}
+
+void plat_trace_span(const char *name, const char *cat,
+                     uint64_t start_ns, uint64_t dur_ns,
+                     const char *arg_name, int64_t arg)
+{
+    PlatTraceEvent *ev;
+    size_t k;
+
+    if (!atomic_load_explicit(&trace_on, memory_order_relaxed))
+        return;
+
+    atomic_fetch_add(&trace_busy, 1);
+    if (!atomic_load(&trace_on)) {
+        atomic_fetch_sub(&trace_busy, 1);
+        return;
+    }
+
+    k = atomic_fetch_add_explicit(&trace_count, 1, memory_order_relaxed);
+    if (k >= trace_max) {
+        atomic_fetch_sub(&trace_busy, 1);
+        return;
+    }
+
+    ev = &trace_events[k];
+    ev->cat = cat;
+    ev->arg_name = arg_name;
+    ev->start = start_ns;
+    ev->dur = dur_ns;
+    ev->arg = arg;
+    ev->tid = plat_thread_id();
+    __atomic_store_n(&ev->name, name, __ATOMIC_RELEASE);
+    atomic_fetch_sub(&trace_busy, 1);
+}
+
+int plat_trace_close(void)
+{
+    size_t k, n;
+    FILE *f;
+    int first = 1;
+
+    if (!trace_events)
+        return -1;
+
+    atomic_store(&trace_on, 0);
+    while (atomic_load(&trace_busy))
+        sched_yield();
+    n = atomic_load(&trace_count);
+
+    f = fopen(trace_path, "w");
+    if (f) {
+        fprintf(f, "{\"traceEvents\":[\n");
+        for (k = 0; k < n && k < trace_max; k++) {
+            PlatTraceEvent *ev = &trace_events[k];
+            const char *name = __atomic_load_n(&ev->name, __ATOMIC_ACQUIRE);
+            uint64_t ts;
+
+            if (!name || ev->start < trace_t0)
+                continue;
+            ts = ev->start - trace_t0;
+            fprintf(f, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+                       "\"ts\":%llu.%03u,\"dur\":%llu.%03u,\"pid\":%d,\"tid\":%ld",
+                    first ? "" : ",\n", name, ev->cat,
+                    (unsigned long long)(ts / 1000), (unsigned)(ts % 1000),
+                    (unsigned long long)(ev->dur / 1000), (unsigned)(ev->dur % 1000),
+                    (int)getpid(), ev->tid);
+            if (ev->arg_name)
+                fprintf(f, ",\"args\":{\"%s\":%lld}", ev->arg_name, (long long)ev->arg);
+            fprintf(f, "}");
+            first = 0;
+        }
+        fprintf(f, "\n],\"displayTimeUnit\":\"ns\",\"otherData\":{\"dropped\":%llu}}\n",
+                (unsigned long long)(n > trace_max ? n - trace_max : 0));
+        if (fclose(f) != 0)
+            f = NULL;
+    }
+
+    free(trace_events);
+    free(trace_path);
+    trace_events = NULL;
+    trace_path = NULL;
+    return f ? 0 : -1;
+}
+
+
+
+/*************************************************************************/
+/* Arenas are a list of mmap()ed blocks, filled front to back.          */
+/*************************************************************************/
+
+#define PLAT_ARENA_ALIGN    16
+
+typedef struct platarenablock_ PlatArenaBlock;
+struct platarenablock_ {
+    PlatArenaBlock *next;
+    size_t size;        /* usable bytes behind the header */
+    size_t used;
+};
+
+struct platarena_ {
+    PlatArenaBlock *first;
+    PlatArenaBlock *cur;
+    size_t block_size;
+#ifdef PLAT_MEM_STATS
+    PlatMemSite *site;      /* blocks are charged here */
+    PlatMemOwner *owner;
+#endif
+};
+
+#define PLAT_ARENA_HDR \
+    ((sizeof(PlatArenaBlock) + PLAT_ARENA_ALIGN - 1) & ~(PLAT_ARENA_ALIGN - 1))
+
+static PlatArenaBlock *plat_arena_block(PlatArena *arena, size_t size)
+{
+    PlatArenaBlock *b;
+    size_t total = PLAT_ARENA_HDR + size;
+
+    b = mmap(NULL, total, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (b == MAP_FAILED)
+        return NULL;
+#ifdef PLAT_MEM_STATS
+    pthread_mutex_lock(&mem_lock);
+    mem_charge(arena->site, arena->owner, total);
+    pthread_mutex_unlock(&mem_lock);
+#else
+    (void) arena;
+#endif
+    b->next = NULL;
+    b->size = size;
+    b->used = 0;
+    return b;
+}
+
+PlatArena *_plat_arena_new(const char *file, int line, size_t block_size)
+{
+    PlatArena *arena = calloc(1, sizeof(PlatArena));
+
+    if (!arena)
+        return NULL;
+    arena->block_size = block_size;
+#ifdef PLAT_MEM_STATS
+    pthread_mutex_lock(&mem_lock);
+    arena->site = mem_site(file, line);
+    arena->owner = NULL;
+    pthread_mutex_unlock(&mem_lock);
+#else
+    (void) file;
+    (void) line;
+#endif
+    arena->first = arena->cur = plat_arena_block(arena, block_size - PLAT_ARENA_HDR);
+    if (!arena->first) {
+        free(arena);
+        return NULL;
+    }
+    return arena;
+}
+
+void *plat_arena_alloc(PlatArena *arena, size_t size)
+{
+    PlatArenaBlock *b = arena->cur, *n;
+    void *ptr;
+
+    size = (size + PLAT_ARENA_ALIGN - 1) & ~(PLAT_ARENA_ALIGN - 1);
+
+    if (b->size - b->used < size) {
+        /* blocks behind cur are left over from before a reset */
+        n = b->next;
+        if (n && n->size >= size) {
+            n->used = 0;
+        } else {
+            size_t bs = arena->block_size - PLAT_ARENA_HDR;
+            n = plat_arena_block(arena, size > bs ? size : bs);
+            if (!n)
+                return NULL;
+            n->next = b->next;
+            b->next = n;
+        }
+        arena->cur = b = n;
+    }
+
+    ptr = (char *)b + PLAT_ARENA_HDR + b->used;
+    b->used += size;
+    return ptr;
+}
+
+void *plat_arena_zalloc(PlatArena *arena, size_t size)
+{
+    void *ptr = plat_arena_alloc(arena, size);
+
+    if (ptr)
+        memset(ptr, 0, size);
+    return ptr;
+}
+
+char *plat_arena_strdup(PlatArena *arena, const char *str)
+{
+    size_t len = strlen(str) + 1;
+    char *p = plat_arena_alloc(arena, len);
+
+    if (p)
+        memcpy(p, str, len);
+    return p;
+}
+
+void plat_arena_reset(PlatArena *arena)
+{
+    arena->cur = arena->first;
+    arena->cur->used = 0;
+}
+
+#ifdef PLAT_MEM_STATS
+void plat_arena_adopt(PlatArena *arena, const void *owner)
+{
+    PlatArenaBlock *b;
+    PlatMemOwner *o;
+
+    pthread_mutex_lock(&mem_lock);
+    o = mem_owner(owner);
+    if (o != arena->owner) {
+        for (b = arena->first; b; b = b->next) {
+            if (arena->owner)
+                mem_sub(&arena->owner->st, PLAT_ARENA_HDR + b->size);
+            if (o)
+                mem_add(&o->st, PLAT_ARENA_HDR + b->size);
+        }
+        arena->owner = o;
+    }
+    pthread_mutex_unlock(&mem_lock);
+}
+#endif
+
+void plat_arena_free(PlatArena *arena)
+{
+    PlatArenaBlock *b, *n;
+
+    if (!arena)
+        return;
+    for (b = arena->first; b; b = n) {
+        n = b->next;
+#ifdef PLAT_MEM_STATS
+        pthread_mutex_lock(&mem_lock);
+        mem_uncharge(arena->site, arena->owner, PLAT_ARENA_HDR + b->size);
+        pthread_mutex_unlock(&mem_lock);
+#endif
+        munmap(b, PLAT_ARENA_HDR + b->size);
+    }
+    free(arena);
+}
+
+
+
+/*************************************************************************/
+/* Logging. Messages below the current level are dropped before they are */
+/* formatted. After plat_log_open they go through a lock free ring that  */
+/* a background thread drains into the sink, so callers never wait for   */
+/* the sink; without it they are passed to the sink right away.          */
+/*************************************************************************/
+
+#define PLAT_LOG_SLOTS      256     /* power of two */
+#define PLAT_LOG_MSG_LEN    512
+
+typedef struct {
+    atomic_ulong seq;       /* ring protocol, see plat_log_send */
+    PlatLogLevel level;
+    const char *tag;
+    char msg[PLAT_LOG_MSG_LEN];
+} PlatLogSlot;
+
+static atomic_int log_level = PLAT_LOG_DEBUG;
+static PlatLogSink log_sink;
+static void *log_sink_data;
+
+static _Atomic(PlatLogSlot *) log_ring;  /* NULL: synchronous mode */
+static atomic_int log_senders;  /* plat_log_send calls using log_ring */
+static atomic_ulong log_head;   /* next slot to fill */
+static unsigned long log_tail;  /* next slot to drain, drain thread only */
+static atomic_ulong log_dropped;
+static atomic_int log_stop;
+static sem_t log_sem;
+static pthread_t log_thread;
+
+static void plat_log_emit(PlatLogLevel level, const char *tag, const char *msg)
+{
+    if (log_sink)
+        log_sink(level, tag, msg, log_sink_data);
+    else
+        fprintf(stderr, "[%s] %s\n", tag, msg);
+}
+
+void plat_log_set_level(PlatLogLevel level)
+{
+    atomic_store_explicit(&log_level, (int) level, memory_order_relaxed);
+}
+
+PlatLogLevel plat_log_get_level(void)
+{
+    return (PlatLogLevel) atomic_load_explicit(&log_level, memory_order_relaxed);
+}
+
+void plat_log_set_sink(PlatLogSink sink, void *userdata)
+{
+    log_sink = sink;
+    log_sink_data = userdata;
+}
+
+unsigned long plat_log_dropped(void)
+{
+    return atomic_load(&log_dropped);
+}
+
+/* drain everything published so far, returns the number of messages */
+static int plat_log_drain(PlatLogSlot *ring)
+{
+    int n = 0;
+
+    for (;;) {
+        PlatLogSlot *slot = &ring[log_tail & (PLAT_LOG_SLOTS - 1)];
+        unsigned long seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+
+        if (seq != log_tail + 1)
+            break;
+        plat_log_emit(slot->level, slot->tag, slot->msg);
+        atomic_store_explicit(&slot->seq, log_tail + PLAT_LOG_SLOTS,
+                              memory_order_release);
+        log_tail++;
+        n++;
+    }
+    return n;
+}
+
+/* arg is the ring, log_ring is already NULL for the last drain */
+static void *plat_log_thread(void *arg)
+{
+    PlatLogSlot *ring = arg;
+
+    while (!atomic_load(&log_stop)) {
+        sem_wait(&log_sem);
+        plat_log_drain(ring);
+    }
+    plat_log_drain(ring);
+    return NULL;
+}
+
 int plat_log_open(void)
 {
+    PlatLogSlot *ring;
+    unsigned long k;
+
+    if (atomic_load(&log_ring))
+        return 0;
+
+    ring = calloc(PLAT_LOG_SLOTS, sizeof(PlatLogSlot));
+    if (!ring)
+        return -1;
+    for (k = 0; k < PLAT_LOG_SLOTS; k++)
+        atomic_init(&ring[k].seq, k);
+    atomic_store(&log_head, 0);
+    log_tail = 0;
+    atomic_store(&log_stop, 0);
+
+    if (sem_init(&log_sem, 0, 0) != 0) {
+        free(ring);
+        return -1;
+    }
+    if (pthread_create(&log_thread, NULL, plat_log_thread, ring) != 0) {
+        sem_destroy(&log_sem);
+        free(ring);
+        return -1;
+    }
+    atomic_store(&log_ring, ring);
     return 0;
 }
 
@@ -132,19 +1020,96 @@ int plat_log_send(PlatLogLevel level,
                   const char *tag, const char *fmt, ...)
 {
     char buffer[1024];
+    PlatLogSlot *ring, *slot;
+    unsigned long pos;
     va_list ap;
 
+    if ((int) level < atomic_load_explicit(&log_level, memory_order_relaxed))
+        return 0;
+
+    /* Announce the call before looking at the ring: plat_log_close
+       clears log_ring first and then waits for log_senders to drop to
+       zero, so a ring seen here stays until the message is published.
+       Both are sequentially consistent, which that relies on. */
+    atomic_fetch_add(&log_senders, 1);
+    ring = atomic_load(&log_ring);
+    if (!ring) {
+        atomic_fetch_sub(&log_senders, 1);
+
+        va_start(ap, fmt);
+        vsnprintf(buffer, sizeof(buffer), fmt, ap);
+        va_end(ap);
+
+        plat_log_emit(level, tag, buffer);
+        return 0;
+    }
+
+    /* A slot is free for position pos when its seq equals pos, and
+       holds a message once seq is pos + 1. Take a free slot or drop
+       the message if the ring is full. */
+    pos = atomic_load_explicit(&log_head, memory_order_relaxed);
+    for (;;) {
+        unsigned long seq;
+        long diff;
+
+        slot = &ring[pos & (PLAT_LOG_SLOTS - 1)];
+        seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        diff = (long)(seq - pos);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&log_head, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            atomic_fetch_add(&log_dropped, 1);
+            atomic_fetch_sub(&log_senders, 1);
+            return -1;
+        } else {
+            pos = atomic_load_explicit(&log_head, memory_order_relaxed);
+        }
+    }
+
+    slot->level = level;
+    slot->tag = tag;
     va_start(ap, fmt);
-    vsnprintf(buffer, 1024, fmt, ap);
+    vsnprintf(slot->msg, PLAT_LOG_MSG_LEN, fmt, ap);
     va_end(ap);
 
-    fprintf(stderr, "[%s] %s\n", tag, buffer);
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+    sem_post(&log_sem);
+    atomic_fetch_sub(&log_senders, 1);
 
     return 0;
 }
 
 int plat_log_close(void)
 {
+    PlatLogSlot *ring;
+    unsigned long dropped;
+
+    /* new messages go to the sink directly from here on, the ones being
+       written into the ring are waited for */
+    ring = atomic_exchange(&log_ring, NULL);
+    if (!ring)
+        return 0;
+    while (atomic_load(&log_senders) > 0)
+        sched_yield();
+
+    atomic_store(&log_stop, 1);
+    sem_post(&log_sem);
+    pthread_join(log_thread, NULL);
+    sem_destroy(&log_sem);
+
+    /* a slot taken but never drained would be lost, count it */
+    atomic_fetch_add(&log_dropped, atomic_load(&log_head) - log_tail);
+    free(ring);
+
+    dropped = atomic_load(&log_dropped);
+    if (dropped > 0) {
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer), "%lu messages dropped", dropped);
+        plat_log_emit(PLAT_LOG_WARNING, __FILE__, buffer);
+    }
     return 0;
 }
 
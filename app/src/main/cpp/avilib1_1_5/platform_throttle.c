@@ -0,0 +1,340 @@
+/*
+ * platform_throttle.c -- slow storage emulation for benchmarks.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "platform.h"
+#include "platform_throttle.h"
+
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+
+struct platthrottle_ {
+    PlatThrottleConfig cfg;
+    pthread_mutex_t lock;
+    uint64_t free_at;               /* real mode: device busy until */
+    const PlatThrottleFile *last;   /* file and end of the last request */
+    int64_t last_end;
+    uint64_t rnd;
+    unsigned long files;
+    PlatThrottleStats st;
+};
+
+struct platthrottlefile_ {
+    PlatThrottle *dev;
+    int fd;
+};
+
+/*************************************************************************/
+/* configuration                                                         */
+/*************************************************************************/
+
+/* ballpark figures for each class of device, not any particular part */
+static const struct {
+    const char *name;
+    PlatThrottleConfig cfg;
+} presets[] = {
+    { "sdcard", {  800,   20000000,  1500,  65536, 0.002,  50000, 1, 0 } },
+    { "usb2",   {  300,   30000000,   600,  65536, 0.001,  20000, 1, 0 } },
+    { "hdd",    {  100,  150000000,  8000, 262144, 0.0005, 30000, 1, 0 } },
+    { "nvme",   {   20, 2000000000,     0,      0, 0,          0, 1, 0 } },
+};
+
+static int parse_size(const char *val, uint64_t *out)
+{
+    char *end;
+    double v = strtod(val, &end);
+
+    switch (*end) {
+      case 'k': v *= 1e3; end++; break;
+      case 'M': v *= 1e6; end++; break;
+      case 'G': v *= 1e9; end++; break;
+    }
+    if (end == val || *end || v < 0)
+        return -1;
+    *out = (uint64_t)v;
+    return 0;
+}
+
+static int parse_item(const char *item, PlatThrottleConfig *cfg)
+{
+    const char *eq = strchr(item, '=');
+    const char *val = eq ? eq + 1 : NULL;
+    size_t klen = eq ? (size_t)(eq - item) : strlen(item);
+    uint64_t u;
+    char *end;
+    size_t i;
+
+    if (!eq) {
+        for (i = 0; i < sizeof(presets) / sizeof(presets[0]); i++) {
+            if (!strcmp(item, presets[i].name)) {
+                *cfg = presets[i].cfg;
+                return 0;
+            }
+        }
+        return -1;
+    }
+
+#define KEY(k)  (klen == sizeof(k) - 1 && !strncmp(item, k, klen))
+    if (KEY("spike")) {
+        cfg->spike_rate = strtod(val, &end);
+        return (end == val || *end || cfg->spike_rate < 0
+                || cfg->spike_rate > 1) ? -1 : 0;
+    }
+    if (parse_size(val, &u) < 0)
+        return -1;
+    if (KEY("lat"))
+        cfg->latency_us = (uint32_t)u;
+    else if (KEY("bw"))
+        cfg->bandwidth = u;
+    else if (KEY("seek"))
+        cfg->seek_us = (uint32_t)u;
+    else if (KEY("gap"))
+        cfg->seek_gap = (uint32_t)u;
+    else if (KEY("spike_us"))
+        cfg->spike_us = (uint32_t)u;
+    else if (KEY("seed") && u)
+        cfg->seed = u;
+    else if (KEY("virtual"))
+        cfg->virtual_time = u != 0;
+    else
+        return -1;
+#undef KEY
+    return 0;
+}
+
+int plat_throttle_parse(const char *spec, PlatThrottleConfig *cfg)
+{
+    char buf[256], *item, *save = NULL;
+
+    if (!spec || !cfg || strlen(spec) >= sizeof(buf)) {
+        errno = EINVAL;
+        return -1;
+    }
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->seed = 1;
+
+    strcpy(buf, spec);
+    for (item = strtok_r(buf, ",", &save); item;
+         item = strtok_r(NULL, ",", &save)) {
+        if (parse_item(item, cfg) < 0) {
+            plat_log_send(PLAT_LOG_ERROR, __FILE__,
+                          "bad throttle setting '%s'", item);
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*************************************************************************/
+/* the device                                                            */
+/*************************************************************************/
+
+PlatThrottle *plat_throttle_new(const PlatThrottleConfig *cfg)
+{
+    PlatThrottle *dev;
+
+    if (!cfg) {
+        errno = EINVAL;
+        return NULL;
+    }
+    dev = plat_zalloc(sizeof(*dev));
+    if (!dev)
+        return NULL;
+    dev->cfg = *cfg;
+    dev->rnd = cfg->seed ? cfg->seed : 1;
+    pthread_mutex_init(&dev->lock, NULL);
+    return dev;
+}
+
+void plat_throttle_free(PlatThrottle *dev)
+{
+    if (!dev)
+        return;
+    if (dev->files)
+        plat_log_send(PLAT_LOG_WARNING, __FILE__,
+                      "device freed with %lu open files", dev->files);
+    pthread_mutex_destroy(&dev->lock);
+    plat_free(dev);
+}
+
+void plat_throttle_stats(PlatThrottle *dev, PlatThrottleStats *st)
+{
+    pthread_mutex_lock(&dev->lock);
+    *st = dev->st;
+    pthread_mutex_unlock(&dev->lock);
+}
+
+/* xorshift64*, uniform in [0, 1) */
+static double throttle_random(PlatThrottle *dev)
+{
+    dev->rnd ^= dev->rnd >> 12;
+    dev->rnd ^= dev->rnd << 25;
+    dev->rnd ^= dev->rnd >> 27;
+    return ((dev->rnd * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * charge one request to the device and, in real mode, sleep until the
+ * device would have finished it. Service starts when the request
+ * arrives or when the device is done with the one before, whichever
+ * is later.
+ */
+static void throttle_request(PlatThrottleFile *f, int64_t offset, size_t count)
+{
+    PlatThrottle *dev = f->dev;
+    const PlatThrottleConfig *cfg = &dev->cfg;
+    uint64_t ns, now = 0, done = 0;
+    struct timespec ts;
+
+    pthread_mutex_lock(&dev->lock);
+    ns = (uint64_t)cfg->latency_us * 1000;
+    if (cfg->bandwidth)
+        ns += (uint64_t)((double)count * 1e9 / cfg->bandwidth);
+    if (dev->last != f || offset < dev->last_end
+        || offset - dev->last_end > cfg->seek_gap) {
+        /* the very first request is no seek */
+        if (dev->st.requests) {
+            ns += (uint64_t)cfg->seek_us * 1000;
+            dev->st.seeks++;
+        }
+    }
+    if (cfg->spike_rate > 0 && throttle_random(dev) < cfg->spike_rate) {
+        ns += (uint64_t)cfg->spike_us * 1000;
+        dev->st.spikes++;
+    }
+    dev->last = f;
+    dev->last_end = offset + (int64_t)count;
+    dev->st.requests++;
+    dev->st.bytes += count;
+    dev->st.busy_ns += ns;
+
+    if (!cfg->virtual_time) {
+        now = plat_time_ns();
+        done = (dev->free_at > now ? dev->free_at : now) + ns;
+        dev->free_at = done;
+        dev->st.wait_ns += done - now;
+    }
+    pthread_mutex_unlock(&dev->lock);
+
+    if (cfg->virtual_time)
+        return;
+    /* plat_time_ns is CLOCK_MONOTONIC as well */
+    ts.tv_sec = done / 1000000000ULL;
+    ts.tv_nsec = done % 1000000000ULL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+/*************************************************************************/
+/* files                                                                 */
+/*************************************************************************/
+
+PlatThrottleFile *plat_throttle_open(PlatThrottle *dev,
+                                     const char *path, int flags)
+{
+    PlatThrottleFile *f;
+
+    if (!dev || !path) {
+        errno = EINVAL;
+        return NULL;
+    }
+    f = plat_zalloc(sizeof(*f));
+    if (!f)
+        return NULL;
+    f->fd = plat_open(path, flags, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (f->fd < 0) {
+        plat_free(f);
+        return NULL;
+    }
+    f->dev = dev;
+    pthread_mutex_lock(&dev->lock);
+    dev->files++;
+    pthread_mutex_unlock(&dev->lock);
+    return f;
+}
+
+ssize_t plat_throttle_read_at(void *file, void *buf, size_t count,
+                              int64_t offset)
+{
+    PlatThrottleFile *f = file;
+    ssize_t n = plat_pread(f->fd, buf, count, offset);
+
+    if (n >= 0)
+        throttle_request(f, offset, (size_t)n);
+    return n;
+}
+
+ssize_t plat_throttle_write_at(void *file, const void *buf, size_t count,
+                               int64_t offset)
+{
+    PlatThrottleFile *f = file;
+    const char *p = buf;
+    size_t done = 0;
+
+    while (done < count) {
+        ssize_t n = pwrite(f->fd, p + done, count - done, offset + done);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        done += n;
+    }
+    throttle_request(f, offset, count);
+    return (ssize_t)count;
+}
+
+int64_t plat_throttle_size(void *file)
+{
+    PlatThrottleFile *f = file;
+
+    return plat_seek(f->fd, 0, SEEK_END);
+}
+
+int plat_throttle_truncate(void *file, int64_t length)
+{
+    PlatThrottleFile *f = file;
+
+    return ftruncate(f->fd, length);
+}
+
+int plat_throttle_close(void *file)
+{
+    PlatThrottleFile *f = file;
+    PlatThrottle *dev = f->dev;
+    int ret = plat_close(f->fd);
+
+    pthread_mutex_lock(&dev->lock);
+    dev->files--;
+    if (dev->last == f)
+        dev->last = NULL;
+    pthread_mutex_unlock(&dev->lock);
+    plat_free(f);
+    return ret;
+}
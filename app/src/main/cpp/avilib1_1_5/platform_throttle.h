@@ -0,0 +1,103 @@
+/*
+ * platform_throttle.h -- slow storage emulation for benchmarks.
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef PLATFORM_THROTTLE_H
+#define PLATFORM_THROTTLE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*************************************************************************/
+/* throttled files                                                       */
+/*************************************************************************/
+
+/* A PlatThrottle is a modelled storage device: every request to one of
+   its files costs a fixed latency, the transfer time at the device
+   bandwidth, a seek penalty when it does not start shortly after the
+   previous request ended and, now and then, a latency spike drawn from
+   a seeded generator. Requests are served one after the other, like on a single
+   queue SD card, so concurrent readers wait for each other.
+
+   The file calls have the signatures of the avi_io_t callbacks; a
+   throttled file is opened with AVI_open_io/AVI_open_output_io:
+
+       avi_io_t io = { plat_throttle_read_at, plat_throttle_write_at,
+                       plat_throttle_size, NULL, plat_throttle_truncate,
+                       plat_throttle_close,
+                       plat_throttle_open(dev, path, O_RDONLY) };
+
+   With virtual_time set nothing sleeps, the service time only adds up
+   in PlatThrottleStats.busy_ns. Those numbers depend on the request
+   pattern alone, not on the machine, and are the ones to compare on CI.
+
+   Only the host benchmarks link this; it is no part of the library. */
+
+typedef struct platthrottleconfig_ {
+    uint32_t latency_us;    /* per request */
+    uint64_t bandwidth;     /* bytes per second, 0 for unlimited */
+    uint32_t seek_us;       /* request not continuing the previous one */
+    uint32_t seek_gap;      /* forward skips up to this many bytes are
+                               no seek (readahead, same erase block) */
+    double   spike_rate;    /* probability of a spike per request */
+    uint32_t spike_us;
+    uint64_t seed;          /* of the spike generator, not 0 */
+    int      virtual_time;  /* account the service time, don't sleep */
+} PlatThrottleConfig;
+
+typedef struct platthrottlestats_ {
+    uint64_t requests;
+    uint64_t bytes;
+    uint64_t seeks;
+    uint64_t spikes;
+    uint64_t busy_ns;       /* modelled service time */
+    uint64_t wait_ns;       /* real mode: time spent queued and asleep */
+} PlatThrottleStats;
+
+typedef struct platthrottle_ PlatThrottle;
+typedef struct platthrottlefile_ PlatThrottleFile;
+
+/* "preset[,key=value...]", "key=value,..." starts from no throttling.
+   presets: sdcard, usb2, hdd, nvme
+   keys: lat, seek, spike_us (microseconds), bw (bytes/s), gap (bytes),
+   spike (rate), seed, virtual (0/1). k/M/G suffixes are powers of
+   1000.
+   Returns -1 on a bad spec. */
+int plat_throttle_parse(const char *spec, PlatThrottleConfig *cfg);
+
+PlatThrottle *plat_throttle_new(const PlatThrottleConfig *cfg);
+/* all files of the device must be closed */
+void plat_throttle_free(PlatThrottle *dev);
+/* stats of all files since plat_throttle_new */
+void plat_throttle_stats(PlatThrottle *dev, PlatThrottleStats *st);
+
+/* flags as for open(2), new files get mode 0644 */
+PlatThrottleFile *plat_throttle_open(PlatThrottle *dev,
+                                     const char *path, int flags);
+
+/* void * so that they fit avi_io_t as they are */
+ssize_t plat_throttle_read_at(void *file, void *buf, size_t count,
+                              int64_t offset);
+ssize_t plat_throttle_write_at(void *file, const void *buf, size_t count,
+                               int64_t offset);
+int64_t plat_throttle_size(void *file);
+int plat_throttle_truncate(void *file, int64_t length);
+int plat_throttle_close(void *file);
+
+#endif /* PLATFORM_THROTTLE_H */
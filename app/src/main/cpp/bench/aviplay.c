@@ -0,0 +1,389 @@
+/*
+ * aviplay.c -- headless playback of an AVI, for timing the player
+ *
+ * Plays a file (or one generated with avigen) through playback.c into
+ * a sink that only burns the given time per frame, standing in for
+ * decoding and drawing. With -m naive the loop the app used before is
+ * run instead: show a frame, sleep (int) (1000 / fps) ms. Reported are
+ * the frames shown and dropped, how late they were and how far the
+ * last frame drifted from its presentation time.
+ *
+ *   aviplay [-f file | -n frames -F fps -k keyint -s size] [-m clock|naive]
+ *           [-K any|key] [-c cost_us] [-J jitter_us] [-S seed] [-V]
+ *           [-r slots] [-t storage] [-a track [-M audio|video] [-p period_us]
+ *           [-q periods] [-d skew_ppm] [-e format] [-C channels] [-g gain]
+ *           [-w out.wav]] [-j result.json]
+ *
+ * -V runs on a virtual clock: sleeping and the sink cost only advance
+ * it, so results do not depend on the machine. -r reads ahead through
+ * a frame ring, -t reads from emulated slow storage (see benchthrottle.h);
+ * together they show how much of the read latency the ring hides.
+ *
+ * -a plays an audio track on the host device of audio.h, whose clock
+ * can be made to run off CLOCK_MONOTONIC by -d ppm, as sound cards do.
+ * The device knows what it plays when, so every frame shown is checked
+ * against the audio heard at that moment (the A/V offset). With -M
+ * audio (the default) the frames are timed on the audio clock, with -M
+ * video on CLOCK_MONOTONIC as without audio, which lets the offset drift.
+ * -e, -C and -g have the device take another sample format (u8, s16,
+ * s24, s32, f32), channel count or gain than the track's; the reader
+ * converts (pcmconv.h).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "audio.h"
+#include "avigen.h"
+#include "benchthrottle.h"
+#include "benchutil.h"
+#include "playback.h"
+
+typedef struct {
+  int virt;
+  uint64_t vnow;
+} play_clock_t;
+
+typedef struct {
+  play_clock_t *clock;
+  uint64_t cost, jitter, rnd;
+  uint64_t t0;              /* clock at the start of playback */
+  bench_lat_t late;         /* lateness of shown frames */
+  long shown, last;
+  uint64_t last_shown;      /* clock when the last frame was shown */
+  audio_host_t *host;       /* with audio */
+  bench_lat_t av;           /* |A/V offset| of shown frames */
+  int64_t av_min, av_max, av_last;
+} play_sink_t;
+
+static uint64_t clock_now(void *opaque) {
+  play_clock_t *c = opaque;
+
+  return c->virt ? c->vnow : bench_now_ns();
+}
+
+static void clock_sleep_until(void *opaque, uint64_t ns) {
+  play_clock_t *c = opaque;
+  uint64_t now;
+
+  if (c->virt) {
+    if (ns > c->vnow) c->vnow = ns;
+    return;
+  }
+  now = bench_now_ns();
+  if (ns > now) {
+    struct timespec ts = { (time_t) ((ns - now) / 1000000000ULL),
+                           (long) ((ns - now) % 1000000000ULL) };
+    nanosleep(&ts, NULL);
+  }
+}
+
+/* spends the cost of decoding and drawing a frame */
+static void burn(play_sink_t *s) {
+  uint64_t ns = s->cost, t;
+
+  if (s->jitter) ns += bench_rand(&s->rnd) % s->jitter;
+  if (s->clock->virt) {
+    s->clock->vnow += ns;
+    return;
+  }
+  t = bench_now_ns();
+  while (bench_now_ns() - t < ns)
+    ;
+}
+
+static int sink_frame(void *opaque, const playback_frame_t *f) {
+  play_sink_t *s = opaque;
+
+  bench_lat_add(&s->late, f->late_ns > 0 ? (uint64_t) f->late_ns : 0);
+  if (s->host) {
+    // > 0: the picture comes after its sound
+    int64_t av = (int64_t) (audio_host_pts(s->host) - f->pts_ns);
+
+    bench_lat_add(&s->av, (uint64_t) (av < 0 ? -av : av));
+    if (!s->shown || av < s->av_min) s->av_min = av;
+    if (!s->shown || av > s->av_max) s->av_max = av;
+    s->av_last = av;
+  }
+  s->shown++;
+  s->last = f->frame;
+  s->last_shown = clock_now(s->clock);
+  burn(s);
+  return 0;
+}
+
+/* the pacing VideoActivity used to do */
+static int play_naive(avi_t *AVI, playback_t *p, play_sink_t *s) {
+  long i, n = AVI_video_frames(AVI), maxlen = 0;
+  uint64_t interval = (uint64_t) (int) (1000 / AVI_frame_rate(AVI)) * 1000000;
+  char *buf;
+
+  for (i = 0; i < n; i++)
+    if (AVI_frame_size(AVI, i) > maxlen) maxlen = AVI_frame_size(AVI, i);
+  buf = malloc(maxlen + 1);
+  if (!buf) return -1;
+
+  AVI_seek_start(AVI);
+  for (i = 0; i < n; i++) {
+    playback_frame_t f;
+
+    memset(&f, 0, sizeof(f));
+    f.len = AVI_read_frame(AVI, buf, &f.keyframe);
+    if (f.len < 0) break;
+    f.data = buf;
+    f.frame = i;
+    f.pts_ns = playback_pts(p, i);
+    f.late_ns = (int64_t) (clock_now(s->clock) - s->t0 - f.pts_ns);
+    sink_frame(s, &f);
+    clock_sleep_until(s->clock, clock_now(s->clock) + interval);
+  }
+  free(buf);
+  return i < n ? -1 : 0;
+}
+
+static void usage(void) {
+  fprintf(stderr,
+          "usage: aviplay [options]\n"
+          "  -f FILE   play an existing file\n"
+          "  -o FILE   generate the test file here (aviplay.avi)\n"
+          "  -n N      frames to generate (750)\n"
+          "  -F FPS    frame rate to generate (29.97)\n"
+          "  -k N      keyframe interval to generate (12)\n"
+          "  -s N      bytes per frame to generate (10000)\n"
+          "  -m MODE   clock (playback.c) or naive (sleep per frame) (clock)\n"
+          "  -K MODE   skip to any frame or the next keyframe when late (default\n"
+          "            from the file)\n"
+          "  -c US     cost of a frame in the sink (5000)\n"
+          "  -J US     random extra cost up to this (0)\n"
+          "  -S SEED   random seed (1)\n"
+          "  -V        virtual clock\n"
+          "  -r N      read ahead into a ring of N frames (0)\n"
+          "  -t SPEC   read from emulated storage, see avibench\n"
+          "  -a N      play audio track N on the host device\n"
+          "  -M MODE   time frames on the audio or the video clock (audio)\n"
+          "  -p US     device period (10000)\n"
+          "  -q N      periods queued in the device (4)\n"
+          "  -d PPM    device clock off CLOCK_MONOTONIC by this (0)\n"
+          "  -e FMT    device sample format: u8, s16, s24, s32, f32 (the track's)\n"
+          "  -C N      device channels (the track's)\n"
+          "  -g GAIN   gain of the audio (1)\n"
+          "  -w FILE   write what the device plays as WAV\n"
+          "  -j FILE   write the JSON result here (stdout)\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  const char *file = "aviplay.avi", *mode = "clock", *skip = NULL, *master = "audio";
+  avigen_opts_t o;
+  play_clock_t clk;
+  play_sink_t s;
+  playback_clock_t pc = { clock_now, clock_sleep_until, &clk };
+  playback_sink_t sink = { sink_frame, &s };
+  playback_stats_t st;
+  avi_ring_stats_t rs;
+  audio_host_config_t hc;
+  audio_sink_t as;
+  audio_stats_t ast;
+  audio_t *audio = NULL;
+  PlatThrottle *dev = NULL;
+  playback_t *p;
+  bench_json_t j;
+  FILE *out = stdout;
+  avi_t *AVI;
+  uint32_t rate = 0, scale = 0;
+  int c, generate = 1, r, slots = 0, track = -1, channels = 0;
+  pcm_fmt_t sample = PCM_FMT_NONE;
+  float gain = 1;
+
+  avigen_defaults(&o);
+  o.frames = 750;
+  o.fps = 29.97;
+  o.frame_size = 10000;
+  memset(&clk, 0, sizeof(clk));
+  memset(&s, 0, sizeof(s));
+  s.clock = &clk;
+  s.cost = 5000000;
+  s.rnd = 1;
+  memset(&hc, 0, sizeof(hc));
+
+  while ((c = getopt(argc, argv, "f:o:n:F:k:s:m:K:c:J:S:Vr:t:a:M:p:q:d:e:C:g:w:j:h")) != -1) {
+    switch (c) {
+      case 'f': file = optarg; generate = 0; break;
+      case 'o': file = optarg; break;
+      case 'n': o.frames = atol(optarg); break;
+      case 'F': o.fps = atof(optarg); break;
+      case 'k': o.keyint = atol(optarg); break;
+      case 's': o.frame_size = atol(optarg); break;
+      case 'm': mode = optarg; break;
+      case 'K': skip = optarg; break;
+      case 'c': s.cost = strtoull(optarg, NULL, 0) * 1000; break;
+      case 'J': s.jitter = strtoull(optarg, NULL, 0) * 1000; break;
+      case 'S': s.rnd = strtoull(optarg, NULL, 0); break;
+      case 'V': clk.virt = 1; break;
+      case 'r': slots = atoi(optarg); break;
+      case 't':
+        dev = bench_throttle_new(optarg);
+        if (!dev) return 1;
+        break;
+      case 'a': track = atoi(optarg); break;
+      case 'M': master = optarg; break;
+      case 'p': hc.period_us = atoi(optarg); break;
+      case 'q': hc.periods = atoi(optarg); break;
+      case 'd': hc.skew_ppm = atof(optarg); break;
+      case 'e':
+        for (sample = 0; sample < PCM_FMT_COUNT; sample++)
+          if (!strcmp(optarg, pcm_fmt_name(sample))) break;
+        if (sample == PCM_FMT_COUNT) usage();
+        break;
+      case 'C': channels = atoi(optarg); break;
+      case 'g': gain = (float) atof(optarg); break;
+      case 'w': hc.wav = optarg; break;
+      case 'j':
+        out = fopen(optarg, "w");
+        if (!out) {
+          perror(optarg);
+          return 1;
+        }
+        break;
+      default: usage();
+    }
+  }
+  if ((strcmp(mode, "clock") && strcmp(mode, "naive")) || !s.rnd ||
+      (skip && strcmp(skip, "any") && strcmp(skip, "key")) ||
+      (strcmp(master, "audio") && strcmp(master, "video")) ||
+      // the audio device plays in real time
+      (track >= 0 && (clk.virt || strcmp(mode, "clock"))))
+    usage();
+
+  if (generate && avigen_write(file, &o, NULL) < 0) return 1;
+  AVI = dev ? bench_throttle_input(dev, file) : AVI_open_input_file(file, 1);
+  if (!AVI) {
+    AVI_print_error("aviplay: open");
+    return 1;
+  }
+  p = playback_new(AVI, &sink, &pc);
+  if (!p) {
+    fprintf(stderr, "aviplay: %s has no frame rate\n", file);
+    return 1;
+  }
+  if (slots && (strcmp(mode, "clock") || playback_set_readahead(p, slots) < 0)) {
+    fprintf(stderr, "aviplay: no read-ahead ring of %d slots\n", slots);
+    return 1;
+  }
+  if (skip) playback_set_skip(p, strcmp(skip, "key") ? PLAYBACK_ANY_FRAME : PLAYBACK_KEYFRAME);
+  AVI_frame_rate_rational(AVI, &rate, &scale);
+  if (track >= 0) {
+    if (!(s.host = audio_host_new(&hc))) return 1;
+    as = audio_host_sink(s.host);
+    audio = audio_new(AVI, track, &as, 0);
+    if (!audio) {
+      fprintf(stderr, "aviplay: no PCM audio track %d in %s\n", track, file);
+      return 1;
+    }
+    if ((sample != PCM_FMT_NONE || channels || gain != 1)
+        && audio_set_output(audio, sample != PCM_FMT_NONE ? sample : audio_track_format(audio)->sample,
+                            channels ? channels : audio_track_format(audio)->channels, gain) < 0) {
+      fprintf(stderr, "aviplay: no conversion of track %d to %s, %d channels\n", track,
+              pcm_fmt_name(sample), channels);
+      return 1;
+    }
+    if (!strcmp(master, "audio")) playback_set_audio(p, audio);
+  }
+
+  s.t0 = clock_now(&clk);
+  if (audio && strcmp(master, "audio") && audio_start(audio, 0) < 0) {
+    fprintf(stderr, "aviplay: the device does not play track %d\n", track);
+    return 1;
+  }
+  r = strcmp(mode, "naive") ? playback_run(p) : play_naive(AVI, p, &s);
+  if (r < 0) AVI_print_error("aviplay: play");
+  if (audio) audio_stop(audio);
+  playback_get_stats(p, &st);
+
+  memset(&j, 0, sizeof(j));
+  j.f = out;
+  bench_json_obj(&j, NULL);
+  bench_json_str(&j, "bench", "aviplay");
+  bench_json_str(&j, "file", file);
+  bench_json_str(&j, "mode", mode);
+  bench_json_int(&j, "virtual_clock", clk.virt);
+  bench_json_int(&j, "rate", rate);
+  bench_json_int(&j, "scale", scale);
+  bench_json_int(&j, "frames", AVI_video_frames(AVI));
+  bench_json_int(&j, "shown", s.shown);
+  bench_json_int(&j, "dropped", AVI_video_frames(AVI) - s.shown);
+  bench_json_int(&j, "skips", st.skips);
+  bench_json_num(&j, "cost_ms", s.cost / 1e6);
+  // > 0: the last frame came later than its presentation time
+  bench_json_num(&j, "end_drift_ms", s.shown ?
+                 ((double) (s.last_shown - s.t0) - (double) playback_pts(p, s.last)) / 1e6 : 0);
+  bench_json_num(&j, "played_s", (clock_now(&clk) - s.t0) / 1e9);
+  bench_json_num(&j, "content_s", playback_pts(p, AVI_video_frames(AVI)) / 1e9);
+  bench_json_num(&j, "read_ms", st.read_ns / 1e6);
+  bench_json_obj(&j, "late");
+  bench_json_lat(&j, &s.late);
+  bench_json_end(&j);
+  if (playback_ring_stats(p, &rs) == 0) {
+    bench_json_obj(&j, "ring");
+    bench_json_int(&j, "slots", rs.slots);
+    bench_json_int(&j, "produced", rs.produced);
+    bench_json_int(&j, "discarded", rs.discarded);
+    bench_json_int(&j, "seeks", rs.seeks);
+    bench_json_int(&j, "underruns", rs.underruns);
+    bench_json_num(&j, "underrun_ms", rs.underrun_ns / 1e6);
+    bench_json_int(&j, "full_waits", rs.full_waits);
+    bench_json_num(&j, "mean_fill", rs.consumed ? (double) rs.fill_sum / rs.consumed : 0);
+    bench_json_int(&j, "min_fill", rs.fill_min);
+    bench_json_end(&j);
+  }
+  if (audio) {
+    const audio_format_t *af = audio_format(audio);
+
+    audio_get_stats(audio, &ast);
+    bench_json_obj(&j, "audio");
+    bench_json_int(&j, "track", track);
+    bench_json_str(&j, "master", st.audio_master ? "audio" : "video");
+    bench_json_int(&j, "rate", af->rate);
+    bench_json_int(&j, "channels", af->channels);
+    bench_json_int(&j, "bits", af->bits);
+    bench_json_str(&j, "sample", pcm_fmt_name(af->sample));
+    bench_json_str(&j, "track_sample", pcm_fmt_name(audio_track_format(audio)->sample));
+    bench_json_int(&j, "track_channels", audio_track_format(audio)->channels);
+    bench_json_num(&j, "gain", gain);
+    bench_json_num(&j, "skew_ppm", hc.skew_ppm);
+    bench_json_num(&j, "drift_ppm", ast.drift_ppm);
+    bench_json_num(&j, "latency_ms", ast.latency_ns / 1e6);
+    bench_json_int(&j, "pulls", ast.pulls);
+    bench_json_int(&j, "underruns", ast.underruns);
+    bench_json_num(&j, "silence_ms", ast.silence / (double) af->block / af->rate * 1e3);
+    bench_json_num(&j, "ring_ms", ast.ring_bytes / (double) af->block / af->rate * 1e3);
+    bench_json_num(&j, "ring_min_ms", ast.ring_min / (double) af->block / af->rate * 1e3);
+    bench_json_int(&j, "reads", ast.reads);
+    bench_json_int(&j, "full_waits", ast.full_waits);
+    bench_json_int(&j, "snaps", ast.snaps);
+    bench_json_num(&j, "clock_error_mean_us", ast.measured ? ast.error_ns / 1e3 / ast.measured : 0);
+    bench_json_num(&j, "clock_error_max_us", ast.max_error_ns / 1e3);
+    bench_json_end(&j);
+    // > 0: the picture comes after its sound
+    bench_json_obj(&j, "av_offset");
+    bench_json_num(&j, "min_ms", s.av_min / 1e6);
+    bench_json_num(&j, "max_ms", s.av_max / 1e6);
+    bench_json_num(&j, "end_ms", s.av_last / 1e6);
+    bench_json_lat(&j, &s.av);
+    bench_json_end(&j);
+  }
+  bench_json_end(&j);
+
+  bench_lat_free(&s.late);
+  bench_lat_free(&s.av);
+  audio_free(audio);
+  audio_host_free(s.host);
+  playback_free(p);
+  AVI_close(AVI);
+  plat_throttle_free(dev);
+  if (generate) unlink(file);
+  if (out != stdout) fclose(out);
+  return r < 0;
+}
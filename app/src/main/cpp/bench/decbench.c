@@ -0,0 +1,304 @@
+/*
+ * decbench.c -- throughput of the decoder pool in vdec.c
+ *
+ * Feeds a stream of uncompressed frames through vdec the way playback
+ * does -- submit while there is room, then take the next frame -- with
+ * 1, 2, 4 ... worker threads, and reports frames per second and how
+ * often the consumer had to wait for a frame. Every frame that comes
+ * out is checked to be the one expected at that place and to match a
+ * conversion done directly with pixconv / pixscale on one thread.
+ *
+ *   decbench [-s format] [-W width -H height] [-w width -h height]
+ *            [-o rgb565|rgba8888] [-T threads] [-d depth] [-F chunks]
+ *            [-n frames] [-S seed] [-j result.json]
+ *
+ * The frames are -F chunks of random pixels, shown in a loop. -w/-h
+ * scale them on the workers. -T is the most threads tried (one per
+ * CPU, at least 2). Timings only mean something from an optimized
+ * build, and more threads than CPUs only add overhead.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "benchutil.h"
+#include "pixscale.h"
+#include "vdec.h"
+
+typedef struct {
+  vdec_stream_t st;
+  alBITMAPINFOHEADER bih;
+  vdec_config_t cfg;
+  int chunks;
+  long frames, len;
+  char **chunk;
+  uint64_t *ref;            /* hash of the expected output per chunk */
+} bench_t;
+
+/* the strf of an uncompressed stream of fmt */
+static int make_bih(alBITMAPINFOHEADER *bih, pix_fmt_t fmt, int width, int height) {
+  static const struct {
+    pix_fmt_t fmt;
+    uint32_t comp;
+    int bits;
+  } dib[] = {
+    { PIX_FMT_BGR24, 0, 24 },
+    { PIX_FMT_BGR32, 0, 32 },
+    { PIX_FMT_RGB555, 0, 16 },
+    { PIX_FMT_RGB565, 3, 16 },
+    { PIX_FMT_YUY2, VDEC_FOURCC('Y', 'U', 'Y', '2'), 16 },
+    { PIX_FMT_UYVY, VDEC_FOURCC('U', 'Y', 'V', 'Y'), 16 },
+    { PIX_FMT_I420, VDEC_FOURCC('I', '4', '2', '0'), 12 },
+    { PIX_FMT_YV12, VDEC_FOURCC('Y', 'V', '1', '2'), 12 },
+  };
+  size_t i;
+
+  for (i = 0; i < sizeof(dib) / sizeof(dib[0]); i++) {
+    if (dib[i].fmt != fmt) continue;
+    // avilib keeps the header as it is in the file: little-endian, as
+    // is every host this runs on
+    memset(bih, 0, sizeof(*bih));
+    bih->bi_size = sizeof(*bih);
+    bih->bi_width = width;
+    bih->bi_height = height;
+    bih->bi_planes = 1;
+    bih->bi_bit_count = dib[i].bits;
+    bih->bi_compression = dib[i].comp;
+    return 0;
+  }
+  return -1;
+}
+
+static uint64_t hash_image(const pix_image_t *img) {
+  int bpp = img->fmt == PIX_FMT_RGB565 ? 2 : 4;
+  uint64_t h = 14695981039346656037ULL;
+  int x, y;
+
+  for (y = 0; y < img->height; y++) {
+    const uint8_t *p = img->data[0] + (long) y * img->stride[0];
+
+    for (x = 0; x < img->width * bpp; x++)
+      h = (h ^ p[x]) * 1099511628211ULL;
+  }
+  return h;
+}
+
+/* what the workers should make of each chunk, done here directly */
+static int make_refs(bench_t *b) {
+  size_t size = pix_image_size(b->cfg.fmt, b->cfg.width, b->cfg.height);
+  uint8_t *buf = malloc(size);
+  pix_scaler_t *s = NULL;
+  pix_image_t src, dst;
+  int i, ret = 0;
+
+  if (!buf) return -1;
+  if (b->cfg.width != b->st.width || b->cfg.height != b->st.height)
+    s = pix_scaler_new(b->st.width, b->st.height, b->cfg.width, b->cfg.height, PIX_SCALE_BILINEAR, 1);
+  pix_image_init(&dst, b->cfg.fmt, b->cfg.width, b->cfg.height, buf, 0);
+  for (i = 0; i < b->chunks && !ret; i++) {
+    if (pix_image_dib(&src, &b->bih, b->chunk[i], b->len) < 0
+        || (s ? pix_scale(s, &src, &dst) : pix_convert(&src, &dst)) < 0)
+      ret = -1;
+    b->ref[i] = hash_image(&dst);
+  }
+  pix_scaler_free(s);
+  free(buf);
+  return ret;
+}
+
+/* plays b->frames frames through d; with check, returns the frames that
+   were wrong, hashing them takes longer than decoding */
+static long run(bench_t *b, vdec_t *d, int check, double *ms) {
+  long fed = 0, n, bad = 0;
+  uint64_t t = bench_now_ns();
+
+  for (n = 0; n < b->frames; n++) {
+    const vdec_frame_t *f;
+
+    while (fed < b->frames && vdec_can_submit(d)) {
+      vdec_submit(d, fed, b->chunk[fed % b->chunks], b->len, 1);
+      fed++;
+    }
+    f = vdec_get(d, n);
+    if (!f || f->frame != n || f->status < 0
+        || (check && hash_image(&f->image) != b->ref[n % b->chunks]))
+      bad++;
+    if (f) vdec_release(d);
+  }
+  *ms = (bench_now_ns() - t) / 1e6;
+  return bad;
+}
+
+/* 1, 2, 4 ... and max last */
+static int more_threads(int n, int max) {
+  return n < max && 2 * n > max ? max : 2 * n;
+}
+
+static void usage(void) {
+  fprintf(stderr,
+          "usage: decbench [options]\n"
+          "  -s FMT    source format (i420)\n"
+          "  -W N -H N source size (1920 x 1080)\n"
+          "  -w N -h N output size (the source size)\n"
+          "  -o FMT    rgb565 or rgba8888 (rgb565)\n"
+          "  -T N      most worker threads tried (one per CPU, at least 2)\n"
+          "  -d N      frames in flight (two per worker)\n"
+          "  -F N      distinct chunks (16)\n"
+          "  -n N      frames per run (200)\n"
+          "  -S SEED   random seed (1)\n"
+          "  -j FILE   write the JSON result here (stdout)\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  pix_fmt_t fmt = PIX_FMT_I420;
+  int c, i, threads, max_threads = 0, fail = 0;
+  double ms, base_ms = 0;
+  uint64_t seed = 1;
+  bench_json_t j;
+  FILE *out = stdout;
+  bench_t b;
+  long k;
+
+  memset(&b, 0, sizeof(b));
+  b.st.width = 1920;
+  b.st.height = 1080;
+  b.cfg.fmt = PIX_FMT_RGB565;
+  b.chunks = 16;
+  b.frames = 200;
+
+  while ((c = getopt(argc, argv, "s:W:H:w:h:o:T:d:F:n:S:j:")) != -1) {
+    switch (c) {
+      case 's':
+        for (fmt = 0; fmt < PIX_FMT_COUNT; fmt++)
+          if (!strcmp(optarg, pix_fmt_name(fmt))) break;
+        if (fmt == PIX_FMT_COUNT) usage();
+        break;
+      case 'W': b.st.width = atoi(optarg); break;
+      case 'H': b.st.height = atoi(optarg); break;
+      case 'w': b.cfg.width = atoi(optarg); break;
+      case 'h': b.cfg.height = atoi(optarg); break;
+      case 'o':
+        if (!strcmp(optarg, "rgba8888")) b.cfg.fmt = PIX_FMT_RGBA8888;
+        else if (strcmp(optarg, "rgb565")) usage();
+        break;
+      case 'T': max_threads = atoi(optarg); break;
+      case 'd': b.cfg.depth = atoi(optarg); break;
+      case 'F': b.chunks = atoi(optarg); break;
+      case 'n': b.frames = atol(optarg); break;
+      case 'S': seed = strtoull(optarg, NULL, 0); break;
+      case 'j':
+        out = fopen(optarg, "w");
+        if (!out) {
+          perror(optarg);
+          return 1;
+        }
+        break;
+      default: usage();
+    }
+  }
+  if (b.st.width <= 0 || b.st.height <= 0 || b.chunks < 1 || b.frames < 1 || !seed) usage();
+  if (!b.cfg.width) b.cfg.width = b.st.width;
+  if (!b.cfg.height) b.cfg.height = b.st.height;
+  if (max_threads <= 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    max_threads = cpus > 2 ? (int) cpus : 2;
+  }
+  if (make_bih(&b.bih, fmt, b.st.width, b.st.height) < 0) {
+    fprintf(stderr, "decbench: %s is not a DIB format\n", pix_fmt_name(fmt));
+    return 1;
+  }
+  b.st.fourcc = b.bih.bi_compression;
+  b.st.bih = &b.bih;
+
+  // DIB rows are padded to 4 bytes, the YUV layouts are not
+  if (b.bih.bi_compression == 0 || b.bih.bi_compression == 3)
+    b.len = (((long) b.st.width * b.bih.bi_bit_count / 8 + 3) & ~3L) * b.st.height;
+  else
+    b.len = (long) pix_image_size(fmt, b.st.width, b.st.height);
+  b.chunk = calloc(b.chunks, sizeof(char *));
+  b.ref = calloc(b.chunks, sizeof(uint64_t));
+  if (!b.chunk || !b.ref) {
+    perror("decbench");
+    return 1;
+  }
+  for (i = 0; i < b.chunks; i++) {
+    if (!(b.chunk[i] = malloc(b.len))) {
+      perror("decbench");
+      return 1;
+    }
+    for (k = 0; k < b.len; k++)
+      b.chunk[i][k] = (char) bench_rand(&seed);
+  }
+  if (make_refs(&b) < 0) {
+    fprintf(stderr, "decbench: can't convert %s\n", pix_fmt_name(fmt));
+    return 1;
+  }
+
+  memset(&j, 0, sizeof(j));
+  j.f = out;
+  bench_json_obj(&j, NULL);
+  bench_json_str(&j, "bench", "decbench");
+  bench_json_str(&j, "src", pix_fmt_name(fmt));
+  bench_json_str(&j, "dst", pix_fmt_name(b.cfg.fmt));
+  bench_json_int(&j, "src_width", b.st.width);
+  bench_json_int(&j, "src_height", b.st.height);
+  bench_json_int(&j, "width", b.cfg.width);
+  bench_json_int(&j, "height", b.cfg.height);
+  bench_json_int(&j, "frames", b.frames);
+  bench_json_int(&j, "cpus", sysconf(_SC_NPROCESSORS_ONLN));
+  bench_json_arr(&j, "runs");
+
+  for (threads = 1; threads <= max_threads; threads = more_threads(threads, max_threads)) {
+    vdec_config_t cfg = b.cfg;
+    vdec_stats_t st;
+    vdec_t *d;
+    long bad;
+
+    cfg.threads = threads;
+    d = vdec_new(&b.st, &cfg);
+    if (!d) {
+      fprintf(stderr, "decbench: no decoder on %d threads\n", threads);
+      return 1;
+    }
+    bad = run(&b, d, 1, &ms);
+    vdec_free(d);
+    // again for the time, on a fresh pool
+    d = vdec_new(&b.st, &cfg);
+    if (!d) {
+      fprintf(stderr, "decbench: no decoder on %d threads\n", threads);
+      return 1;
+    }
+    bad += run(&b, d, 0, &ms);
+    vdec_get_stats(d, &st);
+    if (threads == 1) base_ms = ms;
+    if (bad) fail = 1;
+
+    bench_json_obj(&j, NULL);
+    bench_json_str(&j, "codec", vdec_name(d));
+    bench_json_int(&j, "threads", st.threads);
+    bench_json_int(&j, "depth", st.depth);
+    bench_json_num(&j, "fps", b.frames * 1e3 / ms);
+    bench_json_num(&j, "ms_per_frame", ms / b.frames);
+    bench_json_num(&j, "speedup", base_ms / ms);
+    bench_json_num(&j, "worker_ms_per_frame", st.decoded ? st.decode_ns / 1e6 / st.decoded : 0);
+    bench_json_int(&j, "waits", (long long) st.waits);
+    bench_json_num(&j, "wait_ms", st.wait_ns / 1e6);
+    bench_json_int(&j, "bad_frames", bad);
+    bench_json_end(&j);
+    vdec_free(d);
+  }
+  bench_json_arr_end(&j);
+  bench_json_end(&j);
+
+  for (i = 0; i < b.chunks; i++)
+    free(b.chunk[i]);
+  free(b.chunk);
+  free(b.ref);
+  if (out != stdout) fclose(out);
+  if (fail) fprintf(stderr, "decbench: frames out of order or wrong\n");
+  return fail;
+}
@@ -0,0 +1,433 @@
+/*
+ * mjpegbench.c -- speed of the MJPEG decoder in jpeg.c and vdec_mjpeg.c
+ *
+ * Encodes -F frames of a synthetic camera picture (gradients, edges,
+ * fine texture and noise, moving from frame to frame) with the encoder
+ * in mjpegenc.c, leaving out DHT as MJPEG does, and decodes them
+ *
+ *  - on one thread with each ISA, C and the SIMD ones the CPU has, the
+ *    output checked to be the same bytes as C's; for C also the luma
+ *    PSNR against the source, to show the decoder is right at all;
+ *  - through vdec with 1, 2, 4 ... worker threads, as playback would.
+ *
+ *   mjpegbench [-W width -H height] [-s j420|j422|j444] [-q quality]
+ *              [-r restart] [-o rgb565|rgba8888] [-T threads]
+ *              [-F frames] [-n frames] [-f file.avi] [-S seed]
+ *              [-j result.json]
+ *
+ * Without -W/-H it runs 720p and 1080p. -f decodes the first -F frames
+ * of an MJPEG AVI instead (no PSNR then). -T is the most threads tried
+ * (one per CPU, at least 2). Timings only mean something from an
+ * optimized build, and more threads than CPUs only add overhead.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "benchutil.h"
+#include "jpeg.h"
+#include "mjpegenc.h"
+#include "vdec.h"
+
+typedef struct {
+  int width, height;
+  pix_fmt_t out;
+  int chunks;
+  char **chunk;
+  long *len;
+  uint64_t *ref;            /* hash of the C decode of each chunk */
+  uint8_t **src;            /* the planar source of each, NULL for -f */
+  pix_fmt_t src_fmt;
+  avi_t *avi;
+} bench_t;
+
+static uint64_t hash_image(const pix_image_t *img) {
+  int bpp = img->fmt == PIX_FMT_RGB565 ? 2 : 4;
+  uint64_t h = 14695981039346656037ULL;
+  int x, y;
+
+  for (y = 0; y < img->height; y++) {
+    const uint8_t *p = img->data[0] + (long) y * img->stride[0];
+
+    for (x = 0; x < img->width * bpp; x++)
+      h = (h ^ p[x]) * 1099511628211ULL;
+  }
+  return h;
+}
+
+/* frame i of the test picture, full range YCbCr */
+static void make_picture(pix_image_t *img, int i, uint64_t *seed) {
+  const int sx = img->fmt != PIX_FMT_J444, sy = img->fmt == PIX_FMT_J420;
+  const int w = img->width, h = img->height, shift = 4 * i;
+  int x, y;
+
+  for (y = 0; y < h; y++) {
+    uint8_t *p = img->data[0] + (long) y * img->stride[0];
+
+    for (x = 0; x < w; x++) {
+      const int xx = x + shift;
+      // a sky gradient, a checkered wall with sharp edges, fine texture
+      int v = y < h / 3 ? 160 + 60 * y / h : ((xx / 96 + y / 64) & 1) ? 170 : 70;
+
+      v += (int) (20 * sin(xx * 0.21) * cos(y * 0.13));
+      v += (int) (bench_rand(seed) % 9) - 4;
+      p[x] = (uint8_t) (v < 0 ? 0 : v > 255 ? 255 : v);
+    }
+  }
+  for (y = 0; y < (h + sy) >> sy; y++)
+    for (x = 0; x < (w + sx) >> sx; x++) {
+      const int xx = (x << sx) + shift, yy = y << sy;
+
+      img->data[1][(long) y * img->stride[1] + x] = (uint8_t) (128 + 40 * xx / (w + shift + 1) - 20);
+      img->data[2][(long) y * img->stride[2] + x] = (uint8_t) (((xx / 96 + yy / 64) & 1) ? 150 : 110);
+    }
+}
+
+static int encode_frames(bench_t *b, const mjpeg_enc_opts_t *o, uint64_t *seed) {
+  const size_t size = pix_image_size(b->src_fmt, b->width, b->height);
+  // incompressible noise would not fit, a camera picture does easily
+  const long max = (long) b->width * b->height * 4 + 4096;
+  int i;
+
+  for (i = 0; i < b->chunks; i++) {
+    pix_image_t img;
+
+    if (!(b->src[i] = malloc(size)) || !(b->chunk[i] = malloc(max))) return -1;
+    pix_image_init(&img, b->src_fmt, b->width, b->height, b->src[i], 0);
+    make_picture(&img, i, seed);
+    if ((b->len[i] = mjpeg_encode(&img, o, (uint8_t *) b->chunk[i], max)) < 0) return -1;
+  }
+  return 0;
+}
+
+static int read_frames(bench_t *b, const char *path) {
+  long frames;
+  int i, key;
+
+  if (!(b->avi = AVI_open_input_file(path, 1))) {
+    fprintf(stderr, "mjpegbench: %s: %s\n", path, AVI_strerror());
+    return -1;
+  }
+  b->width = AVI_video_width(b->avi);
+  b->height = AVI_video_height(b->avi);
+  frames = AVI_video_frames(b->avi);
+  if (frames < b->chunks) b->chunks = (int) frames;
+  for (i = 0; i < b->chunks; i++) {
+    long size = AVI_frame_size(b->avi, i);
+
+    if (size < 0 || !(b->chunk[i] = malloc(size + 1))) return -1;
+    AVI_set_video_position(b->avi, i);
+    if ((b->len[i] = AVI_read_frame(b->avi, b->chunk[i], &key)) < 0) return -1;
+  }
+  return b->chunks > 0 ? 0 : -1;
+}
+
+/* luma PSNR of chunk 0 decoded against its source */
+static double psnr_y(bench_t *b, jpeg_t *j) {
+  pix_image_t img;
+  jpeg_info_t info;
+  uint8_t *buf;
+  double se = 0;
+  int x, y;
+
+  if (jpeg_info(b->chunk[0], b->len[0], &info) < 0) return 0;
+  if (!(buf = malloc(pix_image_size(info.fmt, b->width, b->height)))) return 0;
+  pix_image_init(&img, info.fmt, b->width, b->height, buf, 0);
+  if (jpeg_decode(j, b->chunk[0], b->len[0], &img) >= 0) {
+    for (y = 0; y < b->height; y++)
+      for (x = 0; x < b->width; x++) {
+        const int d = img.data[0][(long) y * img.stride[0] + x] - b->src[0][(long) y * b->width + x];
+
+        se += d * d;
+      }
+  }
+  free(buf);
+  return se ? 10 * log10(255.0 * 255.0 * b->width * b->height / se) : 99;
+}
+
+/* n frames on this thread; returns the frames whose bytes differ from
+   the C decode (with check) or that did not decode */
+static long run_single(bench_t *b, jpeg_t *j, long n, int check, double *ms) {
+  pix_image_t img;
+  uint8_t *buf = malloc(pix_image_size(b->out, b->width, b->height));
+  long i, bad = 0;
+  uint64_t t;
+
+  if (!buf) return n;
+  pix_image_init(&img, b->out, b->width, b->height, buf, 0);
+  t = bench_now_ns();
+  for (i = 0; i < n; i++) {
+    if (jpeg_decode(j, b->chunk[i % b->chunks], b->len[i % b->chunks], &img) < 0
+        || (check && hash_image(&img) != b->ref[i % b->chunks]))
+      bad++;
+  }
+  *ms = (bench_now_ns() - t) / 1e6;
+  free(buf);
+  return bad;
+}
+
+/* n frames through d the way playback feeds it */
+static long run_pool(bench_t *b, vdec_t *d, long frames, int check, double *ms) {
+  long fed = 0, n, bad = 0;
+  uint64_t t = bench_now_ns();
+
+  for (n = 0; n < frames; n++) {
+    const vdec_frame_t *f;
+
+    while (fed < frames && vdec_can_submit(d)) {
+      vdec_submit(d, fed, b->chunk[fed % b->chunks], b->len[fed % b->chunks], 1);
+      fed++;
+    }
+    f = vdec_get(d, n);
+    if (!f || f->frame != n || f->status < 0
+        || (check && hash_image(&f->image) != b->ref[n % b->chunks]))
+      bad++;
+    if (f) vdec_release(d);
+  }
+  *ms = (bench_now_ns() - t) / 1e6;
+  return bad;
+}
+
+static vdec_t *pool(bench_t *b, int threads) {
+  vdec_config_t cfg;
+  vdec_stream_t st;
+
+  memset(&cfg, 0, sizeof(cfg));
+  memset(&st, 0, sizeof(st));
+  cfg.fmt = b->out;
+  cfg.threads = threads;
+  if (b->avi) return vdec_open(b->avi, &cfg);
+  st.fourcc = VDEC_FOURCC('M', 'J', 'P', 'G');
+  st.width = b->width;
+  st.height = b->height;
+  return vdec_new(&st, &cfg);
+}
+
+/* 1, 2, 4 ... and max last */
+static int more_threads(int n, int max) {
+  return n < max && 2 * n > max ? max : 2 * n;
+}
+
+/* all runs at one size; 1 if a frame came out wrong */
+static int bench_size(bench_t *b, long frames, int max_threads, bench_json_t *j) {
+  jpeg_t *dec = jpeg_new();
+  double ms, base_ms = 0;
+  long total = 0, bad;
+  int i, isa, threads, fail = 0;
+  pix_image_t img;
+  uint8_t *buf;
+
+  if (!dec || !(buf = malloc(pix_image_size(b->out, b->width, b->height)))) return 1;
+  // the reference: C on one thread
+  pix_set_isa(PIX_ISA_C);
+  pix_image_init(&img, b->out, b->width, b->height, buf, 0);
+  for (i = 0; i < b->chunks; i++) {
+    if (jpeg_decode(dec, b->chunk[i], b->len[i], &img) < 0) {
+      fprintf(stderr, "mjpegbench: frame %d does not decode\n", i);
+      fail = 1;
+    }
+    b->ref[i] = hash_image(&img);
+    total += b->len[i];
+  }
+  free(buf);
+
+  bench_json_obj(j, NULL);
+  bench_json_int(j, "width", b->width);
+  bench_json_int(j, "height", b->height);
+  bench_json_int(j, "bytes_per_frame", total / b->chunks);
+  bench_json_num(j, "bits_per_pixel", 8.0 * total / b->chunks / ((double) b->width * b->height));
+  if (b->src) bench_json_num(j, "psnr_y", psnr_y(b, dec));
+
+  bench_json_arr(j, "single");
+  for (isa = 0; isa < PIX_ISA_COUNT; isa++) {
+    if (pix_set_isa(isa) < 0) continue;
+    bad = run_single(b, dec, b->chunks, 1, &ms);
+    bad += run_single(b, dec, frames, 0, &ms);
+    if (bad) fail = 1;
+    bench_json_obj(j, NULL);
+    bench_json_str(j, "isa", pix_isa_name(isa));
+    bench_json_num(j, "fps", frames * 1e3 / ms);
+    bench_json_num(j, "ms_per_frame", ms / frames);
+    bench_json_int(j, "exact", !bad);
+    bench_json_end(j);
+  }
+  bench_json_arr_end(j);
+  pix_set_isa(-1);
+
+  bench_json_arr(j, "pool");
+  for (threads = 1; threads <= max_threads; threads = more_threads(threads, max_threads)) {
+    vdec_stats_t st;
+    vdec_t *d = pool(b, threads);
+
+    if (!d) {
+      fprintf(stderr, "mjpegbench: no decoder on %d threads\n", threads);
+      fail = 1;
+      break;
+    }
+    bad = run_pool(b, d, b->chunks, 1, &ms);
+    vdec_free(d);
+    // again for the time, on a fresh pool
+    if (!(d = pool(b, threads))) break;
+    bad += run_pool(b, d, frames, 0, &ms);
+    vdec_get_stats(d, &st);
+    if (threads == 1) base_ms = ms;
+    if (bad) fail = 1;
+
+    bench_json_obj(j, NULL);
+    bench_json_str(j, "isa", pix_isa_name(pix_isa()));
+    bench_json_int(j, "threads", st.threads);
+    bench_json_num(j, "fps", frames * 1e3 / ms);
+    bench_json_num(j, "ms_per_frame", ms / frames);
+    bench_json_num(j, "speedup", base_ms / ms);
+    bench_json_num(j, "worker_ms_per_frame", st.decoded ? st.decode_ns / 1e6 / st.decoded : 0);
+    bench_json_int(j, "waits", (long long) st.waits);
+    bench_json_int(j, "bad_frames", bad);
+    bench_json_end(j);
+    vdec_free(d);
+  }
+  bench_json_arr_end(j);
+  bench_json_end(j);
+  jpeg_free(dec);
+  return fail;
+}
+
+static void free_frames(bench_t *b) {
+  int i;
+
+  for (i = 0; i < b->chunks; i++) {
+    free(b->chunk[i]);
+    if (b->src) free(b->src[i]);
+    b->chunk[i] = NULL;
+  }
+  if (b->avi) AVI_close(b->avi);
+  b->avi = NULL;
+}
+
+static void usage(void) {
+  fprintf(stderr,
+          "usage: mjpegbench [options]\n"
+          "  -W N -H N frame size (720p and 1080p)\n"
+          "  -s FMT    sampling: j420, j422 or j444 (j422)\n"
+          "  -q N      quality (85)\n"
+          "  -r N      restart interval in MCUs (none)\n"
+          "  -o FMT    rgb565 or rgba8888 (rgb565)\n"
+          "  -T N      most worker threads tried (one per CPU, at least 2)\n"
+          "  -F N      distinct frames (8)\n"
+          "  -n N      frames per run (100)\n"
+          "  -f FILE   the frames of this MJPEG AVI instead\n"
+          "  -S SEED   random seed (1)\n"
+          "  -j FILE   write the JSON result here (stdout)\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  static const int sizes[][2] = { { 1280, 720 }, { 1920, 1080 } };
+  mjpeg_enc_opts_t o = { 85, 0, 0 };
+  int c, i, max_threads = 0, fail = 0, width = 0, height = 0;
+  const char *file = NULL;
+  uint64_t seed = 1;
+  long frames = 100;
+  bench_json_t j;
+  FILE *out = stdout;
+  bench_t b;
+
+  memset(&b, 0, sizeof(b));
+  b.out = PIX_FMT_RGB565;
+  b.src_fmt = PIX_FMT_J422;
+  b.chunks = 8;
+
+  while ((c = getopt(argc, argv, "W:H:s:q:r:o:T:F:n:f:S:j:")) != -1) {
+    switch (c) {
+      case 'W': width = atoi(optarg); break;
+      case 'H': height = atoi(optarg); break;
+      case 's':
+        if (!strcmp(optarg, "j420")) b.src_fmt = PIX_FMT_J420;
+        else if (!strcmp(optarg, "j444")) b.src_fmt = PIX_FMT_J444;
+        else if (strcmp(optarg, "j422")) usage();
+        break;
+      case 'q': o.quality = atoi(optarg); break;
+      case 'r': o.restart = atoi(optarg); break;
+      case 'o':
+        if (!strcmp(optarg, "rgba8888")) b.out = PIX_FMT_RGBA8888;
+        else if (strcmp(optarg, "rgb565")) usage();
+        break;
+      case 'T': max_threads = atoi(optarg); break;
+      case 'F': b.chunks = atoi(optarg); break;
+      case 'n': frames = atol(optarg); break;
+      case 'f': file = optarg; break;
+      case 'S': seed = strtoull(optarg, NULL, 0); break;
+      case 'j':
+        out = fopen(optarg, "w");
+        if (!out) {
+          perror(optarg);
+          return 1;
+        }
+        break;
+      default: usage();
+    }
+  }
+  if ((width > 0) != (height > 0) || width < 0 || height < 0 || b.chunks < 1 || frames < 1
+      || o.quality < 1 || o.quality > 100 || o.restart < 0 || !seed)
+    usage();
+  if (max_threads <= 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    max_threads = cpus > 2 ? (int) cpus : 2;
+  }
+  b.chunk = calloc(b.chunks, sizeof(char *));
+  b.len = calloc(b.chunks, sizeof(long));
+  b.ref = calloc(b.chunks, sizeof(uint64_t));
+  if (!file) b.src = calloc(b.chunks, sizeof(uint8_t *));
+  if (!b.chunk || !b.len || !b.ref || (!file && !b.src)) {
+    perror("mjpegbench");
+    return 1;
+  }
+
+  memset(&j, 0, sizeof(j));
+  j.f = out;
+  bench_json_obj(&j, NULL);
+  bench_json_str(&j, "bench", "mjpegbench");
+  bench_json_str(&j, "dst", pix_fmt_name(b.out));
+  if (file) {
+    bench_json_str(&j, "file", file);
+  } else {
+    bench_json_str(&j, "sampling", pix_fmt_name(b.src_fmt));
+    bench_json_int(&j, "quality", o.quality);
+    bench_json_int(&j, "restart", o.restart);
+  }
+  bench_json_int(&j, "frames", frames);
+  bench_json_int(&j, "cpus", sysconf(_SC_NPROCESSORS_ONLN));
+  bench_json_arr(&j, "sizes");
+
+  for (i = 0; i < (file || width ? 1 : 2); i++) {
+    if (file) {
+      if (read_frames(&b, file) < 0) {
+        fail = 1;
+        break;
+      }
+    } else {
+      b.width = width ? width : sizes[i][0];
+      b.height = height ? height : sizes[i][1];
+      if (encode_frames(&b, &o, &seed) < 0) {
+        fprintf(stderr, "mjpegbench: can't make the test frames\n");
+        fail = 1;
+        break;
+      }
+    }
+    fail |= bench_size(&b, frames, max_threads, &j);
+    free_frames(&b);
+  }
+  bench_json_arr_end(&j);
+  bench_json_end(&j);
+
+  free(b.chunk);
+  free(b.len);
+  free(b.ref);
+  free(b.src);
+  if (out != stdout) fclose(out);
+  if (fail) fprintf(stderr, "mjpegbench: frames wrong or not decoded\n");
+  return fail;
+}
@@ -0,0 +1,262 @@
+/*
+ * mjpegenc.c -- a small baseline JPEG encoder to make MJPEG test frames
+ *
+ * See mjpegenc.h. Written for clarity over speed: a float DCT per block
+ * and edge blocks filled by repeating the last row and column.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "jpeg_impl.h"
+#include "mjpegenc.h"
+
+/* the example tables of the standard (K.1), natural order */
+static const uint8_t std_q[2][64] = {
+  {
+    16, 11, 10, 16, 24, 40, 51, 61, 12, 12, 14, 19, 26, 58, 60, 55,
+    14, 13, 16, 24, 40, 57, 69, 56, 14, 17, 22, 29, 51, 87, 80, 62,
+    18, 22, 37, 56, 68, 109, 103, 77, 24, 35, 55, 64, 81, 104, 113, 92,
+    49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99,
+  }, {
+    17, 18, 24, 47, 99, 99, 99, 99, 18, 21, 26, 66, 99, 99, 99, 99,
+    24, 26, 56, 99, 99, 99, 99, 99, 47, 66, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+  },
+};
+
+typedef struct
+{
+  uint8_t *p, *end;
+  int full;
+  uint32_t bits;            /* right aligned */
+  int nbits;
+  uint16_t code[4][256];    /* jpeg_std_bits order */
+  uint8_t size[4][256];
+  uint8_t q[2][64];         /* natural order */
+  double cos[8][8];
+} enc_t;
+
+static void put_byte(enc_t *e, int b) {
+  if (e->p < e->end) *e->p++ = (uint8_t) b;
+  else e->full = 1;
+}
+
+static void put_be16(enc_t *e, int v) {
+  put_byte(e, v >> 8);
+  put_byte(e, v & 255);
+}
+
+/* n bits of code into the entropy coded data, 0xFF stuffed */
+static void put_bits(enc_t *e, unsigned code, int n) {
+  e->bits = e->bits << n | (code & ((1u << n) - 1));
+  e->nbits += n;
+  while (e->nbits >= 8) {
+    const int b = (e->bits >> (e->nbits - 8)) & 255;
+
+    put_byte(e, b);
+    if (b == 0xFF) put_byte(e, 0);
+    e->nbits -= 8;
+  }
+}
+
+/* pads the last byte with ones */
+static void flush_bits(enc_t *e) {
+  if (e->nbits) put_bits(e, 0x7F, 8 - e->nbits);
+  e->bits = 0;
+}
+
+static void put_huff(enc_t *e, int t, int symbol) {
+  put_bits(e, e->code[t][symbol], e->size[t][symbol]);
+}
+
+/* the category and bits of v, as DC differences and AC values code */
+static void put_value(enc_t *e, int t, int run, int v) {
+  int a = v < 0 ? -v : v, n = 0;
+
+  while (a >> n)
+    n++;
+  put_huff(e, t, run << 4 | n);
+  if (n) put_bits(e, v < 0 ? (unsigned) (v - 1) : (unsigned) v, n);
+}
+
+static void fdct_quant(const enc_t *e, const double in[64], const uint8_t *q, int out[64]) {
+  double t[64];
+  int u, v, k;
+
+  for (v = 0; v < 8; v++)
+    for (u = 0; u < 8; u++) {
+      double s = 0;
+
+      for (k = 0; k < 8; k++)
+        s += e->cos[u][k] * in[8 * v + k];
+      t[8 * v + u] = s;
+    }
+  for (v = 0; v < 8; v++)
+    for (u = 0; u < 8; u++) {
+      double s = 0;
+
+      for (k = 0; k < 8; k++)
+        s += e->cos[v][k] * t[8 * k + u];
+      out[8 * v + u] = (int) lround(s / q[8 * v + u]);
+    }
+}
+
+/* the block at x, y of plane p (w x h) */
+static void put_block(enc_t *e, const uint8_t *p, int stride, int w, int h, int x, int y,
+                      int chroma, int *pred) {
+  double in[64];
+  int out[64], i, j, run = 0;
+
+  for (i = 0; i < 8; i++)
+    for (j = 0; j < 8; j++) {
+      const int yy = y + i < h ? y + i : h - 1, xx = x + j < w ? x + j : w - 1;
+
+      in[8 * i + j] = p[(long) yy * stride + xx] - 128.0;
+    }
+  fdct_quant(e, in, e->q[chroma], out);
+  put_value(e, chroma, 0, out[0] - *pred);
+  *pred = out[0];
+  for (i = 1; i < 64; i++) {
+    const int v = out[jpeg_zigzag[i]];
+
+    if (!v) {
+      run++;
+      continue;
+    }
+    for (; run > 15; run -= 16)
+      put_huff(e, 2 + chroma, 0xF0);
+    put_value(e, 2 + chroma, run, v);
+    run = 0;
+  }
+  if (run) put_huff(e, 2 + chroma, 0x00);
+}
+
+static void put_headers(enc_t *e, const pix_image_t *src, const mjpeg_enc_opts_t *o, int hv) {
+  int i, k, t;
+
+  put_be16(e, 0xFFD8);
+  // the APP0 of AVI1, one field
+  put_be16(e, 0xFFE0);
+  put_be16(e, 16);
+  put_byte(e, 'A');
+  put_byte(e, 'V');
+  put_byte(e, 'I');
+  put_byte(e, '1');
+  for (i = 0; i < 10; i++)
+    put_byte(e, 0);
+
+  put_be16(e, 0xFFDB);
+  put_be16(e, 2 + 2 * 65);
+  for (t = 0; t < 2; t++) {
+    put_byte(e, t);
+    for (k = 0; k < 64; k++)
+      put_byte(e, e->q[t][jpeg_zigzag[k]]);
+  }
+
+  put_be16(e, 0xFFC0);
+  put_be16(e, 17);
+  put_byte(e, 8);
+  put_be16(e, src->height);
+  put_be16(e, src->width);
+  put_byte(e, 3);
+  for (i = 0; i < 3; i++) {
+    put_byte(e, i + 1);
+    put_byte(e, i ? 0x11 : hv);
+    put_byte(e, i ? 1 : 0);
+  }
+
+  if (o->dht) {
+    int len = 2;
+
+    for (t = 0; t < 4; t++)
+      for (len += 17, k = 0; k < 16; k++)
+        len += jpeg_std_bits[t][k];
+    put_be16(e, 0xFFC4);
+    put_be16(e, len);
+    for (t = 0; t < 4; t++) {
+      int n = 0;
+
+      put_byte(e, (t >> 1) << 4 | (t & 1));
+      for (k = 0; k < 16; k++) {
+        put_byte(e, jpeg_std_bits[t][k]);
+        n += jpeg_std_bits[t][k];
+      }
+      for (k = 0; k < n; k++)
+        put_byte(e, jpeg_std_vals[t][k]);
+    }
+  }
+  if (o->restart) {
+    put_be16(e, 0xFFDD);
+    put_be16(e, 4);
+    put_be16(e, o->restart);
+  }
+
+  put_be16(e, 0xFFDA);
+  put_be16(e, 12);
+  put_byte(e, 3);
+  for (i = 0; i < 3; i++) {
+    put_byte(e, i + 1);
+    put_byte(e, i ? 0x11 : 0x00);
+  }
+  put_byte(e, 0);
+  put_byte(e, 63);
+  put_byte(e, 0);
+}
+
+long mjpeg_encode(const pix_image_t *src, const mjpeg_enc_opts_t *o, uint8_t *out, long size) {
+  const int hs = src->fmt == PIX_FMT_J444 ? 1 : 2, vs = src->fmt == PIX_FMT_J420 ? 2 : 1;
+  const int cw = (src->width + hs - 1) / hs, ch = (src->height + vs - 1) / vs;
+  const int mcux = (src->width + 8 * hs - 1) / (8 * hs), mcuy = (src->height + 8 * vs - 1) / (8 * vs);
+  const int scale = o->quality < 50 ? 5000 / o->quality : 200 - 2 * o->quality;
+  int pred[3] = { 0, 0, 0 }, n = 0, rst = 0;
+  int t, i, k, mx, my;
+  enc_t e;
+
+  if (src->fmt != PIX_FMT_J420 && src->fmt != PIX_FMT_J422 && src->fmt != PIX_FMT_J444) return -1;
+  if (o->quality < 1 || o->quality > 100) return -1;
+  memset(&e, 0, sizeof(e));
+  e.p = out;
+  e.end = out + size;
+  for (t = 0; t < 2; t++)
+    for (k = 0; k < 64; k++) {
+      const int q = (std_q[t][k] * scale + 50) / 100;
+
+      e.q[t][k] = (uint8_t) (q < 1 ? 1 : q > 255 ? 255 : q);
+    }
+  for (t = 0; t < 4; t++) {
+    unsigned code = 0;
+
+    for (n = 0, i = 0; i < 16; i++, code <<= 1)
+      for (k = 0; k < jpeg_std_bits[t][i]; k++, n++) {
+        e.code[t][jpeg_std_vals[t][n]] = (uint16_t) code++;
+        e.size[t][jpeg_std_vals[t][n]] = (uint8_t) (i + 1);
+      }
+  }
+  for (i = 0; i < 8; i++)
+    for (k = 0; k < 8; k++)
+      e.cos[i][k] = (i ? 0.5 : sqrt(0.125)) * cos((2 * k + 1) * i * M_PI / 16);
+
+  put_headers(&e, src, o, hs << 4 | vs);
+  for (n = 0, my = 0; my < mcuy; my++)
+    for (mx = 0; mx < mcux; mx++, n++) {
+      int bx, by;
+
+      if (o->restart && n && n % o->restart == 0) {
+        flush_bits(&e);
+        put_be16(&e, 0xFFD0 + rst);
+        rst = (rst + 1) & 7;
+        pred[0] = pred[1] = pred[2] = 0;
+      }
+      for (by = 0; by < vs; by++)
+        for (bx = 0; bx < hs; bx++)
+          put_block(&e, src->data[0], src->stride[0], src->width, src->height,
+                    (mx * hs + bx) * 8, (my * vs + by) * 8, 0, &pred[0]);
+      for (i = 1; i < 3; i++)
+        put_block(&e, src->data[i], src->stride[i], cw, ch, mx * 8, my * 8, 1, &pred[i]);
+    }
+  flush_bits(&e);
+  put_be16(&e, 0xFFD9);
+  return e.full ? -1 : e.p - out;
+}
@@ -0,0 +1,25 @@
+/*
+ * mjpegenc.h -- a small baseline JPEG encoder to make MJPEG test frames
+ *
+ * Only for the host tools: float DCT, the quality scaling of the IJG
+ * code and the Huffman tables of the standard, which MJPEG frames are
+ * expected to use and may leave out.
+ */
+
+#ifndef MJPEGENC_H
+#define MJPEGENC_H
+
+#include "pixconv.h"
+
+typedef struct
+{
+  int quality;              /* 1 .. 100 */
+  int restart;              /* MCUs per restart interval, 0 for none */
+  int dht;                  /* write the tables, MJPEG leaves them out */
+} mjpeg_enc_opts_t;
+
+/* src is J420, J422 or J444; returns the bytes written to out, -1 if
+   they do not fit in size */
+long mjpeg_encode(const pix_image_t *src, const mjpeg_enc_opts_t *o, uint8_t *out, long size);
+
+#endif /* MJPEGENC_H */
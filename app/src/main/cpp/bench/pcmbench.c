@@ -0,0 +1,235 @@
+/*
+ * pcmbench.c -- speed of the PCM conversions in pcmconv.c
+ *
+ * Converts a buffer of random samples from every track format (u8,
+ * s16, s24, s32, f32; 1, 2, 6 and 8 channels) to 16 bit and float
+ * stereo and to 16 bit mono, with each ISA the CPU has, and reports the
+ * time against the C kernels. Before timing, each SIMD result is
+ * compared with the C one, on the buffer and on one a frame shorter,
+ * which runs the scalar tails, and converted in place; any difference
+ * is an error.
+ *
+ *   pcmbench [-f frames] [-n runs] [-s format] [-c channels] [-g gain]
+ *            [-i isa] [-S seed] [-j result.json]
+ *
+ * With -g the mix applies a gain, which turns a stereo to stereo case
+ * from a copy into a multiply. Timings only mean something from an
+ * optimized build (CMAKE_BUILD_TYPE=Release).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "benchutil.h"
+#include "pcmconv.h"
+#include "pixconv.h"
+
+typedef struct {
+  long frames;
+  float gain;
+  uint8_t *src, *dst, *ref, *tmp;
+} bench_t;
+
+static int conv_init(bench_t *b, pcm_conv_t *c, pcm_fmt_t in, int ich, pcm_fmt_t out, int och) {
+  if (pcm_conv_init(c, in, ich, out, och) < 0) return -1;
+  c->gain = b->gain;
+  pcm_conv_update(c);
+  return 0;
+}
+
+/* isa against C on the buffer and on one a frame shorter, out of place
+   and in place */
+static int verify(bench_t *b, const pcm_conv_t *c, int isa) {
+  const size_t ib = (size_t) pcm_fmt_bytes(c->in_fmt) * c->in_channels;
+  const size_t ob = (size_t) pcm_fmt_bytes(c->out_fmt) * c->out_channels;
+  const size_t size = (size_t) b->frames * (ib > ob ? ib : ob);
+  long frames;
+
+  for (frames = b->frames; frames >= b->frames - 1; frames--) {
+    const char *how = NULL;
+    size_t n, k;
+
+    memset(b->dst, 0x5A, size);
+    memset(b->ref, 0x5A, size);
+    pix_set_isa(PIX_ISA_C);
+    n = pcm_convert(c, b->src, b->ref, frames);
+    pix_set_isa(isa);
+    pcm_convert(c, b->src, b->dst, frames);
+    if (memcmp(b->dst, b->ref, size)) how = "";
+    memcpy(b->tmp, b->src, frames * ib);
+    pcm_convert(c, b->tmp, b->tmp, frames);
+    if (!how && memcmp(b->tmp, b->ref, n)) how = " in place";
+    if (how) {
+      const uint8_t *d = *how ? b->tmp : b->dst;
+
+      for (k = 0; d[k] == b->ref[k]; k++)
+        ;
+      fprintf(stderr, "pcmbench: %s/%d -> %s/%d%s on %s differs from c at byte %zu, %ld frames\n",
+              pcm_fmt_name(c->in_fmt), c->in_channels, pcm_fmt_name(c->out_fmt), c->out_channels,
+              how, pix_isa_name(isa), k, frames);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static double run(bench_t *b, const pcm_conv_t *c, int isa, int runs) {
+  uint64_t t;
+  int i;
+
+  pix_set_isa(isa);
+  pcm_convert(c, b->src, b->dst, b->frames);
+  t = bench_now_ns();
+  for (i = 0; i < runs; i++)
+    pcm_convert(c, b->src, b->dst, b->frames);
+  return (bench_now_ns() - t) / 1e6 / runs;
+}
+
+static void usage(void) {
+  fprintf(stderr,
+          "usage: pcmbench [options]\n"
+          "  -f N      sample frames per buffer (480000, 10 s at 48 kHz)\n"
+          "  -n N      conversions of the buffer per case (20)\n"
+          "  -s FMT    only this input format (all)\n"
+          "  -c N      only this many input channels (1, 2, 6, 8)\n"
+          "  -g GAIN   gain of the mix (1)\n"
+          "  -i ISA    only this ISA and c (all the CPU has)\n"
+          "  -S SEED   random seed (1)\n"
+          "  -j FILE   write the JSON result here (stdout)\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  static const int chans[] = { 1, 2, 6, 8 };
+  static const struct { pcm_fmt_t fmt; int channels; } outs[] = {
+    { PCM_FMT_S16, 2 }, { PCM_FMT_F32, 2 }, { PCM_FMT_S16, 1 },
+  };
+  bench_t b;
+  bench_json_t j;
+  FILE *out = stdout;
+  uint64_t seed = 1;
+  size_t size, k;
+  int c, runs = 20, only_ch = 0, only_fmt = -1, only_isa = -1, fail = 0, isa, i, o;
+  pcm_fmt_t in;
+
+  memset(&b, 0, sizeof(b));
+  b.frames = 480000;
+  b.gain = 1;
+
+  while ((c = getopt(argc, argv, "f:n:s:c:g:i:S:j:")) != -1) {
+    switch (c) {
+      case 'f': b.frames = atol(optarg); break;
+      case 'n': runs = atoi(optarg); break;
+      case 's':
+        for (only_fmt = 0; only_fmt < PCM_FMT_COUNT; only_fmt++)
+          if (!strcmp(optarg, pcm_fmt_name(only_fmt))) break;
+        if (only_fmt == PCM_FMT_COUNT) usage();
+        break;
+      case 'c': only_ch = atoi(optarg); break;
+      case 'g': b.gain = (float) atof(optarg); break;
+      case 'i':
+        for (only_isa = 0; only_isa < PIX_ISA_COUNT; only_isa++)
+          if (!strcmp(optarg, pix_isa_name(only_isa))) break;
+        if (only_isa == PIX_ISA_COUNT) usage();
+        break;
+      case 'S': seed = strtoull(optarg, NULL, 0); break;
+      case 'j':
+        out = fopen(optarg, "w");
+        if (!out) {
+          perror(optarg);
+          return 1;
+        }
+        break;
+      default: usage();
+    }
+  }
+  if (b.frames < 2 || runs < 1 || only_ch < 0 || only_ch > PCM_MAX_CHANNELS || !seed) usage();
+  if (only_isa >= 0 && pix_set_isa(only_isa) < 0) {
+    fprintf(stderr, "pcmbench: this CPU has no %s\n", pix_isa_name(only_isa));
+    return 1;
+  }
+
+  // the largest frame is 8 channels of 32 bit, in or out
+  size = (size_t) b.frames * PCM_MAX_CHANNELS * 4;
+  b.src = malloc(size);
+  b.dst = malloc(size);
+  b.ref = malloc(size);
+  b.tmp = malloc(size);
+  if (!b.src || !b.dst || !b.ref || !b.tmp) {
+    perror("pcmbench");
+    return 1;
+  }
+
+  memset(&j, 0, sizeof(j));
+  j.f = out;
+  bench_json_obj(&j, NULL);
+  bench_json_str(&j, "bench", "pcmbench");
+  bench_json_int(&j, "frames", b.frames);
+  bench_json_int(&j, "runs", runs);
+  bench_json_num(&j, "gain", b.gain);
+  bench_json_str(&j, "best_isa", pix_isa_name(pix_isa_best()));
+  bench_json_arr(&j, "cases");
+
+  for (in = 0; in < PCM_FMT_COUNT; in++) {
+    if (only_fmt >= 0 && in != (pcm_fmt_t) only_fmt) continue;
+    // random bytes for the integers; floats from -1.25 to 1.25, which
+    // clip now and then, random bits would be NaN as often
+    for (k = 0; k + 4 <= size; k += 4) {
+      uint32_t r = (uint32_t) bench_rand(&seed);
+
+      if (in == PCM_FMT_F32) {
+        float f = (float) ((double) r / 4294967296.0 * 2.5 - 1.25);
+
+        memcpy(b.src + k, &f, 4);
+      } else {
+        memcpy(b.src + k, &r, 4);
+      }
+    }
+    for (i = 0; i < (int) (sizeof(chans) / sizeof(chans[0])); i++) {
+      const int ich = only_ch ? only_ch : chans[i];
+
+      if (only_ch && i) break;
+      for (o = 0; o < (int) (sizeof(outs) / sizeof(outs[0])); o++) {
+        pcm_conv_t cv;
+        double c_ms;
+
+        if (conv_init(&b, &cv, in, ich, outs[o].fmt, outs[o].channels) < 0) usage();
+        c_ms = run(&b, &cv, PIX_ISA_C, runs);
+        for (isa = 0; isa < PIX_ISA_COUNT; isa++) {
+          double ms;
+          int ok;
+
+          if (pix_set_isa(isa) < 0) continue;
+          if (only_isa >= 0 && isa != only_isa && isa != PIX_ISA_C) continue;
+          ok = isa == PIX_ISA_C || verify(&b, &cv, isa) == 0;
+          fail |= !ok;
+          ms = isa == PIX_ISA_C ? c_ms : run(&b, &cv, isa, runs);
+
+          bench_json_obj(&j, NULL);
+          bench_json_str(&j, "src", pcm_fmt_name(in));
+          bench_json_int(&j, "src_channels", ich);
+          bench_json_str(&j, "dst", pcm_fmt_name(outs[o].fmt));
+          bench_json_int(&j, "dst_channels", outs[o].channels);
+          bench_json_int(&j, "mix", cv.mix);
+          bench_json_str(&j, "isa", pix_isa_name(isa));
+          bench_json_num(&j, "ms", ms);
+          bench_json_num(&j, "msamples_per_s", (double) b.frames * ich / ms / 1e3);
+          bench_json_num(&j, "speedup", c_ms / ms);
+          bench_json_int(&j, "exact", ok);
+          bench_json_end(&j);
+        }
+      }
+    }
+  }
+  bench_json_arr_end(&j);
+  bench_json_end(&j);
+
+  free(b.src);
+  free(b.dst);
+  free(b.ref);
+  free(b.tmp);
+  if (out != stdout) fclose(out);
+  return fail;
+}
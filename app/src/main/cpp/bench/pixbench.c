@@ -0,0 +1,219 @@
+/*
+ * pixbench.c -- speed of the frame conversions in pixconv.c
+ *
+ * Converts a frame of random pixels from every source format to RGB565
+ * and RGBA8888 with each ISA the CPU has, and reports the time per
+ * frame against the C kernels. Before timing, each SIMD result is
+ * compared with the C one on the full frame and on a frame one pixel
+ * narrower, which runs the scalar tails; any difference is an error.
+ *
+ *   pixbench [-w width] [-h height] [-n frames] [-s format] [-i isa]
+ *            [-b] [-S seed] [-j result.json]
+ *
+ * RGB sources are read bottom-up like DIBs in an AVI; -b turns that
+ * off, which shows what the flip costs. Timings only mean something
+ * from an optimized build (CMAKE_BUILD_TYPE=Release).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "benchutil.h"
+#include "pixconv.h"
+
+typedef struct {
+  int width, height, top_down;
+  uint64_t seed;
+  uint8_t *src, *dst, *ref;
+  pix_palette_t pal;        /* random colours for PAL8 */
+} bench_t;
+
+static int is_rgb(pix_fmt_t fmt) {
+  return fmt <= PIX_FMT_RGB565 || fmt == PIX_FMT_RGBA8888 || fmt == PIX_FMT_PAL8;
+}
+
+/* src over b->src as it would come out of a file */
+static void src_image(bench_t *b, pix_fmt_t fmt, int width, pix_image_t *img) {
+  pix_image_init(img, fmt, width, b->height, b->src, 0);
+  if (fmt == PIX_FMT_PAL8) img->data[1] = (uint8_t *) &b->pal;
+  if (is_rgb(fmt) && !b->top_down) {
+    img->data[0] += (long) img->stride[0] * (b->height - 1);
+    img->stride[0] = -img->stride[0];
+  }
+}
+
+static int dst_image(bench_t *b, pix_fmt_t fmt, int width, uint8_t *buf, pix_image_t *img) {
+  // keep the destination stride of the full frame, like a window buffer
+  return pix_image_init(img, fmt, width, b->height, buf,
+                        b->width * (fmt == PIX_FMT_RGB565 ? 2 : 4));
+}
+
+/* isa against C on the frame and on one a pixel narrower */
+static int verify(bench_t *b, pix_fmt_t src, pix_fmt_t out, int isa) {
+  size_t size = pix_image_size(out, b->width, b->height);
+  int width;
+
+  for (width = b->width; width >= b->width - 1; width--) {
+    pix_image_t s, d, r;
+
+    src_image(b, src, width, &s);
+    dst_image(b, out, width, b->dst, &d);
+    dst_image(b, out, width, b->ref, &r);
+    memset(b->dst, 0x5A, size);
+    memset(b->ref, 0x5A, size);
+    pix_set_isa(PIX_ISA_C);
+    pix_convert(&s, &r);
+    pix_set_isa(isa);
+    pix_convert(&s, &d);
+    if (memcmp(b->dst, b->ref, size)) {
+      size_t k = 0;
+
+      while (b->dst[k] == b->ref[k]) k++;
+      fprintf(stderr, "pixbench: %s -> %s on %s differs from c at byte %zu, width %d\n",
+              pix_fmt_name(src), pix_fmt_name(out), pix_isa_name(isa), k, width);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static double run(bench_t *b, pix_fmt_t src, pix_fmt_t out, int isa, int frames) {
+  pix_image_t s, d;
+  uint64_t t;
+  int i;
+
+  src_image(b, src, b->width, &s);
+  dst_image(b, out, b->width, b->dst, &d);
+  pix_set_isa(isa);
+  pix_convert(&s, &d);
+  t = bench_now_ns();
+  for (i = 0; i < frames; i++)
+    pix_convert(&s, &d);
+  return (bench_now_ns() - t) / 1e6 / frames;
+}
+
+static void usage(void) {
+  fprintf(stderr,
+          "usage: pixbench [options]\n"
+          "  -w N      frame width (1920)\n"
+          "  -h N      frame height (1080)\n"
+          "  -n N      frames to convert per case (50)\n"
+          "  -s FMT    only this source format (all)\n"
+          "  -i ISA    only this ISA and c (all the CPU has)\n"
+          "  -b        RGB sources top-down instead of bottom-up\n"
+          "  -S SEED   random seed (1)\n"
+          "  -j FILE   write the JSON result here (stdout)\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  static const pix_fmt_t outs[] = { PIX_FMT_RGB565, PIX_FMT_RGBA8888 };
+  bench_t b;
+  bench_json_t j;
+  FILE *out = stdout;
+  size_t size, k;
+  int c, frames = 50, only_src = -1, only_isa = -1, fail = 0, isa, o;
+  pix_fmt_t src;
+
+  memset(&b, 0, sizeof(b));
+  b.width = 1920;
+  b.height = 1080;
+  b.seed = 1;
+
+  while ((c = getopt(argc, argv, "w:h:n:s:i:bS:j:")) != -1) {
+    switch (c) {
+      case 'w': b.width = atoi(optarg); break;
+      case 'h': b.height = atoi(optarg); break;
+      case 'n': frames = atoi(optarg); break;
+      case 's':
+        for (only_src = 0; only_src < PIX_FMT_COUNT; only_src++)
+          if (!strcmp(optarg, pix_fmt_name(only_src))) break;
+        if (only_src == PIX_FMT_COUNT) usage();
+        break;
+      case 'i':
+        for (only_isa = 0; only_isa < PIX_ISA_COUNT; only_isa++)
+          if (!strcmp(optarg, pix_isa_name(only_isa))) break;
+        if (only_isa == PIX_ISA_COUNT) usage();
+        break;
+      case 'b': b.top_down = 1; break;
+      case 'S': b.seed = strtoull(optarg, NULL, 0); break;
+      case 'j':
+        out = fopen(optarg, "w");
+        if (!out) {
+          perror(optarg);
+          return 1;
+        }
+        break;
+      default: usage();
+    }
+  }
+  if (b.width < 2 || b.height < 1 || frames < 1 || !b.seed) usage();
+  if (only_isa >= 0 && pix_set_isa(only_isa) < 0) {
+    fprintf(stderr, "pixbench: this CPU has no %s\n", pix_isa_name(only_isa));
+    return 1;
+  }
+
+  // the largest source is BGR32/RGBA8888, the largest output RGBA8888
+  size = pix_image_size(PIX_FMT_BGR32, b.width, b.height);
+  b.src = malloc(size);
+  b.dst = malloc(size);
+  b.ref = malloc(size);
+  if (!b.src || !b.dst || !b.ref) {
+    perror("pixbench");
+    return 1;
+  }
+  for (k = 0; k < size; k++)
+    b.src[k] = (uint8_t) bench_rand(&b.seed);
+  // the first bytes of the frame make as good a palette as any
+  pix_palette_init(&b.pal, b.src, 256);
+
+  memset(&j, 0, sizeof(j));
+  j.f = out;
+  bench_json_obj(&j, NULL);
+  bench_json_str(&j, "bench", "pixbench");
+  bench_json_int(&j, "width", b.width);
+  bench_json_int(&j, "height", b.height);
+  bench_json_int(&j, "frames", frames);
+  bench_json_int(&j, "bottom_up", !b.top_down);
+  bench_json_str(&j, "best_isa", pix_isa_name(pix_isa_best()));
+  bench_json_arr(&j, "cases");
+
+  for (src = 0; src < PIX_FMT_COUNT; src++) {
+    if (only_src >= 0 && src != (pix_fmt_t) only_src) continue;
+    for (o = 0; o < 2; o++) {
+      double c_ms = run(&b, src, outs[o], PIX_ISA_C, frames);
+
+      for (isa = 0; isa < PIX_ISA_COUNT; isa++) {
+        double ms;
+        int ok;
+
+        if (pix_set_isa(isa) < 0) continue;
+        if (only_isa >= 0 && isa != only_isa && isa != PIX_ISA_C) continue;
+        ok = isa == PIX_ISA_C || verify(&b, src, outs[o], isa) == 0;
+        fail |= !ok;
+        ms = isa == PIX_ISA_C ? c_ms : run(&b, src, outs[o], isa, frames);
+
+        bench_json_obj(&j, NULL);
+        bench_json_str(&j, "src", pix_fmt_name(src));
+        bench_json_str(&j, "dst", pix_fmt_name(outs[o]));
+        bench_json_str(&j, "isa", pix_isa_name(isa));
+        bench_json_num(&j, "ms_per_frame", ms);
+        bench_json_num(&j, "mpix_per_s", (double) b.width * b.height / ms / 1e3);
+        bench_json_num(&j, "src_mb_per_s", pix_image_size(src, b.width, b.height) / ms / 1e3);
+        bench_json_num(&j, "speedup", c_ms / ms);
+        bench_json_int(&j, "exact", ok);
+        bench_json_end(&j);
+      }
+    }
+  }
+  bench_json_arr_end(&j);
+  bench_json_end(&j);
+
+  free(b.src);
+  free(b.dst);
+  free(b.ref);
+  if (out != stdout) fclose(out);
+  return fail;
+}
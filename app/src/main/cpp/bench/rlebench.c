@@ -0,0 +1,597 @@
+/*
+ * rlebench.c -- speed of MS-RLE decoding and PAL8 expansion
+ *
+ * Makes -F frames of a synthetic screen recording (a desktop, windows
+ * with text being typed into one of them and a moving pointer), codes
+ * them as BI_RLE8 or BI_RLE4 the way screen recorders do, key frames
+ * in full and the rest as deltas on the frame before, and plays them
+ * through vdec with each ISA the CPU has. Every frame that comes out is
+ * compared with the source frame expanded through the palette directly.
+ * It also times the two halves apart: drawing the chunks into the index
+ * buffer, and expanding a frame to the output format.
+ *
+ *   rlebench [-W width -H height] [-b 8|4] [-k interval] [-o rgb565|rgba8888]
+ *            [-F frames] [-n frames] [-f file.avi] [-S seed] [-j result.json]
+ *
+ * Without -W/-H it runs 720p and 1080p. -f plays the first -F frames of
+ * an RLE AVI instead, without the check. Timings only mean something
+ * from an optimized build.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "benchutil.h"
+#include "vdec.h"
+
+typedef struct {
+  int width, height, bits, keyint;
+  pix_fmt_t out;
+  int chunks;
+  char **chunk;
+  long *len;
+  int *key;
+  uint64_t *ref;            /* hash of each frame expanded, NULL for -f */
+  uint8_t bgrx[256][4];
+  alBITMAPINFOHEADER bih;
+  avi_t *avi;
+} bench_t;
+
+static uint64_t hash_image(const pix_image_t *img) {
+  int bpp = img->fmt == PIX_FMT_RGB565 ? 2 : 4;
+  uint64_t h = 14695981039346656037ULL;
+  int x, y;
+
+  for (y = 0; y < img->height; y++) {
+    const uint8_t *p = img->data[0] + (long) y * img->stride[0];
+
+    for (x = 0; x < img->width * bpp; x++)
+      h = (h ^ p[x]) * 1099511628211ULL;
+  }
+  return h;
+}
+
+/*************************************************************************/
+/* the screen                                                            */
+/*************************************************************************/
+
+static void fill(uint8_t *f, int w, int h, int x0, int y0, int x1, int y1, int c) {
+  int y;
+
+  if (x0 < 0) x0 = 0;
+  if (y0 < 0) y0 = 0;
+  if (x1 > w) x1 = w;
+  if (y1 > h) y1 = h;
+  for (y = y0; y < y1 && x0 < x1; y++)
+    memset(f + (long) y * w + x0, c, x1 - x0);
+}
+
+/* a line of made up glyphs, 6 x 9 pixels each, from seed */
+static void text(uint8_t *f, int w, int h, int x, int y, int chars, int c, uint64_t seed) {
+  int i, gx, gy;
+
+  for (i = 0; i < chars; i++, x += 7) {
+    uint64_t g = bench_rand(&seed);
+
+    if (g % 7 == 0) continue;   /* a space */
+    for (gy = 0; gy < 9; gy++)
+      for (gx = 0; gx < 6; gx++)
+        if ((g >> (gy * 6 + gx)) & 1 && x + gx < w && y + gy < h)
+          f[(long) (y + gy) * w + x + gx] = (uint8_t) c;
+  }
+}
+
+/* frame i, top-down indices */
+static void make_screen(const bench_t *b, uint8_t *f, int i, uint64_t seed) {
+  const int w = b->width, h = b->height, colors = 1 << b->bits;
+  const int ww = w / 2, wh = h / 2, typed = i * 3, line_chars = (ww - 20) / 7;
+  int y, k;
+
+  // desktop in bands, a task bar, two windows, the second one typed into
+  for (y = 0; y < h; y++)
+    memset(f + (long) y * w, 1 + y * 6 / h, w);
+  fill(f, w, h, 0, h - 30, w, h, 8);
+  for (k = 0; k < 12; k++)
+    fill(f, w, h, 40 + k * 60, h - 26, 80 + k * 60, h - 4, 9 + k % 3);
+  fill(f, w, h, 60, 60, 60 + ww, 60 + wh, 15);
+  fill(f, w, h, 60, 60, 60 + ww, 80, 12);
+  for (y = 0; y < wh - 30; y += 12)
+    text(f, w, h, 70, 90 + y, line_chars, 0, seed + y);
+  fill(f, w, h, w / 3, h / 3, w / 3 + ww, h / 3 + wh, 14);
+  fill(f, w, h, w / 3, h / 3, w / 3 + ww, h / 3 + 20, 13);
+  for (k = 0; k * line_chars < typed; k++) {
+    const int n = typed - k * line_chars < line_chars ? typed - k * line_chars : line_chars;
+
+    text(f, w, h, w / 3 + 10, h / 3 + 30 + (k * 12) % (wh - 45), n, 0, seed + 1000 + k);
+  }
+  // the pointer wanders
+  fill(f, w, h, (i * 13) % w, (i * 7) % h, (i * 13) % w + 12, (i * 7) % h + 19, colors - 1);
+}
+
+/*************************************************************************/
+/* the encoder                                                           */
+/*************************************************************************/
+
+typedef struct {
+  uint8_t *p, *end;
+  int bits;
+} enc_t;
+
+static void put2(enc_t *e, int a, int b) {
+  if (e->end - e->p >= 2) {
+    *e->p++ = (uint8_t) a;
+    *e->p++ = (uint8_t) b;
+  } else {
+    e->p = e->end + 1;          /* marks it full */
+  }
+}
+
+static int run_at(const uint8_t *s, int i, int end) {
+  int r = 1;
+
+  while (i + r < end && r < 255 && s[i + r] == s[i])
+    r++;
+  return r;
+}
+
+/* pixels a .. b - 1 of row s as runs and literals */
+static void put_pixels(enc_t *e, const uint8_t *s, int a, int b) {
+  int i = a;
+
+  while (i < b) {
+    int r = run_at(s, i, b), j, n, k;
+
+    if (r >= 3 || b - i < 3) {
+      put2(e, r, e->bits == 8 ? s[i] : s[i] << 4 | s[i]);
+      i += r;
+      continue;
+    }
+    // literal up to where a run of 3 starts
+    for (j = i; j < b && j - i < 254 && run_at(s, j, b) < 3; j++)
+      ;
+    if ((n = j - i) < 3) n = b - i < 3 ? b - i : 3;
+    put2(e, 0, n);
+    if (e->bits == 8) {
+      if (e->end - e->p < n + 1) {
+        e->p = e->end + 1;
+        return;
+      }
+      memcpy(e->p, s + i, n);
+      e->p += n;
+      if (n & 1) *e->p++ = 0;
+    } else {
+      const int bytes = (n + 1) / 2;
+
+      if (e->end - e->p < bytes + 1) {
+        e->p = e->end + 1;
+        return;
+      }
+      for (k = 0; k < bytes; k++)
+        *e->p++ = (uint8_t) (s[i + 2 * k] << 4 | (2 * k + 1 < n ? s[i + 2 * k + 1] : 0));
+      if (bytes & 1) *e->p++ = 0;
+    }
+    i += n;
+  }
+}
+
+/* cur as a key frame or as the changes to prev; -1 if out is too small */
+static long rle_encode(const bench_t *b, const uint8_t *cur, const uint8_t *prev, uint8_t *out, long size) {
+  const int w = b->width, h = b->height;
+  enc_t e = { out, out + size, b->bits };
+  int x = 0, y = 0, row;
+
+  for (row = 0; row < h; row++) {
+    // DIB rows count from the bottom
+    const uint8_t *s = cur + (long) (h - 1 - row) * w;
+    const uint8_t *o = prev ? prev + (long) (h - 1 - row) * w : NULL;
+    int a = 0;
+
+    while (a < w) {
+      int end;
+
+      if (o) {
+        while (a < w && s[a] == o[a])
+          a++;
+        if (a == w) break;
+      }
+      // up to an unchanged stretch long enough to skip with a delta
+      for (end = a; end < w; end++) {
+        int same = 0;
+
+        while (o && end + same < w && same < 8 && s[end + same] == o[end + same])
+          same++;
+        if (same >= 8 || (same && end + same == w)) break;
+      }
+      // get there: end of line, then deltas
+      if (row > y && a < x) {
+        put2(&e, 0, 0);
+        x = 0;
+        y++;
+      }
+      while (row > y || a > x) {
+        const int dx = a - x > 255 ? 255 : a - x, dy = row - y > 255 ? 255 : row - y;
+
+        put2(&e, 0, 2);
+        put2(&e, dx, dy);
+        x += dx;
+        y += dy;
+      }
+      put_pixels(&e, s, a, end);
+      x = a = end;
+    }
+    if (!o) {
+      put2(&e, 0, 0);
+      x = 0;
+      y++;
+    }
+  }
+  put2(&e, 0, 1);
+  return e.p > e.end ? -1 : e.p - out;
+}
+
+/*************************************************************************/
+/* the runs                                                              */
+/*************************************************************************/
+
+static void make_palette(bench_t *b, uint64_t *seed) {
+  int i;
+
+  for (i = 0; i < 256; i++) {
+    uint64_t v = bench_rand(seed);
+
+    b->bgrx[i][0] = (uint8_t) v;
+    b->bgrx[i][1] = (uint8_t) (v >> 8);
+    b->bgrx[i][2] = (uint8_t) (v >> 16);
+    b->bgrx[i][3] = 0;
+  }
+  // text black, windows light
+  memset(b->bgrx[0], 0, 3);
+  memset(b->bgrx[14], 0xF0, 3);
+  memset(b->bgrx[15], 0xFF, 3);
+}
+
+static int make_frames(bench_t *b, uint64_t *seed) {
+  const long size = (long) b->width * b->height;
+  const long max = 3 * size + 1024;
+  uint8_t *cur = malloc(size), *prev = malloc(size), *buf = NULL;
+  pix_palette_t pal;
+  pix_image_t src, dst;
+  const uint64_t scene = bench_rand(seed);
+  int i, ret = 0;
+
+  if (!cur || !prev || !(buf = malloc(pix_image_size(b->out, b->width, b->height)))) ret = -1;
+  pix_palette_init(&pal, b->bgrx[0], 1 << b->bits);
+  pix_set_isa(PIX_ISA_C);
+  for (i = 0; i < b->chunks && !ret; i++) {
+    uint8_t *t;
+
+    b->key[i] = i % b->keyint == 0;
+    make_screen(b, cur, i, scene);
+    if (!(b->chunk[i] = malloc(max))
+        || (b->len[i] = rle_encode(b, cur, b->key[i] ? NULL : prev, (uint8_t *) b->chunk[i], max)) < 0)
+      ret = -1;
+    pix_image_init(&src, PIX_FMT_PAL8, b->width, b->height, cur, 0);
+    src.data[1] = (uint8_t *) &pal;
+    pix_image_init(&dst, b->out, b->width, b->height, buf, 0);
+    pix_convert(&src, &dst);
+    b->ref[i] = hash_image(&dst);
+    t = prev;
+    prev = cur;
+    cur = t;
+  }
+  pix_set_isa(-1);
+  free(cur);
+  free(prev);
+  free(buf);
+  return ret;
+}
+
+static int read_frames(bench_t *b, const char *path) {
+  long frames;
+  int i;
+
+  if (!(b->avi = AVI_open_input_file(path, 1))) {
+    fprintf(stderr, "rlebench: %s: %s\n", path, AVI_strerror());
+    return -1;
+  }
+  b->width = AVI_video_width(b->avi);
+  b->height = AVI_video_height(b->avi);
+  frames = AVI_video_frames(b->avi);
+  if (frames < b->chunks) b->chunks = (int) frames;
+  for (i = 0; i < b->chunks; i++) {
+    long size = AVI_frame_size(b->avi, i);
+
+    if (size < 0 || !(b->chunk[i] = malloc(size + 1))) return -1;
+    AVI_set_video_position(b->avi, i);
+    if ((b->len[i] = AVI_read_frame(b->avi, b->chunk[i], &b->key[i])) < 0) return -1;
+  }
+  return b->chunks > 0 ? 0 : -1;
+}
+
+static void stream(bench_t *b, vdec_stream_t *st) {
+  memset(st, 0, sizeof(*st));
+  memset(&b->bih, 0, sizeof(b->bih));
+  b->bih.bi_size = sizeof(b->bih);
+  b->bih.bi_width = b->width;
+  b->bih.bi_height = b->height;
+  b->bih.bi_planes = 1;
+  b->bih.bi_bit_count = b->bits;
+  b->bih.bi_compression = b->bits == 8 ? 1 : 2;
+  b->bih.bi_clr_used = 1 << b->bits;
+  st->fourcc = b->bih.bi_compression;
+  st->width = b->width;
+  st->height = b->height;
+  st->bih = &b->bih;
+  st->palette = b->bgrx[0];
+  st->colors = 1 << b->bits;
+}
+
+/* n frames through d from the first; the frames that were wrong, or
+   that did not come out */
+static long run(bench_t *b, vdec_t *d, long frames, int check, double *ms) {
+  long fed = 0, n, bad = 0;
+  uint64_t t = bench_now_ns();
+
+  for (n = 0; n < frames; n++) {
+    const vdec_frame_t *f;
+
+    while (fed < frames && vdec_can_submit(d)) {
+      const int i = (int) (fed % b->chunks);
+
+      vdec_submit(d, fed, b->chunk[i], b->len[i], b->key[i]);
+      fed++;
+    }
+    f = vdec_get(d, n);
+    if (!f || f->frame != n || f->status < 0 || (check && hash_image(&f->image) != b->ref[n % b->chunks]))
+      bad++;
+    if (f) vdec_release(d);
+  }
+  *ms = (bench_now_ns() - t) / 1e6;
+  return bad;
+}
+
+static vdec_t *pool(bench_t *b) {
+  vdec_config_t cfg;
+  vdec_stream_t st;
+
+  memset(&cfg, 0, sizeof(cfg));
+  cfg.fmt = b->out;
+  if (b->avi) return vdec_open(b->avi, &cfg);
+  stream(b, &st);
+  return vdec_new(&st, &cfg);
+}
+
+/* ms per frame of the codec alone: chunks drawn into its index buffer */
+static double draw_ms(bench_t *b, long frames) {
+  vdec_stream_t st;
+  const vdec_codec_t *codec;
+  pix_image_t pic;
+  void *ctx;
+  uint64_t t;
+  long n;
+
+  if (b->avi) {
+    const uint8_t *cc = (const uint8_t *) AVI_video_compressor(b->avi);
+
+    memset(&st, 0, sizeof(st));
+    st.fourcc = VDEC_FOURCC(cc[0], cc[1], cc[2], cc[3]);
+    st.width = b->width;
+    st.height = b->height;
+    st.bih = b->avi->bitmap_info_header;
+    st.colors = AVI_video_palette(b->avi, &st.palette);
+  } else {
+    stream(b, &st);
+  }
+  if (!(codec = vdec_find(st.fourcc)) || !(ctx = codec->open(&st))) return 0;
+  t = bench_now_ns();
+  for (n = 0; n < frames; n++) {
+    const int i = (int) (n % b->chunks);
+
+    codec->decode(ctx, b->chunk[i], b->len[i], b->key[i], &pic);
+  }
+  t = bench_now_ns() - t;
+  codec->close(ctx);
+  return t / 1e6 / frames;
+}
+
+/* ms of expanding the last frame drawn to the output, in the ISA in use */
+static double expand_ms(bench_t *b, long frames) {
+  uint8_t *idx = calloc((size_t) b->width, b->height), *buf = malloc(pix_image_size(b->out, b->width, b->height));
+  pix_palette_t pal;
+  pix_image_t src, dst;
+  uint64_t t;
+  long n;
+
+  if (!idx || !buf) {
+    free(idx);
+    free(buf);
+    return 0;
+  }
+  pix_palette_init(&pal, b->bgrx[0], 256);
+  pix_image_init(&src, PIX_FMT_PAL8, b->width, b->height, idx, 0);
+  src.data[1] = (uint8_t *) &pal;
+  pix_image_init(&dst, b->out, b->width, b->height, buf, 0);
+  t = bench_now_ns();
+  for (n = 0; n < frames; n++)
+    pix_convert(&src, &dst);
+  t = bench_now_ns() - t;
+  free(idx);
+  free(buf);
+  return t / 1e6 / frames;
+}
+
+static int bench_size(bench_t *b, long frames, bench_json_t *j) {
+  long total = 0, keys = 0, key_total = 0, bad;
+  double ms;
+  int i, isa, fail = 0;
+
+  for (i = 0; i < b->chunks; i++) {
+    total += b->len[i];
+    if (b->key[i]) {
+      keys++;
+      key_total += b->len[i];
+    }
+  }
+  bench_json_obj(j, NULL);
+  bench_json_int(j, "width", b->width);
+  bench_json_int(j, "height", b->height);
+  bench_json_int(j, "bytes_per_frame", total / b->chunks);
+  bench_json_int(j, "bytes_per_key_frame", keys ? key_total / keys : 0);
+  bench_json_num(j, "draw_ms_per_frame", draw_ms(b, frames));
+  bench_json_arr(j, "isas");
+  for (isa = 0; isa < PIX_ISA_COUNT; isa++) {
+    vdec_t *d;
+
+    if (pix_set_isa(isa) < 0) continue;
+    if (!(d = pool(b))) {
+      fprintf(stderr, "rlebench: no decoder for the stream\n");
+      fail = 1;
+      break;
+    }
+    // the check pass warms up too
+    bad = b->ref ? run(b, d, b->chunks, 1, &ms) : 0;
+    vdec_free(d);
+    if (!(d = pool(b))) break;
+    bad += run(b, d, frames, 0, &ms);
+    vdec_free(d);
+    if (bad) fail = 1;
+
+    bench_json_obj(j, NULL);
+    bench_json_str(j, "isa", pix_isa_name(isa));
+    bench_json_num(j, "fps", frames * 1e3 / ms);
+    bench_json_num(j, "ms_per_frame", ms / frames);
+    bench_json_num(j, "expand_ms_per_frame", expand_ms(b, frames));
+    if (b->ref) bench_json_int(j, "exact", !bad);
+    bench_json_int(j, "bad_frames", bad);
+    bench_json_end(j);
+  }
+  pix_set_isa(-1);
+  bench_json_arr_end(j);
+  bench_json_end(j);
+  return fail;
+}
+
+static void free_frames(bench_t *b) {
+  int i;
+
+  for (i = 0; i < b->chunks; i++) {
+    free(b->chunk[i]);
+    b->chunk[i] = NULL;
+  }
+  if (b->avi) AVI_close(b->avi);
+  b->avi = NULL;
+}
+
+static void usage(void) {
+  fprintf(stderr,
+          "usage: rlebench [options]\n"
+          "  -W N -H N frame size (720p and 1080p)\n"
+          "  -b N      bits per pixel, 8 (BI_RLE8) or 4 (BI_RLE4) (8)\n"
+          "  -k N      a key frame every N frames (100)\n"
+          "  -o FMT    rgb565 or rgba8888 (rgb565)\n"
+          "  -F N      distinct frames (200)\n"
+          "  -n N      frames per run (400)\n"
+          "  -f FILE   the frames of this RLE AVI instead\n"
+          "  -S SEED   random seed (1)\n"
+          "  -j FILE   write the JSON result here (stdout)\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  static const int sizes[][2] = { { 1280, 720 }, { 1920, 1080 } };
+  int c, i, fail = 0, width = 0, height = 0;
+  const char *file = NULL;
+  uint64_t seed = 1;
+  long frames = 400;
+  bench_json_t j;
+  FILE *out = stdout;
+  bench_t b;
+
+  memset(&b, 0, sizeof(b));
+  b.out = PIX_FMT_RGB565;
+  b.bits = 8;
+  b.keyint = 100;
+  b.chunks = 200;
+
+  while ((c = getopt(argc, argv, "W:H:b:k:o:F:n:f:S:j:")) != -1) {
+    switch (c) {
+      case 'W': width = atoi(optarg); break;
+      case 'H': height = atoi(optarg); break;
+      case 'b': b.bits = atoi(optarg); break;
+      case 'k': b.keyint = atoi(optarg); break;
+      case 'o':
+        if (!strcmp(optarg, "rgba8888")) b.out = PIX_FMT_RGBA8888;
+        else if (strcmp(optarg, "rgb565")) usage();
+        break;
+      case 'F': b.chunks = atoi(optarg); break;
+      case 'n': frames = atol(optarg); break;
+      case 'f': file = optarg; break;
+      case 'S': seed = strtoull(optarg, NULL, 0); break;
+      case 'j':
+        out = fopen(optarg, "w");
+        if (!out) {
+          perror(optarg);
+          return 1;
+        }
+        break;
+      default: usage();
+    }
+  }
+  if ((width > 0) != (height > 0) || width < 0 || height < 0 || (b.bits != 8 && b.bits != 4)
+      || b.keyint < 1 || b.chunks < 1 || frames < 1 || !seed)
+    usage();
+  b.chunk = calloc(b.chunks, sizeof(char *));
+  b.len = calloc(b.chunks, sizeof(long));
+  b.key = calloc(b.chunks, sizeof(int));
+  if (!file) b.ref = calloc(b.chunks, sizeof(uint64_t));
+  if (!b.chunk || !b.len || !b.key || (!file && !b.ref)) {
+    perror("rlebench");
+    return 1;
+  }
+  make_palette(&b, &seed);
+
+  memset(&j, 0, sizeof(j));
+  j.f = out;
+  bench_json_obj(&j, NULL);
+  bench_json_str(&j, "bench", "rlebench");
+  bench_json_str(&j, "dst", pix_fmt_name(b.out));
+  if (file) {
+    bench_json_str(&j, "file", file);
+  } else {
+    bench_json_int(&j, "bits", b.bits);
+    bench_json_int(&j, "key_interval", b.keyint);
+  }
+  bench_json_int(&j, "frames", frames);
+  bench_json_arr(&j, "sizes");
+
+  for (i = 0; i < (file || width ? 1 : 2); i++) {
+    if (file) {
+      if (read_frames(&b, file) < 0) {
+        fail = 1;
+        break;
+      }
+    } else {
+      b.width = width ? width : sizes[i][0];
+      b.height = height ? height : sizes[i][1];
+      if (make_frames(&b, &seed) < 0) {
+        fprintf(stderr, "rlebench: can't make the test frames\n");
+        fail = 1;
+        break;
+      }
+    }
+    fail |= bench_size(&b, frames, &j);
+    free_frames(&b);
+  }
+  bench_json_arr_end(&j);
+  bench_json_end(&j);
+
+  free(b.chunk);
+  free(b.len);
+  free(b.key);
+  free(b.ref);
+  if (out != stdout) fclose(out);
+  if (fail) fprintf(stderr, "rlebench: frames wrong or not decoded\n");
+  return fail;
+}
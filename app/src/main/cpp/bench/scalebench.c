@@ -0,0 +1,295 @@
+/*
+ * scalebench.c -- speed of the fused scale and conversion in pixscale.c
+ *
+ * Scales a frame of random pixels to a set of display sizes and times,
+ * per ISA and thread count, the fused path (pix_scale) against the two
+ * pass one the app had before: convert the whole frame to RGBA, then
+ * scale that. Also reported is how much memory each path moves per
+ * frame. Every result is checked against the C kernels on one thread.
+ *
+ *   scalebench [-s format] [-W width -H height] [-w width -h height]
+ *              [-f nearest|bilinear] [-o rgb565|rgba8888] [-i isa]
+ *              [-T threads] [-n frames] [-S seed] [-j result.json]
+ *
+ * Without -w/-h the 1080p source goes to 720p, 540p (2:1 box), 270p
+ * (4:1 box) and 480p bilinear and 540p nearest, and a 360p source up to
+ * 720p. -T sets the threads of the multi-threaded runs (one per CPU).
+ * Timings only mean something from an optimized build.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "benchutil.h"
+#include "pixscale.h"
+
+typedef struct {
+  int sw, sh, dw, dh;
+  pix_filter_t filter;
+} scale_case_t;
+
+static const scale_case_t default_cases[] = {
+  { 1920, 1080, 1280, 720, PIX_SCALE_BILINEAR },
+  { 1920, 1080, 960, 540, PIX_SCALE_BILINEAR },
+  { 1920, 1080, 480, 270, PIX_SCALE_BILINEAR },
+  { 1920, 1080, 854, 480, PIX_SCALE_BILINEAR },
+  { 1920, 1080, 960, 540, PIX_SCALE_NEAREST },
+  { 640, 360, 1280, 720, PIX_SCALE_BILINEAR },
+};
+
+typedef struct {
+  pix_fmt_t fmt, out;
+  int frames, threads;
+  uint8_t *src, *rgba, *dst, *ref;
+} bench_t;
+
+static double time_fused(bench_t *b, pix_scaler_t *s, pix_image_t *src, pix_image_t *dst) {
+  uint64_t t;
+  int i;
+
+  pix_scale(s, src, dst);
+  t = bench_now_ns();
+  for (i = 0; i < b->frames; i++)
+    pix_scale(s, src, dst);
+  return (bench_now_ns() - t) / 1e6 / b->frames;
+}
+
+/* convert at full size, then scale the RGBA frame */
+static double time_two_pass(bench_t *b, pix_scaler_t *s, pix_image_t *src, pix_image_t *dst) {
+  pix_image_t full;
+  uint64_t t;
+  int i;
+
+  pix_image_init(&full, PIX_FMT_RGBA8888, src->width, src->height, b->rgba, 0);
+  pix_convert(src, &full);
+  pix_scale(s, &full, dst);
+  t = bench_now_ns();
+  for (i = 0; i < b->frames; i++) {
+    pix_convert(src, &full);
+    pix_scale(s, &full, dst);
+  }
+  return (bench_now_ns() - t) / 1e6 / b->frames;
+}
+
+/* source rows the fused path converts per frame */
+static long rows_converted(const scale_case_t *c, const char *method) {
+  long rows = 0, y, last = -1;
+
+  if (!strcmp(method, "box2") || !strcmp(method, "box4") || !strcmp(method, "copy")) return c->sh;
+  for (y = 0; y < c->dh; y++) {
+    long sy = (2 * y + 1) * c->sh / (2 * c->dh);
+
+    if (!strcmp(method, "bilinear")) {
+      // two neighbours, kept from one output row to the next
+      long lo = ((2 * y + 1) * c->sh - c->dh) / (2 * c->dh), hi = lo + 1;
+
+      if (lo < 0) lo = 0;
+      if (hi >= c->sh) hi = c->sh - 1;
+      if (last < lo) rows++;
+      if (hi != lo && last < hi) rows++;
+      last = hi;
+    } else if (sy != last) {
+      rows++;
+      last = sy;
+    }
+  }
+  return rows;
+}
+
+static void usage(void) {
+  fprintf(stderr,
+          "usage: scalebench [options]\n"
+          "  -s FMT    source format (i420)\n"
+          "  -W N -H N source size (1920 x 1080)\n"
+          "  -w N -h N target size, one case instead of the default set\n"
+          "  -f F      nearest or bilinear (bilinear)\n"
+          "  -o FMT    rgb565 or rgba8888 (rgb565)\n"
+          "  -i ISA    only this ISA and c (all the CPU has)\n"
+          "  -T N      threads of the multi-threaded runs (one per CPU)\n"
+          "  -n N      frames per run (50)\n"
+          "  -S SEED   random seed (1)\n"
+          "  -j FILE   write the JSON result here (stdout)\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  const scale_case_t *cases = default_cases;
+  scale_case_t one = { 1920, 1080, 0, 0, PIX_SCALE_BILINEAR };
+  int ncases = sizeof(default_cases) / sizeof(default_cases[0]);
+  int c, n, isa, only_isa = -1, fail = 0, custom = 0;
+  uint64_t seed = 1;
+  size_t size, k;
+  bench_json_t j;
+  FILE *out = stdout;
+  bench_t b;
+
+  memset(&b, 0, sizeof(b));
+  b.fmt = PIX_FMT_I420;
+  b.out = PIX_FMT_RGB565;
+  b.frames = 50;
+
+  while ((c = getopt(argc, argv, "s:W:H:w:h:f:o:i:T:n:S:j:")) != -1) {
+    switch (c) {
+      case 's':
+        for (b.fmt = 0; b.fmt < PIX_FMT_COUNT; b.fmt++)
+          if (!strcmp(optarg, pix_fmt_name(b.fmt))) break;
+        if (b.fmt == PIX_FMT_COUNT) usage();
+        break;
+      case 'W': one.sw = atoi(optarg); custom = 1; break;
+      case 'H': one.sh = atoi(optarg); custom = 1; break;
+      case 'w': one.dw = atoi(optarg); custom = 1; break;
+      case 'h': one.dh = atoi(optarg); custom = 1; break;
+      case 'f':
+        if (!strcmp(optarg, "nearest")) one.filter = PIX_SCALE_NEAREST;
+        else if (strcmp(optarg, "bilinear")) usage();
+        break;
+      case 'o':
+        if (!strcmp(optarg, "rgba8888")) b.out = PIX_FMT_RGBA8888;
+        else if (strcmp(optarg, "rgb565")) usage();
+        break;
+      case 'i':
+        for (only_isa = 0; only_isa < PIX_ISA_COUNT; only_isa++)
+          if (!strcmp(optarg, pix_isa_name(only_isa))) break;
+        if (only_isa == PIX_ISA_COUNT) usage();
+        break;
+      case 'T': b.threads = atoi(optarg); break;
+      case 'n': b.frames = atoi(optarg); break;
+      case 'S': seed = strtoull(optarg, NULL, 0); break;
+      case 'j':
+        out = fopen(optarg, "w");
+        if (!out) {
+          perror(optarg);
+          return 1;
+        }
+        break;
+      default: usage();
+    }
+  }
+  if (custom) {
+    if (one.dw <= 0 || one.dh <= 0 || one.sw <= 0 || one.sh <= 0) usage();
+    cases = &one;
+    ncases = 1;
+  }
+  if (b.frames < 1 || !seed) usage();
+  if (only_isa >= 0 && pix_set_isa(only_isa) < 0) {
+    fprintf(stderr, "scalebench: this CPU has no %s\n", pix_isa_name(only_isa));
+    return 1;
+  }
+
+  // room for the largest source and target as RGBA
+  size = 0;
+  for (n = 0; n < ncases; n++) {
+    size_t s = pix_image_size(PIX_FMT_RGBA8888, cases[n].sw, cases[n].sh);
+    size_t d = pix_image_size(PIX_FMT_RGBA8888, cases[n].dw, cases[n].dh);
+
+    if (s > size) size = s;
+    if (d > size) size = d;
+  }
+  b.src = malloc(size);
+  b.rgba = malloc(size);
+  b.dst = malloc(size);
+  b.ref = malloc(size);
+  if (!b.src || !b.rgba || !b.dst || !b.ref) {
+    perror("scalebench");
+    return 1;
+  }
+  for (k = 0; k < size; k++)
+    b.src[k] = (uint8_t) bench_rand(&seed);
+
+  memset(&j, 0, sizeof(j));
+  j.f = out;
+  bench_json_obj(&j, NULL);
+  bench_json_str(&j, "bench", "scalebench");
+  bench_json_str(&j, "src", pix_fmt_name(b.fmt));
+  bench_json_str(&j, "dst", pix_fmt_name(b.out));
+  bench_json_int(&j, "frames", b.frames);
+  bench_json_str(&j, "best_isa", pix_isa_name(pix_isa_best()));
+  bench_json_int(&j, "cpus", sysconf(_SC_NPROCESSORS_ONLN));
+  bench_json_arr(&j, "cases");
+
+  for (n = 0; n < ncases; n++) {
+    const scale_case_t *sc = &cases[n];
+    pix_scaler_t *ref = pix_scaler_new(sc->sw, sc->sh, sc->dw, sc->dh, sc->filter, 1);
+    size_t dsize = pix_image_size(b.out, sc->dw, sc->dh);
+    pix_image_t src, dst, rdst;
+    char from[32], to[32];
+    long rows;
+
+    if (!ref) {
+      fprintf(stderr, "scalebench: no scaler for %dx%d -> %dx%d\n", sc->sw, sc->sh, sc->dw, sc->dh);
+      return 1;
+    }
+    pix_image_init(&src, b.fmt, sc->sw, sc->sh, b.src, 0);
+    pix_image_init(&dst, b.out, sc->dw, sc->dh, b.dst, 0);
+    pix_image_init(&rdst, b.out, sc->dw, sc->dh, b.ref, 0);
+    pix_set_isa(PIX_ISA_C);
+    pix_scale(ref, &src, &rdst);
+    rows = rows_converted(sc, pix_scaler_method(ref));
+    snprintf(from, sizeof(from), "%dx%d", sc->sw, sc->sh);
+    snprintf(to, sizeof(to), "%dx%d", sc->dw, sc->dh);
+
+    for (isa = 0; isa < PIX_ISA_COUNT; isa++) {
+      int t;
+
+      if (pix_set_isa(isa) < 0) continue;
+      if (only_isa >= 0 && isa != only_isa && isa != PIX_ISA_C) continue;
+
+      // one thread, then the pool
+      for (t = 0; t < 2; t++) {
+        pix_scaler_t *s = t ? pix_scaler_new(sc->sw, sc->sh, sc->dw, sc->dh, sc->filter, b.threads) : ref;
+        double fused, two;
+        int ok;
+
+        if (!s) continue;
+        if (t && pix_scaler_threads(s) == 1) {
+          pix_scaler_free(s);
+          continue;
+        }
+        memset(b.dst, 0x5A, dsize);
+        pix_scale(s, &src, &dst);
+        ok = !memcmp(b.dst, b.ref, dsize);
+        if (!ok) {
+          fprintf(stderr, "scalebench: %dx%d -> %dx%d %s on %s, %d threads differs from c\n",
+                  sc->sw, sc->sh, sc->dw, sc->dh, pix_scaler_method(s), pix_isa_name(isa),
+                  pix_scaler_threads(s));
+          fail = 1;
+        }
+        fused = time_fused(&b, s, &src, &dst);
+        two = time_two_pass(&b, s, &src, &dst);
+
+        bench_json_obj(&j, NULL);
+        bench_json_str(&j, "from", from);
+        bench_json_str(&j, "to", to);
+        bench_json_str(&j, "method", pix_scaler_method(s));
+        bench_json_str(&j, "isa", pix_isa_name(isa));
+        bench_json_int(&j, "threads", pix_scaler_threads(s));
+        bench_json_num(&j, "fused_ms", fused);
+        bench_json_num(&j, "two_pass_ms", two);
+        bench_json_num(&j, "speedup", two / fused);
+        bench_json_int(&j, "rows_converted", rows);
+        // reads of the source rows it needs and the writes of the target
+        bench_json_num(&j, "fused_mb", (pix_image_size(b.fmt, sc->sw, sc->sh) * rows / sc->sh
+                                        + dsize) / 1e6);
+        // the whole source, the RGBA frame written and read back, the target
+        bench_json_num(&j, "two_pass_mb", (pix_image_size(b.fmt, sc->sw, sc->sh)
+                                           + 2 * pix_image_size(PIX_FMT_RGBA8888, sc->sw, sc->sh)
+                                           + dsize) / 1e6);
+        bench_json_int(&j, "exact", ok);
+        bench_json_end(&j);
+        if (t) pix_scaler_free(s);
+      }
+    }
+    pix_scaler_free(ref);
+  }
+  bench_json_arr_end(&j);
+  bench_json_end(&j);
+
+  free(b.src);
+  free(b.rgba);
+  free(b.dst);
+  free(b.ref);
+  if (out != stdout) fclose(out);
+  return fail;
+}
@@ -0,0 +1,688 @@
+/*
+ * jpeg.c -- baseline JPEG decoder
+ *
+ * See jpeg.h. The entropy decoder reads 32 bits at a time and resolves
+ * Huffman codes of up to 9 bits with one table lookup, longer ones by
+ * comparing against the largest code of each length (the scheme of the
+ * standard's F.2.2.3 and of stb_image). Blocks with only a DC value,
+ * most of them in flat areas, skip the IDCT.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jpeg_impl.h"
+
+#define FAST_BITS 9
+
+enum {
+  M_SOF0 = 0xC0, M_SOF1 = 0xC1, M_DHT = 0xC4, M_DAC = 0xCC, M_RST0 = 0xD0, M_RST7 = 0xD7,
+  M_SOI = 0xD8, M_EOI = 0xD9, M_SOS = 0xDA, M_DQT = 0xDB, M_DRI = 0xDD, M_TEM = 0x01,
+};
+
+typedef struct
+{
+  uint8_t  fast[1 << FAST_BITS];  /* symbol of the next FAST_BITS, 255 if longer */
+  uint8_t  size[257];             /* code length of each symbol, 0 after the last */
+  uint8_t  values[256];
+  uint16_t code[256];
+  uint32_t maxcode[18];           /* of each length, left aligned to 16 bits */
+  int      delta[17];             /* code to symbol index */
+  int      nvalues;
+} huff_t;
+
+typedef struct
+{
+  int id, h, v, tq;
+  const huff_t *dc, *ac;          /* of the scan */
+  int pred;
+  uint8_t *strip;                 /* the rows of the band */
+  int stride;
+} comp_t;
+
+struct jpeg_s
+{
+  huff_t std[4];                  /* jpeg_std_bits order */
+  huff_t huff[2][4];              /* DC and AC tables by id, from DHT */
+  const huff_t *table[2][4];      /* what the ids stand for now */
+  uint16_t q[4][64];              /* zigzag order */
+  int qset;                       /* bit per table seen */
+
+  int width, height, ncomp;
+  comp_t comp[3];
+  int hmax, vmax, mcux, mcuy;
+  int restart;
+  pix_fmt_t fmt;
+
+  uint8_t *buf;                   /* strips and a row of 128s */
+  size_t buf_size;
+  uint8_t *gray;
+
+  const uint8_t *p, *end;         /* entropy coded data */
+  uint32_t bits;                  /* left aligned */
+  int nbits;
+  int marker;                     /* the one the data stopped at */
+  int pad;                        /* zero bytes fed after it */
+
+  jpeg_kernels_t k;
+  int16_t blk[64];
+};
+
+const uint8_t jpeg_zigzag[64] = {
+   0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+  12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+  35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+  58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+const uint8_t jpeg_std_bits[4][16] = {
+  { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 },
+  { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 },
+  { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d },
+  { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 },
+};
+
+static const uint8_t std_dc_vals[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+static const uint8_t std_ac_luma[162] = {
+  0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+  0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+  0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+  0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+  0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+  0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+  0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+  0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+  0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+  0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+  0xf9, 0xfa,
+};
+
+static const uint8_t std_ac_chroma[162] = {
+  0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+  0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+  0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+  0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+  0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+  0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+  0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+  0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+  0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+  0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+  0xf9, 0xfa,
+};
+
+const uint8_t *const jpeg_std_vals[4] = { std_dc_vals, std_dc_vals, std_ac_luma, std_ac_chroma };
+
+/*************************************************************************/
+/* the C IDCT, see jpeg_impl.h                                           */
+/*************************************************************************/
+
+/* 8 values step apart, before the final shift */
+static inline void idct8(const int16_t *s, int step, int bias, int o[8]) {
+  const int s0 = s[0], s1 = s[step], s2 = s[2 * step], s3 = s[3 * step];
+  const int s4 = s[4 * step], s5 = s[5 * step], s6 = s[6 * step], s7 = s[7 * step];
+  const int t2 = s2 * JPEG_R0A + s6 * JPEG_R0B, t3 = s2 * JPEG_R1A + s6 * JPEG_R1B;
+  const int e0 = (int16_t) (s0 + s4) * 4096 + bias, e1 = (int16_t) (s0 - s4) * 4096 + bias;
+  const int x0 = e0 + t3, x3 = e0 - t3, x1 = e1 + t2, x2 = e1 - t2;
+  const int s17 = (int16_t) (s1 + s7), s35 = (int16_t) (s3 + s5);
+  const int y4 = s17 * JPEG_R2A + s35 * JPEG_R2B, y5 = s17 * JPEG_R3A + s35 * JPEG_R3B;
+  const int x4 = s7 * JPEG_R4A + s3 * JPEG_R4B + y4, x6 = s7 * JPEG_R5A + s3 * JPEG_R5B + y5;
+  const int x5 = s5 * JPEG_R6A + s1 * JPEG_R6B + y5, x7 = s5 * JPEG_R7A + s1 * JPEG_R7B + y4;
+
+  o[0] = x0 + x7;
+  o[7] = x0 - x7;
+  o[1] = x1 + x6;
+  o[6] = x1 - x6;
+  o[2] = x2 + x5;
+  o[5] = x2 - x5;
+  o[3] = x3 + x4;
+  o[4] = x3 - x4;
+}
+
+static void idct_c(const int16_t blk[64], uint8_t *dst, int stride) {
+  int16_t t[64];
+  int o[8], i, j;
+
+  for (i = 0; i < 8; i++) {
+    idct8(blk + i, 8, JPEG_BIAS1, o);
+    for (j = 0; j < 8; j++) {
+      int v = o[j] >> 10;
+
+      t[8 * j + i] = (int16_t) (v < -32768 ? -32768 : v > 32767 ? 32767 : v);
+    }
+  }
+  for (i = 0; i < 8; i++, dst += stride) {
+    idct8(t + 8 * i, 1, JPEG_BIAS2, o);
+    for (j = 0; j < 8; j++) {
+      int v = o[j] >> 17;
+
+      dst[j] = (uint8_t) (v < 0 ? 0 : v > 255 ? 255 : v);
+    }
+  }
+}
+
+void jpeg_kernels_c(jpeg_kernels_t *k) {
+  k->idct = idct_c;
+}
+
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+static jpeg_kernels_t kernels[PIX_ISA_COUNT];
+
+static void kernels_init(void) {
+  int i, best = pix_isa_best();
+
+  for (i = 0; i < PIX_ISA_COUNT; i++)
+    jpeg_kernels_c(&kernels[i]);
+  if (best == PIX_ISA_NEON) {
+    jpeg_kernels_neon(&kernels[PIX_ISA_NEON]);
+    return;
+  }
+  if (best >= PIX_ISA_SSE2) jpeg_kernels_sse2(&kernels[PIX_ISA_SSE2]);
+  // the IDCT works on 8 lanes of 16 bit, AVX2 has nothing to add
+  if (best >= PIX_ISA_AVX2) jpeg_kernels_sse2(&kernels[PIX_ISA_AVX2]);
+}
+
+/*************************************************************************/
+/* Huffman tables                                                        */
+/*************************************************************************/
+
+static int huff_build(huff_t *h, const uint8_t bits[16], const uint8_t *values) {
+  int i, j, k = 0;
+  unsigned code = 0;
+
+  for (i = 0; i < 16; i++)
+    for (j = 0; j < bits[i]; j++) {
+      if (k == 256) return -1;
+      h->size[k++] = (uint8_t) (i + 1);
+    }
+  h->size[k] = 0;
+  h->nvalues = k;
+  memcpy(h->values, values, k);
+
+  for (k = 0, j = 1; j <= 16; j++) {
+    h->delta[j] = k - (int) code;
+    while (h->size[k] == j)
+      h->code[k++] = (uint16_t) code++;
+    // more codes than the length has room for
+    if (code > 1u << j) return -1;
+    h->maxcode[j] = code << (16 - j);
+    code <<= 1;
+  }
+  h->maxcode[17] = 0xffffffff;
+
+  memset(h->fast, 255, sizeof(h->fast));
+  for (i = 0; i < h->nvalues; i++) {
+    int s = h->size[i];
+
+    if (s <= FAST_BITS) {
+      int c = h->code[i] << (FAST_BITS - s), m = 1 << (FAST_BITS - s);
+
+      for (j = 0; j < m; j++)
+        h->fast[c + j] = (uint8_t) i;
+    }
+  }
+  return 0;
+}
+
+/*************************************************************************/
+/* entropy coded data                                                    */
+/*************************************************************************/
+
+/* at least 25 bits; past a marker or the end the data reads as zeros */
+static void fill(jpeg_t *j) {
+  while (j->nbits <= 24) {
+    unsigned b = 0;
+
+    if (!j->marker && j->p < j->end) {
+      b = *j->p++;
+      if (b == 0xFF) {
+        while (j->p < j->end && *j->p == 0xFF)
+          j->p++;
+        if (j->p == j->end) {
+          j->marker = M_EOI;
+          b = 0;
+        } else if (*j->p == 0) {
+          j->p++;
+        } else {
+          j->marker = *j->p++;
+          b = 0;
+        }
+      }
+    } else if (!j->marker) {
+      j->marker = M_EOI;
+    }
+    if (j->marker) j->pad++;
+    j->bits |= b << (24 - j->nbits);
+    j->nbits += 8;
+  }
+}
+
+/* n of 1 .. 16 */
+static inline int get_bits(jpeg_t *j, int n) {
+  int v;
+
+  if (j->nbits < n) fill(j);
+  v = (int) (j->bits >> (32 - n));
+  j->bits <<= n;
+  j->nbits -= n;
+  return v;
+}
+
+/* v of n bits as the signed value it codes */
+static inline int extend(int v, int n) {
+  return v < 1 << (n - 1) ? v - (1 << n) + 1 : v;
+}
+
+static inline int huff_decode(jpeg_t *j, const huff_t *h) {
+  unsigned c;
+  int k, s;
+
+  if (j->nbits < 16) fill(j);
+  k = h->fast[j->bits >> (32 - FAST_BITS)];
+  if (k < 255) {
+    s = h->size[k];
+    j->bits <<= s;
+    j->nbits -= s;
+    return h->values[k];
+  }
+  c = j->bits >> 16;
+  for (s = FAST_BITS + 1; c >= h->maxcode[s]; s++)
+    ;
+  if (s == 17) return -1;
+  k = (int) (j->bits >> (32 - s)) + h->delta[s];
+  if (k < 0 || k >= h->nvalues) return -1;
+  j->bits <<= s;
+  j->nbits -= s;
+  return h->values[k];
+}
+
+/* 1 if it has AC coefficients, 0 if only DC, -1 if it is corrupt */
+static int decode_block(jpeg_t *j, comp_t *c, const uint16_t *q) {
+  int16_t *blk = j->blk;
+  int t, k, ac = 0;
+
+  memset(blk, 0, sizeof(j->blk));
+  t = huff_decode(j, c->dc);
+  if (t < 0 || t > 15) return -1;
+  // wrapped to 16 bit, which valid data never reaches, so that the
+  // products below stay in range
+  if (t) c->pred = (int16_t) (c->pred + extend(get_bits(j, t), t));
+  blk[0] = (int16_t) (c->pred * q[0]);
+  for (k = 1; k < 64;) {
+    int rs = huff_decode(j, c->ac), r, s;
+
+    if (rs < 0) return -1;
+    r = rs >> 4;
+    s = rs & 15;
+    if (!s) {
+      if (r != 15) break;       // end of block
+      k += 16;
+      continue;
+    }
+    k += r;
+    if (k > 63) return -1;
+    blk[jpeg_zigzag[k]] = (int16_t) (extend(get_bits(j, s), s) * q[k]);
+    k++;
+    ac = 1;
+  }
+  return ac;
+}
+
+/* the block of DC value dc, the same as idct of it */
+static void fill_dc(int dc, uint8_t *dst, int stride) {
+  int v = dc * 4, i;
+
+  // the column pass saturates, the row pass clamps
+  v = v < -32768 ? -32768 : v > 32767 ? 32767 : v;
+  v = (v * 4096 + JPEG_BIAS2) >> 17;
+  v = v < 0 ? 0 : v > 255 ? 255 : v;
+  for (i = 0; i < 8; i++, dst += stride)
+    memset(dst, v, 8);
+}
+
+/* past the RSTn that should come next */
+static int restart(jpeg_t *j) {
+  int i;
+
+  // what is left in the bits is padding; the marker may still be ahead
+  if (!j->marker) {
+    while (j->p + 1 < j->end && !(j->p[0] == 0xFF && j->p[1] >= M_RST0 && j->p[1] <= M_RST7))
+      j->p++;
+    if (j->p + 1 >= j->end) return -1;
+    j->marker = j->p[1];
+    j->p += 2;
+  }
+  if (j->marker < M_RST0 || j->marker > M_RST7) return -1;
+  j->marker = 0;
+  j->pad = 0;
+  j->bits = 0;
+  j->nbits = 0;
+  for (i = 0; i < j->ncomp; i++)
+    j->comp[i].pred = 0;
+  return 0;
+}
+
+/*************************************************************************/
+/* the scan                                                              */
+/*************************************************************************/
+
+static int strips_alloc(jpeg_t *j) {
+  size_t size = 0;
+  uint8_t *b;
+  int i;
+
+  for (i = 0; i < j->ncomp; i++) {
+    comp_t *c = &j->comp[i];
+
+    c->stride = j->mcux * c->h * 8;
+    size += (size_t) c->stride * c->v * 8;
+  }
+  size += (size_t) j->comp[0].stride;
+  if (size > j->buf_size) {
+    free(j->buf);
+    j->buf = malloc(size);
+    j->buf_size = j->buf ? size : 0;
+    if (!j->buf) return -1;
+  }
+  for (b = j->buf, i = 0; i < j->ncomp; i++) {
+    j->comp[i].strip = b;
+    b += (size_t) j->comp[i].stride * j->comp[i].v * 8;
+  }
+  j->gray = b;
+  memset(j->gray, 128, j->comp[0].stride);
+  return 0;
+}
+
+/* rows y0 .. y0 + n - 1 of the image from the strips to dst */
+static void put_band(jpeg_t *j, pix_image_t *dst, pix_row_fn kernel, int y0, int n) {
+  const int sx = j->fmt != PIX_FMT_J444, sy = j->fmt == PIX_FMT_J420;
+  const uint8_t *cb = j->gray, *cr = j->gray;
+  int cstride = 0, r;
+
+  if (j->ncomp == 3) {
+    cb = j->comp[1].strip;
+    cr = j->comp[2].strip;
+    cstride = j->comp[1].stride;
+  }
+  for (r = 0; r < n; r++) {
+    const uint8_t *src[3];
+    const int y = y0 + r;
+
+    src[0] = j->comp[0].strip + r * j->comp[0].stride;
+    src[1] = cb + (r >> sy) * cstride;
+    src[2] = cr + (r >> sy) * cstride;
+    if (kernel) {
+      kernel(src, dst->data[0] + (long) y * dst->stride[0], dst->width);
+    } else {
+      const int cw = (dst->width + sx) >> sx;
+
+      memcpy(dst->data[0] + (long) y * dst->stride[0], src[0], dst->width);
+      memcpy(dst->data[1] + (long) (y >> sy) * dst->stride[1], src[1], cw);
+      memcpy(dst->data[2] + (long) (y >> sy) * dst->stride[2], src[2], cw);
+    }
+  }
+}
+
+static int decode_scan(jpeg_t *j, pix_image_t *dst) {
+  const int band = 8 * j->vmax;
+  pix_row_fn kernel = NULL;
+  int mx, my, i, todo = j->restart;
+
+  if (dst->width > j->width || dst->height > j->height) return -1;
+  if (dst->fmt == PIX_FMT_RGB565 || dst->fmt == PIX_FMT_RGBA8888)
+    kernel = pix_row_kernel(j->fmt, dst->fmt == PIX_FMT_RGB565 ? PIX_OUT_565 : PIX_OUT_RGBA);
+  else if (dst->fmt != j->fmt)
+    return -1;
+  if (strips_alloc(j) < 0) return -1;
+  j->k = kernels[pix_isa()];
+  j->bits = 0;
+  j->nbits = 0;
+  j->marker = 0;
+  j->pad = 0;
+  for (i = 0; i < j->ncomp; i++)
+    j->comp[i].pred = 0;
+
+  // bands below dst->height are cropped off and not decoded
+  for (my = 0; my < j->mcuy && my * band < dst->height; my++) {
+    for (mx = 0; mx < j->mcux; mx++) {
+      if (j->restart && !todo--) {
+        if (restart(j) < 0) return -1;
+        todo = j->restart - 1;
+      }
+      for (i = 0; i < j->ncomp; i++) {
+        comp_t *c = &j->comp[i];
+        const uint16_t *q = j->q[c->tq];
+        int bx, by;
+
+        for (by = 0; by < c->v; by++)
+          for (bx = 0; bx < c->h; bx++) {
+            uint8_t *out = c->strip + by * 8 * c->stride + (mx * c->h + bx) * 8;
+            // past the end of the data: the rest of the image is gray
+            int ac = j->pad > 8 ? 0 : decode_block(j, c, q);
+
+            if (ac < 0) return -1;
+            if (j->pad > 8) fill_dc(0, out, c->stride);
+            else if (ac) j->k.idct(j->blk, out, c->stride);
+            else fill_dc(j->blk[0], out, c->stride);
+          }
+      }
+    }
+    put_band(j, dst, kernel, my * band, dst->height - my * band < band ? dst->height - my * band : band);
+  }
+  return 0;
+}
+
+/*************************************************************************/
+/* markers                                                               */
+/*************************************************************************/
+
+static inline int be16(const uint8_t *p) {
+  return p[0] << 8 | p[1];
+}
+
+/* the next marker from *p on, skipping anything else; -1 at the end */
+static int next_marker(const uint8_t **p, const uint8_t *end) {
+  const uint8_t *q = *p;
+
+  for (;;) {
+    while (q < end && *q != 0xFF)
+      q++;
+    while (q < end && *q == 0xFF)
+      q++;
+    if (q >= end) return -1;
+    if (*q) {
+      *p = q + 1;
+      return *q;
+    }
+  }
+}
+
+/* the body of the segment at *p, whose length comes first */
+static const uint8_t *segment(const uint8_t **p, const uint8_t *end, int *n) {
+  const uint8_t *b = *p;
+  int len;
+
+  if (end - b < 2) return NULL;
+  len = be16(b);
+  if (len < 2 || len > end - b) return NULL;
+  *p = b + len;
+  *n = len - 2;
+  return b + 2;
+}
+
+static int read_sof(jpeg_t *j, const uint8_t *b, int n) {
+  int i;
+
+  if (n < 6 || b[0] != 8) return -1;
+  j->height = be16(b + 1);
+  j->width = be16(b + 3);
+  j->ncomp = b[5];
+  // DNL (height 0) never comes with MJPEG
+  if (!j->width || !j->height || (j->ncomp != 1 && j->ncomp != 3) || n < 6 + 3 * j->ncomp) return -1;
+  for (i = 0; i < j->ncomp; i++) {
+    comp_t *c = &j->comp[i];
+
+    c->id = b[6 + 3 * i];
+    c->h = b[7 + 3 * i] >> 4;
+    c->v = b[7 + 3 * i] & 15;
+    c->tq = b[8 + 3 * i];
+    if (c->tq > 3) return -1;
+  }
+  // one component is one block per MCU, whatever its sampling
+  if (j->ncomp == 1) j->comp[0].h = j->comp[0].v = 1;
+  for (i = 1; i < j->ncomp; i++)
+    if (j->comp[i].h != 1 || j->comp[i].v != 1) return -1;
+  if (j->comp[0].h == 1 && j->comp[0].v == 1) j->fmt = PIX_FMT_J444;
+  else if (j->comp[0].h == 2 && j->comp[0].v == 1) j->fmt = PIX_FMT_J422;
+  else if (j->comp[0].h == 2 && j->comp[0].v == 2) j->fmt = PIX_FMT_J420;
+  else return -1;
+  j->hmax = j->comp[0].h;
+  j->vmax = j->comp[0].v;
+  j->mcux = (j->width + 8 * j->hmax - 1) / (8 * j->hmax);
+  j->mcuy = (j->height + 8 * j->vmax - 1) / (8 * j->vmax);
+  return 0;
+}
+
+static int read_dht(jpeg_t *j, const uint8_t *b, int n) {
+  while (n > 0) {
+    int tc = b[0] >> 4, th = b[0] & 15, count = 0, i;
+
+    if (tc > 1 || th > 3 || n < 17) return -1;
+    for (i = 0; i < 16; i++)
+      count += b[1 + i];
+    if (count > 256 || n < 17 + count) return -1;
+    if (huff_build(&j->huff[tc][th], b + 1, b + 17) < 0) return -1;
+    j->table[tc][th] = &j->huff[tc][th];
+    b += 17 + count;
+    n -= 17 + count;
+  }
+  return 0;
+}
+
+static int read_dqt(jpeg_t *j, const uint8_t *b, int n) {
+  while (n > 0) {
+    int pq = b[0] >> 4, tq = b[0] & 15, i;
+
+    if (pq > 1 || tq > 3 || n < 1 + 64 * (pq + 1)) return -1;
+    for (i = 0; i < 64; i++)
+      j->q[tq][i] = (uint16_t) (pq ? be16(b + 1 + 2 * i) : b[1 + i]);
+    j->qset |= 1 << tq;
+    b += 1 + 64 * (pq + 1);
+    n -= 1 + 64 * (pq + 1);
+  }
+  return 0;
+}
+
+static int read_sos(jpeg_t *j, const uint8_t *b, int n) {
+  int i;
+
+  // all components in one scan: separate scans per component are legal
+  // baseline but no camera writes them
+  if (!j->ncomp || n < 1 || b[0] != j->ncomp || n < 1 + 2 * j->ncomp + 3) return -1;
+  for (i = 0; i < j->ncomp; i++) {
+    const int id = b[1 + 2 * i], td = b[2 + 2 * i] >> 4, ta = b[2 + 2 * i] & 15;
+    comp_t *c = &j->comp[i];
+
+    if (c->id != id || td > 3 || ta > 3) return -1;
+    c->dc = j->table[0][td];
+    c->ac = j->table[1][ta];
+    if (!c->dc || !c->ac || !(j->qset & 1 << c->tq)) return -1;
+  }
+  return 0;
+}
+
+/*************************************************************************/
+
+jpeg_t *jpeg_new(void) {
+  jpeg_t *j = calloc(1, sizeof(*j));
+  int i;
+
+  if (!j) return NULL;
+  pthread_once(&kernels_once, kernels_init);
+  for (i = 0; i < 4; i++)
+    huff_build(&j->std[i], jpeg_std_bits[i], jpeg_std_vals[i]);
+  return j;
+}
+
+void jpeg_free(jpeg_t *j) {
+  if (!j) return;
+  free(j->buf);
+  free(j);
+}
+
+/* from SOI up to the first SOS, or SOF if sof_only */
+static int read_headers(jpeg_t *j, const uint8_t **p, const uint8_t *end, int sof_only) {
+  int m;
+
+  if (next_marker(p, end) != M_SOI) return -1;
+  for (;;) {
+    const uint8_t *b;
+    int n;
+
+    m = next_marker(p, end);
+    if (m < 0 || m == M_EOI) return -1;
+    if ((m >= M_RST0 && m <= M_RST7) || m == M_TEM) continue;
+    if (!(b = segment(p, end, &n))) return -1;
+    if (m == M_SOF0 || m == M_SOF1) {
+      if (read_sof(j, b, n) < 0) return -1;
+      if (sof_only) return 0;
+    } else if (m > M_SOF1 && m <= 0xCF && m != M_DHT && m != M_DAC) {
+      return -1;                // progressive, lossless, arithmetic coded
+    } else if (m == M_DHT) {
+      if (read_dht(j, b, n) < 0) return -1;
+    } else if (m == M_DQT) {
+      if (read_dqt(j, b, n) < 0) return -1;
+    } else if (m == M_DRI) {
+      if (n < 2) return -1;
+      j->restart = be16(b);
+    } else if (m == M_SOS) {
+      return read_sos(j, b, n);
+    }
+  }
+}
+
+int jpeg_info(const void *data, long len, jpeg_info_t *info) {
+  const uint8_t *p = data;
+  jpeg_t j;
+
+  if (!data || len < 2) return -1;
+  j.ncomp = 0;
+  if (read_headers(&j, &p, p + len, 1) < 0) return -1;
+  info->width = j.width;
+  info->height = j.height;
+  info->fmt = j.fmt;
+  info->gray = j.ncomp == 1;
+  return 0;
+}
+
+long jpeg_decode(jpeg_t *j, const void *data, long len, pix_image_t *dst) {
+  const uint8_t *p = data, *end = p + len;
+  int i;
+
+  if (!data || len < 2) return -1;
+  // tables and the restart interval do not carry over from the last image
+  for (i = 0; i < 4; i++) {
+    j->table[0][i] = i < 2 ? &j->std[i] : NULL;
+    j->table[1][i] = i < 2 ? &j->std[2 + i] : NULL;
+  }
+  j->qset = 0;
+  j->restart = 0;
+  j->ncomp = 0;
+  if (read_headers(j, &p, end, 0) < 0) return -1;
+
+  j->p = p;
+  j->end = end;
+  if (decode_scan(j, dst) < 0) return -1;
+
+  if (j->marker == M_EOI) return j->p - (const uint8_t *) data;
+  // the EOI is further on, past what of the scan was cropped off
+  p = j->marker ? j->p - 2 : j->p;
+  for (;;) {
+    int m = next_marker(&p, end);
+
+    if (m < 0) return len;
+    if (m == M_EOI) return p - (const uint8_t *) data;
+  }
+}
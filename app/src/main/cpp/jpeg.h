@@ -0,0 +1,49 @@
+/*
+ * jpeg.h -- baseline JPEG decoding for Motion-JPEG video
+ *
+ * Reads the frames of MJPG and AVI1 streams: sequential Huffman coded
+ * 8 bit JPEG (SOF0, SOF1), gray or YCbCr with luma sampled 1x1, 2x1 or
+ * 2x2 against chroma, in one interleaved scan. That covers what cameras
+ * and capture cards write; progressive and arithmetic coded images are
+ * refused. Frames without DHT get the tables of the standard, which is
+ * what MJPEG expects.
+ *
+ * The IDCT has SIMD versions (SSE2, NEON) that follow pixconv's ISA and
+ * give the same pixels as the C one. The image is decoded a band of 8
+ * or 16 rows at a time, and each band goes through the pixconv row
+ * kernels straight into the destination while it is still in cache.
+ * Chroma is upsampled by repeating it, as for I420.
+ */
+
+#ifndef JPEG_H
+#define JPEG_H
+
+#include "pixconv.h"
+
+typedef struct
+{
+  int width, height;
+  pix_fmt_t fmt;            /* PIX_FMT_J420, J422 or J444 */
+  int gray;                 /* one component, chroma reads as 128 */
+} jpeg_info_t;
+
+/* the frame header of the first image in data, -1 if there is none or
+   it has a layout jpeg_decode refuses */
+int jpeg_info(const void *data, long len, jpeg_info_t *info);
+
+typedef struct jpeg_s jpeg_t;
+
+/* one per thread; it keeps the tables and buffers between images */
+jpeg_t *jpeg_new(void);
+void jpeg_free(jpeg_t *j);
+
+/*
+ * The first image in data to dst, which is RGB565, RGBA8888 or the
+ * image's own J format, and not larger than the image: the rest is
+ * cropped off. Returns the bytes up to and with its EOI, so that a
+ * second image (the other field of AVI1) can follow, or -1. A truncated
+ * image decodes, with gray where the data ran out.
+ */
+long jpeg_decode(jpeg_t *j, const void *data, long len, pix_image_t *dst);
+
+#endif /* JPEG_H */
@@ -0,0 +1,63 @@
+/*
+ * jpeg_impl.h -- IDCT kernels of the JPEG decoder, shared by its ISA files
+ *
+ * The IDCT is the islow one of the IJG code in 12 bit fixed point, in
+ * the form stb_image gives it for SIMD: every multiply is a rotation of
+ * two inputs (x * a + y * b, one pmaddwd or vmlal), products and sums
+ * in 32 bit, and the four input sums that feed the rotations in 16 bit.
+ * The C kernel does exactly that too, so all give the same bytes, also
+ * for coefficients out of range.
+ */
+
+#ifndef JPEG_IMPL_H
+#define JPEG_IMPL_H
+
+#include "jpeg.h"
+#include "pixconv_impl.h"
+
+#define JPEG_F2F(x)     ((int) ((x) * 4096 + 0.5))
+
+/* even part: t2 = s2 * R0A + s6 * R0B, t3 = s2 * R1A + s6 * R1B */
+#define JPEG_R0A        JPEG_F2F(0.5411961)
+#define JPEG_R0B        (JPEG_F2F(0.5411961) + JPEG_F2F(-1.847759065))
+#define JPEG_R1A        (JPEG_F2F(0.5411961) + JPEG_F2F(0.765366865))
+#define JPEG_R1B        JPEG_F2F(0.5411961)
+/* odd part, the rotations of (s1 + s7, s3 + s5) */
+#define JPEG_R2A        (JPEG_F2F(1.175875602) + JPEG_F2F(-0.899976223))
+#define JPEG_R2B        JPEG_F2F(1.175875602)
+#define JPEG_R3A        JPEG_F2F(1.175875602)
+#define JPEG_R3B        (JPEG_F2F(1.175875602) + JPEG_F2F(-2.562915447))
+/* ... of (s7, s3) */
+#define JPEG_R4A        (JPEG_F2F(-1.961570560) + JPEG_F2F(0.298631336))
+#define JPEG_R4B        JPEG_F2F(-1.961570560)
+#define JPEG_R5A        JPEG_F2F(-1.961570560)
+#define JPEG_R5B        (JPEG_F2F(-1.961570560) + JPEG_F2F(3.072711026))
+/* ... and of (s5, s1) */
+#define JPEG_R6A        (JPEG_F2F(-0.390180644) + JPEG_F2F(2.053119869))
+#define JPEG_R6B        JPEG_F2F(-0.390180644)
+#define JPEG_R7A        JPEG_F2F(-0.390180644)
+#define JPEG_R7B        (JPEG_F2F(-0.390180644) + JPEG_F2F(1.501321110))
+
+/* columns: + bias, >> 10, saturated to 16 bit. Rows: + bias (rounding
+   and the level shift), >> 17, clamped to 0..255 */
+#define JPEG_BIAS1      512
+#define JPEG_BIAS2      (65536 + (128 << 17))
+
+typedef struct
+{
+  /* a dequantized block in natural order to 8 rows of 8 pixels */
+  void (*idct)(const int16_t blk[64], uint8_t *dst, int stride);
+} jpeg_kernels_t;
+
+/* each sets the kernels it has */
+void jpeg_kernels_c(jpeg_kernels_t *k);
+void jpeg_kernels_sse2(jpeg_kernels_t *k);
+void jpeg_kernels_neon(jpeg_kernels_t *k);
+
+/* the tables of the standard (K.3), which MJPEG frames leave out: DC
+   luma, DC chroma, AC luma, AC chroma */
+extern const uint8_t jpeg_std_bits[4][16];
+extern const uint8_t *const jpeg_std_vals[4];
+extern const uint8_t jpeg_zigzag[64];
+
+#endif /* JPEG_IMPL_H */
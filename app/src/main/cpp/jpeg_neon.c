@@ -0,0 +1,123 @@
+/*
+ * jpeg_neon.c -- NEON IDCT of the JPEG decoder
+ *
+ * The SSE2 one with vmull/vmlal for the rotations: a register per row,
+ * the column pass, a transpose, the row pass and a transpose back.
+ */
+
+#include "jpeg_impl.h"
+
+#if defined(__ARM_NEON)
+
+#include <arm_neon.h>
+
+typedef struct
+{
+  int32x4_t lo, hi;
+} wide_t;
+
+/* x * a + y * b in 32 bit */
+static inline wide_t rot_neon(int16x8_t x, int16x8_t y, int a, int b) {
+  wide_t o;
+
+  o.lo = vmlal_n_s16(vmull_n_s16(vget_low_s16(x), (int16_t) a), vget_low_s16(y), (int16_t) b);
+  o.hi = vmlal_n_s16(vmull_n_s16(vget_high_s16(x), (int16_t) a), vget_high_s16(y), (int16_t) b);
+  return o;
+}
+
+/* v << 12 in 32 bit, plus bias */
+static inline wide_t widen_neon(int16x8_t v, int32x4_t bias) {
+  wide_t o;
+
+  o.lo = vaddq_s32(vshll_n_s16(vget_low_s16(v), 12), bias);
+  o.hi = vaddq_s32(vshll_n_s16(vget_high_s16(v), 12), bias);
+  return o;
+}
+
+static inline wide_t add_neon(wide_t a, wide_t b) {
+  a.lo = vaddq_s32(a.lo, b.lo);
+  a.hi = vaddq_s32(a.hi, b.hi);
+  return a;
+}
+
+static inline wide_t sub_neon(wide_t a, wide_t b) {
+  a.lo = vsubq_s32(a.lo, b.lo);
+  a.hi = vsubq_s32(a.hi, b.hi);
+  return a;
+}
+
+/* the column pass shifts by 10 and saturates in one go; the row pass
+   needs 17, more than vqshrn takes */
+#define NARROW1(v)      vcombine_s16(vqshrn_n_s32((v).lo, 10), vqshrn_n_s32((v).hi, 10))
+#define NARROW2(v)      vcombine_s16(vqmovn_s32(vshrq_n_s32((v).lo, 17)), \
+                                     vqmovn_s32(vshrq_n_s32((v).hi, 17)))
+
+#define IDCT8_NEON(s, bias, NARROW) do { \
+  const int32x4_t b_ = vdupq_n_s32(bias); \
+  const wide_t t2 = rot_neon(s[2], s[6], JPEG_R0A, JPEG_R0B); \
+  const wide_t t3 = rot_neon(s[2], s[6], JPEG_R1A, JPEG_R1B); \
+  const wide_t e0 = widen_neon(vaddq_s16(s[0], s[4]), b_); \
+  const wide_t e1 = widen_neon(vsubq_s16(s[0], s[4]), b_); \
+  const wide_t x0 = add_neon(e0, t3), x3 = sub_neon(e0, t3); \
+  const wide_t x1 = add_neon(e1, t2), x2 = sub_neon(e1, t2); \
+  const int16x8_t s17 = vaddq_s16(s[1], s[7]), s35 = vaddq_s16(s[3], s[5]); \
+  const wide_t y4 = rot_neon(s17, s35, JPEG_R2A, JPEG_R2B); \
+  const wide_t y5 = rot_neon(s17, s35, JPEG_R3A, JPEG_R3B); \
+  const wide_t x4 = add_neon(rot_neon(s[7], s[3], JPEG_R4A, JPEG_R4B), y4); \
+  const wide_t x6 = add_neon(rot_neon(s[7], s[3], JPEG_R5A, JPEG_R5B), y5); \
+  const wide_t x5 = add_neon(rot_neon(s[5], s[1], JPEG_R6A, JPEG_R6B), y5); \
+  const wide_t x7 = add_neon(rot_neon(s[5], s[1], JPEG_R7A, JPEG_R7B), y4); \
+  s[0] = NARROW(add_neon(x0, x7)); \
+  s[7] = NARROW(sub_neon(x0, x7)); \
+  s[1] = NARROW(add_neon(x1, x6)); \
+  s[6] = NARROW(sub_neon(x1, x6)); \
+  s[2] = NARROW(add_neon(x2, x5)); \
+  s[5] = NARROW(sub_neon(x2, x5)); \
+  s[3] = NARROW(add_neon(x3, x4)); \
+  s[4] = NARROW(sub_neon(x3, x4)); \
+} while (0)
+
+static inline void transpose_neon(int16x8_t r[8]) {
+  const int16x8x2_t a01 = vtrnq_s16(r[0], r[1]), a23 = vtrnq_s16(r[2], r[3]);
+  const int16x8x2_t a45 = vtrnq_s16(r[4], r[5]), a67 = vtrnq_s16(r[6], r[7]);
+  const int32x4x2_t b02 = vtrnq_s32(vreinterpretq_s32_s16(a01.val[0]), vreinterpretq_s32_s16(a23.val[0]));
+  const int32x4x2_t b13 = vtrnq_s32(vreinterpretq_s32_s16(a01.val[1]), vreinterpretq_s32_s16(a23.val[1]));
+  const int32x4x2_t b46 = vtrnq_s32(vreinterpretq_s32_s16(a45.val[0]), vreinterpretq_s32_s16(a67.val[0]));
+  const int32x4x2_t b57 = vtrnq_s32(vreinterpretq_s32_s16(a45.val[1]), vreinterpretq_s32_s16(a67.val[1]));
+
+  // b02 holds columns 0 and 4 (first and second half) of rows 0-3, then 2 and 6
+#define HALVES(d0, d1, p, q) \
+  r[d0] = vreinterpretq_s16_s32(vcombine_s32(vget_low_s32(p), vget_low_s32(q))); \
+  r[d1] = vreinterpretq_s16_s32(vcombine_s32(vget_high_s32(p), vget_high_s32(q)))
+  HALVES(0, 4, b02.val[0], b46.val[0]);
+  HALVES(2, 6, b02.val[1], b46.val[1]);
+  HALVES(1, 5, b13.val[0], b57.val[0]);
+  HALVES(3, 7, b13.val[1], b57.val[1]);
+#undef HALVES
+}
+
+static void idct_neon(const int16_t blk[64], uint8_t *dst, int stride) {
+  int16x8_t r[8];
+  int i;
+
+  for (i = 0; i < 8; i++)
+    r[i] = vld1q_s16(blk + 8 * i);
+  IDCT8_NEON(r, JPEG_BIAS1, NARROW1);
+  transpose_neon(r);
+  IDCT8_NEON(r, JPEG_BIAS2, NARROW2);
+  transpose_neon(r);
+  for (i = 0; i < 8; i++)
+    vst1_u8(dst + i * stride, vqmovun_s16(r[i]));
+}
+
+void jpeg_kernels_neon(jpeg_kernels_t *k) {
+  k->idct = idct_neon;
+}
+
+#else /* !__ARM_NEON */
+
+void jpeg_kernels_neon(jpeg_kernels_t *k) {
+  (void) k;
+}
+
+#endif
@@ -0,0 +1,133 @@
+/*
+ * jpeg_x86.c -- SSE2 IDCT of the JPEG decoder
+ *
+ * A register per row of the block: the column pass works on all eight
+ * columns at once, then the block is transposed for the row pass and
+ * back for the stores. Rotations are pmaddwd on interleaved inputs.
+ */
+
+#include "jpeg_impl.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+#define SSE2 __attribute__((target("sse2")))
+
+/* x * a + y * b in 32 bit, low and high four lanes */
+static inline SSE2 void rot_sse2(__m128i x, __m128i y, int a, int b, __m128i o[2]) {
+  const __m128i c = _mm_setr_epi16((short) a, (short) b, (short) a, (short) b,
+                                   (short) a, (short) b, (short) a, (short) b);
+
+  o[0] = _mm_madd_epi16(_mm_unpacklo_epi16(x, y), c);
+  o[1] = _mm_madd_epi16(_mm_unpackhi_epi16(x, y), c);
+}
+
+/* v << 12 in 32 bit, plus bias */
+static inline SSE2 void widen_sse2(__m128i v, __m128i bias, __m128i o[2]) {
+  const __m128i z = _mm_setzero_si128();
+
+  o[0] = _mm_add_epi32(_mm_srai_epi32(_mm_unpacklo_epi16(z, v), 4), bias);
+  o[1] = _mm_add_epi32(_mm_srai_epi32(_mm_unpackhi_epi16(z, v), 4), bias);
+}
+
+static inline SSE2 void add_sse2(const __m128i a[2], const __m128i b[2], __m128i o[2]) {
+  o[0] = _mm_add_epi32(a[0], b[0]);
+  o[1] = _mm_add_epi32(a[1], b[1]);
+}
+
+static inline SSE2 void sub_sse2(const __m128i a[2], const __m128i b[2], __m128i o[2]) {
+  o[0] = _mm_sub_epi32(a[0], b[0]);
+  o[1] = _mm_sub_epi32(a[1], b[1]);
+}
+
+/* a + b and a - b, shifted and saturated to 16 bit */
+static inline SSE2 void bfly_sse2(const __m128i a[2], const __m128i b[2], __m128i shift,
+                                  __m128i *o0, __m128i *o1) {
+  *o0 = _mm_packs_epi32(_mm_sra_epi32(_mm_add_epi32(a[0], b[0]), shift),
+                        _mm_sra_epi32(_mm_add_epi32(a[1], b[1]), shift));
+  *o1 = _mm_packs_epi32(_mm_sra_epi32(_mm_sub_epi32(a[0], b[0]), shift),
+                        _mm_sra_epi32(_mm_sub_epi32(a[1], b[1]), shift));
+}
+
+/* the 1-D IDCT of s[0] .. s[7] lane by lane, in place */
+static inline SSE2 void idct8_sse2(__m128i s[8], int bias, int shift) {
+  const __m128i b = _mm_set1_epi32(bias), sh = _mm_cvtsi32_si128(shift);
+  __m128i t2[2], t3[2], e0[2], e1[2], x0[2], x1[2], x2[2], x3[2];
+  __m128i y0[2], y1[2], y2[2], y3[2], y4[2], y5[2], x4[2], x5[2], x6[2], x7[2];
+
+  rot_sse2(s[2], s[6], JPEG_R0A, JPEG_R0B, t2);
+  rot_sse2(s[2], s[6], JPEG_R1A, JPEG_R1B, t3);
+  widen_sse2(_mm_add_epi16(s[0], s[4]), b, e0);
+  widen_sse2(_mm_sub_epi16(s[0], s[4]), b, e1);
+  add_sse2(e0, t3, x0);
+  sub_sse2(e0, t3, x3);
+  add_sse2(e1, t2, x1);
+  sub_sse2(e1, t2, x2);
+
+  rot_sse2(_mm_add_epi16(s[1], s[7]), _mm_add_epi16(s[3], s[5]), JPEG_R2A, JPEG_R2B, y4);
+  rot_sse2(_mm_add_epi16(s[1], s[7]), _mm_add_epi16(s[3], s[5]), JPEG_R3A, JPEG_R3B, y5);
+  rot_sse2(s[7], s[3], JPEG_R4A, JPEG_R4B, y0);
+  rot_sse2(s[7], s[3], JPEG_R5A, JPEG_R5B, y2);
+  rot_sse2(s[5], s[1], JPEG_R6A, JPEG_R6B, y1);
+  rot_sse2(s[5], s[1], JPEG_R7A, JPEG_R7B, y3);
+  add_sse2(y0, y4, x4);
+  add_sse2(y1, y5, x5);
+  add_sse2(y2, y5, x6);
+  add_sse2(y3, y4, x7);
+
+  bfly_sse2(x0, x7, sh, &s[0], &s[7]);
+  bfly_sse2(x1, x6, sh, &s[1], &s[6]);
+  bfly_sse2(x2, x5, sh, &s[2], &s[5]);
+  bfly_sse2(x3, x4, sh, &s[3], &s[4]);
+}
+
+static inline SSE2 void transpose_sse2(__m128i r[8]) {
+  const __m128i a0 = _mm_unpacklo_epi16(r[0], r[1]), a1 = _mm_unpackhi_epi16(r[0], r[1]);
+  const __m128i a2 = _mm_unpacklo_epi16(r[2], r[3]), a3 = _mm_unpackhi_epi16(r[2], r[3]);
+  const __m128i a4 = _mm_unpacklo_epi16(r[4], r[5]), a5 = _mm_unpackhi_epi16(r[4], r[5]);
+  const __m128i a6 = _mm_unpacklo_epi16(r[6], r[7]), a7 = _mm_unpackhi_epi16(r[6], r[7]);
+  const __m128i b0 = _mm_unpacklo_epi32(a0, a2), b1 = _mm_unpackhi_epi32(a0, a2);
+  const __m128i b2 = _mm_unpacklo_epi32(a1, a3), b3 = _mm_unpackhi_epi32(a1, a3);
+  const __m128i b4 = _mm_unpacklo_epi32(a4, a6), b5 = _mm_unpackhi_epi32(a4, a6);
+  const __m128i b6 = _mm_unpacklo_epi32(a5, a7), b7 = _mm_unpackhi_epi32(a5, a7);
+
+  r[0] = _mm_unpacklo_epi64(b0, b4);
+  r[1] = _mm_unpackhi_epi64(b0, b4);
+  r[2] = _mm_unpacklo_epi64(b1, b5);
+  r[3] = _mm_unpackhi_epi64(b1, b5);
+  r[4] = _mm_unpacklo_epi64(b2, b6);
+  r[5] = _mm_unpackhi_epi64(b2, b6);
+  r[6] = _mm_unpacklo_epi64(b3, b7);
+  r[7] = _mm_unpackhi_epi64(b3, b7);
+}
+
+static SSE2 void idct_sse2(const int16_t blk[64], uint8_t *dst, int stride) {
+  __m128i r[8];
+  int i;
+
+  for (i = 0; i < 8; i++)
+    r[i] = _mm_loadu_si128((const __m128i *) (blk + 8 * i));
+  idct8_sse2(r, JPEG_BIAS1, 10);
+  transpose_sse2(r);
+  idct8_sse2(r, JPEG_BIAS2, 17);
+  transpose_sse2(r);
+  for (i = 0; i < 8; i += 2) {
+    const __m128i p = _mm_packus_epi16(r[i], r[i + 1]);
+
+    _mm_storel_epi64((__m128i *) (dst + i * stride), p);
+    _mm_storel_epi64((__m128i *) (dst + (i + 1) * stride), _mm_srli_si128(p, 8));
+  }
+}
+
+void jpeg_kernels_sse2(jpeg_kernels_t *k) {
+  k->idct = idct_sse2;
+}
+
+#else /* !x86 */
+
+void jpeg_kernels_sse2(jpeg_kernels_t *k) {
+  (void) k;
+}
+
+#endif
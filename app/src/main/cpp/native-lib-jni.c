@@ -1,9 +1,16 @@
 #include <jni.h>
+#include <stdlib.h>
 #include <string.h>
 #include <android/bitmap.h>
+#include <android/native_window_jni.h>
 
 #include "config.h"
 #include "avilib1_1_5/avilib.h"
+#include "audio.h"
+#include "pixconv.h"
+#include "pixscale.h"
+#include "playback.h"
+#include "vdec.h"
 
 JNIEXPORT jlong JNICALL
 Java_com_czf_aviplayer_NativeLibInterface_openFile(JNIEnv *env, jclass clazz, jstring jfilePath) {
@@ -45,23 +52,212 @@ Java_com_czf_aviplayer_NativeLibInterface_closeFile(JNIEnv *env, jclass clazz, j
 
 JNIEXPORT jlong JNICALL
 Java_com_czf_aviplayer_NativeLibInterface_setFrame(JNIEnv *env, jclass clazz, jlong avi, jobject jbitmap) {
-  char *buf = NULL;
-  if (AndroidBitmap_lockPixels(env, jbitmap, (void **)&buf) < 0) {
+  AndroidBitmapInfo info;
+  pix_image_t dst;
+  char *buf = NULL, *pixels = NULL;
+  int w, h;
+  long frameSize = AVI_frame_size((avi_t *)avi, ((avi_t *)avi)->video_pos);
+  int keyFrame = 0;
+
+  if (frameSize < 0 || AndroidBitmap_getInfo(env, jbitmap, &info) < 0) {
+    return -1;
+  }
+  buf = malloc(frameSize + 1);
+  if (!buf) {
     return -1;
   }
-
-  int keyFrame = 0;
-  long frameSize = 0;
   frameSize = AVI_read_frame((avi_t *)avi, buf, &keyFrame);
   if (frameSize < 0) {
-    AndroidBitmap_unlockPixels(env, jbitmap);
     log("--==--: %s\n", AVI_strerror());
+    free(buf);
     return -1;
   }
+  // a frame larger than the bitmap is scaled down to fit it
+  pix_fit(AVI_video_width((avi_t *)avi), AVI_video_height((avi_t *)avi), info.width, info.height, &w, &h);
+  if (AndroidBitmap_lockPixels(env, jbitmap, (void **)&pixels) < 0) {
+    free(buf);
+    return -1;
+  }
+  if ((info.format != ANDROID_BITMAP_FORMAT_RGB_565 && info.format != ANDROID_BITMAP_FORMAT_RGBA_8888)
+      || pix_image_init(&dst, info.format == ANDROID_BITMAP_FORMAT_RGB_565 ? PIX_FMT_RGB565 : PIX_FMT_RGBA8888,
+                        w, h, pixels, info.stride) < 0) {
+    frameSize = -1;
+  } else if (vdec_decode_one((avi_t *)avi, buf, frameSize, keyFrame, &dst) < 0) {
+    log("--==--: can't show this frame format\n");
+    frameSize = -1;
+  }
+  free(buf);
 
   if (AndroidBitmap_unlockPixels(env, jbitmap) < 0) {
     return -1;
   }
-
   return frameSize;
 }
+
+/*
+ * Playback: the clock and the frame dropping live in playback.c, the
+ * decoding in vdec.c, on a thread per core. Frames come out of it
+ * converted to RGB565 and, when larger than the window, scaled to fit
+ * it, so the compositor is not left to scale a buffer of the full frame
+ * size. What is left here is a sink that copies them into the window.
+ * The first audio track plays through OpenSL ES, converted to 16 bit
+ * stereo, and is the clock the frames are timed on; without one, or
+ * with one that is not PCM, the frames go by CLOCK_MONOTONIC.
+ */
+
+// what the mixer and the hardware add below the buffer queue, a guess:
+// OpenSL ES does not tell
+#define AUDIO_OUTPUT_MS 40
+
+typedef struct {
+  ANativeWindow *window;
+  int width, height;      // of the window buffers
+  vdec_t *dec;
+  audio_sles_t *sles;
+  audio_t *audio;
+  playback_t *playback;
+} player_t;
+
+static int window_sink(void *opaque, const playback_frame_t *f) {
+  player_t *pl = opaque;
+  ANativeWindow_Buffer b;
+  pix_image_t dst;
+
+  if (f->decoded->status < 0) {
+    // dropped like a late frame, the clock goes on
+    return 0;
+  }
+  if (ANativeWindow_lock(pl->window, &b, NULL) < 0) {
+    return 0;
+  }
+  if (b.width >= pl->width && b.height >= pl->height) {
+    pix_image_init(&dst, PIX_FMT_RGB565, pl->width, pl->height, b.bits, b.stride * 2);
+    pix_convert(&f->decoded->image, &dst);
+  }
+  ANativeWindow_unlockAndPost(pl->window);
+  return 0;
+}
+
+JNIEXPORT jlong JNICALL
+Java_com_czf_aviplayer_NativeLibInterface_playerNew(JNIEnv *env, jclass clazz, jlong avi, jobject surface) {
+  player_t *pl = calloc(1, sizeof(*pl));
+  playback_sink_t sink = { window_sink, pl };
+  vdec_config_t cfg = { PIX_FMT_RGB565 };
+  int fw = AVI_video_width((avi_t *)avi), fh = AVI_video_height((avi_t *)avi);
+
+  if (!pl) {
+    return -1;
+  }
+  pl->window = ANativeWindow_fromSurface(env, surface);
+  if (!pl->window) {
+    free(pl);
+    return -1;
+  }
+  // the window's own size, before the geometry below overrides it
+  pix_fit(fw, fh, ANativeWindow_getWidth(pl->window), ANativeWindow_getHeight(pl->window),
+          &pl->width, &pl->height);
+  cfg.width = pl->width;
+  cfg.height = pl->height;
+  pl->dec = vdec_open((avi_t *)avi, &cfg);
+  if (!pl->dec) {
+    log("--==--: no decoder for \"%.4s\"\n", AVI_video_compressor((avi_t *)avi));
+    ANativeWindow_release(pl->window);
+    free(pl);
+    return -1;
+  }
+  log("--==--: %dx%d shown at %dx%d, %s on %d threads\n", fw, fh, pl->width, pl->height,
+      vdec_name(pl->dec), vdec_threads(pl->dec));
+  ANativeWindow_setBuffersGeometry(pl->window, pl->width, pl->height, WINDOW_FORMAT_RGB_565);
+
+  pl->playback = playback_new((avi_t *)avi, &sink, NULL);
+  if (!pl->playback) {
+    log("--==--: no frame rate\n");
+    vdec_free(pl->dec);
+    ANativeWindow_release(pl->window);
+    free(pl);
+    return -1;
+  }
+  playback_set_decoder(pl->playback, pl->dec);
+  // SD card stalls hit the reader thread, not the screen
+  if (playback_set_readahead(pl->playback, 4) < 0) {
+    log("--==--: no memory for read-ahead, reading in place\n");
+  }
+  if (AVI_audio_tracks((avi_t *)avi) > 0 && (pl->sles = audio_sles_new(AUDIO_OUTPUT_MS))) {
+    audio_sink_t as = audio_sles_sink(pl->sles);
+
+    pl->audio = audio_new((avi_t *)avi, 0, &as, 0);
+    // what the mixer takes without converting again; anything else,
+    // surround included, is mixed down on the reader thread
+    if (pl->audio && audio_set_output(pl->audio, PCM_FMT_S16, 2, 1.0f) < 0) {
+      audio_free(pl->audio);
+      pl->audio = NULL;
+    }
+    if (pl->audio) {
+      const audio_format_t *af = audio_track_format(pl->audio);
+
+      log("--==--: audio %ld Hz, %d channels, %s, played as s16 stereo\n", af->rate, af->channels,
+          pcm_fmt_name(af->sample));
+      playback_set_audio(pl->playback, pl->audio);
+    } else {
+      log("--==--: audio track is not PCM, playing without sound\n");
+    }
+  }
+  return (jlong)pl;
+}
+
+/* blocks until the end of the file or playerStop */
+JNIEXPORT jint JNICALL
+Java_com_czf_aviplayer_NativeLibInterface_playerRun(JNIEnv *env, jclass clazz, jlong player) {
+  player_t *pl = (player_t *)player;
+  playback_stats_t st;
+  avi_ring_stats_t rs;
+  vdec_stats_t ds;
+  int ret = playback_run(pl->playback);
+
+  playback_get_stats(pl->playback, &st);
+  log("--==--: shown %ld, dropped %ld, late %ld (max %lld us)\n", st.shown, st.dropped,
+      st.late, (long long)(st.max_late_ns / 1000));
+  if (playback_ring_stats(pl->playback, &rs) == 0) {
+    log("--==--: read-ahead underruns %lu (%lld us), mean fill %.1f of %d\n", rs.underruns,
+        (long long)(rs.underrun_ns / 1000), rs.consumed ? (double)rs.fill_sum / rs.consumed : 0.0,
+        rs.slots);
+  }
+  vdec_get_stats(pl->dec, &ds);
+  log("--==--: decoded %lu, failed %lu, waited %lu times (%lld us) on %d threads\n", ds.decoded,
+      ds.failed, ds.waits, (long long)(ds.wait_ns / 1000), ds.threads);
+  if (pl->audio) {
+    audio_stats_t as;
+
+    audio_get_stats(pl->audio, &as);
+    log("--==--: %s master, audio underruns %lu, latency %lld us, drift %.1f ppm, clock error mean %lld us\n",
+        st.audio_master ? "audio" : "video", as.underruns, (long long)(as.latency_ns / 1000), as.drift_ppm,
+        (long long)(as.measured ? as.error_ns / as.measured / 1000 : 0));
+  }
+  return ret;
+}
+
+JNIEXPORT void JNICALL
+Java_com_czf_aviplayer_NativeLibInterface_playerStop(JNIEnv *env, jclass clazz, jlong player) {
+  playback_stop(((player_t *)player)->playback);
+}
+
+/* presentation time of the frame on screen, in ms */
+JNIEXPORT jlong JNICALL
+Java_com_czf_aviplayer_NativeLibInterface_playerPosition(JNIEnv *env, jclass clazz, jlong player) {
+  player_t *pl = (player_t *)player;
+  long pos = playback_position(pl->playback);
+
+  return pos < 0 ? 0 : (jlong)(playback_pts(pl->playback, pos) / 1000000);
+}
+
+JNIEXPORT void JNICALL
+Java_com_czf_aviplayer_NativeLibInterface_playerFree(JNIEnv *env, jclass clazz, jlong player) {
+  player_t *pl = (player_t *)player;
+
+  playback_free(pl->playback);
+  audio_free(pl->audio);
+  audio_sles_free(pl->sles);
+  vdec_free(pl->dec);
+  ANativeWindow_release(pl->window);
+  free(pl);
+}
@@ -0,0 +1,385 @@
+/*
+ * pcmconv.c -- PCM sample format conversion and mixing, C kernels and
+ * dispatch
+ *
+ * See pcmconv.h. A conversion runs in blocks of PCM_BLOCK frames
+ * through two float buffers on the stack, small enough to stay in L1:
+ * the input kernel fills one, the mix writes the other, the output
+ * kernel reads it. The kernels come from the table of the ISA in use,
+ * which starts as a copy of the C table with the SIMD kernels laid over
+ * it.
+ */
+
+#include <pthread.h>
+#include <string.h>
+
+#include "pcmconv_impl.h"
+#include "pixconv.h"
+
+#define PCM_BLOCK 256
+
+/*************************************************************************/
+/* C kernels, the reference for the SIMD ones                            */
+/*************************************************************************/
+
+static void u8_f32(const uint8_t *s, float *d, long n) {
+  long i;
+
+  for (i = 0; i < n; i++) d[i] = (float) (s[i] - 128) * (1 / PCM_U8_ONE);
+}
+
+static void s16_f32(const uint8_t *s, float *d, long n) {
+  long i;
+
+  for (i = 0; i < n; i++, s += 2)
+    d[i] = (float) (int16_t) (s[0] | s[1] << 8) * (1 / PCM_S16_ONE);
+}
+
+static void s24_f32(const uint8_t *s, float *d, long n) {
+  long i;
+
+  for (i = 0; i < n; i++, s += 3)
+    d[i] = (float) ((int32_t) ((uint32_t) s[0] << 8 | (uint32_t) s[1] << 16
+                               | (uint32_t) s[2] << 24) >> 8) * (1 / PCM_S24_ONE);
+}
+
+static void s32_f32(const uint8_t *s, float *d, long n) {
+  long i;
+
+  for (i = 0; i < n; i++, s += 4)
+    d[i] = (float) (int32_t) ((uint32_t) s[0] | (uint32_t) s[1] << 8
+                              | (uint32_t) s[2] << 16 | (uint32_t) s[3] << 24) * (1 / PCM_S32_ONE);
+}
+
+static void f32_f32(const uint8_t *s, float *d, long n) {
+  memcpy(d, s, (size_t) n * 4);
+}
+
+/* x * one saturated to lo .. hi, rounded to nearest even like the SIMD
+   conversions do. In double, which holds all of it exactly */
+static inline int32_t quant(float x, double one, double lo, double hi) {
+  double v = (double) x * one, f;
+  int32_t i;
+
+  v = v >= lo ? v : lo;
+  v = v <= hi ? v : hi;
+  i = (int32_t) v;
+  f = v - i;
+  if (f > 0.5 || (f == 0.5 && (i & 1))) i++;
+  else if (f < -0.5 || (f == -0.5 && (i & 1))) i--;
+  return i;
+}
+
+static void f32_u8(const float *s, uint8_t *d, long n) {
+  long i;
+
+  for (i = 0; i < n; i++) d[i] = (uint8_t) (quant(s[i], PCM_U8_ONE, -128, 127) + 128);
+}
+
+static void f32_s16(const float *s, uint8_t *d, long n) {
+  long i;
+
+  for (i = 0; i < n; i++, d += 2) {
+    int32_t v = quant(s[i], PCM_S16_ONE, -32768, 32767);
+
+    d[0] = (uint8_t) v;
+    d[1] = (uint8_t) (v >> 8);
+  }
+}
+
+static void f32_s24(const float *s, uint8_t *d, long n) {
+  long i;
+
+  for (i = 0; i < n; i++, d += 3) {
+    int32_t v = quant(s[i], PCM_S24_ONE, -8388608, 8388607);
+
+    d[0] = (uint8_t) v;
+    d[1] = (uint8_t) (v >> 8);
+    d[2] = (uint8_t) (v >> 16);
+  }
+}
+
+static void f32_s32(const float *s, uint8_t *d, long n) {
+  long i;
+
+  for (i = 0; i < n; i++, d += 4) {
+    int32_t v = quant(s[i], PCM_S32_ONE, -2147483648.0, 2147483647.0);
+
+    d[0] = (uint8_t) v;
+    d[1] = (uint8_t) (v >> 8);
+    d[2] = (uint8_t) (v >> 16);
+    d[3] = (uint8_t) (v >> 24);
+  }
+}
+
+static void f32_out(const float *s, uint8_t *d, long n) {
+  memcpy(d, s, (size_t) n * 4);
+}
+
+static void mix_scale(const pcm_conv_t *c, const float *s, float *d, long frames) {
+  const float g = c->m[0][0];
+  const long n = frames * c->in_channels;
+  long i;
+
+  for (i = 0; i < n; i++) d[i] = s[i] * g;
+}
+
+/* every mix: the products of an output added in channel order */
+static void mix_any(const pcm_conv_t *c, const float *s, float *d, long frames) {
+  const int in = c->in_channels, out = c->out_channels;
+  long f;
+  int i, o;
+
+  for (f = 0; f < frames; f++, s += in, d += out)
+    for (o = 0; o < out; o++) {
+      float acc = s[0] * c->m[o][0];
+
+      for (i = 1; i < in; i++) acc += s[i] * c->m[o][i];
+      d[o] = acc;
+    }
+}
+
+void pcm_kernels_c(pcm_kernels_t *k) {
+  int i;
+
+  k->to_f32[PCM_FMT_U8] = u8_f32;
+  k->to_f32[PCM_FMT_S16] = s16_f32;
+  k->to_f32[PCM_FMT_S24] = s24_f32;
+  k->to_f32[PCM_FMT_S32] = s32_f32;
+  k->to_f32[PCM_FMT_F32] = f32_f32;
+  k->from_f32[PCM_FMT_U8] = f32_u8;
+  k->from_f32[PCM_FMT_S16] = f32_s16;
+  k->from_f32[PCM_FMT_S24] = f32_s24;
+  k->from_f32[PCM_FMT_S32] = f32_s32;
+  k->from_f32[PCM_FMT_F32] = f32_out;
+  k->mix[PCM_MIX_COPY] = NULL;
+  for (i = PCM_MIX_COPY + 1; i < PCM_MIX_COUNT; i++)
+    k->mix[i] = mix_any;
+  k->mix[PCM_MIX_SCALE] = mix_scale;
+}
+
+static pcm_kernels_t kernels_c;
+
+void pcm_to_f32_c(pcm_fmt_t fmt, const uint8_t *src, float *dst, long n) {
+  if (n > 0) kernels_c.to_f32[fmt](src, dst, n);
+}
+
+void pcm_from_f32_c(pcm_fmt_t fmt, const float *src, uint8_t *dst, long n) {
+  if (n > 0) kernels_c.from_f32[fmt](src, dst, n);
+}
+
+void pcm_mix_c(const pcm_conv_t *c, const float *src, float *dst, long frames) {
+  if (frames > 0) kernels_c.mix[c->mix](c, src, dst, frames);
+}
+
+/*************************************************************************/
+/* dispatch                                                              */
+/*************************************************************************/
+
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+static pcm_kernels_t kernels[PIX_ISA_COUNT];
+
+static void kernels_init(void) {
+  int i, best = pix_isa_best();
+
+  pcm_kernels_c(&kernels_c);
+  for (i = 0; i < PIX_ISA_COUNT; i++)
+    kernels[i] = kernels_c;
+  if (best == PIX_ISA_NEON) {
+    pcm_kernels_neon(&kernels[PIX_ISA_NEON]);
+    return;
+  }
+  if (best >= PIX_ISA_SSE2) pcm_kernels_sse2(&kernels[PIX_ISA_SSE2]);
+  if (best >= PIX_ISA_AVX2) {
+    pcm_kernels_sse2(&kernels[PIX_ISA_AVX2]);
+    pcm_kernels_avx2(&kernels[PIX_ISA_AVX2]);
+  }
+}
+
+int pcm_fmt_bytes(pcm_fmt_t fmt) {
+  static const int bytes[PCM_FMT_COUNT] = { 1, 2, 3, 4, 4 };
+
+  return fmt > PCM_FMT_NONE && fmt < PCM_FMT_COUNT ? bytes[fmt] : -1;
+}
+
+pcm_fmt_t pcm_fmt_wave(int format_tag, int bits) {
+  if (format_tag == 1) {    // WAVE_FORMAT_PCM
+    switch (bits) {
+      case 8: return PCM_FMT_U8;
+      case 16: return PCM_FMT_S16;
+      case 24: return PCM_FMT_S24;
+      case 32: return PCM_FMT_S32;
+    }
+  }
+  if (format_tag == 3 && bits == 32) return PCM_FMT_F32;    // WAVE_FORMAT_IEEE_FLOAT
+  return PCM_FMT_NONE;
+}
+
+const char *pcm_fmt_name(pcm_fmt_t fmt) {
+  static const char *const names[PCM_FMT_COUNT] = { "u8", "s16", "s24", "s32", "f32" };
+
+  return fmt > PCM_FMT_NONE && fmt < PCM_FMT_COUNT ? names[fmt] : "none";
+}
+
+/*************************************************************************/
+/* matrices                                                              */
+/*************************************************************************/
+
+enum { FL, FR, FC, LFE, BL, BR, SL, SR, BC };
+
+/* the speakers of 1 to 8 channels in WAVE order */
+static const uint8_t layouts[PCM_MAX_CHANNELS][PCM_MAX_CHANNELS] = {
+  { FC },
+  { FL, FR },
+  { FL, FR, FC },
+  { FL, FR, BL, BR },
+  { FL, FR, FC, BL, BR },
+  { FL, FR, FC, LFE, BL, BR },
+  { FL, FR, FC, LFE, BC, SL, SR },
+  { FL, FR, FC, LFE, BL, BR, SL, SR },
+};
+
+/* what a speaker gives the left side of a stereo downmix; mirrored for
+   the right */
+static float to_left(int spk) {
+  switch (spk) {
+    case FL: return 1;
+    case FC: case BL: case SL: return 0.70710678f;
+    case BC: return 0.5f;
+  }
+  return 0;
+}
+
+static int mirror(int spk) {
+  switch (spk) {
+    case FL: return FR;
+    case FR: return FL;
+    case BL: return BR;
+    case BR: return BL;
+    case SL: return SR;
+    case SR: return SL;
+  }
+  return spk;
+}
+
+static void stereo_rows(int in, float l[PCM_MAX_CHANNELS], float r[PCM_MAX_CHANNELS]) {
+  float sl = 0, sr = 0;
+  int i;
+
+  if (in == 1) {
+    l[0] = r[0] = 1;
+    return;
+  }
+  for (i = 0; i < in; i++) {
+    l[i] = to_left(layouts[in - 1][i]);
+    r[i] = to_left(mirror(layouts[in - 1][i]));
+    sl += l[i];
+    sr += r[i];
+  }
+  for (i = 0; i < in; i++) {
+    if (sl > 1) l[i] /= sl;
+    if (sr > 1) r[i] /= sr;
+  }
+}
+
+int pcm_conv_init(pcm_conv_t *c, pcm_fmt_t in_fmt, int in_channels,
+                  pcm_fmt_t out_fmt, int out_channels) {
+  float l[PCM_MAX_CHANNELS], r[PCM_MAX_CHANNELS];
+  int i;
+
+  if (pcm_fmt_bytes(in_fmt) < 0 || pcm_fmt_bytes(out_fmt) < 0
+      || in_channels < 1 || in_channels > PCM_MAX_CHANNELS
+      || out_channels < 1 || out_channels > PCM_MAX_CHANNELS)
+    return -1;
+  memset(c, 0, sizeof(*c));
+  c->in_fmt = in_fmt;
+  c->out_fmt = out_fmt;
+  c->in_channels = in_channels;
+  c->out_channels = out_channels;
+  c->gain = 1;
+
+  if (out_channels <= 2) {
+    stereo_rows(in_channels, l, r);
+    for (i = 0; i < in_channels; i++) {
+      if (out_channels == 2) {
+        c->matrix[0][i] = l[i];
+        c->matrix[1][i] = r[i];
+      } else {
+        c->matrix[0][i] = (l[i] + r[i]) * 0.5f;
+      }
+    }
+  } else if (in_channels == 1) {
+    c->matrix[0][0] = c->matrix[1][0] = 1;
+  } else {
+    for (i = 0; i < in_channels && i < out_channels; i++)
+      c->matrix[i][i] = 1;
+  }
+  pcm_conv_update(c);
+  return 0;
+}
+
+void pcm_conv_update(pcm_conv_t *c) {
+  const int in = c->in_channels, out = c->out_channels;
+  int i, o, diag = in == out;
+
+  memset(c->m, 0, sizeof(c->m));
+  for (o = 0; o < out; o++)
+    for (i = 0; i < in; i++) {
+      c->m[o][i] = c->matrix[o][i] * c->gain;
+      if (c->m[o][i] != (i == o ? c->m[0][0] : 0)) diag = 0;
+    }
+
+  if (diag) c->mix = c->m[0][0] == 1 ? PCM_MIX_COPY : PCM_MIX_SCALE;
+  else if (in == 1 && out == 2) c->mix = PCM_MIX_1_2;
+  else if (in == 2 && out == 2) c->mix = PCM_MIX_2_2;
+  else if (in == 2 && out == 1) c->mix = PCM_MIX_2_1;
+  else if (out == 2) c->mix = PCM_MIX_N_2;
+  else if (out == 1) c->mix = PCM_MIX_N_1;
+  else c->mix = PCM_MIX_ANY;
+}
+
+/*************************************************************************/
+/* conversion                                                            */
+/*************************************************************************/
+
+static void convert_block(const pcm_conv_t *c, const pcm_kernels_t *k,
+                          const uint8_t *src, uint8_t *dst, long frames) {
+  float in[PCM_BLOCK * PCM_MAX_CHANNELS], out[PCM_BLOCK * PCM_MAX_CHANNELS];
+  const float *f = in;
+
+  k->to_f32[c->in_fmt](src, in, frames * c->in_channels);
+  if (c->mix != PCM_MIX_COPY) {
+    k->mix[c->mix](c, in, out, frames);
+    f = out;
+  }
+  k->from_f32[c->out_fmt](f, dst, frames * c->out_channels);
+}
+
+size_t pcm_convert(const pcm_conv_t *c, const void *src, void *dst, long frames) {
+  const size_t ib = (size_t) pcm_fmt_bytes(c->in_fmt) * c->in_channels;
+  const size_t ob = (size_t) pcm_fmt_bytes(c->out_fmt) * c->out_channels;
+  const pcm_kernels_t *k;
+  long blocks, b;
+  int backward;
+
+  if (frames <= 0) return 0;
+  if (c->mix == PCM_MIX_COPY && c->in_fmt == c->out_fmt) {
+    if (src != dst) memmove(dst, src, frames * ob);
+    return frames * ob;
+  }
+  pthread_once(&kernels_once, kernels_init);
+  k = &kernels[pix_isa()];
+
+  // a whole block is read before it is written: in place, the blocks go
+  // forward when frames shrink and backward when they grow, so that none
+  // overwrites input not read yet
+  backward = ob > ib;
+  blocks = (frames + PCM_BLOCK - 1) / PCM_BLOCK;
+  for (b = 0; b < blocks; b++) {
+    const long f = (backward ? blocks - 1 - b : b) * PCM_BLOCK;
+
+    convert_block(c, k, (const uint8_t *) src + f * ib, (uint8_t *) dst + f * ob,
+                  frames - f < PCM_BLOCK ? frames - f : PCM_BLOCK);
+  }
+  return frames * ob;
+}
@@ -0,0 +1,89 @@
+/*
+ * pcmconv.h -- sample format conversion, channel mixing and gain of PCM
+ * audio for playback
+ *
+ * Converts what an AVI audio track carries (8 bit unsigned, 16, 24 and
+ * 32 bit signed little endian PCM, or 32 bit float, one to eight
+ * channels interleaved) to what an output device takes, interleaved 16
+ * bit or float, usually stereo. On the way the channels go through a
+ * mixing matrix, which downmixes, upmixes and applies the gain.
+ *
+ * Samples are taken to float (-1 .. 1), mixed, and rounded to the
+ * output format, saturating. Every step has a plain C version, the
+ * reference; SSE2, AVX2 and NEON versions of the common ones give the
+ * same bytes. The ISA is the one pixconv uses, pix_set_isa sets it for
+ * both.
+ */
+
+#ifndef PCMCONV_H
+#define PCMCONV_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum
+{
+  PCM_FMT_NONE = -1,
+  PCM_FMT_U8,               /* unsigned, 128 is silence */
+  PCM_FMT_S16,
+  PCM_FMT_S24,              /* packed in 3 bytes */
+  PCM_FMT_S32,
+  PCM_FMT_F32,              /* float, full scale at +-1 */
+  PCM_FMT_COUNT
+} pcm_fmt_t;
+
+#define PCM_MAX_CHANNELS 8
+
+enum {
+  PCM_MIX_COPY = 0,         /* same channels, gain 1: no mixing */
+  PCM_MIX_SCALE,            /* same channels, the gain only */
+  PCM_MIX_1_2,              /* mono to stereo */
+  PCM_MIX_2_2,
+  PCM_MIX_2_1,
+  PCM_MIX_N_2,              /* any to stereo */
+  PCM_MIX_N_1,              /* any to mono */
+  PCM_MIX_ANY,
+  PCM_MIX_COUNT
+};
+
+typedef struct
+{
+  pcm_fmt_t in_fmt, out_fmt;
+  int in_channels, out_channels;
+  /* out[o] = sum of in[i] * matrix[o][i], times gain. Change them, then
+     call pcm_conv_update */
+  float matrix[PCM_MAX_CHANNELS][PCM_MAX_CHANNELS];
+  float gain;
+
+  /* set by pcm_conv_update */
+  int mix;                  /* PCM_MIX_* */
+  float m[PCM_MAX_CHANNELS][PCM_MAX_CHANNELS];   /* matrix * gain */
+} pcm_conv_t;
+
+/* bytes of a sample, -1 for PCM_FMT_NONE */
+int pcm_fmt_bytes(pcm_fmt_t fmt);
+/* from the WAVEFORMATEX of a track: WAVE_FORMAT_PCM of 8 to 32 bits,
+   WAVE_FORMAT_IEEE_FLOAT of 32. PCM_FMT_NONE for anything else */
+pcm_fmt_t pcm_fmt_wave(int format_tag, int bits);
+const char *pcm_fmt_name(pcm_fmt_t fmt);
+
+/*
+ * Gain 1 and the default matrix, channels in WAVE order (FL FR FC LFE
+ * BL BR SL SR; 4 channels are FL FR BL BR, 5 are FL FR FC BL BR):
+ *  - to stereo, the ITU downmix: centre and surrounds at -3 dB to both
+ *    sides, LFE dropped; mono goes to both sides as it is,
+ *  - to mono, the mean of that stereo,
+ *  - else channel to channel, mono in to FL and FR.
+ * Downmix rows are scaled down to add up to no more than 1, which
+ * keeps full scale input from clipping. -1 for formats or channel
+ * counts out of range.
+ */
+int pcm_conv_init(pcm_conv_t *c, pcm_fmt_t in_fmt, int in_channels,
+                  pcm_fmt_t out_fmt, int out_channels);
+void pcm_conv_update(pcm_conv_t *c);
+
+/* frames from src to dst, returns the bytes written. dst may be src,
+   the buffer must then hold the frames in the larger of both formats */
+size_t pcm_convert(const pcm_conv_t *c, const void *src, void *dst, long frames);
+
+#endif /* PCMCONV_H */
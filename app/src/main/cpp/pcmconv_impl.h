@@ -0,0 +1,44 @@
+/*
+ * pcmconv_impl.h -- kernels of pcmconv, shared by its ISA files
+ *
+ * A conversion goes through float: samples to float, the mix, float to
+ * the output format. All kernels scale by powers of two and round to
+ * nearest even, and a mix adds the products of an output in channel
+ * order, each product rounded (the files are built without FMA
+ * contraction), so the SIMD ones give the bytes of the C ones.
+ */
+
+#ifndef PCMCONV_IMPL_H
+#define PCMCONV_IMPL_H
+
+#include "pcmconv.h"
+
+/* full scale of the integer formats */
+#define PCM_U8_ONE      128.0f
+#define PCM_S16_ONE     32768.0f
+#define PCM_S24_ONE     8388608.0f
+#define PCM_S32_ONE     2147483648.0f
+
+typedef struct
+{
+  /* n samples to float, and back; the latter saturates, NaN goes to the
+     negative full scale */
+  void (*to_f32[PCM_FMT_COUNT])(const uint8_t *src, float *dst, long n);
+  void (*from_f32[PCM_FMT_COUNT])(const float *src, uint8_t *dst, long n);
+  /* frames of c->in_channels to c->out_channels by c->m, for the
+     PCM_MIX_* of c; none for PCM_MIX_COPY */
+  void (*mix[PCM_MIX_COUNT])(const pcm_conv_t *c, const float *src, float *dst, long frames);
+} pcm_kernels_t;
+
+/* each sets the kernels it has */
+void pcm_kernels_c(pcm_kernels_t *k);
+void pcm_kernels_sse2(pcm_kernels_t *k);
+void pcm_kernels_avx2(pcm_kernels_t *k);
+void pcm_kernels_neon(pcm_kernels_t *k);
+
+/* the C kernels, for what a SIMD loop leaves */
+void pcm_to_f32_c(pcm_fmt_t fmt, const uint8_t *src, float *dst, long n);
+void pcm_from_f32_c(pcm_fmt_t fmt, const float *src, uint8_t *dst, long n);
+void pcm_mix_c(const pcm_conv_t *c, const float *src, float *dst, long frames);
+
+#endif /* PCMCONV_IMPL_H */
@@ -0,0 +1,205 @@
+/*
+ * pcmconv_neon.c -- NEON kernels of pcmconv
+ *
+ * Widening to float works on armeabi-v7a too. The mixes and the way
+ * back are arm64 only: v7 NEON flushes denormals to zero where the C
+ * kernels do not, and has no float to int conversion that rounds to
+ * nearest (vcvtnq) nor a min/max that drops NaN (vminnmq/vmaxnmq, which
+ * does what the C clamp does). vld2/vst2 split and merge stereo.
+ */
+
+#include "pcmconv_impl.h"
+
+#if defined(__ARM_NEON)
+
+#include <arm_neon.h>
+
+/* 8 lanes of 16 bit to float times k */
+static inline void s16x8_f32_neon(int16x8_t v, float k, float *d) {
+  vst1q_f32(d, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), k));
+  vst1q_f32(d + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))), k));
+}
+
+static void u8_f32_neon(const uint8_t *s, float *d, long n) {
+  const uint8x8_t bias = vdup_n_u8(128);
+  long i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    const uint8x16_t v = vld1q_u8(s + i);
+
+    // the difference wraps in 16 bit, as signed it is right
+    s16x8_f32_neon(vreinterpretq_s16_u16(vsubl_u8(vget_low_u8(v), bias)), 1 / PCM_U8_ONE, d + i);
+    s16x8_f32_neon(vreinterpretq_s16_u16(vsubl_u8(vget_high_u8(v), bias)), 1 / PCM_U8_ONE, d + i + 8);
+  }
+  pcm_to_f32_c(PCM_FMT_U8, s + i, d + i, n - i);
+}
+
+static void s16_f32_neon(const uint8_t *s, float *d, long n) {
+  long i;
+
+  for (i = 0; i + 8 <= n; i += 8)
+    s16x8_f32_neon(vreinterpretq_s16_u8(vld1q_u8(s + 2 * i)), 1 / PCM_S16_ONE, d + i);
+  pcm_to_f32_c(PCM_FMT_S16, s + 2 * i, d + i, n - i);
+}
+
+/* vld3 splits 8 samples into their bytes: the low 16 bit of each are
+   the first two, the top byte widens with its sign */
+static void s24_f32_neon(const uint8_t *s, float *d, long n) {
+  long i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    const uint8x8x3_t b = vld3_u8(s + 3 * i);
+    const uint16x8_t lo = vorrq_u16(vmovl_u8(b.val[0]), vshll_n_u8(b.val[1], 8));
+    const int16x8_t hi = vmovl_s8(vreinterpret_s8_u8(b.val[2]));
+    const int32x4_t v0 = vorrq_s32(vshll_n_s16(vget_low_s16(hi), 16),
+                                   vreinterpretq_s32_u32(vmovl_u16(vget_low_u16(lo))));
+    const int32x4_t v1 = vorrq_s32(vshll_n_s16(vget_high_s16(hi), 16),
+                                   vreinterpretq_s32_u32(vmovl_u16(vget_high_u16(lo))));
+
+    vst1q_f32(d + i, vmulq_n_f32(vcvtq_f32_s32(v0), 1 / PCM_S24_ONE));
+    vst1q_f32(d + i + 4, vmulq_n_f32(vcvtq_f32_s32(v1), 1 / PCM_S24_ONE));
+  }
+  pcm_to_f32_c(PCM_FMT_S24, s + 3 * i, d + i, n - i);
+}
+
+static void s32_f32_neon(const uint8_t *s, float *d, long n) {
+  long i;
+
+  for (i = 0; i + 4 <= n; i += 4)
+    vst1q_f32(d + i, vmulq_n_f32(vcvtq_f32_s32(vreinterpretq_s32_u8(vld1q_u8(s + 4 * i))), 1 / PCM_S32_ONE));
+  pcm_to_f32_c(PCM_FMT_S32, s + 4 * i, d + i, n - i);
+}
+
+#if defined(__aarch64__)
+
+/* 4 floats to 32 bit at full scale k, saturated */
+static inline int32x4_t quant_neon(const float *s, float k, float32x4_t lo, float32x4_t hi) {
+  return vcvtnq_s32_f32(vminnmq_f32(vmaxnmq_f32(vmulq_n_f32(vld1q_f32(s), k), lo), hi));
+}
+
+static void f32_s16_neon(const float *s, uint8_t *d, long n) {
+  const float32x4_t lo = vdupq_n_f32(-32768.0f), hi = vdupq_n_f32(32767.0f);
+  long i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    const int16x8_t v = vcombine_s16(vqmovn_s32(quant_neon(s + i, PCM_S16_ONE, lo, hi)),
+                                     vqmovn_s32(quant_neon(s + i + 4, PCM_S16_ONE, lo, hi)));
+
+    vst1q_u8(d + 2 * i, vreinterpretq_u8_s16(v));
+  }
+  pcm_from_f32_c(PCM_FMT_S16, s + i, d + 2 * i, n - i);
+}
+
+static void mix_scale_neon(const pcm_conv_t *c, const float *s, float *d, long frames) {
+  const float g = c->m[0][0];
+  const long n = frames * c->in_channels;
+  long i;
+
+  for (i = 0; i + 4 <= n; i += 4)
+    vst1q_f32(d + i, vmulq_n_f32(vld1q_f32(s + i), g));
+  for (; i < n; i++) d[i] = s[i] * g;
+}
+
+static void mix_1_2_neon(const pcm_conv_t *c, const float *s, float *d, long frames) {
+  long i;
+
+  for (i = 0; i + 4 <= frames; i += 4) {
+    const float32x4_t x = vld1q_f32(s + i);
+    float32x4x2_t o;
+
+    o.val[0] = vmulq_n_f32(x, c->m[0][0]);
+    o.val[1] = vmulq_n_f32(x, c->m[1][0]);
+    vst2q_f32(d + 2 * i, o);
+  }
+  pcm_mix_c(c, s + i, d + 2 * i, frames - i);
+}
+
+static void mix_2_2_neon(const pcm_conv_t *c, const float *s, float *d, long frames) {
+  long i;
+
+  for (i = 0; i + 4 <= frames; i += 4) {
+    const float32x4x2_t x = vld2q_f32(s + 2 * i);
+    float32x4x2_t o;
+
+    o.val[0] = vaddq_f32(vmulq_n_f32(x.val[0], c->m[0][0]), vmulq_n_f32(x.val[1], c->m[0][1]));
+    o.val[1] = vaddq_f32(vmulq_n_f32(x.val[0], c->m[1][0]), vmulq_n_f32(x.val[1], c->m[1][1]));
+    vst2q_f32(d + 2 * i, o);
+  }
+  pcm_mix_c(c, s + 2 * i, d + 2 * i, frames - i);
+}
+
+static void mix_2_1_neon(const pcm_conv_t *c, const float *s, float *d, long frames) {
+  long i;
+
+  for (i = 0; i + 4 <= frames; i += 4) {
+    const float32x4x2_t x = vld2q_f32(s + 2 * i);
+
+    vst1q_f32(d + i, vaddq_f32(vmulq_n_f32(x.val[0], c->m[0][0]), vmulq_n_f32(x.val[1], c->m[0][1])));
+  }
+  pcm_mix_c(c, s + 2 * i, d + i, frames - i);
+}
+
+/* channel j of 4 frames */
+static inline float32x4_t gather_neon(const float *s, int in) {
+  float32x4_t x = vld1q_dup_f32(s);
+
+  x = vld1q_lane_f32(s + in, x, 1);
+  x = vld1q_lane_f32(s + 2 * in, x, 2);
+  return vld1q_lane_f32(s + 3 * in, x, 3);
+}
+
+static inline void mix_n_neon(const pcm_conv_t *c, const float *s, float *d, long frames, int out) {
+  const int in = c->in_channels;
+  long i;
+
+  for (i = 0; i + 4 <= frames; i += 4, s += 4 * in) {
+    float32x4_t x = gather_neon(s, in);
+    float32x4x2_t o;
+    int j;
+
+    o.val[0] = vmulq_n_f32(x, c->m[0][0]);
+    o.val[1] = vmulq_n_f32(x, c->m[1][0]);
+    for (j = 1; j < in; j++) {
+      x = gather_neon(s + j, in);
+      o.val[0] = vaddq_f32(o.val[0], vmulq_n_f32(x, c->m[0][j]));
+      if (out == 2) o.val[1] = vaddq_f32(o.val[1], vmulq_n_f32(x, c->m[1][j]));
+    }
+    if (out == 2) vst2q_f32(d + 2 * i, o);
+    else vst1q_f32(d + i, o.val[0]);
+  }
+  pcm_mix_c(c, s, d + out * i, frames - i);
+}
+
+static void mix_n_2_neon(const pcm_conv_t *c, const float *s, float *d, long frames) {
+  mix_n_neon(c, s, d, frames, 2);
+}
+
+static void mix_n_1_neon(const pcm_conv_t *c, const float *s, float *d, long frames) {
+  mix_n_neon(c, s, d, frames, 1);
+}
+
+#endif /* __aarch64__ */
+
+void pcm_kernels_neon(pcm_kernels_t *k) {
+  k->to_f32[PCM_FMT_U8] = u8_f32_neon;
+  k->to_f32[PCM_FMT_S16] = s16_f32_neon;
+  k->to_f32[PCM_FMT_S24] = s24_f32_neon;
+  k->to_f32[PCM_FMT_S32] = s32_f32_neon;
+#if defined(__aarch64__)
+  k->from_f32[PCM_FMT_S16] = f32_s16_neon;
+  k->mix[PCM_MIX_SCALE] = mix_scale_neon;
+  k->mix[PCM_MIX_1_2] = mix_1_2_neon;
+  k->mix[PCM_MIX_2_2] = mix_2_2_neon;
+  k->mix[PCM_MIX_2_1] = mix_2_1_neon;
+  k->mix[PCM_MIX_N_2] = mix_n_2_neon;
+  k->mix[PCM_MIX_N_1] = mix_n_1_neon;
+#endif
+}
+
+#else /* !__ARM_NEON */
+
+void pcm_kernels_neon(pcm_kernels_t *k) {
+  (void) k;
+}
+
+#endif
@@ -0,0 +1,348 @@
+/*
+ * pcmconv_x86.c -- SSE2 and AVX2 kernels of pcmconv
+ *
+ * Samples widen to 32 bit and convert with cvtdq2ps, go back with
+ * cvtps2dq, which rounds to nearest even like the C kernels, after a
+ * clamp in float (minps/maxps take the second operand for NaN, the C
+ * clamp does the same). Stereo is split into left and right vectors
+ * with shufps and merged again with unpcklps; the mixes of more
+ * channels gather a channel of 4 or 8 frames into a vector. The rest of
+ * a buffer is left to the C kernels.
+ */
+
+#include "pcmconv_impl.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+
+/*************************************************************************/
+/* SSE2                                                                  */
+/*************************************************************************/
+
+/* 8 lanes of 16 bit to float times k, low and high four */
+static inline SSE2 void s16x8_f32_sse2(__m128i v, __m128 k, float *d) {
+  _mm_storeu_ps(d, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16)), k));
+  _mm_storeu_ps(d + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16)), k));
+}
+
+static SSE2 void u8_f32_sse2(const uint8_t *s, float *d, long n) {
+  const __m128i z = _mm_setzero_si128(), bias = _mm_set1_epi16(128);
+  const __m128 k = _mm_set1_ps(1 / PCM_U8_ONE);
+  long i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+
+    s16x8_f32_sse2(_mm_sub_epi16(_mm_unpacklo_epi8(v, z), bias), k, d + i);
+    s16x8_f32_sse2(_mm_sub_epi16(_mm_unpackhi_epi8(v, z), bias), k, d + i + 8);
+  }
+  pcm_to_f32_c(PCM_FMT_U8, s + i, d + i, n - i);
+}
+
+static SSE2 void s16_f32_sse2(const uint8_t *s, float *d, long n) {
+  const __m128 k = _mm_set1_ps(1 / PCM_S16_ONE);
+  long i;
+
+  for (i = 0; i + 8 <= n; i += 8)
+    s16x8_f32_sse2(_mm_loadu_si128((const __m128i *) (s + 2 * i)), k, d + i);
+  pcm_to_f32_c(PCM_FMT_S16, s + 2 * i, d + i, n - i);
+}
+
+static SSE2 void s32_f32_sse2(const uint8_t *s, float *d, long n) {
+  const __m128 k = _mm_set1_ps(1 / PCM_S32_ONE);
+  long i;
+
+  for (i = 0; i + 4 <= n; i += 4)
+    _mm_storeu_ps(d + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *) (s + 4 * i))), k));
+  pcm_to_f32_c(PCM_FMT_S32, s + 4 * i, d + i, n - i);
+}
+
+/* 4 floats to 32 bit at full scale k, saturated */
+static inline SSE2 __m128i quant_sse2(const float *s, __m128 k, __m128 lo, __m128 hi) {
+  return _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(s), k), lo), hi));
+}
+
+static SSE2 void f32_s16_sse2(const float *s, uint8_t *d, long n) {
+  const __m128 k = _mm_set1_ps(PCM_S16_ONE), lo = _mm_set1_ps(-32768.0f), hi = _mm_set1_ps(32767.0f);
+  long i;
+
+  for (i = 0; i + 8 <= n; i += 8)
+    _mm_storeu_si128((__m128i *) (d + 2 * i),
+                     _mm_packs_epi32(quant_sse2(s + i, k, lo, hi), quant_sse2(s + i + 4, k, lo, hi)));
+  pcm_from_f32_c(PCM_FMT_S16, s + i, d + 2 * i, n - i);
+}
+
+static SSE2 void mix_scale_sse2(const pcm_conv_t *c, const float *s, float *d, long frames) {
+  const __m128 g = _mm_set1_ps(c->m[0][0]);
+  const long n = frames * c->in_channels;
+  long i;
+
+  for (i = 0; i + 4 <= n; i += 4)
+    _mm_storeu_ps(d + i, _mm_mul_ps(_mm_loadu_ps(s + i), g));
+  for (; i < n; i++) d[i] = s[i] * c->m[0][0];
+}
+
+/* left and right of 4 frames to d */
+static inline SSE2 void store2_sse2(float *d, __m128 l, __m128 r) {
+  _mm_storeu_ps(d, _mm_unpacklo_ps(l, r));
+  _mm_storeu_ps(d + 4, _mm_unpackhi_ps(l, r));
+}
+
+/* left and right of 4 frames of s */
+static inline SSE2 void load2_sse2(const float *s, __m128 *l, __m128 *r) {
+  const __m128 a = _mm_loadu_ps(s), b = _mm_loadu_ps(s + 4);
+
+  *l = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+  *r = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+}
+
+static SSE2 void mix_1_2_sse2(const pcm_conv_t *c, const float *s, float *d, long frames) {
+  const __m128 a = _mm_set1_ps(c->m[0][0]), b = _mm_set1_ps(c->m[1][0]);
+  long i;
+
+  for (i = 0; i + 4 <= frames; i += 4) {
+    const __m128 x = _mm_loadu_ps(s + i);
+
+    store2_sse2(d + 2 * i, _mm_mul_ps(x, a), _mm_mul_ps(x, b));
+  }
+  pcm_mix_c(c, s + i, d + 2 * i, frames - i);
+}
+
+static SSE2 void mix_2_2_sse2(const pcm_conv_t *c, const float *s, float *d, long frames) {
+  const __m128 a = _mm_set1_ps(c->m[0][0]), b = _mm_set1_ps(c->m[0][1]);
+  const __m128 e = _mm_set1_ps(c->m[1][0]), f = _mm_set1_ps(c->m[1][1]);
+  long i;
+
+  for (i = 0; i + 4 <= frames; i += 4) {
+    __m128 l, r;
+
+    load2_sse2(s + 2 * i, &l, &r);
+    store2_sse2(d + 2 * i, _mm_add_ps(_mm_mul_ps(l, a), _mm_mul_ps(r, b)),
+                _mm_add_ps(_mm_mul_ps(l, e), _mm_mul_ps(r, f)));
+  }
+  pcm_mix_c(c, s + 2 * i, d + 2 * i, frames - i);
+}
+
+static SSE2 void mix_2_1_sse2(const pcm_conv_t *c, const float *s, float *d, long frames) {
+  const __m128 a = _mm_set1_ps(c->m[0][0]), b = _mm_set1_ps(c->m[0][1]);
+  long i;
+
+  for (i = 0; i + 4 <= frames; i += 4) {
+    __m128 l, r;
+
+    load2_sse2(s + 2 * i, &l, &r);
+    _mm_storeu_ps(d + i, _mm_add_ps(_mm_mul_ps(l, a), _mm_mul_ps(r, b)));
+  }
+  pcm_mix_c(c, s + 2 * i, d + i, frames - i);
+}
+
+/* channel by channel over 4 frames, whose samples of a channel are
+   gathered into a vector */
+static inline SSE2 void mix_n_sse2(const pcm_conv_t *c, const float *s, float *d, long frames, int out) {
+  const int in = c->in_channels;
+  long i;
+
+  for (i = 0; i + 4 <= frames; i += 4, s += 4 * in) {
+    __m128 x = _mm_setr_ps(s[0], s[in], s[2 * in], s[3 * in]);
+    __m128 l = _mm_mul_ps(x, _mm_set1_ps(c->m[0][0])), r = _mm_mul_ps(x, _mm_set1_ps(c->m[1][0]));
+    int j;
+
+    for (j = 1; j < in; j++) {
+      x = _mm_setr_ps(s[j], s[in + j], s[2 * in + j], s[3 * in + j]);
+      l = _mm_add_ps(l, _mm_mul_ps(x, _mm_set1_ps(c->m[0][j])));
+      if (out == 2) r = _mm_add_ps(r, _mm_mul_ps(x, _mm_set1_ps(c->m[1][j])));
+    }
+    if (out == 2) store2_sse2(d + 2 * i, l, r);
+    else _mm_storeu_ps(d + i, l);
+  }
+  pcm_mix_c(c, s, d + out * i, frames - i);
+}
+
+static SSE2 void mix_n_2_sse2(const pcm_conv_t *c, const float *s, float *d, long frames) {
+  mix_n_sse2(c, s, d, frames, 2);
+}
+
+static SSE2 void mix_n_1_sse2(const pcm_conv_t *c, const float *s, float *d, long frames) {
+  mix_n_sse2(c, s, d, frames, 1);
+}
+
+/*************************************************************************/
+/* AVX2                                                                  */
+/*************************************************************************/
+
+static AVX2 void u8_f32_avx2(const uint8_t *s, float *d, long n) {
+  const __m256i bias = _mm256_set1_epi32(128);
+  const __m256 k = _mm256_set1_ps(1 / PCM_U8_ONE);
+  long i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    const __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+
+    _mm256_storeu_ps(d + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_cvtepu8_epi32(v), bias)), k));
+    _mm256_storeu_ps(d + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(
+        _mm256_sub_epi32(_mm256_cvtepu8_epi32(_mm_srli_si128(v, 8)), bias)), k));
+  }
+  pcm_to_f32_c(PCM_FMT_U8, s + i, d + i, n - i);
+}
+
+static AVX2 void s16_f32_avx2(const uint8_t *s, float *d, long n) {
+  const __m256 k = _mm256_set1_ps(1 / PCM_S16_ONE);
+  long i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    const __m128i a = _mm_loadu_si128((const __m128i *) (s + 2 * i));
+    const __m128i b = _mm_loadu_si128((const __m128i *) (s + 2 * i + 16));
+
+    _mm256_storeu_ps(d + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(a)), k));
+    _mm256_storeu_ps(d + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(b)), k));
+  }
+  pcm_to_f32_c(PCM_FMT_S16, s + 2 * i, d + i, n - i);
+}
+
+/* 8 samples of 3 bytes: 4 from each half of 12 bytes, each put into the
+   top of a 32 bit lane and shifted down with its sign. The second half
+   is loaded from byte 12 on and reads 4 bytes past the 24 */
+static AVX2 void s24_f32_avx2(const uint8_t *s, float *d, long n) {
+  const __m256i shuf = _mm256_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11,
+                                        -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+  const __m256 k = _mm256_set1_ps(1 / PCM_S24_ONE);
+  long i;
+
+  for (i = 0; i + 10 <= n; i += 8) {
+    const uint8_t *p = s + 3 * i;
+    __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *) p)),
+                                        _mm_loadu_si128((const __m128i *) (p + 12)), 1);
+
+    v = _mm256_srai_epi32(_mm256_shuffle_epi8(v, shuf), 8);
+    _mm256_storeu_ps(d + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), k));
+  }
+  pcm_to_f32_c(PCM_FMT_S24, s + 3 * i, d + i, n - i);
+}
+
+static AVX2 void s32_f32_avx2(const uint8_t *s, float *d, long n) {
+  const __m256 k = _mm256_set1_ps(1 / PCM_S32_ONE);
+  long i;
+
+  for (i = 0; i + 8 <= n; i += 8)
+    _mm256_storeu_ps(d + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *) (s + 4 * i))), k));
+  pcm_to_f32_c(PCM_FMT_S32, s + 4 * i, d + i, n - i);
+}
+
+static inline AVX2 __m256i quant_avx2(const float *s, __m256 k, __m256 lo, __m256 hi) {
+  return _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(s), k), lo), hi));
+}
+
+static AVX2 void f32_s16_avx2(const float *s, uint8_t *d, long n) {
+  const __m256 k = _mm256_set1_ps(PCM_S16_ONE), lo = _mm256_set1_ps(-32768.0f), hi = _mm256_set1_ps(32767.0f);
+  long i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    // packs works within the 128 bit lanes, the permute puts them in order
+    __m256i v = _mm256_packs_epi32(quant_avx2(s + i, k, lo, hi), quant_avx2(s + i + 8, k, lo, hi));
+
+    _mm256_storeu_si256((__m256i *) (d + 2 * i), _mm256_permute4x64_epi64(v, _MM_SHUFFLE(3, 1, 2, 0)));
+  }
+  pcm_from_f32_c(PCM_FMT_S16, s + i, d + 2 * i, n - i);
+}
+
+/* left and right of 8 frames to d */
+static inline AVX2 void store2_avx2(float *d, __m256 l, __m256 r) {
+  const __m256 a = _mm256_unpacklo_ps(l, r), b = _mm256_unpackhi_ps(l, r);
+
+  _mm256_storeu_ps(d, _mm256_permute2f128_ps(a, b, 0x20));
+  _mm256_storeu_ps(d + 8, _mm256_permute2f128_ps(a, b, 0x31));
+}
+
+/* left and right of 8 frames of s, in frame order */
+static inline AVX2 void load2_avx2(const float *s, __m256 *l, __m256 *r) {
+  const __m256 a = _mm256_loadu_ps(s), b = _mm256_loadu_ps(s + 8);
+  const __m256 x = _mm256_permute2f128_ps(a, b, 0x20), y = _mm256_permute2f128_ps(a, b, 0x31);
+
+  *l = _mm256_shuffle_ps(x, y, _MM_SHUFFLE(2, 0, 2, 0));
+  *r = _mm256_shuffle_ps(x, y, _MM_SHUFFLE(3, 1, 3, 1));
+}
+
+static AVX2 void mix_2_2_avx2(const pcm_conv_t *c, const float *s, float *d, long frames) {
+  const __m256 a = _mm256_set1_ps(c->m[0][0]), b = _mm256_set1_ps(c->m[0][1]);
+  const __m256 e = _mm256_set1_ps(c->m[1][0]), f = _mm256_set1_ps(c->m[1][1]);
+  long i;
+
+  for (i = 0; i + 8 <= frames; i += 8) {
+    __m256 l, r;
+
+    load2_avx2(s + 2 * i, &l, &r);
+    store2_avx2(d + 2 * i, _mm256_add_ps(_mm256_mul_ps(l, a), _mm256_mul_ps(r, b)),
+                _mm256_add_ps(_mm256_mul_ps(l, e), _mm256_mul_ps(r, f)));
+  }
+  pcm_mix_c(c, s + 2 * i, d + 2 * i, frames - i);
+}
+
+/* mix_n_sse2 over 8 frames, a gather per channel */
+static inline AVX2 void mix_n_avx2(const pcm_conv_t *c, const float *s, float *d, long frames, int out) {
+  const int in = c->in_channels;
+  const __m256i idx = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(in));
+  long i;
+
+  for (i = 0; i + 8 <= frames; i += 8, s += 8 * in) {
+    __m256 x = _mm256_i32gather_ps(s, idx, 4);
+    __m256 l = _mm256_mul_ps(x, _mm256_set1_ps(c->m[0][0])), r = _mm256_mul_ps(x, _mm256_set1_ps(c->m[1][0]));
+    int j;
+
+    for (j = 1; j < in; j++) {
+      x = _mm256_i32gather_ps(s + j, idx, 4);
+      l = _mm256_add_ps(l, _mm256_mul_ps(x, _mm256_set1_ps(c->m[0][j])));
+      if (out == 2) r = _mm256_add_ps(r, _mm256_mul_ps(x, _mm256_set1_ps(c->m[1][j])));
+    }
+    if (out == 2) store2_avx2(d + 2 * i, l, r);
+    else _mm256_storeu_ps(d + i, l);
+  }
+  pcm_mix_c(c, s, d + out * i, frames - i);
+}
+
+static AVX2 void mix_n_2_avx2(const pcm_conv_t *c, const float *s, float *d, long frames) {
+  mix_n_avx2(c, s, d, frames, 2);
+}
+
+static AVX2 void mix_n_1_avx2(const pcm_conv_t *c, const float *s, float *d, long frames) {
+  mix_n_avx2(c, s, d, frames, 1);
+}
+
+void pcm_kernels_sse2(pcm_kernels_t *k) {
+  k->to_f32[PCM_FMT_U8] = u8_f32_sse2;
+  k->to_f32[PCM_FMT_S16] = s16_f32_sse2;
+  k->to_f32[PCM_FMT_S32] = s32_f32_sse2;
+  k->from_f32[PCM_FMT_S16] = f32_s16_sse2;
+  k->mix[PCM_MIX_SCALE] = mix_scale_sse2;
+  k->mix[PCM_MIX_1_2] = mix_1_2_sse2;
+  k->mix[PCM_MIX_2_2] = mix_2_2_sse2;
+  k->mix[PCM_MIX_2_1] = mix_2_1_sse2;
+  k->mix[PCM_MIX_N_2] = mix_n_2_sse2;
+  k->mix[PCM_MIX_N_1] = mix_n_1_sse2;
+}
+
+void pcm_kernels_avx2(pcm_kernels_t *k) {
+  k->to_f32[PCM_FMT_U8] = u8_f32_avx2;
+  k->to_f32[PCM_FMT_S16] = s16_f32_avx2;
+  k->to_f32[PCM_FMT_S24] = s24_f32_avx2;
+  k->to_f32[PCM_FMT_S32] = s32_f32_avx2;
+  k->from_f32[PCM_FMT_S16] = f32_s16_avx2;
+  k->mix[PCM_MIX_2_2] = mix_2_2_avx2;
+  k->mix[PCM_MIX_N_2] = mix_n_2_avx2;
+  k->mix[PCM_MIX_N_1] = mix_n_1_avx2;
+}
+
+#else /* !x86 */
+
+void pcm_kernels_sse2(pcm_kernels_t *k) {
+  (void) k;
+}
+
+void pcm_kernels_avx2(pcm_kernels_t *k) {
+  (void) k;
+}
+
+#endif
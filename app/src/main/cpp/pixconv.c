@@ -0,0 +1,456 @@
+/*
+ * pixconv.c -- pixel format conversion, C kernels and dispatch
+ *
+ * See pixconv.h. A conversion is a loop over rows calling one row
+ * kernel; the kernel is looked up per source format and output format
+ * in the table of the ISA in use, which starts as a copy of the C table
+ * with the SIMD kernels laid over it.
+ */
+
+#include <pthread.h>
+#include <string.h>
+
+#include "pixconv_impl.h"
+
+/*************************************************************************/
+/* C kernels, the reference for the SIMD ones                            */
+/*************************************************************************/
+
+static inline uint8_t clamp8(int v) {
+  return v < 0 ? 0 : v > 255 ? 255 : (uint8_t) v;
+}
+
+#define PUT_565(d, x, r, g, b) \
+  (((uint16_t *) (d))[x] = (uint16_t) (((r) & 0xF8) << 8 | ((g) & 0xFC) << 3 | (b) >> 3))
+
+#define PUT_RGBA(d, x, r, g, b) do { \
+  (d)[4 * (x)] = (r); \
+  (d)[4 * (x) + 1] = (g); \
+  (d)[4 * (x) + 2] = (b); \
+  (d)[4 * (x) + 3] = 255; \
+} while (0)
+
+#define LE16(p) ((p)[0] | (p)[1] << 8)
+
+/* packed RGB: FETCH sets r, g, b of pixel x from p */
+#define RGB_ROWS(name, FETCH) \
+static void name##_565(const uint8_t *const s[3], uint8_t *d, int w) { \
+  const uint8_t *p = s[0]; \
+  int x, r, g, b; \
+  for (x = 0; x < w; x++) { \
+    FETCH; \
+    PUT_565(d, x, r, g, b); \
+  } \
+} \
+static void name##_rgba(const uint8_t *const s[3], uint8_t *d, int w) { \
+  const uint8_t *p = s[0]; \
+  int x, r, g, b; \
+  for (x = 0; x < w; x++) { \
+    FETCH; \
+    PUT_RGBA(d, x, r, g, b); \
+  } \
+}
+
+// 5 and 6 bit fields widen by repeating their top bits, so white stays 255
+#define EXPAND5(v) ((v) << 3 | (v) >> 2)
+#define EXPAND6(v) ((v) << 2 | (v) >> 4)
+
+RGB_ROWS(bgr24, (b = p[3 * x], g = p[3 * x + 1], r = p[3 * x + 2]))
+RGB_ROWS(bgr32, (b = p[4 * x], g = p[4 * x + 1], r = p[4 * x + 2]))
+RGB_ROWS(rgba, (r = p[4 * x], g = p[4 * x + 1], b = p[4 * x + 2]))
+RGB_ROWS(rgb555, (r = LE16(p + 2 * x) >> 10 & 31, g = LE16(p + 2 * x) >> 5 & 31,
+                  b = LE16(p + 2 * x) & 31,
+                  r = EXPAND5(r), g = EXPAND5(g), b = EXPAND5(b)))
+RGB_ROWS(rgb565, (r = LE16(p + 2 * x) >> 11, g = LE16(p + 2 * x) >> 5 & 63,
+                  b = LE16(p + 2 * x) & 31,
+                  r = EXPAND5(r), g = EXPAND6(g), b = EXPAND5(b)))
+
+static void copy_565(const uint8_t *const s[3], uint8_t *d, int w) {
+  memcpy(d, s[0], (size_t) w * 2);
+}
+
+static void copy_rgba(const uint8_t *const s[3], uint8_t *d, int w) {
+  memcpy(d, s[0], (size_t) w * 4);
+}
+
+/* pixel x of luma y and chroma u, v to d, RANGE YUV or JPEG */
+#define RANGE_PUT(RANGE, PUT, d, x, y, u, v) do { \
+  int c_ = PIX_##RANGE##_C(y), d_ = (u) - 128, e_ = (v) - 128; \
+  int r_ = clamp8(PIX_##RANGE##_R(c_, d_, e_) >> 6); \
+  int g_ = clamp8(PIX_##RANGE##_G(c_, d_, e_) >> 6); \
+  int b_ = clamp8(PIX_##RANGE##_B(c_, d_, e_) >> 6); \
+  PUT(d, x, r_, g_, b_); \
+} while (0)
+
+#define YUV_PUT(PUT, d, x, y, u, v) RANGE_PUT(YUV, PUT, d, x, y, u, v)
+
+/* 4:2:2 packed, Y0, Y1, U and V at byte offsets y0, y1, u, v of each pair */
+#define PACKED_YUV_ROWS(name, y0, u, y1, v) \
+static void name##_##565(const uint8_t *const s[3], uint8_t *d, int w) { \
+  const uint8_t *p = s[0]; \
+  int x; \
+  for (x = 0; x + 1 < w; x += 2, p += 4) { \
+    YUV_PUT(PUT_565, d, x, p[y0], p[u], p[v]); \
+    YUV_PUT(PUT_565, d, x + 1, p[y1], p[u], p[v]); \
+  } \
+  if (x < w) YUV_PUT(PUT_565, d, x, p[y0], p[u], p[v]); \
+} \
+static void name##_rgba(const uint8_t *const s[3], uint8_t *d, int w) { \
+  const uint8_t *p = s[0]; \
+  int x; \
+  for (x = 0; x + 1 < w; x += 2, p += 4) { \
+    YUV_PUT(PUT_RGBA, d, x, p[y0], p[u], p[v]); \
+    YUV_PUT(PUT_RGBA, d, x + 1, p[y1], p[u], p[v]); \
+  } \
+  if (x < w) YUV_PUT(PUT_RGBA, d, x, p[y0], p[u], p[v]); \
+}
+
+PACKED_YUV_ROWS(yuy2, 0, 1, 2, 3)
+PACKED_YUV_ROWS(uyvy, 1, 0, 3, 2)
+
+/* planar, chroma x of pixel x is x >> SHIFT */
+#define PLANAR_ROWS(name, RANGE, SHIFT) \
+static void name##_565(const uint8_t *const s[3], uint8_t *d, int w) { \
+  int x; \
+  for (x = 0; x < w; x++) \
+    RANGE_PUT(RANGE, PUT_565, d, x, s[0][x], s[1][x >> (SHIFT)], s[2][x >> (SHIFT)]); \
+} \
+static void name##_rgba(const uint8_t *const s[3], uint8_t *d, int w) { \
+  int x; \
+  for (x = 0; x < w; x++) \
+    RANGE_PUT(RANGE, PUT_RGBA, d, x, s[0][x], s[1][x >> (SHIFT)], s[2][x >> (SHIFT)]); \
+}
+
+PLANAR_ROWS(i420, YUV, 1)
+PLANAR_ROWS(j420, JPEG, 1)
+PLANAR_ROWS(j444, JPEG, 0)
+
+/* PAL8, s[1] is the palette */
+static void pal8_565(const uint8_t *const s[3], uint8_t *d, int w) {
+  const pix_palette_t *pal = (const pix_palette_t *) s[1];
+  uint16_t *o = (uint16_t *) d;
+  int x;
+
+  for (x = 0; x < w; x++)
+    o[x] = pal->rgb565[s[0][x]];
+}
+
+static void pal8_rgba(const uint8_t *const s[3], uint8_t *d, int w) {
+  const pix_palette_t *pal = (const pix_palette_t *) s[1];
+  uint32_t *o = (uint32_t *) d;
+  int x;
+
+  for (x = 0; x < w; x++)
+    o[x] = pal->rgba[s[0][x]];
+}
+
+void pix_rows_c(pix_row_table_t t) {
+#define SET(fmt, name) \
+  t[fmt][PIX_OUT_565] = name##_565; \
+  t[fmt][PIX_OUT_RGBA] = name##_rgba
+  SET(PIX_FMT_BGR24, bgr24);
+  SET(PIX_FMT_BGR32, bgr32);
+  SET(PIX_FMT_RGB555, rgb555);
+  SET(PIX_FMT_RGB565, rgb565);
+  SET(PIX_FMT_YUY2, yuy2);
+  SET(PIX_FMT_UYVY, uyvy);
+  SET(PIX_FMT_I420, i420);
+  SET(PIX_FMT_YV12, i420);
+  SET(PIX_FMT_RGBA8888, rgba);
+  SET(PIX_FMT_J420, j420);
+  SET(PIX_FMT_J422, j420);
+  SET(PIX_FMT_J444, j444);
+  SET(PIX_FMT_PAL8, pal8);
+#undef SET
+  t[PIX_FMT_RGB565][PIX_OUT_565] = copy_565;
+  t[PIX_FMT_RGBA8888][PIX_OUT_RGBA] = copy_rgba;
+}
+
+/*************************************************************************/
+/* dispatch                                                              */
+/*************************************************************************/
+
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+static pix_row_table_t tables[PIX_ISA_COUNT];
+static int isa_best, isa_used;
+
+static void tables_init(void) {
+  int i;
+
+  for (i = 0; i < PIX_ISA_COUNT; i++)
+    pix_rows_c(tables[i]);
+  isa_best = PIX_ISA_C;
+
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2")) {
+    pix_rows_sse2(tables[PIX_ISA_SSE2]);
+    isa_best = PIX_ISA_SSE2;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    // AVX2 only has kernels where it beats SSE2 by enough to matter
+    pix_rows_sse2(tables[PIX_ISA_AVX2]);
+    pix_rows_avx2(tables[PIX_ISA_AVX2]);
+    isa_best = PIX_ISA_AVX2;
+  }
+#elif defined(__ARM_NEON)
+  // arm64 always has it, armeabi-v7a builds only get here with -mfpu=neon
+  pix_rows_neon(tables[PIX_ISA_NEON]);
+  isa_best = PIX_ISA_NEON;
+#endif
+  isa_used = isa_best;
+}
+
+int pix_isa_best(void) {
+  pthread_once(&tables_once, tables_init);
+  return isa_best;
+}
+
+int pix_isa(void) {
+  pthread_once(&tables_once, tables_init);
+  return isa_used;
+}
+
+int pix_set_isa(int isa) {
+  pthread_once(&tables_once, tables_init);
+  if (isa < 0) isa = isa_best;
+  if (isa >= PIX_ISA_COUNT) return -1;
+  // C always works; NEON and the x86 ones never come together
+  if (isa != PIX_ISA_C && isa > isa_best) return -1;
+  if (isa != PIX_ISA_C && (isa == PIX_ISA_NEON) != (isa_best == PIX_ISA_NEON)) return -1;
+  isa_used = isa;
+  return 0;
+}
+
+const char *pix_isa_name(int isa) {
+  static const char *const names[PIX_ISA_COUNT] = { "c", "sse2", "avx2", "neon" };
+
+  return isa >= 0 && isa < PIX_ISA_COUNT ? names[isa] : "?";
+}
+
+const char *pix_fmt_name(pix_fmt_t fmt) {
+  static const char *const names[PIX_FMT_COUNT] = {
+    "bgr24", "bgr32", "rgb555", "rgb565", "yuy2", "uyvy", "i420", "yv12", "rgba8888",
+    "j420", "j422", "j444", "pal8"
+  };
+
+  return fmt >= 0 && fmt < PIX_FMT_COUNT ? names[fmt] : "?";
+}
+
+/* the planar formats and how their chroma is subsampled */
+static int planar(pix_fmt_t fmt) {
+  return fmt == PIX_FMT_I420 || fmt == PIX_FMT_YV12 || (fmt >= PIX_FMT_J420 && fmt <= PIX_FMT_J444);
+}
+
+static int chroma_shift_x(pix_fmt_t fmt) {
+  return fmt != PIX_FMT_J444;
+}
+
+static int chroma_shift_y(pix_fmt_t fmt) {
+  return fmt == PIX_FMT_I420 || fmt == PIX_FMT_YV12 || fmt == PIX_FMT_J420;
+}
+
+static int chroma_width(pix_fmt_t fmt, int width) {
+  return (width + chroma_shift_x(fmt)) >> chroma_shift_x(fmt);
+}
+
+static int chroma_height(pix_fmt_t fmt, int height) {
+  return (height + chroma_shift_y(fmt)) >> chroma_shift_y(fmt);
+}
+
+void pix_row_tail(pix_fmt_t fmt, int out, const uint8_t *const src[3],
+                  uint8_t *dst, int x, int width) {
+  static const int bpp[PIX_FMT_COUNT] = { 3, 4, 2, 2, 2, 2, 1, 1, 4, 1, 1, 1, 1 };
+  const uint8_t *s[3];
+
+  if (x >= width) return;
+  s[0] = src[0] + (long) x * bpp[fmt];
+  s[1] = s[2] = NULL;
+  if (fmt == PIX_FMT_PAL8) s[1] = src[1];
+  if (planar(fmt)) {
+    s[1] = src[1] + (x >> chroma_shift_x(fmt));
+    s[2] = src[2] + (x >> chroma_shift_x(fmt));
+  }
+  tables[PIX_ISA_C][fmt][out](s, dst + (long) x * (out == PIX_OUT_565 ? 2 : 4), width - x);
+}
+
+/*************************************************************************/
+/* images                                                                */
+/*************************************************************************/
+
+
+/* bytes of an unpadded row of plane 0 */
+static long row_bytes(pix_fmt_t fmt, int width) {
+  switch (fmt) {
+  case PIX_FMT_BGR24:    return 3L * width;
+  case PIX_FMT_BGR32:
+  case PIX_FMT_RGBA8888: return 4L * width;
+  case PIX_FMT_YUY2:
+  case PIX_FMT_UYVY:     return 4L * ((width + 1) / 2);
+  case PIX_FMT_RGB555:
+  case PIX_FMT_RGB565:   return 2L * width;
+  case PIX_FMT_I420:
+  case PIX_FMT_YV12:
+  case PIX_FMT_J420:
+  case PIX_FMT_J422:
+  case PIX_FMT_J444:
+  case PIX_FMT_PAL8:     return width;
+  default:               return -1;
+  }
+}
+
+size_t pix_image_size(pix_fmt_t fmt, int width, int height) {
+  long row = row_bytes(fmt, width);
+
+  if (row < 0 || width <= 0 || height <= 0) return 0;
+  if (planar(fmt))
+    return (size_t) row * height + 2 * (size_t) chroma_width(fmt, width) * chroma_height(fmt, height);
+  return (size_t) row * height;
+}
+
+int pix_image_init(pix_image_t *img, pix_fmt_t fmt, int width, int height,
+                   void *buf, int stride) {
+  long row = row_bytes(fmt, width);
+  uint8_t *p = buf;
+
+  if (row < 0 || width <= 0 || height <= 0 || !buf) return -1;
+  if (!stride) stride = (int) row;
+  if (stride < row) return -1;
+
+  memset(img, 0, sizeof(*img));
+  img->fmt = fmt;
+  img->width = width;
+  img->height = height;
+  img->data[0] = p;
+  img->stride[0] = stride;
+  if (planar(fmt)) {
+    int cstride = stride == row ? chroma_width(fmt, width) : stride >> chroma_shift_x(fmt);
+    long csize = (long) cstride * chroma_height(fmt, height);
+
+    img->data[1] = p + (long) stride * height;
+    img->data[2] = img->data[1] + csize;
+    img->stride[1] = img->stride[2] = cstride;
+  }
+  return 0;
+}
+
+/* the header is the file's bytes, little-endian */
+static uint32_t le32(const void *v) {
+  const uint8_t *p = v;
+
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static uint16_t le16(const void *v) {
+  const uint8_t *p = v;
+
+  return (uint16_t) LE16(p);
+}
+
+#define FOURCC(a, b, c, d) ((uint32_t) (a) | (uint32_t) (b) << 8 | (uint32_t) (c) << 16 | (uint32_t) (d) << 24)
+
+#define BI_RGB       0
+#define BI_BITFIELDS 3
+
+int pix_image_dib(pix_image_t *img, const alBITMAPINFOHEADER *bih,
+                  const void *data, long len) {
+  uint32_t comp = le32(&bih->bi_compression);
+  int32_t height = (int32_t) le32(&bih->bi_height);
+  int width = (int) le32(&bih->bi_width);
+  int bits = le16(&bih->bi_bit_count);
+  int bottom_up = 0, stride;
+  pix_fmt_t fmt = PIX_FMT_NONE;
+  long row;
+
+  if (comp == BI_RGB || comp == BI_BITFIELDS) {
+    // BITFIELDS masks are not kept by avilib; 16 bit ones are 565 in
+    // practice, 32 bit ones the usual x8r8g8b8
+    if (bits == 24) fmt = PIX_FMT_BGR24;
+    else if (bits == 32) fmt = PIX_FMT_BGR32;
+    else if (bits == 16) fmt = comp == BI_RGB ? PIX_FMT_RGB555 : PIX_FMT_RGB565;
+    else if (bits == 8 && comp == BI_RGB) fmt = PIX_FMT_PAL8;
+    bottom_up = height > 0;
+  } else if (comp == FOURCC('Y', 'U', 'Y', '2') || comp == FOURCC('Y', 'U', 'Y', 'V')) {
+    fmt = PIX_FMT_YUY2;
+  } else if (comp == FOURCC('U', 'Y', 'V', 'Y')) {
+    fmt = PIX_FMT_UYVY;
+  } else if (comp == FOURCC('I', '4', '2', '0') || comp == FOURCC('I', 'Y', 'U', 'V')) {
+    fmt = PIX_FMT_I420;
+  } else if (comp == FOURCC('Y', 'V', '1', '2')) {
+    fmt = PIX_FMT_YV12;
+  }
+  if (fmt == PIX_FMT_NONE) return -1;
+  if (height < 0) height = -height;
+
+  row = row_bytes(fmt, width);
+  // DIB rows are padded to 4 bytes, the YUV layouts are not
+  stride = (int) (planar(fmt) || fmt == PIX_FMT_YUY2 || fmt == PIX_FMT_UYVY ? row : (row + 3) & ~3L);
+  if (width <= 0 || height <= 0
+      || len < (planar(fmt) ? (long) pix_image_size(fmt, width, height) : (long) stride * height))
+    return -1;
+
+  pix_image_init(img, fmt, width, height, (void *) data, stride);
+  if (bottom_up) {
+    img->data[0] += (long) stride * (height - 1);
+    img->stride[0] = -stride;
+  }
+  return 0;
+}
+
+void pix_palette_init(pix_palette_t *pal, const uint8_t *bgrx, int n) {
+  int i;
+
+  memset(pal, 0, sizeof(*pal));
+  for (i = 0; i < 256; i++) {
+    const uint8_t *q = i < n ? bgrx + 4 * i : NULL;
+    uint8_t rgba[4];
+
+    rgba[0] = pal->r[i] = q ? q[2] : 0;
+    rgba[1] = pal->g[i] = q ? q[1] : 0;
+    rgba[2] = pal->b[i] = q ? q[0] : 0;
+    rgba[3] = 255;
+    memcpy(&pal->rgba[i], rgba, 4);
+    PUT_565(pal->rgb565, i, rgba[0], rgba[1], rgba[2]);
+    pal->lo565[i] = (uint8_t) pal->rgb565[i];
+    pal->hi565[i] = (uint8_t) (pal->rgb565[i] >> 8);
+  }
+}
+
+void pix_convert_row(const pix_image_t *src, int y, int out, uint8_t *dst) {
+  const uint8_t *s[3];
+  int u = 1, v = 2;
+
+  if (src->fmt == PIX_FMT_YV12) {
+    u = 2;
+    v = 1;
+  }
+  s[0] = src->data[0] + (long) y * src->stride[0];
+  s[1] = s[2] = NULL;
+  if (src->fmt == PIX_FMT_PAL8) s[1] = src->data[1];
+  if (planar(src->fmt)) {
+    s[1] = src->data[u] + (long) (y >> chroma_shift_y(src->fmt)) * src->stride[u];
+    s[2] = src->data[v] + (long) (y >> chroma_shift_y(src->fmt)) * src->stride[v];
+  }
+  tables[isa_used][src->fmt][out](s, dst, src->width);
+}
+
+pix_row_fn pix_row_kernel(pix_fmt_t fmt, int out) {
+  pthread_once(&tables_once, tables_init);
+  return tables[isa_used][fmt][out];
+}
+
+int pix_convert(const pix_image_t *src, pix_image_t *dst) {
+  int out, y;
+
+  if (src->fmt < 0 || src->fmt >= PIX_FMT_COUNT) return -1;
+  if (src->fmt == PIX_FMT_PAL8 && !src->data[1]) return -1;
+  if (dst->fmt == PIX_FMT_RGB565) out = PIX_OUT_565;
+  else if (dst->fmt == PIX_FMT_RGBA8888) out = PIX_OUT_RGBA;
+  else return -1;
+  if (src->width != dst->width || src->height != dst->height) return -1;
+
+  pthread_once(&tables_once, tables_init);
+  for (y = 0; y < src->height; y++)
+    pix_convert_row(src, y, out, dst->data[0] + (long) y * dst->stride[0]);
+  return 0;
+}
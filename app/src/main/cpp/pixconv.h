@@ -0,0 +1,99 @@
+/*
+ * pixconv.h -- pixel format conversion of video frames for display
+ *
+ * Converts the uncompressed layouts an AVI can carry (DIB RGB in its
+ * bottom-up row order with 4 byte row padding, 8 bit palette indices,
+ * packed and planar YUV) to what a Surface or a Bitmap takes, RGB565 or
+ * RGBA8888.
+ *
+ * Every conversion has a plain C version, the reference. SSE2, AVX2
+ * (x86) and NEON (ARM) versions of the hot ones are picked at run time
+ * and give the same bytes as the C version; pix_set_isa forces one for
+ * benchmarks and checks.
+ *
+ * YUV is taken as BT.601 limited range, computed in 6 bit fixed point;
+ * the J formats are full range, as JPEG (JFIF) decodes to.
+ */
+
+#ifndef PIXCONV_H
+#define PIXCONV_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "avilib1_1_5/avilib.h"
+
+typedef enum
+{
+  PIX_FMT_NONE = -1,
+  PIX_FMT_BGR24,            /* B G R */
+  PIX_FMT_BGR32,            /* B G R x */
+  PIX_FMT_RGB555,           /* 16 bit LE, x rrrrr ggggg bbbbb */
+  PIX_FMT_RGB565,           /* 16 bit LE, rrrrr gggggg bbbbb */
+  PIX_FMT_YUY2,             /* Y0 U Y1 V */
+  PIX_FMT_UYVY,             /* U Y0 V Y1 */
+  PIX_FMT_I420,             /* planes Y, U, V, chroma halved both ways */
+  PIX_FMT_YV12,             /* planes Y, V, U */
+  PIX_FMT_RGBA8888,         /* R G B A, alpha 255 */
+  PIX_FMT_J420,             /* I420, full range */
+  PIX_FMT_J422,             /* planes Y, U, V, chroma halved across only */
+  PIX_FMT_J444,             /* planes Y, U, V of the same size */
+  PIX_FMT_PAL8,             /* 8 bit indices, data[1] is a pix_palette_t */
+  PIX_FMT_COUNT
+} pix_fmt_t;
+
+typedef struct
+{
+  pix_fmt_t fmt;
+  int       width, height;
+  uint8_t  *data[3];        /* first row of each plane, in display order */
+  int       stride[3];      /* bytes to the next row, < 0 for bottom-up */
+} pix_image_t;
+
+/* fmt over buf, top-down; stride 0 for unpadded rows, planar chroma
+   rows get half of it where chroma is halved across */
+int pix_image_init(pix_image_t *img, pix_fmt_t fmt, int width, int height,
+                   void *buf, int stride);
+/* bytes an unpadded top-down image takes */
+size_t pix_image_size(pix_fmt_t fmt, int width, int height);
+
+/* a video chunk as described by the stream's BITMAPINFOHEADER: format
+   from biCompression/biBitCount, DIB rows bottom-up unless biHeight is
+   negative. -1 for formats this can't show or a short chunk. 8 bit
+   DIBs come out as PAL8 without a palette, the caller sets data[1] */
+int pix_image_dib(pix_image_t *img, const alBITMAPINFOHEADER *bih,
+                  const void *data, long len);
+
+/* the colours of PAL8 images, looked up in the output format */
+typedef struct
+{
+  uint16_t rgb565[256];
+  uint32_t rgba[256];       /* R G B A in memory */
+  uint8_t  r[256], g[256], b[256];  /* both again as byte planes, */
+  uint8_t  lo565[256], hi565[256];  /* for SIMD table lookups */
+} pix_palette_t;
+
+/* from the RGBQUADs (B G R x) of a DIB or a strf; colours past n are
+   black */
+void pix_palette_init(pix_palette_t *pal, const uint8_t *bgrx, int n);
+
+/* src to dst of the same size; dst must be RGB565 or RGBA8888 */
+int pix_convert(const pix_image_t *src, pix_image_t *dst);
+
+enum {
+  PIX_ISA_C = 0,
+  PIX_ISA_SSE2,
+  PIX_ISA_AVX2,
+  PIX_ISA_NEON,
+  PIX_ISA_COUNT
+};
+
+/* best one the CPU has */
+int pix_isa_best(void);
+int pix_isa(void);
+/* -1 for the best, fails for one the CPU does not have */
+int pix_set_isa(int isa);
+const char *pix_isa_name(int isa);
+const char *pix_fmt_name(pix_fmt_t fmt);
+
+#endif /* PIXCONV_H */
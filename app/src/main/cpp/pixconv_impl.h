@@ -0,0 +1,48 @@
+/*
+ * pixconv_impl.h -- row kernels of pixconv, shared by its ISA files
+ */
+
+#ifndef PIXCONV_IMPL_H
+#define PIXCONV_IMPL_H
+
+#include "pixconv.h"
+
+enum { PIX_OUT_565, PIX_OUT_RGBA, PIX_OUTS };
+
+/* one output row of width pixels. src holds the row of each plane,
+   chroma rows already picked; YV12 comes with U and V swapped to I420,
+   J422 rows are J420 ones */
+typedef void (*pix_row_fn)(const uint8_t *const src[3], uint8_t *dst, int width);
+
+typedef pix_row_fn pix_row_table_t[PIX_FMT_COUNT][PIX_OUTS];
+
+/* each fills the entries it has a kernel for */
+void pix_rows_c(pix_row_table_t t);
+void pix_rows_sse2(pix_row_table_t t);
+void pix_rows_avx2(pix_row_table_t t);
+void pix_rows_neon(pix_row_table_t t);
+
+/* the C kernel for pixels x .. width - 1, x even: the rest of a row
+   after a SIMD loop */
+void pix_row_tail(pix_fmt_t fmt, int out, const uint8_t *const src[3],
+                  uint8_t *dst, int x, int width);
+
+/* row y of src in the ISA in use; for callers that did pix_isa() once */
+void pix_convert_row(const pix_image_t *src, int y, int out, uint8_t *dst);
+/* the kernel pix_convert_row would use */
+pix_row_fn pix_row_kernel(pix_fmt_t fmt, int out);
+
+/* YUV to RGB in the 6 bit fixed point all kernels share; the SIMD ones
+   saturate at 16 bit, which only happens where this clamps to 255 */
+#define PIX_YUV_C(y)    (((y) - 16) * 74 + 32)
+#define PIX_YUV_R(c, d, e)  ((c) + 102 * (e))
+#define PIX_YUV_G(c, d, e)  ((c) - 25 * (d) - 52 * (e))
+#define PIX_YUV_B(c, d, e)  ((c) + 129 * (d))
+
+/* the same for full range, which never leaves 16 bit */
+#define PIX_JPEG_C(y)   ((y) * 64 + 32)
+#define PIX_JPEG_R(c, d, e) ((c) + 90 * (e))
+#define PIX_JPEG_G(c, d, e) ((c) - 22 * (d) - 46 * (e))
+#define PIX_JPEG_B(c, d, e) ((c) + 113 * (d))
+
+#endif /* PIXCONV_IMPL_H */
@@ -0,0 +1,290 @@
+/*
+ * pixconv_neon.c -- NEON row kernels of pixconv
+ *
+ * For arm64 and armeabi-v7a with NEON. The structure loads (vld3/vld4)
+ * split the packed formats into planes for free, so every kernel here
+ * works on separate r, g, b vectors of 16 pixels. Like the x86 ones
+ * they leave the rest of a row to pix_row_tail.
+ */
+
+#include "pixconv_impl.h"
+
+#if defined(__ARM_NEON)
+
+#include <arm_neon.h>
+
+/* 8 pixels, 16 bit signed lanes, see PIX_YUV_* and, if full, PIX_JPEG_* */
+static inline void yuv8_neon(int16x8_t y, int16x8_t u, int16x8_t v, int full,
+                             uint8x8_t *r, uint8x8_t *g, uint8x8_t *b) {
+  const int16x8_t c = full ? vaddq_s16(vshlq_n_s16(y, 6), vdupq_n_s16(32))
+                           : vaddq_s16(vmulq_n_s16(vsubq_s16(y, vdupq_n_s16(16)), 74), vdupq_n_s16(32));
+  const int16x8_t d = vsubq_s16(u, vdupq_n_s16(128));
+  const int16x8_t e = vsubq_s16(v, vdupq_n_s16(128));
+
+  // vqshrun clamps to 0..255 like the C kernels
+  *r = vqshrun_n_s16(vqaddq_s16(c, vmulq_n_s16(e, full ? 90 : 102)), 6);
+  *g = vqshrun_n_s16(vqsubq_s16(vqsubq_s16(c, vmulq_n_s16(d, full ? 22 : 25)),
+                                vmulq_n_s16(e, full ? 46 : 52)), 6);
+  *b = vqshrun_n_s16(vqaddq_s16(c, vmulq_n_s16(d, full ? 113 : 129)), 6);
+}
+
+static inline int16x8_t widen(uint8x8_t v) {
+  return vreinterpretq_s16_u16(vmovl_u8(v));
+}
+
+/* r, g, b of 8 pixels to RGB565 */
+static inline uint16x8_t pack565_neon(uint8x8_t r, uint8x8_t g, uint8x8_t b) {
+  uint16x8_t p = vshll_n_u8(r, 8);
+
+  p = vsriq_n_u16(p, vshll_n_u8(g, 8), 5);
+  return vsriq_n_u16(p, vshll_n_u8(b, 8), 11);
+}
+
+static inline void store565_neon(uint8_t *d, uint8x16_t r, uint8x16_t g, uint8x16_t b) {
+  vst1q_u16((uint16_t *) d, pack565_neon(vget_low_u8(r), vget_low_u8(g), vget_low_u8(b)));
+  vst1q_u16((uint16_t *) (d + 16), pack565_neon(vget_high_u8(r), vget_high_u8(g), vget_high_u8(b)));
+}
+
+static inline void store_rgba_neon(uint8_t *d, uint8x16_t r, uint8x16_t g, uint8x16_t b) {
+  uint8x16x4_t q;
+
+  q.val[0] = r;
+  q.val[1] = g;
+  q.val[2] = b;
+  q.val[3] = vdupq_n_u8(255);
+  vst4q_u8(d, q);
+}
+
+static void bgr24_565_neon(const uint8_t *const s[3], uint8_t *d, int w) {
+  int x;
+
+  for (x = 0; x + 16 <= w; x += 16) {
+    uint8x16x3_t p = vld3q_u8(s[0] + 3 * x);
+
+    store565_neon(d + 2 * x, p.val[2], p.val[1], p.val[0]);
+  }
+  pix_row_tail(PIX_FMT_BGR24, PIX_OUT_565, s, d, x, w);
+}
+
+static void bgr24_rgba_neon(const uint8_t *const s[3], uint8_t *d, int w) {
+  int x;
+
+  for (x = 0; x + 16 <= w; x += 16) {
+    uint8x16x3_t p = vld3q_u8(s[0] + 3 * x);
+
+    store_rgba_neon(d + 4 * x, p.val[2], p.val[1], p.val[0]);
+  }
+  pix_row_tail(PIX_FMT_BGR24, PIX_OUT_RGBA, s, d, x, w);
+}
+
+static void bgr32_565_neon(const uint8_t *const s[3], uint8_t *d, int w) {
+  int x;
+
+  for (x = 0; x + 16 <= w; x += 16) {
+    uint8x16x4_t p = vld4q_u8(s[0] + 4 * x);
+
+    store565_neon(d + 2 * x, p.val[2], p.val[1], p.val[0]);
+  }
+  pix_row_tail(PIX_FMT_BGR32, PIX_OUT_565, s, d, x, w);
+}
+
+static void bgr32_rgba_neon(const uint8_t *const s[3], uint8_t *d, int w) {
+  int x;
+
+  for (x = 0; x + 16 <= w; x += 16) {
+    uint8x16x4_t p = vld4q_u8(s[0] + 4 * x);
+
+    store_rgba_neon(d + 4 * x, p.val[2], p.val[1], p.val[0]);
+  }
+  pix_row_tail(PIX_FMT_BGR32, PIX_OUT_RGBA, s, d, x, w);
+}
+
+/*
+ * 16 pixels of YUV, the even and the odd ones apart as vld2/vld4 hand
+ * them out; both halves share u and v. Results are zipped back into
+ * pixel order.
+ */
+static inline void yuv16_neon(uint8x8_t ye, uint8x8_t yo, uint8x8_t u, uint8x8_t v, int full,
+                              uint8x16_t *r, uint8x16_t *g, uint8x16_t *b) {
+  uint8x8_t re, ge, be, ro, go, bo;
+  uint8x8x2_t z;
+
+  yuv8_neon(widen(ye), widen(u), widen(v), full, &re, &ge, &be);
+  yuv8_neon(widen(yo), widen(u), widen(v), full, &ro, &go, &bo);
+  z = vzip_u8(re, ro);
+  *r = vcombine_u8(z.val[0], z.val[1]);
+  z = vzip_u8(ge, go);
+  *g = vcombine_u8(z.val[0], z.val[1]);
+  z = vzip_u8(be, bo);
+  *b = vcombine_u8(z.val[0], z.val[1]);
+}
+
+/* 16 pixels of a 4:2:2 row: vld4 of 32 bytes gives 8 of each field */
+#define PACKED_YUV_NEON(name, fmt, Y0, U, Y1, V) \
+static void name##_565_neon(const uint8_t *const s[3], uint8_t *d, int w) { \
+  int x; \
+  for (x = 0; x + 16 <= w; x += 16) { \
+    uint8x8x4_t p = vld4_u8(s[0] + 2 * x); \
+    uint8x16_t r, g, b; \
+    yuv16_neon(p.val[Y0], p.val[Y1], p.val[U], p.val[V], 0, &r, &g, &b); \
+    store565_neon(d + 2 * x, r, g, b); \
+  } \
+  pix_row_tail(fmt, PIX_OUT_565, s, d, x, w); \
+} \
+static void name##_rgba_neon(const uint8_t *const s[3], uint8_t *d, int w) { \
+  int x; \
+  for (x = 0; x + 16 <= w; x += 16) { \
+    uint8x8x4_t p = vld4_u8(s[0] + 2 * x); \
+    uint8x16_t r, g, b; \
+    yuv16_neon(p.val[Y0], p.val[Y1], p.val[U], p.val[V], 0, &r, &g, &b); \
+    store_rgba_neon(d + 4 * x, r, g, b); \
+  } \
+  pix_row_tail(fmt, PIX_OUT_RGBA, s, d, x, w); \
+}
+
+PACKED_YUV_NEON(yuy2, PIX_FMT_YUY2, 0, 1, 2, 3)
+PACKED_YUV_NEON(uyvy, PIX_FMT_UYVY, 1, 0, 3, 2)
+
+/* 16 pixels of a planar row with chroma halved across */
+static inline void yuv420_neon(const uint8_t *const s[3], int x, int full,
+                               uint8x16_t *r, uint8x16_t *g, uint8x16_t *b) {
+  uint8x8x2_t y = vld2_u8(s[0] + x);
+
+  yuv16_neon(y.val[0], y.val[1], vld1_u8(s[1] + x / 2), vld1_u8(s[2] + x / 2), full, r, g, b);
+}
+
+/* the same with chroma at full width, in two halves of 8 */
+static inline void yuv444_neon(const uint8_t *const s[3], int x, int full,
+                               uint8x16_t *r, uint8x16_t *g, uint8x16_t *b) {
+  uint8x16_t y = vld1q_u8(s[0] + x), u = vld1q_u8(s[1] + x), v = vld1q_u8(s[2] + x);
+  uint8x8_t rl, gl, bl, rh, gh, bh;
+
+  yuv8_neon(widen(vget_low_u8(y)), widen(vget_low_u8(u)), widen(vget_low_u8(v)), full, &rl, &gl, &bl);
+  yuv8_neon(widen(vget_high_u8(y)), widen(vget_high_u8(u)), widen(vget_high_u8(v)), full, &rh, &gh, &bh);
+  *r = vcombine_u8(rl, rh);
+  *g = vcombine_u8(gl, gh);
+  *b = vcombine_u8(bl, bh);
+}
+
+#define PLANAR_YUV_NEON(name, fmt, full, load) \
+static void name##_565_neon(const uint8_t *const s[3], uint8_t *d, int w) { \
+  int x; \
+  for (x = 0; x + 16 <= w; x += 16) { \
+    uint8x16_t r, g, b; \
+    load(s, x, full, &r, &g, &b); \
+    store565_neon(d + 2 * x, r, g, b); \
+  } \
+  pix_row_tail(fmt, PIX_OUT_565, s, d, x, w); \
+} \
+static void name##_rgba_neon(const uint8_t *const s[3], uint8_t *d, int w) { \
+  int x; \
+  for (x = 0; x + 16 <= w; x += 16) { \
+    uint8x16_t r, g, b; \
+    load(s, x, full, &r, &g, &b); \
+    store_rgba_neon(d + 4 * x, r, g, b); \
+  } \
+  pix_row_tail(fmt, PIX_OUT_RGBA, s, d, x, w); \
+}
+
+PLANAR_YUV_NEON(i420, PIX_FMT_I420, 0, yuv420_neon)
+PLANAR_YUV_NEON(j420, PIX_FMT_J420, 1, yuv420_neon)
+PLANAR_YUV_NEON(j444, PIX_FMT_J444, 1, yuv444_neon)
+
+#if defined(__aarch64__)
+
+/* a 256 byte table in 16 registers, for 4 tbl lookups of 64 each */
+typedef struct
+{
+  uint8x16x4_t q[4];
+} lut_neon_t;
+
+static inline void load_lut_neon(lut_neon_t *t, const uint8_t *p) {
+  int k, i;
+
+  for (k = 0; k < 4; k++)
+    for (i = 0; i < 4; i++)
+      t->q[k].val[i] = vld1q_u8(p + 64 * k + 16 * i);
+}
+
+/* indices past a tbl's 64 entries keep what the lanes had */
+static inline uint8x16_t lookup_neon(const lut_neon_t *t, uint8x16_t i) {
+  const uint8x16_t k64 = vdupq_n_u8(64);
+  uint8x16_t v = vqtbl4q_u8(t->q[0], i);
+
+  i = vsubq_u8(i, k64);
+  v = vqtbx4q_u8(v, t->q[1], i);
+  i = vsubq_u8(i, k64);
+  v = vqtbx4q_u8(v, t->q[2], i);
+  return vqtbx4q_u8(v, t->q[3], vsubq_u8(i, k64));
+}
+
+static void pal8_565_neon(const uint8_t *const s[3], uint8_t *d, int w) {
+  const pix_palette_t *pal = (const pix_palette_t *) s[1];
+  lut_neon_t lo, hi;
+  int x;
+
+  load_lut_neon(&lo, pal->lo565);
+  load_lut_neon(&hi, pal->hi565);
+  for (x = 0; x + 16 <= w; x += 16) {
+    const uint8x16_t i = vld1q_u8(s[0] + x);
+    uint8x16x2_t p;
+
+    p.val[0] = lookup_neon(&lo, i);
+    p.val[1] = lookup_neon(&hi, i);
+    vst2q_u8(d + 2 * x, p);
+  }
+  pix_row_tail(PIX_FMT_PAL8, PIX_OUT_565, s, d, x, w);
+}
+
+static void pal8_rgba_neon(const uint8_t *const s[3], uint8_t *d, int w) {
+  const pix_palette_t *pal = (const pix_palette_t *) s[1];
+  lut_neon_t r, g, b;
+  int x;
+
+  load_lut_neon(&r, pal->r);
+  load_lut_neon(&g, pal->g);
+  load_lut_neon(&b, pal->b);
+  for (x = 0; x + 16 <= w; x += 16) {
+    const uint8x16_t i = vld1q_u8(s[0] + x);
+
+    store_rgba_neon(d + 4 * x, lookup_neon(&r, i), lookup_neon(&g, i), lookup_neon(&b, i));
+  }
+  pix_row_tail(PIX_FMT_PAL8, PIX_OUT_RGBA, s, d, x, w);
+}
+
+#endif /* __aarch64__ */
+
+/* the 16 bit RGB inputs vectorize well enough from the C kernels; PAL8
+   needs the 64 byte tables of arm64, armeabi-v7a looks up in C */
+void pix_rows_neon(pix_row_table_t t) {
+  t[PIX_FMT_BGR24][PIX_OUT_565] = bgr24_565_neon;
+  t[PIX_FMT_BGR24][PIX_OUT_RGBA] = bgr24_rgba_neon;
+  t[PIX_FMT_BGR32][PIX_OUT_565] = bgr32_565_neon;
+  t[PIX_FMT_BGR32][PIX_OUT_RGBA] = bgr32_rgba_neon;
+  t[PIX_FMT_YUY2][PIX_OUT_565] = yuy2_565_neon;
+  t[PIX_FMT_YUY2][PIX_OUT_RGBA] = yuy2_rgba_neon;
+  t[PIX_FMT_UYVY][PIX_OUT_565] = uyvy_565_neon;
+  t[PIX_FMT_UYVY][PIX_OUT_RGBA] = uyvy_rgba_neon;
+  t[PIX_FMT_I420][PIX_OUT_565] = i420_565_neon;
+  t[PIX_FMT_I420][PIX_OUT_RGBA] = i420_rgba_neon;
+  t[PIX_FMT_YV12][PIX_OUT_565] = i420_565_neon;
+  t[PIX_FMT_YV12][PIX_OUT_RGBA] = i420_rgba_neon;
+  t[PIX_FMT_J420][PIX_OUT_565] = j420_565_neon;
+  t[PIX_FMT_J420][PIX_OUT_RGBA] = j420_rgba_neon;
+  t[PIX_FMT_J422][PIX_OUT_565] = j420_565_neon;
+  t[PIX_FMT_J422][PIX_OUT_RGBA] = j420_rgba_neon;
+  t[PIX_FMT_J444][PIX_OUT_565] = j444_565_neon;
+  t[PIX_FMT_J444][PIX_OUT_RGBA] = j444_rgba_neon;
+#if defined(__aarch64__)
+  t[PIX_FMT_PAL8][PIX_OUT_565] = pal8_565_neon;
+  t[PIX_FMT_PAL8][PIX_OUT_RGBA] = pal8_rgba_neon;
+#endif
+}
+
+#else /* !__ARM_NEON */
+
+void pix_rows_neon(pix_row_table_t t) {
+  (void) t;
+}
+
+#endif
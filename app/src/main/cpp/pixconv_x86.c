@@ -0,0 +1,589 @@
+/*
+ * pixconv_x86.c -- SSE2 and AVX2 row kernels of pixconv
+ *
+ * Built for any x86 target: each kernel carries its own target
+ * attribute and pixconv.c only installs the ones the CPU has. They do
+ * whole blocks of 16 pixels and leave the rest of the row to the C
+ * kernel through pix_row_tail, so their output is the C kernel's.
+ */
+
+#include "pixconv_impl.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+
+/*************************************************************************/
+/* SSE2                                                                  */
+/*************************************************************************/
+
+/* 16 bit r, g, b of 8 pixels, see PIX_YUV_* and, if full, PIX_JPEG_* */
+static inline SSE2 void yuv8_sse2(__m128i y, __m128i u, __m128i v, int full,
+                                  __m128i *r, __m128i *g, __m128i *b) {
+  const __m128i c = full ? _mm_add_epi16(_mm_slli_epi16(y, 6), _mm_set1_epi16(32))
+                         : _mm_add_epi16(_mm_mullo_epi16(_mm_sub_epi16(y, _mm_set1_epi16(16)),
+                                                         _mm_set1_epi16(74)),
+                                         _mm_set1_epi16(32));
+  const __m128i d = _mm_sub_epi16(u, _mm_set1_epi16(128));
+  const __m128i e = _mm_sub_epi16(v, _mm_set1_epi16(128));
+
+  *r = _mm_srai_epi16(_mm_adds_epi16(c, _mm_mullo_epi16(e, _mm_set1_epi16(full ? 90 : 102))), 6);
+  *g = _mm_srai_epi16(_mm_subs_epi16(_mm_subs_epi16(c, _mm_mullo_epi16(d, _mm_set1_epi16(full ? 22 : 25))),
+                                     _mm_mullo_epi16(e, _mm_set1_epi16(full ? 46 : 52))), 6);
+  *b = _mm_srai_epi16(_mm_adds_epi16(c, _mm_mullo_epi16(d, _mm_set1_epi16(full ? 113 : 129))), 6);
+}
+
+/* RGB565 of 8 pixels from 16 bit r, g, b, clamped to 0..255 here */
+static inline SSE2 __m128i pack565_16_sse2(__m128i r, __m128i g, __m128i b) {
+  const __m128i z = _mm_setzero_si128(), m = _mm_set1_epi16(255);
+
+  r = _mm_min_epi16(_mm_max_epi16(r, z), m);
+  g = _mm_min_epi16(_mm_max_epi16(g, z), m);
+  b = _mm_min_epi16(_mm_max_epi16(b, z), m);
+  return _mm_or_si128(_mm_or_si128(_mm_slli_epi16(_mm_and_si128(r, _mm_set1_epi16(0xF8)), 8),
+                                   _mm_slli_epi16(_mm_and_si128(g, _mm_set1_epi16(0xFC)), 3)),
+                      _mm_srli_epi16(b, 3));
+}
+
+/* 16 pixels of 8 bit r, g, b as R G B A */
+static inline SSE2 void store_rgba_sse2(uint8_t *d, __m128i r, __m128i g, __m128i b) {
+  const __m128i a = _mm_set1_epi8(-1);
+  const __m128i rg_lo = _mm_unpacklo_epi8(r, g), rg_hi = _mm_unpackhi_epi8(r, g);
+  const __m128i ba_lo = _mm_unpacklo_epi8(b, a), ba_hi = _mm_unpackhi_epi8(b, a);
+
+  _mm_storeu_si128((__m128i *) d, _mm_unpacklo_epi16(rg_lo, ba_lo));
+  _mm_storeu_si128((__m128i *) (d + 16), _mm_unpackhi_epi16(rg_lo, ba_lo));
+  _mm_storeu_si128((__m128i *) (d + 32), _mm_unpacklo_epi16(rg_hi, ba_hi));
+  _mm_storeu_si128((__m128i *) (d + 48), _mm_unpackhi_epi16(rg_hi, ba_hi));
+}
+
+/* B G R x of 4 pixels */
+static inline SSE2 __m128i bgrx_to_rgba_sse2(__m128i p) {
+  return _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_srli_epi32(p, 16), _mm_set1_epi32(0xFF)),
+                                   _mm_and_si128(p, _mm_set1_epi32(0xFF00))),
+                      _mm_or_si128(_mm_slli_epi32(_mm_and_si128(p, _mm_set1_epi32(0xFF)), 16),
+                                   _mm_set1_epi32((int) 0xFF000000)));
+}
+
+/* B G R x of 4 pixels to RGB565 in the low half of each 32 bit lane */
+static inline SSE2 __m128i bgrx_to_565_sse2(__m128i p) {
+  return _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_srli_epi32(p, 8), _mm_set1_epi32(0xF800)),
+                                   _mm_and_si128(_mm_srli_epi32(p, 5), _mm_set1_epi32(0x07E0))),
+                      _mm_and_si128(_mm_srli_epi32(p, 3), _mm_set1_epi32(0x001F)));
+}
+
+/* R G B A of 4 pixels, the same */
+static inline SSE2 __m128i rgba_to_565_sse2(__m128i p) {
+  return _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_slli_epi32(p, 8), _mm_set1_epi32(0xF800)),
+                                   _mm_and_si128(_mm_srli_epi32(p, 5), _mm_set1_epi32(0x07E0))),
+                      _mm_and_si128(_mm_srli_epi32(p, 19), _mm_set1_epi32(0x001F)));
+}
+
+/* two of the above to 8 16 bit lanes; sign extend so packs keeps them */
+static inline SSE2 __m128i pack32_sse2(__m128i a, __m128i b) {
+  return _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16),
+                         _mm_srai_epi32(_mm_slli_epi32(b, 16), 16));
+}
+
+static SSE2 void bgr32_rgba_sse2(const uint8_t *const s[3], uint8_t *d, int w) {
+  int x;
+
+  for (x = 0; x + 4 <= w; x += 4)
+    _mm_storeu_si128((__m128i *) (d + 4 * x),
+                     bgrx_to_rgba_sse2(_mm_loadu_si128((const __m128i *) (s[0] + 4 * x))));
+  pix_row_tail(PIX_FMT_BGR32, PIX_OUT_RGBA, s, d, x, w);
+}
+
+static SSE2 void bgr32_565_sse2(const uint8_t *const s[3], uint8_t *d, int w) {
+  int x;
+
+  for (x = 0; x + 8 <= w; x += 8) {
+    __m128i a = _mm_loadu_si128((const __m128i *) (s[0] + 4 * x));
+    __m128i b = _mm_loadu_si128((const __m128i *) (s[0] + 4 * x + 16));
+
+    _mm_storeu_si128((__m128i *) (d + 2 * x), pack32_sse2(bgrx_to_565_sse2(a), bgrx_to_565_sse2(b)));
+  }
+  pix_row_tail(PIX_FMT_BGR32, PIX_OUT_565, s, d, x, w);
+}
+
+static SSE2 void rgba_565_sse2(const uint8_t *const s[3], uint8_t *d, int w) {
+  int x;
+
+  for (x = 0; x + 8 <= w; x += 8) {
+    __m128i a = _mm_loadu_si128((const __m128i *) (s[0] + 4 * x));
+    __m128i b = _mm_loadu_si128((const __m128i *) (s[0] + 4 * x + 16));
+
+    _mm_storeu_si128((__m128i *) (d + 2 * x), pack32_sse2(rgba_to_565_sse2(a), rgba_to_565_sse2(b)));
+  }
+  pix_row_tail(PIX_FMT_RGBA8888, PIX_OUT_565, s, d, x, w);
+}
+
+/* 16 bit fields of 8 RGB555 or RGB565 pixels */
+static inline SSE2 void split555_sse2(__m128i p, __m128i *r5, __m128i *g5, __m128i *b5) {
+  const __m128i m = _mm_set1_epi16(31);
+
+  *r5 = _mm_and_si128(_mm_srli_epi16(p, 10), m);
+  *g5 = _mm_and_si128(_mm_srli_epi16(p, 5), m);
+  *b5 = _mm_and_si128(p, m);
+}
+
+static inline SSE2 __m128i expand5_sse2(__m128i v) {
+  return _mm_or_si128(_mm_slli_epi16(v, 3), _mm_srli_epi16(v, 2));
+}
+
+static SSE2 void rgb555_565_sse2(const uint8_t *const s[3], uint8_t *d, int w) {
+  int x;
+
+  for (x = 0; x + 8 <= w; x += 8) {
+    __m128i r, g, b;
+
+    split555_sse2(_mm_loadu_si128((const __m128i *) (s[0] + 2 * x)), &r, &g, &b);
+    g = _mm_or_si128(_mm_slli_epi16(g, 1), _mm_srli_epi16(g, 4));
+    _mm_storeu_si128((__m128i *) (d + 2 * x),
+                     _mm_or_si128(_mm_or_si128(_mm_slli_epi16(r, 11), _mm_slli_epi16(g, 5)), b));
+  }
+  pix_row_tail(PIX_FMT_RGB555, PIX_OUT_565, s, d, x, w);
+}
+
+static SSE2 void rgb555_rgba_sse2(const uint8_t *const s[3], uint8_t *d, int w) {
+  int x;
+
+  for (x = 0; x + 16 <= w; x += 16) {
+    __m128i r0, g0, b0, r1, g1, b1;
+
+    split555_sse2(_mm_loadu_si128((const __m128i *) (s[0] + 2 * x)), &r0, &g0, &b0);
+    split555_sse2(_mm_loadu_si128((const __m128i *) (s[0] + 2 * x + 16)), &r1, &g1, &b1);
+    store_rgba_sse2(d + 4 * x,
+                    _mm_packus_epi16(expand5_sse2(r0), expand5_sse2(r1)),
+                    _mm_packus_epi16(expand5_sse2(g0), expand5_sse2(g1)),
+                    _mm_packus_epi16(expand5_sse2(b0), expand5_sse2(b1)));
+  }
+  pix_row_tail(PIX_FMT_RGB555, PIX_OUT_RGBA, s, d, x, w);
+}
+
+static inline SSE2 void split565_sse2(__m128i p, __m128i *r, __m128i *g, __m128i *b) {
+  const __m128i r5 = _mm_srli_epi16(p, 11);
+  const __m128i g6 = _mm_and_si128(_mm_srli_epi16(p, 5), _mm_set1_epi16(63));
+  const __m128i b5 = _mm_and_si128(p, _mm_set1_epi16(31));
+
+  *r = expand5_sse2(r5);
+  *g = _mm_or_si128(_mm_slli_epi16(g6, 2), _mm_srli_epi16(g6, 4));
+  *b = expand5_sse2(b5);
+}
+
+static SSE2 void rgb565_rgba_sse2(const uint8_t *const s[3], uint8_t *d, int w) {
+  int x;
+
+  for (x = 0; x + 16 <= w; x += 16) {
+    __m128i r0, g0, b0, r1, g1, b1;
+
+    split565_sse2(_mm_loadu_si128((const __m128i *) (s[0] + 2 * x)), &r0, &g0, &b0);
+    split565_sse2(_mm_loadu_si128((const __m128i *) (s[0] + 2 * x + 16)), &r1, &g1, &b1);
+    store_rgba_sse2(d + 4 * x, _mm_packus_epi16(r0, r1), _mm_packus_epi16(g0, g1),
+                    _mm_packus_epi16(b0, b1));
+  }
+  pix_row_tail(PIX_FMT_RGB565, PIX_OUT_RGBA, s, d, x, w);
+}
+
+/* 8 pixels of a 4:2:2 packed row: y in the low byte of each 16 bit
+   lane (YUY2) or in the high one (UYVY) */
+static inline SSE2 void load422_sse2(const uint8_t *p, int y_high,
+                                     __m128i *y, __m128i *u, __m128i *v) {
+  const __m128i q = _mm_loadu_si128((const __m128i *) p);
+  const __m128i lo = _mm_and_si128(q, _mm_set1_epi16(0xFF)), hi = _mm_srli_epi16(q, 8);
+  const __m128i uv = y_high ? lo : hi;
+
+  *y = y_high ? hi : lo;
+  // uv is U0 V0 U1 V1 U2 V2 U3 V3, each chroma goes to two pixels
+  *u = _mm_shufflehi_epi16(_mm_shufflelo_epi16(uv, _MM_SHUFFLE(2, 2, 0, 0)), _MM_SHUFFLE(2, 2, 0, 0));
+  *v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(uv, _MM_SHUFFLE(3, 3, 1, 1)), _MM_SHUFFLE(3, 3, 1, 1));
+}
+
+#define PACKED_YUV_SSE2(name, fmt, y_high) \
+static SSE2 void name##_565_sse2(const uint8_t *const s[3], uint8_t *d, int w) { \
+  int x; \
+  for (x = 0; x + 8 <= w; x += 8) { \
+    __m128i y, u, v, r, g, b; \
+    load422_sse2(s[0] + 2 * x, y_high, &y, &u, &v); \
+    yuv8_sse2(y, u, v, 0, &r, &g, &b); \
+    _mm_storeu_si128((__m128i *) (d + 2 * x), pack565_16_sse2(r, g, b)); \
+  } \
+  pix_row_tail(fmt, PIX_OUT_565, s, d, x, w); \
+} \
+static SSE2 void name##_rgba_sse2(const uint8_t *const s[3], uint8_t *d, int w) { \
+  int x; \
+  for (x = 0; x + 16 <= w; x += 16) { \
+    __m128i y, u, v, r0, g0, b0, r1, g1, b1; \
+    load422_sse2(s[0] + 2 * x, y_high, &y, &u, &v); \
+    yuv8_sse2(y, u, v, 0, &r0, &g0, &b0); \
+    load422_sse2(s[0] + 2 * x + 16, y_high, &y, &u, &v); \
+    yuv8_sse2(y, u, v, 0, &r1, &g1, &b1); \
+    store_rgba_sse2(d + 4 * x, _mm_packus_epi16(r0, r1), _mm_packus_epi16(g0, g1), \
+                    _mm_packus_epi16(b0, b1)); \
+  } \
+  pix_row_tail(fmt, PIX_OUT_RGBA, s, d, x, w); \
+}
+
+PACKED_YUV_SSE2(yuy2, PIX_FMT_YUY2, 0)
+PACKED_YUV_SSE2(uyvy, PIX_FMT_UYVY, 1)
+
+/* 16 pixels of a planar row as two halves of 16 bit lanes */
+static inline SSE2 void load420_sse2(const uint8_t *const s[3], int x,
+                                     __m128i y[2], __m128i u[2], __m128i v[2]) {
+  const __m128i z = _mm_setzero_si128();
+  const __m128i yy = _mm_loadu_si128((const __m128i *) (s[0] + x));
+  const __m128i uu = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (s[1] + x / 2)), z);
+  const __m128i vv = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (s[2] + x / 2)), z);
+
+  y[0] = _mm_unpacklo_epi8(yy, z);
+  y[1] = _mm_unpackhi_epi8(yy, z);
+  u[0] = _mm_unpacklo_epi16(uu, uu);
+  u[1] = _mm_unpackhi_epi16(uu, uu);
+  v[0] = _mm_unpacklo_epi16(vv, vv);
+  v[1] = _mm_unpackhi_epi16(vv, vv);
+}
+
+/* 16 pixels of a row with chroma at full width */
+static inline SSE2 void load444_sse2(const uint8_t *const s[3], int x,
+                                     __m128i y[2], __m128i u[2], __m128i v[2]) {
+  const __m128i z = _mm_setzero_si128();
+  const __m128i yy = _mm_loadu_si128((const __m128i *) (s[0] + x));
+  const __m128i uu = _mm_loadu_si128((const __m128i *) (s[1] + x));
+  const __m128i vv = _mm_loadu_si128((const __m128i *) (s[2] + x));
+
+  y[0] = _mm_unpacklo_epi8(yy, z);
+  y[1] = _mm_unpackhi_epi8(yy, z);
+  u[0] = _mm_unpacklo_epi8(uu, z);
+  u[1] = _mm_unpackhi_epi8(uu, z);
+  v[0] = _mm_unpacklo_epi8(vv, z);
+  v[1] = _mm_unpackhi_epi8(vv, z);
+}
+
+#define PLANAR_YUV_SSE2(name, fmt, full, load) \
+static SSE2 void name##_565_sse2(const uint8_t *const s[3], uint8_t *d, int w) { \
+  int x; \
+  for (x = 0; x + 16 <= w; x += 16) { \
+    __m128i y[2], u[2], v[2], r, g, b; \
+    load(s, x, y, u, v); \
+    yuv8_sse2(y[0], u[0], v[0], full, &r, &g, &b); \
+    _mm_storeu_si128((__m128i *) (d + 2 * x), pack565_16_sse2(r, g, b)); \
+    yuv8_sse2(y[1], u[1], v[1], full, &r, &g, &b); \
+    _mm_storeu_si128((__m128i *) (d + 2 * x + 16), pack565_16_sse2(r, g, b)); \
+  } \
+  pix_row_tail(fmt, PIX_OUT_565, s, d, x, w); \
+} \
+static SSE2 void name##_rgba_sse2(const uint8_t *const s[3], uint8_t *d, int w) { \
+  int x; \
+  for (x = 0; x + 16 <= w; x += 16) { \
+    __m128i y[2], u[2], v[2], r0, g0, b0, r1, g1, b1; \
+    load(s, x, y, u, v); \
+    yuv8_sse2(y[0], u[0], v[0], full, &r0, &g0, &b0); \
+    yuv8_sse2(y[1], u[1], v[1], full, &r1, &g1, &b1); \
+    store_rgba_sse2(d + 4 * x, _mm_packus_epi16(r0, r1), _mm_packus_epi16(g0, g1), \
+                    _mm_packus_epi16(b0, b1)); \
+  } \
+  pix_row_tail(fmt, PIX_OUT_RGBA, s, d, x, w); \
+}
+
+PLANAR_YUV_SSE2(i420, PIX_FMT_I420, 0, load420_sse2)
+PLANAR_YUV_SSE2(j420, PIX_FMT_J420, 1, load420_sse2)
+PLANAR_YUV_SSE2(j444, PIX_FMT_J444, 1, load444_sse2)
+
+/* BGR24 needs byte shuffles and PAL8 gathers, they stay on C until AVX2 */
+void pix_rows_sse2(pix_row_table_t t) {
+  t[PIX_FMT_BGR32][PIX_OUT_565] = bgr32_565_sse2;
+  t[PIX_FMT_BGR32][PIX_OUT_RGBA] = bgr32_rgba_sse2;
+  t[PIX_FMT_RGB555][PIX_OUT_565] = rgb555_565_sse2;
+  t[PIX_FMT_RGB555][PIX_OUT_RGBA] = rgb555_rgba_sse2;
+  t[PIX_FMT_RGB565][PIX_OUT_RGBA] = rgb565_rgba_sse2;
+  t[PIX_FMT_YUY2][PIX_OUT_565] = yuy2_565_sse2;
+  t[PIX_FMT_YUY2][PIX_OUT_RGBA] = yuy2_rgba_sse2;
+  t[PIX_FMT_UYVY][PIX_OUT_565] = uyvy_565_sse2;
+  t[PIX_FMT_UYVY][PIX_OUT_RGBA] = uyvy_rgba_sse2;
+  t[PIX_FMT_I420][PIX_OUT_565] = i420_565_sse2;
+  t[PIX_FMT_I420][PIX_OUT_RGBA] = i420_rgba_sse2;
+  t[PIX_FMT_YV12][PIX_OUT_565] = i420_565_sse2;
+  t[PIX_FMT_YV12][PIX_OUT_RGBA] = i420_rgba_sse2;
+  t[PIX_FMT_RGBA8888][PIX_OUT_565] = rgba_565_sse2;
+  t[PIX_FMT_J420][PIX_OUT_565] = j420_565_sse2;
+  t[PIX_FMT_J420][PIX_OUT_RGBA] = j420_rgba_sse2;
+  t[PIX_FMT_J422][PIX_OUT_565] = j420_565_sse2;
+  t[PIX_FMT_J422][PIX_OUT_RGBA] = j420_rgba_sse2;
+  t[PIX_FMT_J444][PIX_OUT_565] = j444_565_sse2;
+  t[PIX_FMT_J444][PIX_OUT_RGBA] = j444_rgba_sse2;
+}
+
+/*************************************************************************/
+/* AVX2                                                                  */
+/*************************************************************************/
+
+static inline AVX2 void yuv16_avx2(__m256i y, __m256i u, __m256i v, int full,
+                                   __m256i *r, __m256i *g, __m256i *b) {
+  const __m256i c = full ? _mm256_add_epi16(_mm256_slli_epi16(y, 6), _mm256_set1_epi16(32))
+                         : _mm256_add_epi16(_mm256_mullo_epi16(_mm256_sub_epi16(y, _mm256_set1_epi16(16)),
+                                                               _mm256_set1_epi16(74)),
+                                            _mm256_set1_epi16(32));
+  const __m256i d = _mm256_sub_epi16(u, _mm256_set1_epi16(128));
+  const __m256i e = _mm256_sub_epi16(v, _mm256_set1_epi16(128));
+
+  *r = _mm256_srai_epi16(_mm256_adds_epi16(c, _mm256_mullo_epi16(e, _mm256_set1_epi16(full ? 90 : 102))), 6);
+  *g = _mm256_srai_epi16(_mm256_subs_epi16(_mm256_subs_epi16(c, _mm256_mullo_epi16(d, _mm256_set1_epi16(full ? 22 : 25))),
+                                           _mm256_mullo_epi16(e, _mm256_set1_epi16(full ? 46 : 52))), 6);
+  *b = _mm256_srai_epi16(_mm256_adds_epi16(c, _mm256_mullo_epi16(d, _mm256_set1_epi16(full ? 113 : 129))), 6);
+}
+
+static inline AVX2 __m256i pack565_16_avx2(__m256i r, __m256i g, __m256i b) {
+  const __m256i z = _mm256_setzero_si256(), m = _mm256_set1_epi16(255);
+
+  r = _mm256_min_epi16(_mm256_max_epi16(r, z), m);
+  g = _mm256_min_epi16(_mm256_max_epi16(g, z), m);
+  b = _mm256_min_epi16(_mm256_max_epi16(b, z), m);
+  return _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(r, _mm256_set1_epi16(0xF8)), 8),
+                                         _mm256_slli_epi16(_mm256_and_si256(g, _mm256_set1_epi16(0xFC)), 3)),
+                         _mm256_srli_epi16(b, 3));
+}
+
+/* 16 lanes of 16 bit to 16 bytes in order, clamped */
+static inline AVX2 __m128i narrow16_avx2(__m256i v) {
+  return _mm256_castsi256_si128(_mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), 0x08));
+}
+
+/* 16 pixels of 16 bit r, g, b as R G B A */
+static inline AVX2 void store_rgba_avx2(uint8_t *d, __m256i r, __m256i g, __m256i b) {
+  store_rgba_sse2(d, narrow16_avx2(r), narrow16_avx2(g), narrow16_avx2(b));
+}
+
+/* 16 pixels of a 4:2:2 packed row */
+static inline AVX2 void load422_avx2(const uint8_t *p, int y_high,
+                                     __m256i *y, __m256i *u, __m256i *v) {
+  const __m256i q = _mm256_loadu_si256((const __m256i *) p);
+  const __m256i lo = _mm256_and_si256(q, _mm256_set1_epi16(0xFF)), hi = _mm256_srli_epi16(q, 8);
+  const __m256i uv = y_high ? lo : hi;
+
+  *y = y_high ? hi : lo;
+  *u = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(uv, _MM_SHUFFLE(2, 2, 0, 0)), _MM_SHUFFLE(2, 2, 0, 0));
+  *v = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(uv, _MM_SHUFFLE(3, 3, 1, 1)), _MM_SHUFFLE(3, 3, 1, 1));
+}
+
+/* 16 pixels of a planar row */
+static inline AVX2 void load420_avx2(const uint8_t *const s[3], int x,
+                                     __m256i *y, __m256i *u, __m256i *v) {
+  const __m256i uu = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (s[1] + x / 2)));
+  const __m256i vv = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (s[2] + x / 2)));
+
+  *y = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (s[0] + x)));
+  // each chroma in a 32 bit lane, copied to both of its 16 bit halves
+  *u = _mm256_or_si256(uu, _mm256_slli_epi32(uu, 16));
+  *v = _mm256_or_si256(vv, _mm256_slli_epi32(vv, 16));
+}
+
+/* 16 pixels of a planar row with chroma at full width */
+static inline AVX2 void load444_avx2(const uint8_t *const s[3], int x,
+                                     __m256i *y, __m256i *u, __m256i *v) {
+  *y = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (s[0] + x)));
+  *u = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (s[1] + x)));
+  *v = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (s[2] + x)));
+}
+
+#define YUV_AVX2(name, fmt, full, LOAD) \
+static AVX2 void name##_565_avx2(const uint8_t *const s[3], uint8_t *d, int w) { \
+  int x; \
+  for (x = 0; x + 16 <= w; x += 16) { \
+    __m256i y, u, v, r, g, b; \
+    LOAD; \
+    yuv16_avx2(y, u, v, full, &r, &g, &b); \
+    _mm256_storeu_si256((__m256i *) (d + 2 * x), pack565_16_avx2(r, g, b)); \
+  } \
+  pix_row_tail(fmt, PIX_OUT_565, s, d, x, w); \
+} \
+static AVX2 void name##_rgba_avx2(const uint8_t *const s[3], uint8_t *d, int w) { \
+  int x; \
+  for (x = 0; x + 16 <= w; x += 16) { \
+    __m256i y, u, v, r, g, b; \
+    LOAD; \
+    yuv16_avx2(y, u, v, full, &r, &g, &b); \
+    store_rgba_avx2(d + 4 * x, r, g, b); \
+  } \
+  pix_row_tail(fmt, PIX_OUT_RGBA, s, d, x, w); \
+}
+
+YUV_AVX2(yuy2, PIX_FMT_YUY2, 0, load422_avx2(s[0] + 2 * x, 0, &y, &u, &v))
+YUV_AVX2(uyvy, PIX_FMT_UYVY, 0, load422_avx2(s[0] + 2 * x, 1, &y, &u, &v))
+YUV_AVX2(i420, PIX_FMT_I420, 0, load420_avx2(s, x, &y, &u, &v))
+YUV_AVX2(j420, PIX_FMT_J420, 1, load420_avx2(s, x, &y, &u, &v))
+YUV_AVX2(j444, PIX_FMT_J444, 1, load444_avx2(s, x, &y, &u, &v))
+
+/* the SSE2 helpers on 256 bit registers */
+static inline AVX2 __m256i bgrx_to_rgba_avx2(__m256i p) {
+  return _mm256_or_si256(_mm256_shuffle_epi8(p, _mm256_setr_epi8(2, 1, 0, -1, 6, 5, 4, -1, 10, 9, 8, -1,
+                                                                 14, 13, 12, -1, 2, 1, 0, -1, 6, 5, 4, -1,
+                                                                 10, 9, 8, -1, 14, 13, 12, -1)),
+                         _mm256_set1_epi32((int) 0xFF000000));
+}
+
+static inline AVX2 __m256i bgrx_to_565_avx2(__m256i p) {
+  return _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(p, 8), _mm256_set1_epi32(0xF800)),
+                                         _mm256_and_si256(_mm256_srli_epi32(p, 5), _mm256_set1_epi32(0x07E0))),
+                         _mm256_and_si256(_mm256_srli_epi32(p, 3), _mm256_set1_epi32(0x001F)));
+}
+
+static inline AVX2 __m256i rgba_to_565_avx2(__m256i p) {
+  return _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(_mm256_slli_epi32(p, 8), _mm256_set1_epi32(0xF800)),
+                                         _mm256_and_si256(_mm256_srli_epi32(p, 5), _mm256_set1_epi32(0x07E0))),
+                         _mm256_and_si256(_mm256_srli_epi32(p, 19), _mm256_set1_epi32(0x001F)));
+}
+
+/* 16 pixels of RGB565 from two registers of B G R x */
+static inline AVX2 __m256i pack32_avx2(__m256i a, __m256i b) {
+  const __m256i p = _mm256_packs_epi32(_mm256_srai_epi32(_mm256_slli_epi32(a, 16), 16),
+                                       _mm256_srai_epi32(_mm256_slli_epi32(b, 16), 16));
+
+  // packs works per 128 bit lane: a0-3 b0-3 a4-7 b4-7
+  return _mm256_permute4x64_epi64(p, _MM_SHUFFLE(3, 1, 2, 0));
+}
+
+static AVX2 void bgr32_rgba_avx2(const uint8_t *const s[3], uint8_t *d, int w) {
+  int x;
+
+  for (x = 0; x + 8 <= w; x += 8)
+    _mm256_storeu_si256((__m256i *) (d + 4 * x),
+                        bgrx_to_rgba_avx2(_mm256_loadu_si256((const __m256i *) (s[0] + 4 * x))));
+  pix_row_tail(PIX_FMT_BGR32, PIX_OUT_RGBA, s, d, x, w);
+}
+
+static AVX2 void bgr32_565_avx2(const uint8_t *const s[3], uint8_t *d, int w) {
+  int x;
+
+  for (x = 0; x + 16 <= w; x += 16) {
+    __m256i a = _mm256_loadu_si256((const __m256i *) (s[0] + 4 * x));
+    __m256i b = _mm256_loadu_si256((const __m256i *) (s[0] + 4 * x + 32));
+
+    _mm256_storeu_si256((__m256i *) (d + 2 * x), pack32_avx2(bgrx_to_565_avx2(a), bgrx_to_565_avx2(b)));
+  }
+  pix_row_tail(PIX_FMT_BGR32, PIX_OUT_565, s, d, x, w);
+}
+
+static AVX2 void rgba_565_avx2(const uint8_t *const s[3], uint8_t *d, int w) {
+  int x;
+
+  for (x = 0; x + 16 <= w; x += 16) {
+    __m256i a = _mm256_loadu_si256((const __m256i *) (s[0] + 4 * x));
+    __m256i b = _mm256_loadu_si256((const __m256i *) (s[0] + 4 * x + 32));
+
+    _mm256_storeu_si256((__m256i *) (d + 2 * x), pack32_avx2(rgba_to_565_avx2(a), rgba_to_565_avx2(b)));
+  }
+  pix_row_tail(PIX_FMT_RGBA8888, PIX_OUT_565, s, d, x, w);
+}
+
+/*
+ * 16 pixels of BGR24 (48 bytes) to four registers of B G R x; the
+ * padding byte is left 0. Loads stay within the 48 bytes.
+ */
+static inline AVX2 void load_bgr24_avx2(const uint8_t *p, __m128i q[4]) {
+  const __m128i m = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+  const __m128i a = _mm_loadu_si128((const __m128i *) p);
+  const __m128i b = _mm_loadu_si128((const __m128i *) (p + 16));
+  const __m128i c = _mm_loadu_si128((const __m128i *) (p + 32));
+
+  q[0] = _mm_shuffle_epi8(a, m);
+  q[1] = _mm_shuffle_epi8(_mm_alignr_epi8(b, a, 12), m);
+  q[2] = _mm_shuffle_epi8(_mm_alignr_epi8(c, b, 8), m);
+  q[3] = _mm_shuffle_epi8(_mm_srli_si128(c, 4), m);
+}
+
+static AVX2 void bgr24_rgba_avx2(const uint8_t *const s[3], uint8_t *d, int w) {
+  int x;
+
+  for (x = 0; x + 16 <= w; x += 16) {
+    __m128i q[4];
+
+    load_bgr24_avx2(s[0] + 3 * x, q);
+    _mm256_storeu_si256((__m256i *) (d + 4 * x), bgrx_to_rgba_avx2(_mm256_set_m128i(q[1], q[0])));
+    _mm256_storeu_si256((__m256i *) (d + 4 * x + 32), bgrx_to_rgba_avx2(_mm256_set_m128i(q[3], q[2])));
+  }
+  pix_row_tail(PIX_FMT_BGR24, PIX_OUT_RGBA, s, d, x, w);
+}
+
+static AVX2 void bgr24_565_avx2(const uint8_t *const s[3], uint8_t *d, int w) {
+  int x;
+
+  for (x = 0; x + 16 <= w; x += 16) {
+    __m128i q[4];
+
+    load_bgr24_avx2(s[0] + 3 * x, q);
+    _mm256_storeu_si256((__m256i *) (d + 2 * x),
+                        pack32_avx2(bgrx_to_565_avx2(_mm256_set_m128i(q[1], q[0])),
+                                    bgrx_to_565_avx2(_mm256_set_m128i(q[3], q[2]))));
+  }
+  pix_row_tail(PIX_FMT_BGR24, PIX_OUT_565, s, d, x, w);
+}
+
+/* PAL8 with the gathers, 8 palette lookups an instruction. The 565
+   ones read 32 bits at 16 bit steps, the last one 2 bytes into rgba[] */
+static AVX2 void pal8_565_avx2(const uint8_t *const s[3], uint8_t *d, int w) {
+  const int *lut = (const int *) ((const pix_palette_t *) s[1])->rgb565;
+  const __m256i m = _mm256_set1_epi32(0xFFFF);
+  int x;
+
+  for (x = 0; x + 16 <= w; x += 16) {
+    const __m128i i = _mm_loadu_si128((const __m128i *) (s[0] + x));
+    const __m256i a = _mm256_and_si256(_mm256_i32gather_epi32(lut, _mm256_cvtepu8_epi32(i), 2), m);
+    const __m256i b = _mm256_and_si256(_mm256_i32gather_epi32(lut, _mm256_cvtepu8_epi32(_mm_srli_si128(i, 8)), 2), m);
+
+    _mm256_storeu_si256((__m256i *) (d + 2 * x), _mm256_permute4x64_epi64(_mm256_packus_epi32(a, b), 0xD8));
+  }
+  pix_row_tail(PIX_FMT_PAL8, PIX_OUT_565, s, d, x, w);
+}
+
+static AVX2 void pal8_rgba_avx2(const uint8_t *const s[3], uint8_t *d, int w) {
+  const int *lut = (const int *) ((const pix_palette_t *) s[1])->rgba;
+  int x;
+
+  for (x = 0; x + 16 <= w; x += 16) {
+    const __m128i i = _mm_loadu_si128((const __m128i *) (s[0] + x));
+
+    _mm256_storeu_si256((__m256i *) (d + 4 * x), _mm256_i32gather_epi32(lut, _mm256_cvtepu8_epi32(i), 4));
+    _mm256_storeu_si256((__m256i *) (d + 4 * x + 32),
+                        _mm256_i32gather_epi32(lut, _mm256_cvtepu8_epi32(_mm_srli_si128(i, 8)), 4));
+  }
+  pix_row_tail(PIX_FMT_PAL8, PIX_OUT_RGBA, s, d, x, w);
+}
+
+void pix_rows_avx2(pix_row_table_t t) {
+  t[PIX_FMT_BGR24][PIX_OUT_565] = bgr24_565_avx2;
+  t[PIX_FMT_BGR24][PIX_OUT_RGBA] = bgr24_rgba_avx2;
+  t[PIX_FMT_BGR32][PIX_OUT_565] = bgr32_565_avx2;
+  t[PIX_FMT_BGR32][PIX_OUT_RGBA] = bgr32_rgba_avx2;
+  t[PIX_FMT_YUY2][PIX_OUT_565] = yuy2_565_avx2;
+  t[PIX_FMT_YUY2][PIX_OUT_RGBA] = yuy2_rgba_avx2;
+  t[PIX_FMT_UYVY][PIX_OUT_565] = uyvy_565_avx2;
+  t[PIX_FMT_UYVY][PIX_OUT_RGBA] = uyvy_rgba_avx2;
+  t[PIX_FMT_I420][PIX_OUT_565] = i420_565_avx2;
+  t[PIX_FMT_I420][PIX_OUT_RGBA] = i420_rgba_avx2;
+  t[PIX_FMT_YV12][PIX_OUT_565] = i420_565_avx2;
+  t[PIX_FMT_YV12][PIX_OUT_RGBA] = i420_rgba_avx2;
+  t[PIX_FMT_RGBA8888][PIX_OUT_565] = rgba_565_avx2;
+  t[PIX_FMT_J420][PIX_OUT_565] = j420_565_avx2;
+  t[PIX_FMT_J420][PIX_OUT_RGBA] = j420_rgba_avx2;
+  t[PIX_FMT_J422][PIX_OUT_565] = j420_565_avx2;
+  t[PIX_FMT_J422][PIX_OUT_RGBA] = j420_rgba_avx2;
+  t[PIX_FMT_J444][PIX_OUT_565] = j444_565_avx2;
+  t[PIX_FMT_J444][PIX_OUT_RGBA] = j444_rgba_avx2;
+  t[PIX_FMT_PAL8][PIX_OUT_565] = pal8_565_avx2;
+  t[PIX_FMT_PAL8][PIX_OUT_RGBA] = pal8_rgba_avx2;
+}
+
+#else /* !x86 */
+
+void pix_rows_sse2(pix_row_table_t t) {
+  (void) t;
+}
+
+void pix_rows_avx2(pix_row_table_t t) {
+  (void) t;
+}
+
+#endif
@@ -0,0 +1,466 @@
+/*
+ * pixscale.c -- frame scaling, C kernels, bands and the thread pool
+ *
+ * See pixscale.h. Per band of output rows:
+ *
+ *  nearest   source row -> RGBA (pixconv) -> pick columns -> dst
+ *  bilinear  source row -> RGBA -> horizontal pass, kept for the next
+ *            output row -> blend of two such rows -> dst
+ *  box       k source rows -> RGBA -> k x k means -> dst
+ *
+ * with a last RGBA -> RGB565 pass when dst is RGB565. Sample positions
+ * are pixel centres in 16.16 fixed point, the same for every band.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pixscale.h"
+#include "pixscale_impl.h"
+
+/* below this many output pixels one thread is faster than waking more */
+#define PIX_SCALE_MT_MIN (320 * 240)
+#define PIX_SCALE_MAX_THREADS 4
+
+enum { METHOD_COPY, METHOD_NEAREST, METHOD_BILINEAR, METHOD_BOX2, METHOD_BOX4 };
+
+typedef struct
+{
+  uint8_t *conv[4];         /* source rows as RGBA, one pixel of padding */
+  uint8_t *hrow[2];         /* horizontal pass of the bilinear rows ... */
+  int htag[2];              /* ... of these source rows, -1 for none */
+  uint8_t *out;             /* RGBA output row before RGB565 */
+} band_t;
+
+struct pix_scaler_s
+{
+  int sw, sh, dw, dh;
+  int method;
+  int32_t *xs, *xw;         /* per output column */
+  int32_t *ys, *yw;         /* per output row */
+  int nbands;
+  band_t *band;
+
+  /* the job of the current pix_scale call */
+  const pix_image_t *src;
+  pix_image_t *dst;
+  pix_scale_kernels_t k;
+
+  pthread_t *thread;
+  pthread_mutex_t lock;
+  pthread_cond_t go, done;
+  unsigned long gen;        /* bumped per job */
+  int pending;              /* bands of the job not finished */
+  int quit;
+};
+
+/*************************************************************************/
+/* C kernels, the reference for the SIMD ones                            */
+/*************************************************************************/
+
+#define BLEND(a, b, f) (((a) * (256 - (f)) + (b) * (f) + 128) >> 8)
+
+void pix_hbilinear_c(const uint8_t *src, uint8_t *dst, const int32_t *xs,
+                     const int32_t *xw, int width) {
+  int x, c;
+
+  for (x = 0; x < width; x++) {
+    const uint8_t *p = src + 4 * xs[x];
+    int f = xw[x] >> 16;
+
+    for (c = 0; c < 4; c++)
+      dst[4 * x + c] = (uint8_t) BLEND(p[c], p[c + 4], f);
+  }
+}
+
+void pix_hnearest_c(const uint8_t *src, uint8_t *dst, const int32_t *xs, int width) {
+  int x;
+
+  for (x = 0; x < width; x++)
+    memcpy(dst + 4 * x, src + 4 * xs[x], 4);
+}
+
+void pix_vblend_c(const uint8_t *a, const uint8_t *b, uint8_t *dst, int f, int n) {
+  int i;
+
+  for (i = 0; i < n; i++)
+    dst[i] = (uint8_t) BLEND(a[i], b[i], f);
+}
+
+void pix_box2_c(const uint8_t *const rows[2], uint8_t *dst, int width) {
+  const uint8_t *a = rows[0], *b = rows[1];
+  int x, c;
+
+  for (x = 0; x < width; x++, a += 8, b += 8)
+    for (c = 0; c < 4; c++)
+      dst[4 * x + c] = (uint8_t) ((a[c] + a[c + 4] + b[c] + b[c + 4] + 2) >> 2);
+}
+
+void pix_box4_c(const uint8_t *const rows[4], uint8_t *dst, int width) {
+  int x, c, r, i;
+
+  for (x = 0; x < width; x++) {
+    for (c = 0; c < 4; c++) {
+      int sum = 8;
+
+      for (r = 0; r < 4; r++)
+        for (i = 0; i < 4; i++)
+          sum += rows[r][16 * x + 4 * i + c];
+      dst[4 * x + c] = (uint8_t) (sum >> 4);
+    }
+  }
+}
+
+void pix_scale_kernels_c(pix_scale_kernels_t *k) {
+  k->hbilinear = pix_hbilinear_c;
+  k->hnearest = pix_hnearest_c;
+  k->vblend = pix_vblend_c;
+  k->box2 = pix_box2_c;
+  k->box4 = pix_box4_c;
+}
+
+/*************************************************************************/
+/* dispatch, follows pixconv's ISA                                       */
+/*************************************************************************/
+
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+static pix_scale_kernels_t kernels[PIX_ISA_COUNT];
+
+static void kernels_init(void) {
+  int i, best = pix_isa_best();
+
+  for (i = 0; i < PIX_ISA_COUNT; i++)
+    pix_scale_kernels_c(&kernels[i]);
+  if (best == PIX_ISA_NEON) {
+    pix_scale_kernels_neon(&kernels[PIX_ISA_NEON]);
+    return;
+  }
+  if (best >= PIX_ISA_SSE2) pix_scale_kernels_sse2(&kernels[PIX_ISA_SSE2]);
+  if (best >= PIX_ISA_AVX2) {
+    pix_scale_kernels_sse2(&kernels[PIX_ISA_AVX2]);
+    pix_scale_kernels_avx2(&kernels[PIX_ISA_AVX2]);
+  }
+}
+
+/*************************************************************************/
+/* one band                                                              */
+/*************************************************************************/
+
+/* source row y as RGBA into buf, the last pixel repeated once */
+static void convert_row(pix_scaler_t *s, int y, uint8_t *buf) {
+  pix_convert_row(s->src, y, PIX_OUT_RGBA, buf);
+  memcpy(buf + 4 * s->sw, buf + 4 * (s->sw - 1), 4);
+}
+
+/* the horizontal pass of source row y, cached for the next output row */
+static const uint8_t *hrow(pix_scaler_t *s, band_t *b, int y) {
+  int slot = y & 1;
+
+  if (b->htag[slot] != y) {
+    convert_row(s, y, b->conv[0]);
+    s->k.hbilinear(b->conv[0], b->hrow[slot], s->xs, s->xw, s->dw);
+    b->htag[slot] = y;
+  }
+  return b->hrow[slot];
+}
+
+static void run_band(pix_scaler_t *s, int n) {
+  band_t *b = &s->band[n];
+  pix_row_fn pack = pix_row_kernel(PIX_FMT_RGBA8888, PIX_OUT_565);
+  int rgba = s->dst->fmt == PIX_FMT_RGBA8888;
+  int y, y0 = (int) ((long) s->dh * n / s->nbands), y1 = (int) ((long) s->dh * (n + 1) / s->nbands);
+
+  b->htag[0] = b->htag[1] = -1;
+  for (y = y0; y < y1; y++) {
+    uint8_t *d = s->dst->data[0] + (long) y * s->dst->stride[0];
+    uint8_t *o = rgba ? d : b->out;
+    const uint8_t *row = o;
+
+    switch (s->method) {
+    case METHOD_NEAREST:
+      convert_row(s, s->ys[y], b->conv[0]);
+      s->k.hnearest(b->conv[0], o, s->xs, s->dw);
+      break;
+    case METHOD_BILINEAR: {
+      const uint8_t *h0 = hrow(s, b, s->ys[y]);
+
+      if (s->yw[y] >> 16 == 0 || s->ys[y] + 1 >= s->sh) {
+        row = h0;
+      } else {
+        const uint8_t *h1 = hrow(s, b, s->ys[y] + 1);
+
+        s->k.vblend(h0, h1, o, s->yw[y] >> 16, 4 * s->dw);
+      }
+      break;
+    }
+    case METHOD_BOX2:
+    case METHOD_BOX4: {
+      int k = s->method == METHOD_BOX2 ? 2 : 4, i;
+
+      for (i = 0; i < k; i++)
+        convert_row(s, k * y + i, b->conv[i]);
+      if (k == 2) s->k.box2((const uint8_t *const *) b->conv, o, s->dw);
+      else s->k.box4((const uint8_t *const *) b->conv, o, s->dw);
+      break;
+    }
+    }
+
+    if (!rgba) {
+      const uint8_t *src[3] = { row, NULL, NULL };
+
+      pack(src, d, s->dw);
+    } else if (row != o) {
+      memcpy(d, row, 4 * (size_t) s->dw);
+    }
+  }
+}
+
+/*************************************************************************/
+/* the pool: band 0 runs on the caller, band i on thread i - 1           */
+/*************************************************************************/
+
+typedef struct
+{
+  pix_scaler_t *s;
+  int n;
+} worker_arg_t;
+
+static void *worker(void *arg) {
+  worker_arg_t *w = arg;
+  pix_scaler_t *s = w->s;
+  unsigned long seen = 0;
+
+  pthread_mutex_lock(&s->lock);
+  for (;;) {
+    while (!s->quit && s->gen == seen)
+      pthread_cond_wait(&s->go, &s->lock);
+    if (s->quit) break;
+    seen = s->gen;
+    pthread_mutex_unlock(&s->lock);
+
+    run_band(s, w->n);
+
+    pthread_mutex_lock(&s->lock);
+    if (--s->pending == 0) pthread_cond_signal(&s->done);
+  }
+  pthread_mutex_unlock(&s->lock);
+  free(w);
+  return NULL;
+}
+
+static void stop_threads(pix_scaler_t *s, int started) {
+  int i;
+
+  pthread_mutex_lock(&s->lock);
+  s->quit = 1;
+  pthread_cond_broadcast(&s->go);
+  pthread_mutex_unlock(&s->lock);
+  for (i = 0; i < started; i++)
+    pthread_join(s->thread[i], NULL);
+}
+
+/*************************************************************************/
+
+/* 16.16 source position of the centre of output pixel i, clamped */
+static int64_t centre(int i, int sn, int dn) {
+  int64_t v = (((int64_t) (2 * i + 1) * sn << 16) / (2 * dn)) - 32768;
+
+  if (v < 0) v = 0;
+  if (v > (int64_t) (sn - 1) << 16) v = (int64_t) (sn - 1) << 16;
+  return v;
+}
+
+/* positions and weights of n output pixels over sn source pixels */
+static void axis(int32_t *pos, int32_t *w, int sn, int dn, int nearest) {
+  int i;
+
+  for (i = 0; i < dn; i++) {
+    if (nearest) {
+      pos[i] = (int32_t) (((int64_t) (2 * i + 1) * sn) / (2 * dn));
+      w[i] = 256;
+    } else {
+      int64_t v = centre(i, sn, dn);
+      int f = (int) (v >> 8) & 255;
+
+      pos[i] = (int32_t) (v >> 16);
+      w[i] = f << 16 | (256 - f);
+    }
+  }
+}
+
+static void free_bands(pix_scaler_t *s) {
+  int i, j;
+
+  if (!s->band) return;
+  for (i = 0; i < s->nbands; i++) {
+    for (j = 0; j < 4; j++)
+      free(s->band[i].conv[j]);
+    free(s->band[i].hrow[0]);
+    free(s->band[i].hrow[1]);
+    free(s->band[i].out);
+  }
+  free(s->band);
+}
+
+static int alloc_bands(pix_scaler_t *s) {
+  // SIMD kernels read up to 32 bytes past what they use
+  size_t conv = 4 * ((size_t) s->sw + 1) + 32, row = 4 * (size_t) s->dw + 32;
+  int i, j, convs = s->method == METHOD_BOX4 ? 4 : s->method == METHOD_BOX2 ? 2 : 1;
+
+  s->band = calloc(s->nbands, sizeof(*s->band));
+  if (!s->band) return -1;
+  for (i = 0; i < s->nbands; i++) {
+    band_t *b = &s->band[i];
+
+    for (j = 0; j < convs; j++)
+      if (!(b->conv[j] = malloc(conv))) return -1;
+    if (s->method == METHOD_BILINEAR)
+      if (!(b->hrow[0] = malloc(row)) || !(b->hrow[1] = malloc(row))) return -1;
+    if (!(b->out = malloc(row))) return -1;
+  }
+  return 0;
+}
+
+pix_scaler_t *pix_scaler_new(int src_w, int src_h, int dst_w, int dst_h,
+                             pix_filter_t filter, int threads) {
+  pix_scaler_t *s;
+  int i;
+
+  if (src_w <= 0 || src_h <= 0 || dst_w <= 0 || dst_h <= 0) return NULL;
+  pthread_once(&kernels_once, kernels_init);
+
+  s = calloc(1, sizeof(*s));
+  if (!s) return NULL;
+  s->sw = src_w;
+  s->sh = src_h;
+  s->dw = dst_w;
+  s->dh = dst_h;
+  pthread_mutex_init(&s->lock, NULL);
+  pthread_cond_init(&s->go, NULL);
+  pthread_cond_init(&s->done, NULL);
+
+  if (src_w == dst_w && src_h == dst_h) s->method = METHOD_COPY;
+  else if (filter == PIX_SCALE_NEAREST) s->method = METHOD_NEAREST;
+  else if (src_w == 2 * dst_w && src_h == 2 * dst_h) s->method = METHOD_BOX2;
+  else if (src_w == 4 * dst_w && src_h == 4 * dst_h) s->method = METHOD_BOX4;
+  else s->method = METHOD_BILINEAR;
+
+  if (threads <= 0) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    threads = n > 0 ? (int) n : 1;
+  }
+  if (threads > PIX_SCALE_MAX_THREADS) threads = PIX_SCALE_MAX_THREADS;
+  if ((long) dst_w * dst_h < PIX_SCALE_MT_MIN || s->method == METHOD_COPY) threads = 1;
+  if (threads > dst_h) threads = dst_h;
+  s->nbands = threads;
+
+  s->xs = malloc(dst_w * sizeof(int32_t));
+  s->xw = malloc(dst_w * sizeof(int32_t));
+  s->ys = malloc(dst_h * sizeof(int32_t));
+  s->yw = malloc(dst_h * sizeof(int32_t));
+  if (!s->xs || !s->xw || !s->ys || !s->yw || alloc_bands(s) < 0) {
+    pix_scaler_free(s);
+    return NULL;
+  }
+  axis(s->xs, s->xw, src_w, dst_w, s->method == METHOD_NEAREST);
+  axis(s->ys, s->yw, src_h, dst_h, s->method == METHOD_NEAREST);
+
+  if (s->nbands > 1) {
+    s->thread = calloc(s->nbands - 1, sizeof(pthread_t));
+    for (i = 0; s->thread && i < s->nbands - 1; i++) {
+      worker_arg_t *w = malloc(sizeof(*w));
+
+      if (w) {
+        w->s = s;
+        w->n = i + 1;
+      }
+      if (!w || pthread_create(&s->thread[i], NULL, worker, w) != 0) {
+        free(w);
+        break;
+      }
+    }
+    if (!s->thread || i < s->nbands - 1) {
+      // no partial pools: the bands are fixed, run them all here
+      stop_threads(s, i);
+      free(s->thread);
+      s->thread = NULL;
+      s->quit = 0;
+      s->nbands = 1;
+    }
+  }
+  return s;
+}
+
+void pix_scaler_free(pix_scaler_t *s) {
+  if (!s) return;
+  if (s->thread) {
+    stop_threads(s, s->nbands - 1);
+    free(s->thread);
+  }
+  pthread_mutex_destroy(&s->lock);
+  pthread_cond_destroy(&s->go);
+  pthread_cond_destroy(&s->done);
+  free_bands(s);
+  free(s->xs);
+  free(s->xw);
+  free(s->ys);
+  free(s->yw);
+  free(s);
+}
+
+int pix_scale(pix_scaler_t *s, const pix_image_t *src, pix_image_t *dst) {
+  if (src->width != s->sw || src->height != s->sh || dst->width != s->dw || dst->height != s->dh)
+    return -1;
+  if (src->fmt < 0 || src->fmt >= PIX_FMT_COUNT || (src->fmt == PIX_FMT_PAL8 && !src->data[1])
+      || (dst->fmt != PIX_FMT_RGB565 && dst->fmt != PIX_FMT_RGBA8888))
+    return -1;
+  if (s->method == METHOD_COPY) return pix_convert(src, dst);
+
+  s->src = src;
+  s->dst = dst;
+  s->k = kernels[pix_isa()];
+
+  if (s->nbands > 1) {
+    pthread_mutex_lock(&s->lock);
+    s->pending = s->nbands - 1;
+    s->gen++;
+    pthread_cond_broadcast(&s->go);
+    pthread_mutex_unlock(&s->lock);
+  }
+  run_band(s, 0);
+  if (s->nbands > 1) {
+    pthread_mutex_lock(&s->lock);
+    while (s->pending)
+      pthread_cond_wait(&s->done, &s->lock);
+    pthread_mutex_unlock(&s->lock);
+  }
+  return 0;
+}
+
+const char *pix_scaler_method(const pix_scaler_t *s) {
+  static const char *const names[] = { "copy", "nearest", "bilinear", "box2", "box4" };
+
+  return names[s->method];
+}
+
+int pix_scaler_threads(const pix_scaler_t *s) {
+  return s->nbands;
+}
+
+void pix_fit(int src_w, int src_h, int max_w, int max_h, int *w, int *h) {
+  *w = src_w;
+  *h = src_h;
+  if (max_w <= 0 || max_h <= 0 || (src_w <= max_w && src_h <= max_h)) return;
+  if ((long) src_w * max_h > (long) src_h * max_w) {
+    *w = max_w;
+    *h = (int) ((long) src_h * max_w / src_w);
+  } else {
+    *h = max_h;
+    *w = (int) ((long) src_w * max_h / src_h);
+  }
+  if (*w < 1) *w = 1;
+  if (*h < 1) *h = 1;
+}
@@ -0,0 +1,50 @@
+/*
+ * pixscale.h -- frame scaling fused with the pixel format conversion
+ *
+ * Scales any pixconv source format straight into an RGB565 or RGBA8888
+ * buffer of the target size. Only the source rows an output row needs
+ * are converted, and each of them once, so a frame that is shown
+ * smaller than it is costs less than converting it at full size: with
+ * nearest, a 2:1 reduction converts half the rows.
+ *
+ * Filters are nearest and bilinear; bilinear at exactly 2:1 or 4:1 in
+ * both directions is done as a 2x2 or 4x4 box average, which is what
+ * bilinear amounts to at 2:1 and what it should be at 4:1.
+ *
+ * Large outputs are split into bands of rows run on a small pool of
+ * threads owned by the scaler. Results do not depend on the number of
+ * threads or on the ISA (see pix_set_isa).
+ */
+
+#ifndef PIXSCALE_H
+#define PIXSCALE_H
+
+#include "pixconv.h"
+
+typedef enum
+{
+  PIX_SCALE_NEAREST,
+  PIX_SCALE_BILINEAR
+} pix_filter_t;
+
+typedef struct pix_scaler_s pix_scaler_t;
+
+/* threads <= 0 for one per CPU, at most 4 */
+pix_scaler_t *pix_scaler_new(int src_w, int src_h, int dst_w, int dst_h,
+                             pix_filter_t filter, int threads);
+void pix_scaler_free(pix_scaler_t *s);
+
+/* src and dst must have the sizes given to pix_scaler_new; dst RGB565
+   or RGBA8888. Not for concurrent calls on one scaler */
+int pix_scale(pix_scaler_t *s, const pix_image_t *src, pix_image_t *dst);
+
+/* "nearest", "bilinear", "box2", "box4" or "copy" */
+const char *pix_scaler_method(const pix_scaler_t *s);
+/* bands a frame is split into */
+int pix_scaler_threads(const pix_scaler_t *s);
+
+/* the largest size with the aspect of src_w x src_h that fits into
+   max_w x max_h, never larger than the source */
+void pix_fit(int src_w, int src_h, int max_w, int max_h, int *w, int *h);
+
+#endif /* PIXSCALE_H */
@@ -0,0 +1,42 @@
+/*
+ * pixscale_impl.h -- row kernels of pixscale, shared by its ISA files
+ *
+ * All of them work on RGBA8888 rows. Weights are 8 bit: a blend of
+ * a and b with weight f is (a * (256 - f) + b * f + 128) >> 8.
+ */
+
+#ifndef PIXSCALE_IMPL_H
+#define PIXSCALE_IMPL_H
+
+#include "pixconv_impl.h"
+
+typedef struct
+{
+  /* pixel x of dst from pixels xs[x] and xs[x] + 1 of src with weight
+     xw[x], packed as f << 16 | (256 - f); src holds one pixel more
+     than the last xs[x] */
+  void (*hbilinear)(const uint8_t *src, uint8_t *dst, const int32_t *xs,
+                    const int32_t *xw, int width);
+  void (*hnearest)(const uint8_t *src, uint8_t *dst, const int32_t *xs, int width);
+  /* n bytes of a and b blended with weight f, 0 < f < 256 */
+  void (*vblend)(const uint8_t *a, const uint8_t *b, uint8_t *dst, int f, int n);
+  /* width pixels, each the rounded mean of a 2x2 or 4x4 block */
+  void (*box2)(const uint8_t *const rows[2], uint8_t *dst, int width);
+  void (*box4)(const uint8_t *const rows[4], uint8_t *dst, int width);
+} pix_scale_kernels_t;
+
+/* each sets the kernels it has */
+void pix_scale_kernels_c(pix_scale_kernels_t *k);
+void pix_scale_kernels_sse2(pix_scale_kernels_t *k);
+void pix_scale_kernels_avx2(pix_scale_kernels_t *k);
+void pix_scale_kernels_neon(pix_scale_kernels_t *k);
+
+/* the C kernels, for the tails of the SIMD ones */
+void pix_hbilinear_c(const uint8_t *src, uint8_t *dst, const int32_t *xs,
+                     const int32_t *xw, int width);
+void pix_hnearest_c(const uint8_t *src, uint8_t *dst, const int32_t *xs, int width);
+void pix_vblend_c(const uint8_t *a, const uint8_t *b, uint8_t *dst, int f, int n);
+void pix_box2_c(const uint8_t *const rows[2], uint8_t *dst, int width);
+void pix_box4_c(const uint8_t *const rows[4], uint8_t *dst, int width);
+
+#endif /* PIXSCALE_IMPL_H */
@@ -0,0 +1,93 @@
+/*
+ * pixscale_neon.c -- NEON kernels of pixscale
+ *
+ * The blend and the box means; vld4 splits RGBA into channels, so the
+ * box sums are pairwise adds within a channel. Column picking and the
+ * horizontal bilinear pass are gathers and stay with the C kernels.
+ */
+
+#include "pixscale_impl.h"
+
+#if defined(__ARM_NEON)
+
+#include <arm_neon.h>
+
+static void vblend_neon(const uint8_t *a, const uint8_t *b, uint8_t *dst, int f, int n) {
+  const uint8x8_t fa = vdup_n_u8((uint8_t) (256 - f)), fb = vdup_n_u8((uint8_t) f);
+  int i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    const uint8x16_t va = vld1q_u8(a + i), vb = vld1q_u8(b + i);
+    uint16x8_t lo = vmull_u8(vget_low_u8(va), fa), hi = vmull_u8(vget_high_u8(va), fa);
+
+    lo = vmlal_u8(lo, vget_low_u8(vb), fb);
+    hi = vmlal_u8(hi, vget_high_u8(vb), fb);
+    // rounding narrow: (x + 128) >> 8
+    vst1q_u8(dst + i, vcombine_u8(vrshrn_n_u16(lo, 8), vrshrn_n_u16(hi, 8)));
+  }
+  if (i < n) pix_vblend_c(a + i, b + i, dst + i, f, n - i);
+}
+
+/* 8 output pixels from 16 source pixels of each of two rows */
+static void box2_neon(const uint8_t *const rows[2], uint8_t *dst, int width) {
+  int x, c;
+
+  for (x = 0; x + 8 <= width; x += 8) {
+    const uint8x16x4_t r0 = vld4q_u8(rows[0] + 8 * x), r1 = vld4q_u8(rows[1] + 8 * x);
+    uint8x8x4_t o;
+
+    for (c = 0; c < 4; c++)
+      o.val[c] = vrshrn_n_u16(vpadalq_u8(vpaddlq_u8(r0.val[c]), r1.val[c]), 2);
+    vst4_u8(dst + 4 * x, o);
+  }
+  if (x < width) {
+    const uint8_t *r[2] = { rows[0] + 8 * x, rows[1] + 8 * x };
+
+    pix_box2_c(r, dst + 4 * x, width - x);
+  }
+}
+
+/* 8 output pixels from 32 source pixels of each of four rows */
+static void box4_neon(const uint8_t *const rows[4], uint8_t *dst, int width) {
+  int x, c, r;
+
+  for (x = 0; x + 8 <= width; x += 8) {
+    uint16x8_t sa[4], sb[4];
+    uint8x8x4_t o;
+
+    for (c = 0; c < 4; c++)
+      sa[c] = sb[c] = vdupq_n_u16(0);
+    for (r = 0; r < 4; r++) {
+      const uint8x16x4_t a = vld4q_u8(rows[r] + 16 * x), b = vld4q_u8(rows[r] + 16 * x + 64);
+
+      for (c = 0; c < 4; c++) {
+        sa[c] = vpadalq_u8(sa[c], a.val[c]);
+        sb[c] = vpadalq_u8(sb[c], b.val[c]);
+      }
+    }
+    // pair sums to sums of four
+    for (c = 0; c < 4; c++)
+      o.val[c] = vrshrn_n_u16(vcombine_u16(vpadd_u16(vget_low_u16(sa[c]), vget_high_u16(sa[c])),
+                                           vpadd_u16(vget_low_u16(sb[c]), vget_high_u16(sb[c]))), 4);
+    vst4_u8(dst + 4 * x, o);
+  }
+  if (x < width) {
+    const uint8_t *rr[4] = { rows[0] + 16 * x, rows[1] + 16 * x, rows[2] + 16 * x, rows[3] + 16 * x };
+
+    pix_box4_c(rr, dst + 4 * x, width - x);
+  }
+}
+
+void pix_scale_kernels_neon(pix_scale_kernels_t *k) {
+  k->vblend = vblend_neon;
+  k->box2 = box2_neon;
+  k->box4 = box4_neon;
+}
+
+#else /* !__ARM_NEON */
+
+void pix_scale_kernels_neon(pix_scale_kernels_t *k) {
+  (void) k;
+}
+
+#endif
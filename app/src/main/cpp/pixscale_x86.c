@@ -0,0 +1,246 @@
+/*
+ * pixscale_x86.c -- SSE2 and AVX2 kernels of pixscale
+ *
+ * Same layout as pixconv_x86.c: per-function targets, whole blocks in
+ * SIMD, the rest of a row through the C kernel. Picking columns is a
+ * gather, which only AVX2 has; SSE2 leaves nearest to C.
+ */
+
+#include "pixscale_impl.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+
+/*************************************************************************/
+/* SSE2                                                                  */
+/*************************************************************************/
+
+/*
+ * Two output pixels from their source pairs (L0 R0, L1 R1, 8 bytes
+ * each) as 32 bit channel sums: the pairs are interleaved byte by byte
+ * so that one pmaddwd per pixel weighs L against R.
+ */
+static inline SSE2 void hpair_sse2(__m128i p0, __m128i p1, __m128i w0, __m128i w1,
+                                   __m128i *s0, __m128i *s1) {
+  const __m128i z = _mm_setzero_si128();
+  // L0 L1 R0 R1, then L0 R0 byte pairs and L1 R1 byte pairs
+  const __m128i q = _mm_shuffle_epi32(_mm_unpacklo_epi64(p0, p1), _MM_SHUFFLE(3, 1, 2, 0));
+  const __m128i lr = _mm_unpacklo_epi8(q, _mm_srli_si128(q, 8));
+
+  *s0 = _mm_madd_epi16(_mm_unpacklo_epi8(lr, z), w0);
+  *s1 = _mm_madd_epi16(_mm_unpackhi_epi8(lr, z), w1);
+}
+
+static SSE2 void hbilinear_sse2(const uint8_t *src, uint8_t *dst, const int32_t *xs,
+                                const int32_t *xw, int width) {
+  const __m128i round = _mm_set1_epi32(128);
+  int x;
+
+  for (x = 0; x + 4 <= width; x += 4) {
+    const __m128i w = _mm_loadu_si128((const __m128i *) (xw + x));
+    __m128i s0, s1, s2, s3;
+
+    hpair_sse2(_mm_loadl_epi64((const __m128i *) (src + 4 * xs[x])),
+               _mm_loadl_epi64((const __m128i *) (src + 4 * xs[x + 1])),
+               _mm_shuffle_epi32(w, 0x00), _mm_shuffle_epi32(w, 0x55), &s0, &s1);
+    hpair_sse2(_mm_loadl_epi64((const __m128i *) (src + 4 * xs[x + 2])),
+               _mm_loadl_epi64((const __m128i *) (src + 4 * xs[x + 3])),
+               _mm_shuffle_epi32(w, 0xAA), _mm_shuffle_epi32(w, 0xFF), &s2, &s3);
+    s0 = _mm_srli_epi32(_mm_add_epi32(s0, round), 8);
+    s1 = _mm_srli_epi32(_mm_add_epi32(s1, round), 8);
+    s2 = _mm_srli_epi32(_mm_add_epi32(s2, round), 8);
+    s3 = _mm_srli_epi32(_mm_add_epi32(s3, round), 8);
+    _mm_storeu_si128((__m128i *) (dst + 4 * x),
+                     _mm_packus_epi16(_mm_packs_epi32(s0, s1), _mm_packs_epi32(s2, s3)));
+  }
+  if (x < width) pix_hbilinear_c(src, dst + 4 * x, xs + x, xw + x, width - x);
+}
+
+/* 16 bytes of a and b blended, weights as 16 bit lanes */
+static inline SSE2 __m128i blend16_sse2(__m128i a, __m128i b, __m128i fa, __m128i fb) {
+  const __m128i z = _mm_setzero_si128(), round = _mm_set1_epi16(128);
+  const __m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a, z), fa),
+                                                 _mm_mullo_epi16(_mm_unpacklo_epi8(b, z), fb)), round);
+  const __m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a, z), fa),
+                                                 _mm_mullo_epi16(_mm_unpackhi_epi8(b, z), fb)), round);
+
+  // at most 255 * 256 + 128, unsigned 16 bit holds it
+  return _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8));
+}
+
+static SSE2 void vblend_sse2(const uint8_t *a, const uint8_t *b, uint8_t *dst, int f, int n) {
+  const __m128i fa = _mm_set1_epi16((short) (256 - f)), fb = _mm_set1_epi16((short) f);
+  int i;
+
+  for (i = 0; i + 16 <= n; i += 16)
+    _mm_storeu_si128((__m128i *) (dst + i),
+                     blend16_sse2(_mm_loadu_si128((const __m128i *) (a + i)),
+                                  _mm_loadu_si128((const __m128i *) (b + i)), fa, fb));
+  if (i < n) pix_vblend_c(a + i, b + i, dst + i, f, n - i);
+}
+
+/* 16 bit channel sums of 4 pixels (16 bytes) of each row: (p0, p1), (p2, p3) */
+static inline SSE2 void sum4_sse2(const uint8_t *const *rows, int nrows, long off,
+                                  __m128i *s01, __m128i *s23) {
+  const __m128i z = _mm_setzero_si128();
+  int r;
+
+  *s01 = *s23 = z;
+  for (r = 0; r < nrows; r++) {
+    const __m128i p = _mm_loadu_si128((const __m128i *) (rows[r] + off));
+
+    *s01 = _mm_add_epi16(*s01, _mm_unpacklo_epi8(p, z));
+    *s23 = _mm_add_epi16(*s23, _mm_unpackhi_epi8(p, z));
+  }
+}
+
+/* neighbouring pixels of two registers of pixel pairs added: (a0 + a1, b0 + b1) */
+static inline SSE2 __m128i hadd_px_sse2(__m128i a, __m128i b) {
+  return _mm_add_epi16(_mm_unpacklo_epi64(a, b), _mm_unpackhi_epi64(a, b));
+}
+
+static SSE2 void box2_sse2(const uint8_t *const rows[2], uint8_t *dst, int width) {
+  const __m128i round = _mm_set1_epi16(2);
+  int x;
+
+  for (x = 0; x + 4 <= width; x += 4) {
+    __m128i a01, a23, b01, b23;
+
+    sum4_sse2(rows, 2, 8L * x, &a01, &a23);
+    sum4_sse2(rows, 2, 8L * x + 16, &b01, &b23);
+    _mm_storeu_si128((__m128i *) (dst + 4 * x),
+                     _mm_packus_epi16(_mm_srli_epi16(_mm_add_epi16(hadd_px_sse2(a01, a23), round), 2),
+                                      _mm_srli_epi16(_mm_add_epi16(hadd_px_sse2(b01, b23), round), 2)));
+  }
+  if (x < width) {
+    const uint8_t *r[2] = { rows[0] + 8 * x, rows[1] + 8 * x };
+
+    pix_box2_c(r, dst + 4 * x, width - x);
+  }
+}
+
+static SSE2 void box4_sse2(const uint8_t *const rows[4], uint8_t *dst, int width) {
+  const __m128i round = _mm_set1_epi16(8);
+  int x, i;
+
+  for (x = 0; x + 4 <= width; x += 4) {
+    __m128i q[4];
+
+    // output pixel x + i from 16 source bytes
+    for (i = 0; i < 4; i++) {
+      __m128i s01, s23;
+
+      sum4_sse2(rows, 4, 16L * (x + i), &s01, &s23);
+      q[i] = _mm_add_epi16(s01, s23);
+    }
+    // q[i] holds (p0 + p2, p1 + p3) of output i, add the halves
+    _mm_storeu_si128((__m128i *) (dst + 4 * x),
+                     _mm_packus_epi16(_mm_srli_epi16(_mm_add_epi16(hadd_px_sse2(q[0], q[1]), round), 4),
+                                      _mm_srli_epi16(_mm_add_epi16(hadd_px_sse2(q[2], q[3]), round), 4)));
+  }
+  if (x < width) {
+    const uint8_t *r[4] = { rows[0] + 16 * x, rows[1] + 16 * x, rows[2] + 16 * x, rows[3] + 16 * x };
+
+    pix_box4_c(r, dst + 4 * x, width - x);
+  }
+}
+
+void pix_scale_kernels_sse2(pix_scale_kernels_t *k) {
+  k->hbilinear = hbilinear_sse2;
+  k->vblend = vblend_sse2;
+  k->box2 = box2_sse2;
+  k->box4 = box4_sse2;
+}
+
+/*************************************************************************/
+/* AVX2                                                                  */
+/*************************************************************************/
+
+static AVX2 void hnearest_avx2(const uint8_t *src, uint8_t *dst, const int32_t *xs, int width) {
+  int x;
+
+  for (x = 0; x + 8 <= width; x += 8)
+    _mm256_storeu_si256((__m256i *) (dst + 4 * x),
+                        _mm256_i32gather_epi32((const int *) src,
+                                               _mm256_loadu_si256((const __m256i *) (xs + x)), 4));
+  if (x < width) pix_hnearest_c(src, dst + 4 * x, xs + x, width - x);
+}
+
+static AVX2 void vblend_avx2(const uint8_t *a, const uint8_t *b, uint8_t *dst, int f, int n) {
+  const __m256i fa = _mm256_set1_epi16((short) (256 - f)), fb = _mm256_set1_epi16((short) f);
+  const __m256i z = _mm256_setzero_si256(), round = _mm256_set1_epi16(128);
+  int i;
+
+  for (i = 0; i + 32 <= n; i += 32) {
+    const __m256i va = _mm256_loadu_si256((const __m256i *) (a + i));
+    const __m256i vb = _mm256_loadu_si256((const __m256i *) (b + i));
+    const __m256i lo = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(va, z), fa),
+                                                         _mm256_mullo_epi16(_mm256_unpacklo_epi8(vb, z), fb)),
+                                        round);
+    const __m256i hi = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(va, z), fa),
+                                                         _mm256_mullo_epi16(_mm256_unpackhi_epi8(vb, z), fb)),
+                                        round);
+
+    // unpack and pack both work per 128 bit lane, so the order holds
+    _mm256_storeu_si256((__m256i *) (dst + i),
+                        _mm256_packus_epi16(_mm256_srli_epi16(lo, 8), _mm256_srli_epi16(hi, 8)));
+  }
+  if (i < n) pix_vblend_c(a + i, b + i, dst + i, f, n - i);
+}
+
+/* the SSE2 pair step on 4 pixels: (L R) pairs gathered as 64 bit */
+static AVX2 void hbilinear_avx2(const uint8_t *src, uint8_t *dst, const int32_t *xs,
+                                const int32_t *xw, int width) {
+  const __m256i z = _mm256_setzero_si256(), round = _mm256_set1_epi32(128);
+  const __m256i even = _mm256_setr_epi32(0, 0, 0, 0, 2, 2, 2, 2);
+  const __m256i odd = _mm256_setr_epi32(1, 1, 1, 1, 3, 3, 3, 3);
+  int x;
+
+  for (x = 0; x + 8 <= width; x += 8) {
+    __m256i out[2];
+    int h;
+
+    for (h = 0; h < 2; h++) {
+      const __m128i idx = _mm_loadu_si128((const __m128i *) (xs + x + 4 * h));
+      const __m256i w = _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *) (xw + x + 4 * h)));
+      // lane 0: pixels 0, 1; lane 1: pixels 2, 3
+      const __m256i p = _mm256_i32gather_epi64((const long long *) src, idx, 4);
+      const __m256i q = _mm256_shuffle_epi32(p, _MM_SHUFFLE(3, 1, 2, 0));
+      const __m256i lr = _mm256_unpacklo_epi8(q, _mm256_srli_si256(q, 8));
+      __m256i s0 = _mm256_madd_epi16(_mm256_unpacklo_epi8(lr, z), _mm256_permutevar8x32_epi32(w, even));
+      __m256i s1 = _mm256_madd_epi16(_mm256_unpackhi_epi8(lr, z), _mm256_permutevar8x32_epi32(w, odd));
+
+      s0 = _mm256_srli_epi32(_mm256_add_epi32(s0, round), 8);
+      s1 = _mm256_srli_epi32(_mm256_add_epi32(s1, round), 8);
+      // per lane: the lane's two pixels as 16 bit
+      out[h] = _mm256_packs_epi32(s0, s1);
+    }
+    // lanes of out[0]: p0 p1 | p2 p3, of out[1]: p4 p5 | p6 p7
+    _mm256_storeu_si256((__m256i *) (dst + 4 * x),
+                        _mm256_permute4x64_epi64(_mm256_packus_epi16(out[0], out[1]),
+                                                 _MM_SHUFFLE(3, 1, 2, 0)));
+  }
+  if (x < width) pix_hbilinear_c(src, dst + 4 * x, xs + x, xw + x, width - x);
+}
+
+void pix_scale_kernels_avx2(pix_scale_kernels_t *k) {
+  k->hnearest = hnearest_avx2;
+  k->hbilinear = hbilinear_avx2;
+  k->vblend = vblend_avx2;
+}
+
+#else /* !x86 */
+
+void pix_scale_kernels_sse2(pix_scale_kernels_t *k) {
+  (void) k;
+}
+
+void pix_scale_kernels_avx2(pix_scale_kernels_t *k) {
+  (void) k;
+}
+
+#endif
@@ -0,0 +1,383 @@
+/*
+ * playback.c -- clock driven video playback on top of avilib
+ *
+ * See playback.h. All times are nanoseconds of the playback clock.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "playback.h"
+
+struct playback_s
+{
+  avi_t *AVI;
+  playback_sink_t sink;
+  playback_clock_t clock;
+  uint32_t rate, scale;
+  long frames;
+  long start;
+  int skip;
+
+  atomic_int stop;
+  atomic_long position;
+
+  pthread_mutex_t lock;     /* stats, and the real clock's sleep */
+  pthread_cond_t wake;
+  playback_stats_t st;
+
+  char *buf;
+  long buf_len;
+  avi_ring_t *ring;         /* read-ahead, NULL to read in place */
+  vdec_t *dec;              /* NULL to hand over chunks */
+  long fed;                 /* next frame for the decoder */
+  audio_t *audio;           /* the master clock, NULL for p->clock */
+};
+
+/*************************************************************************/
+/* the default clock: CLOCK_MONOTONIC, sleeps end on playback_stop       */
+/*************************************************************************/
+
+static uint64_t mono_now(void *opaque) {
+  struct timespec ts;
+
+  (void) opaque;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void mono_sleep_until(void *opaque, uint64_t ns) {
+  playback_t *p = opaque;
+  struct timespec ts;
+
+  ts.tv_sec = ns / 1000000000ULL;
+  ts.tv_nsec = ns % 1000000000ULL;
+  pthread_mutex_lock(&p->lock);
+  while (!atomic_load(&p->stop)
+         && pthread_cond_timedwait(&p->wake, &p->lock, &ts) != ETIMEDOUT)
+    ;
+  pthread_mutex_unlock(&p->lock);
+}
+
+/*************************************************************************/
+/* the audio clock, waits are slept on p->clock                          */
+/*************************************************************************/
+
+static uint64_t audio_now(void *opaque) {
+  playback_t *p = opaque;
+
+  return audio_clock(p->audio);
+}
+
+static void audio_sleep_until(void *opaque, uint64_t ns) {
+  playback_t *p = opaque;
+  uint64_t now;
+
+  // the audio goes at about the pace of p->clock: sleep the difference
+  // there and look again. While the audio stalls, so does the video
+  while (!atomic_load(&p->stop) && (now = audio_clock(p->audio)) < ns)
+    p->clock.sleep_until(p->clock.opaque, p->clock.now(p->clock.opaque) + (ns - now));
+}
+
+/*************************************************************************/
+
+uint64_t playback_pts(playback_t *p, long frame) {
+  uint64_t t = (uint64_t) frame * p->scale;
+
+  // t * 1e9 / rate without overflowing for long files
+  return t / p->rate * 1000000000ULL + t % p->rate * 1000000000ULL / p->rate;
+}
+
+/* the last frame with pts <= t */
+static long frame_at(playback_t *p, uint64_t t) {
+  uint64_t n = (t / 1000000000ULL * p->rate + t % 1000000000ULL * p->rate / 1000000000ULL)
+               / p->scale;
+
+  // the split above may be one off either way
+  while (n > 0 && playback_pts(p, (long) n) > t) n--;
+  while (playback_pts(p, (long) n + 1) <= t) n++;
+  return (long) n;
+}
+
+playback_t *playback_new(avi_t *AVI, const playback_sink_t *sink,
+                         const playback_clock_t *clock) {
+  pthread_condattr_t attr;
+  playback_t *p;
+  long i, keys = 0;
+
+  p = calloc(1, sizeof(*p));
+  if (!p) return NULL;
+
+  p->AVI = AVI;
+  p->frames = AVI_video_frames(AVI);
+  if (AVI_frame_rate_rational(AVI, &p->rate, &p->scale) < 0) {
+    // no usable strh, AVI_frame_rate may still know better than nothing
+    if (AVI_frame_rate(AVI) <= 0) {
+      free(p);
+      return NULL;
+    }
+    p->rate = (uint32_t) (AVI_frame_rate(AVI) * 1000 + 0.5);
+    p->scale = 1000;
+  }
+  if (sink) p->sink = *sink;
+
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&p->wake, &attr);
+  pthread_condattr_destroy(&attr);
+
+  if (clock) {
+    p->clock = *clock;
+  } else {
+    p->clock.now = mono_now;
+    p->clock.sleep_until = mono_sleep_until;
+    p->clock.opaque = p;
+  }
+
+  // intra-only streams can resume anywhere; files without any keyframe
+  // flag (xawtv) are taken as intra-only as well
+  for (i = 0; i < p->frames; i++)
+    if (AVI_frame_is_keyframe(AVI, i) == 1) keys++;
+  p->skip = (keys && keys < p->frames) ? PLAYBACK_KEYFRAME : PLAYBACK_ANY_FRAME;
+
+  atomic_init(&p->stop, 0);
+  atomic_init(&p->position, -1);
+  return p;
+}
+
+void playback_free(playback_t *p) {
+  if (!p) return;
+  AVI_ring_free(p->ring);
+  pthread_cond_destroy(&p->wake);
+  pthread_mutex_destroy(&p->lock);
+  free(p->buf);
+  free(p);
+}
+
+void playback_set_skip(playback_t *p, int mode) {
+  p->skip = mode;
+}
+
+int playback_seek(playback_t *p, long frame) {
+  if (frame < 0 || frame >= p->frames) return -1;
+  p->start = frame;
+  return 0;
+}
+
+int playback_set_readahead(playback_t *p, int slots) {
+  AVI_ring_free(p->ring);
+  p->ring = NULL;
+  if (!slots) return 0;
+  p->ring = AVI_ring_new(p->AVI, slots);
+  return p->ring ? 0 : -1;
+}
+
+void playback_set_decoder(playback_t *p, vdec_t *d) {
+  p->dec = d;
+}
+
+void playback_set_audio(playback_t *p, audio_t *a) {
+  p->audio = a;
+}
+
+int playback_ring_stats(playback_t *p, avi_ring_stats_t *st) {
+  if (!p->ring) return -1;
+  AVI_ring_stats(p->ring, st);
+  return 0;
+}
+
+void playback_stop(playback_t *p) {
+  pthread_mutex_lock(&p->lock);
+  atomic_store(&p->stop, 1);
+  pthread_cond_broadcast(&p->wake);
+  pthread_mutex_unlock(&p->lock);
+}
+
+long playback_position(playback_t *p) {
+  return atomic_load(&p->position);
+}
+
+void playback_get_stats(playback_t *p, playback_stats_t *st) {
+  pthread_mutex_lock(&p->lock);
+  *st = p->st;
+  pthread_mutex_unlock(&p->lock);
+}
+
+/* where to go on when frame `due' is the one to show now */
+static long skip_target(playback_t *p, long due) {
+  long n;
+
+  if (p->skip == PLAYBACK_ANY_FRAME) return due;
+  for (n = due; n < p->frames; n++)
+    if (AVI_frame_is_keyframe(p->AVI, n) == 1) break;
+  return n;
+}
+
+/* reads frame n into f, zero-copy where the backend allows it */
+static int read_frame(playback_t *p, long n, playback_frame_t *f) {
+  long len;
+
+  if (p->ring) {
+    const avi_ring_slot_t *s = AVI_ring_get(p->ring, n);
+
+    if (!s) return -1;
+    f->data = s->data;
+    f->len = s->len;
+    f->keyframe = s->keyframe;
+    return 0;
+  }
+
+  len = AVI_frame_size(p->AVI, n);
+  if (len < 0 || AVI_set_video_position(p->AVI, n) < 0) return -1;
+  if (AVI_can_peek(p->AVI)) {
+    f->data = AVI_peek_frame(p->AVI, &f->len, &f->keyframe);
+    return f->data ? 0 : -1;
+  }
+  if (len + 1 > p->buf_len) {
+    char *b = realloc(p->buf, len + 1);
+
+    if (!b) return -1;
+    p->buf = b;
+    p->buf_len = len + 1;
+  }
+  f->len = AVI_read_frame(p->AVI, p->buf, &f->keyframe);
+  f->data = p->buf;
+  return f->len < 0 ? -1 : 0;
+}
+
+/* keeps the decoder busy: reads and submits frames from pos on while it
+   has room */
+static int feed(playback_t *p, long pos) {
+  playback_frame_t f;
+  int ret;
+
+  if (p->fed < pos) {
+    // skipped past all that is in flight
+    vdec_flush(p->dec);
+    p->fed = pos;
+  }
+  while (p->fed < p->frames && vdec_can_submit(p->dec)) {
+    memset(&f, 0, sizeof(f));
+    if (read_frame(p, p->fed, &f) < 0) return -1;
+    ret = vdec_submit(p->dec, p->fed, f.data, f.len, f.keyframe);
+    if (p->ring) AVI_ring_release(p->ring);
+    if (ret < 0) return -1;
+    p->fed++;
+  }
+  return 0;
+}
+
+int playback_run(playback_t *p) {
+  const playback_clock_t *c = &p->clock;
+  playback_clock_t ac = { audio_now, audio_sleep_until, p };
+  uint64_t t0, now, due, t1;
+  long pos = p->start;
+  int ret = 0;
+
+  // the ring's thread reads from here on, the index stays ours
+  if (p->ring && AVI_ring_start(p->ring, pos) < 0) return -1;
+  if (p->dec) {
+    vdec_flush(p->dec);
+    p->fed = pos;
+  }
+
+  // the audio clock starts at the frame's time, once the device plays
+  if (p->audio && audio_start(p->audio, playback_pts(p, pos)) == 0) c = &ac;
+  pthread_mutex_lock(&p->lock);
+  p->st.audio_master = c == &ac;
+  pthread_mutex_unlock(&p->lock);
+
+  // frame `start' is due right now
+  t0 = c->now(c->opaque) - playback_pts(p, pos);
+
+  while (pos < p->frames && !atomic_load(&p->stop)) {
+    playback_frame_t f;
+
+    now = c->now(c->opaque);
+    due = t0 + playback_pts(p, pos);
+
+    if (now >= t0 + playback_pts(p, pos + 1)) {
+      // more than a frame period late: catch up instead of showing
+      // every frame late from here on
+      long next = skip_target(p, frame_at(p, now - t0));
+
+      if (next > pos) {
+        pthread_mutex_lock(&p->lock);
+        p->st.dropped += next - pos;
+        p->st.skips++;
+        pthread_mutex_unlock(&p->lock);
+        pos = next;
+        continue;
+      }
+    }
+    if (p->dec) {
+      // the frames decode while we sleep
+      t1 = c->now(c->opaque);
+      if (feed(p, pos) < 0) {
+        ret = -1;
+        break;
+      }
+      now = c->now(c->opaque);
+      pthread_mutex_lock(&p->lock);
+      p->st.read_ns += now - t1;
+      pthread_mutex_unlock(&p->lock);
+    }
+    if (now < due) {
+      c->sleep_until(c->opaque, due);
+      if (atomic_load(&p->stop)) break;
+    }
+
+    t1 = c->now(c->opaque);
+    memset(&f, 0, sizeof(f));
+    if (p->dec) {
+      f.decoded = vdec_get(p->dec, pos);
+      if (!f.decoded) {
+        ret = -1;
+        break;
+      }
+      f.keyframe = f.decoded->keyframe;
+    } else if (read_frame(p, pos, &f) < 0) {
+      ret = -1;
+      break;
+    }
+    f.frame = pos;
+    f.pts_ns = playback_pts(p, pos);
+    now = c->now(c->opaque);
+    f.late_ns = (int64_t) (now - due);
+
+    pthread_mutex_lock(&p->lock);
+    if (p->dec) p->st.decode_ns += now - t1;
+    else p->st.read_ns += now - t1;
+    p->st.shown++;
+    if (f.late_ns > 0) {
+      p->st.late++;
+      p->st.late_ns += f.late_ns;
+      if (f.late_ns > p->st.max_late_ns) p->st.max_late_ns = f.late_ns;
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    if (p->sink.frame) {
+      ret = p->sink.frame(p->sink.opaque, &f);
+      t1 = c->now(c->opaque);
+      pthread_mutex_lock(&p->lock);
+      p->st.sink_ns += t1 - now;
+      pthread_mutex_unlock(&p->lock);
+      if (ret < 0) break;
+      ret = 0;
+    }
+    // the reader can refill the slot while we wait for the next frame
+    if (p->dec) vdec_release(p->dec);
+    else if (p->ring) AVI_ring_release(p->ring);
+    atomic_store(&p->position, pos);
+    pos++;
+  }
+
+  if (c == &ac) audio_stop(p->audio);
+  if (p->ring) AVI_ring_stop(p->ring);
+  return ret;
+}
@@ -0,0 +1,121 @@
+/*
+ * playback.h -- clock driven video playback on top of avilib
+ *
+ * Frame n of a file is due (n - first) * scale / rate seconds after
+ * playback started, with rate / scale taken exactly from the stream
+ * header. playback_run reads every frame when it is due and hands it
+ * to the sink. When reading or the sink were so slow that a frame is
+ * more than one frame period late, playback skips ahead to the frame
+ * that is due now -- or to the next keyframe after it, for codecs that
+ * can only resume there -- and counts the skipped frames as dropped.
+ *
+ * With a decoder (vdec.h) frames are read and submitted as soon as the
+ * decoder has room, so that they decode on its workers while playback
+ * waits for the frames in front of them; the sink gets them decoded.
+ *
+ * With audio (audio.h) the audio is the master: playback starts it at
+ * the first frame and takes its clock, the time heard on the device,
+ * in place of the one given to playback_new. That one then only paces
+ * the waits and should follow real time.
+ *
+ * Nothing here knows about Android: the JNI glue is a sink that draws
+ * into an ANativeWindow, on the host any sink (or none) will do. The
+ * clock can be replaced, which makes runs in virtual time possible.
+ */
+
+#ifndef PLAYBACK_H
+#define PLAYBACK_H
+
+#include <stdint.h>
+
+#include "avilib1_1_5/avilib.h"
+#include "avilib1_1_5/framering.h"
+#include "audio.h"
+#include "vdec.h"
+
+typedef struct
+{
+  long        frame;        /* index in the file */
+  const char *data;         /* chunk as stored, valid during the call */
+  long        len;
+  int         keyframe;
+  uint64_t    pts_ns;       /* presentation time from the file start */
+  int64_t     late_ns;      /* < 0 if early, playback waited */
+  /* with a decoder the frame decoded, data is NULL then */
+  const vdec_frame_t *decoded;
+} playback_frame_t;
+
+typedef struct
+{
+  /* a negative return stops playback, playback_run returns it */
+  int   (*frame)(void *opaque, const playback_frame_t *f);
+  void  *opaque;
+} playback_sink_t;
+
+/* defaults to CLOCK_MONOTONIC and sleeping; sleep_until returns early
+   when playback_stop is called */
+typedef struct
+{
+  uint64_t (*now)(void *opaque);
+  void     (*sleep_until)(void *opaque, uint64_t ns);
+  void     *opaque;
+} playback_clock_t;
+
+enum {
+  PLAYBACK_ANY_FRAME = 0,   /* skip to the frame due now */
+  PLAYBACK_KEYFRAME  = 1,   /* skip to the next keyframe from there */
+};
+
+typedef struct
+{
+  long     shown;           /* frames given to the sink */
+  long     dropped;         /* frames skipped because playback was late */
+  long     skips;           /* times playback skipped ahead */
+  long     late;            /* shown after their due time */
+  int64_t  max_late_ns;     /* worst lateness of a shown frame */
+  uint64_t late_ns;         /* sum of the lateness of shown frames */
+  uint64_t read_ns;         /* spent in avilib */
+  uint64_t decode_ns;       /* waiting for the decoder */
+  uint64_t sink_ns;         /* spent in the sink */
+  int      audio_master;    /* frames were timed on the audio clock */
+} playback_stats_t;
+
+typedef struct playback_s playback_t;
+
+/* AVI stays owned by the caller and must outlive the player */
+playback_t *playback_new(avi_t *AVI, const playback_sink_t *sink,
+                         const playback_clock_t *clock);
+void playback_free(playback_t *p);
+
+/* default PLAYBACK_KEYFRAME, unless all frames or none are flagged
+   as keyframes */
+void playback_set_skip(playback_t *p, int mode);
+/* where playback_run starts, default 0 */
+int  playback_seek(playback_t *p, long frame);
+/* read frames ahead on a thread of their own into a ring of that many
+   buffers (see framering.h), 0 reads each frame when it is due */
+int  playback_set_readahead(playback_t *p, int slots);
+/* decode frames ahead on d, NULL to hand the sink the chunks as they
+   are. d stays owned by the caller and must outlive the player */
+void playback_set_decoder(playback_t *p, vdec_t *d);
+/* play a along and time the frames on its clock, NULL to go by the
+   clock of playback_new. a stays owned by the caller and must outlive
+   the player; if it can't start, the frames go by that clock */
+void playback_set_audio(playback_t *p, audio_t *a);
+
+/* plays up to the last frame or playback_stop, returns 0, -1 on a read
+   error or what the sink returned */
+int  playback_run(playback_t *p);
+/* from any thread, also before playback_run was entered. playback_run
+   returns soon after, a stopped player stays stopped */
+void playback_stop(playback_t *p);
+
+/* frame shown last, -1 before the first */
+long playback_position(playback_t *p);
+/* presentation time of a frame */
+uint64_t playback_pts(playback_t *p, long frame);
+void playback_get_stats(playback_t *p, playback_stats_t *st);
+/* after playback_run, -1 without read-ahead */
+int  playback_ring_stats(playback_t *p, avi_ring_stats_t *st);
+
+#endif /* PLAYBACK_H */
@@ -0,0 +1,420 @@
+/*
+ * vdec.c -- codec registry, worker pool and reorder buffer
+ *
+ * See vdec.h. Frames in flight sit in a ring of depth slots, numbered by
+ * three counters that only grow: head (submitted), next (taken by a
+ * worker) and tail (handed back). Workers take slots in submission order
+ * but finish them in any order; vdec_get waits on the slot at the tail,
+ * so frames leave in the order they came. A worker owns its codec
+ * instance and scaler, nothing of them is shared.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pixscale.h"
+#include "vdec_impl.h"
+
+/* the largest SoCs we ship on have eight cores */
+#define VDEC_MAX_THREADS 8
+#define VDEC_MAX_CODECS 16
+
+enum { SLOT_FREE, SLOT_QUEUED, SLOT_BUSY, SLOT_DONE };
+
+typedef struct
+{
+  vdec_frame_t f;
+  int state;
+  char *in;                 /* the chunk, grown to the largest seen */
+  long in_len, in_size;
+  uint8_t *out;
+} slot_t;
+
+typedef struct
+{
+  vdec_t *d;
+  pthread_t thread;
+  void *ctx;
+  pix_scaler_t *scaler;     /* NULL when the output has the stream's size */
+} worker_t;
+
+struct vdec_s
+{
+  const vdec_codec_t *codec;
+  vdec_stream_t st;
+  pix_fmt_t fmt;
+  int width, height;
+  int nworkers, depth;
+  worker_t *worker;
+  slot_t *slot;
+
+  pthread_mutex_t lock;
+  pthread_cond_t work;      /* a slot was queued, or quit */
+  pthread_cond_t done;      /* a slot was decoded */
+  unsigned long head, next, tail;
+  int busy;                 /* slots being decoded */
+  int held;
+  int quit;
+  vdec_stats_t stats;
+};
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*************************************************************************/
+/* the registry                                                          */
+/*************************************************************************/
+
+static const vdec_codec_t *const builtin[] = {
+  &vdec_codec_dib,
+  &vdec_codec_mjpeg,
+  &vdec_codec_rle,
+};
+
+static const vdec_codec_t *registered[VDEC_MAX_CODECS];
+static int nregistered;
+
+static uint32_t fold(uint32_t fourcc) {
+  int i;
+
+  for (i = 0; i < 32; i += 8) {
+    uint32_t c = fourcc >> i & 0xff;
+
+    if (c >= 'a' && c <= 'z') fourcc -= (uint32_t) ('a' - 'A') << i;
+  }
+  return fourcc;
+}
+
+static int reads(const vdec_codec_t *codec, uint32_t fourcc) {
+  int i;
+
+  for (i = 0; i < codec->nfourccs; i++)
+    if (fold(codec->fourccs[i]) == fourcc) return 1;
+  return 0;
+}
+
+int vdec_register(const vdec_codec_t *codec) {
+  if (!codec || !codec->open || !codec->close || !codec->decode || nregistered == VDEC_MAX_CODECS) return -1;
+  registered[nregistered++] = codec;
+  return 0;
+}
+
+const vdec_codec_t *vdec_find(uint32_t fourcc) {
+  int i;
+
+  fourcc = fold(fourcc);
+  // the last registered wins, then the built-in ones
+  for (i = nregistered - 1; i >= 0; i--)
+    if (reads(registered[i], fourcc)) return registered[i];
+  for (i = 0; i < (int) (sizeof(builtin) / sizeof(builtin[0])); i++)
+    if (reads(builtin[i], fourcc)) return builtin[i];
+  return NULL;
+}
+
+/*************************************************************************/
+/* workers                                                               */
+/*************************************************************************/
+
+static int decode_slot(worker_t *w, slot_t *s) {
+  vdec_t *d = w->d;
+  pix_image_t pic;
+
+  if (!w->scaler && d->codec->decode_into)
+    return d->codec->decode_into(w->ctx, s->in, s->in_len, s->f.keyframe, &s->f.image);
+  if (d->codec->decode(w->ctx, s->in, s->in_len, s->f.keyframe, &pic) < 0) return -1;
+  if (w->scaler) return pix_scale(w->scaler, &pic, &s->f.image);
+  return pix_convert(&pic, &s->f.image);
+}
+
+static void *worker_main(void *arg) {
+  worker_t *w = arg;
+  vdec_t *d = w->d;
+
+  pthread_mutex_lock(&d->lock);
+  for (;;) {
+    slot_t *s;
+    uint64_t t;
+    int status;
+
+    while (!d->quit && d->next == d->head)
+      pthread_cond_wait(&d->work, &d->lock);
+    if (d->quit) break;
+    s = &d->slot[d->next++ % d->depth];
+    s->state = SLOT_BUSY;
+    d->busy++;
+    pthread_mutex_unlock(&d->lock);
+
+    t = now_ns();
+    status = decode_slot(w, s);
+    t = now_ns() - t;
+
+    pthread_mutex_lock(&d->lock);
+    s->f.status = status;
+    s->state = SLOT_DONE;
+    d->busy--;
+    d->stats.decode_ns += t;
+    if (status < 0) d->stats.failed++;
+    else d->stats.decoded++;
+    pthread_cond_broadcast(&d->done);
+  }
+  pthread_mutex_unlock(&d->lock);
+  return NULL;
+}
+
+/*************************************************************************/
+
+vdec_t *vdec_new(const vdec_stream_t *st, const vdec_config_t *cfg) {
+  const vdec_codec_t *codec = vdec_find(st->fourcc);
+  size_t out_size;
+  vdec_t *d;
+  int i, n;
+
+  if (!codec) return NULL;
+  if (cfg->fmt != PIX_FMT_RGB565 && cfg->fmt != PIX_FMT_RGBA8888) return NULL;
+  if (st->width <= 0 || st->height <= 0) return NULL;
+
+  d = calloc(1, sizeof(*d));
+  if (!d) return NULL;
+  d->codec = codec;
+  d->st = *st;
+  d->st.fourcc = fold(st->fourcc);
+  d->fmt = cfg->fmt;
+  d->width = cfg->width > 0 ? cfg->width : st->width;
+  d->height = cfg->height > 0 ? cfg->height : st->height;
+  pthread_mutex_init(&d->lock, NULL);
+  pthread_cond_init(&d->work, NULL);
+  pthread_cond_init(&d->done, NULL);
+
+  n = cfg->threads;
+  if (n <= 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    n = cpus > 0 ? (int) cpus : 1;
+  }
+  if (n > VDEC_MAX_THREADS) n = VDEC_MAX_THREADS;
+  // each frame builds on the last one: only one can be decoded at a time
+  if (!(codec->flags & VDEC_INTRA)) n = 1;
+  d->depth = cfg->depth > 0 ? cfg->depth : 2 * n;
+
+  d->worker = calloc(n, sizeof(*d->worker));
+  d->slot = calloc(d->depth, sizeof(*d->slot));
+  if (!d->worker || !d->slot) goto fail;
+  out_size = pix_image_size(d->fmt, d->width, d->height);
+  for (i = 0; i < d->depth; i++) {
+    slot_t *s = &d->slot[i];
+
+    if (!(s->out = malloc(out_size))) goto fail;
+    pix_image_init(&s->f.image, d->fmt, d->width, d->height, s->out, 0);
+  }
+
+  for (i = 0; i < n; i++) {
+    worker_t *w = &d->worker[i];
+
+    w->d = d;
+    if (!(w->ctx = codec->open(&d->st))) break;
+    if (d->width != st->width || d->height != st->height) {
+      // the pool is the parallelism, the scaler of a worker runs on it
+      w->scaler = pix_scaler_new(st->width, st->height, d->width, d->height, PIX_SCALE_BILINEAR, 1);
+      if (!w->scaler) {
+        codec->close(w->ctx);
+        break;
+      }
+    }
+    if (pthread_create(&w->thread, NULL, worker_main, w) != 0) {
+      pix_scaler_free(w->scaler);
+      codec->close(w->ctx);
+      break;
+    }
+    d->nworkers++;
+  }
+  // fewer workers only cost speed
+  if (!d->nworkers) goto fail;
+  return d;
+
+fail:
+  vdec_free(d);
+  return NULL;
+}
+
+static void stream_of(avi_t *AVI, vdec_stream_t *st) {
+  const uint8_t *cc = (const uint8_t *) AVI_video_compressor(AVI);
+
+  st->fourcc = VDEC_FOURCC(cc[0], cc[1], cc[2], cc[3]);
+  st->width = AVI_video_width(AVI);
+  st->height = AVI_video_height(AVI);
+  st->bih = AVI->bitmap_info_header;
+  st->colors = AVI_video_palette(AVI, &st->palette);
+}
+
+vdec_t *vdec_open(avi_t *AVI, const vdec_config_t *cfg) {
+  vdec_stream_t st;
+
+  stream_of(AVI, &st);
+  return vdec_new(&st, cfg);
+}
+
+int vdec_decode_one(avi_t *AVI, const char *data, long len, int keyframe, pix_image_t *dst) {
+  const vdec_codec_t *codec;
+  vdec_stream_t st;
+  pix_image_t pic;
+  void *ctx;
+  int r = -1;
+
+  stream_of(AVI, &st);
+  st.fourcc = fold(st.fourcc);
+  if (!(codec = vdec_find(st.fourcc)) || !(ctx = codec->open(&st))) return -1;
+  if (dst->width == st.width && dst->height == st.height && codec->decode_into) {
+    r = codec->decode_into(ctx, data, len, keyframe, dst);
+  } else if (codec->decode(ctx, data, len, keyframe, &pic) >= 0) {
+    pix_scaler_t *s = pix_scaler_new(st.width, st.height, dst->width, dst->height, PIX_SCALE_BILINEAR, 0);
+
+    if (s) r = pix_scale(s, &pic, dst);
+    pix_scaler_free(s);
+  }
+  codec->close(ctx);
+  return r;
+}
+
+void vdec_free(vdec_t *d) {
+  int i;
+
+  if (!d) return;
+  pthread_mutex_lock(&d->lock);
+  d->quit = 1;
+  pthread_cond_broadcast(&d->work);
+  pthread_mutex_unlock(&d->lock);
+  for (i = 0; i < d->nworkers; i++) {
+    pthread_join(d->worker[i].thread, NULL);
+    pix_scaler_free(d->worker[i].scaler);
+    d->codec->close(d->worker[i].ctx);
+  }
+  for (i = 0; d->slot && i < d->depth; i++) {
+    free(d->slot[i].in);
+    free(d->slot[i].out);
+  }
+  pthread_cond_destroy(&d->done);
+  pthread_cond_destroy(&d->work);
+  pthread_mutex_destroy(&d->lock);
+  free(d->slot);
+  free(d->worker);
+  free(d);
+}
+
+const char *vdec_name(const vdec_t *d) {
+  return d->codec->name;
+}
+
+int vdec_threads(const vdec_t *d) {
+  return d->nworkers;
+}
+
+int vdec_can_submit(vdec_t *d) {
+  int room;
+
+  pthread_mutex_lock(&d->lock);
+  room = d->head - d->tail < (unsigned long) d->depth;
+  pthread_mutex_unlock(&d->lock);
+  return room;
+}
+
+int vdec_submit(vdec_t *d, long frame, const char *data, long len, int keyframe) {
+  slot_t *s;
+
+  if (len < 0 || !vdec_can_submit(d)) return -1;
+  // a free slot is the caller's until it is queued
+  s = &d->slot[d->head % d->depth];
+  if (len + 1 > s->in_size) {
+    char *b = realloc(s->in, len + 1);
+
+    if (!b) return -1;
+    s->in = b;
+    s->in_size = len + 1;
+  }
+  memcpy(s->in, data, len);
+  s->in_len = len;
+  s->f.frame = frame;
+  s->f.keyframe = keyframe;
+  s->f.status = 0;
+
+  pthread_mutex_lock(&d->lock);
+  s->state = SLOT_QUEUED;
+  d->head++;
+  d->stats.submitted++;
+  pthread_cond_signal(&d->work);
+  pthread_mutex_unlock(&d->lock);
+  return 0;
+}
+
+/* with the lock held */
+static void wait_done(vdec_t *d, slot_t *s) {
+  while (s->state != SLOT_DONE)
+    pthread_cond_wait(&d->done, &d->lock);
+}
+
+const vdec_frame_t *vdec_get(vdec_t *d, long frame) {
+  pthread_mutex_lock(&d->lock);
+  while (d->tail < d->head) {
+    slot_t *s = &d->slot[d->tail % d->depth];
+
+    if (s->f.frame > frame) break;
+    if (s->f.frame == frame) {
+      if (s->state != SLOT_DONE) {
+        uint64_t t = now_ns();
+
+        wait_done(d, s);
+        d->stats.waits++;
+        d->stats.wait_ns += now_ns() - t;
+      }
+      d->held = 1;
+      pthread_mutex_unlock(&d->lock);
+      return &s->f;
+    }
+    // in front of frame: not decoding it at all is only safe when no
+    // later frame depends on it
+    if (s->state == SLOT_QUEUED && (d->codec->flags & VDEC_INTRA)) d->next++;
+    else wait_done(d, s);
+    s->state = SLOT_FREE;
+    d->tail++;
+    d->stats.discarded++;
+  }
+  pthread_mutex_unlock(&d->lock);
+  return NULL;
+}
+
+void vdec_release(vdec_t *d) {
+  pthread_mutex_lock(&d->lock);
+  if (d->held) {
+    d->slot[d->tail % d->depth].state = SLOT_FREE;
+    d->tail++;
+    d->held = 0;
+  }
+  pthread_mutex_unlock(&d->lock);
+}
+
+void vdec_flush(vdec_t *d) {
+  pthread_mutex_lock(&d->lock);
+  // queued slots are never started, busy ones have to finish
+  d->next = d->head;
+  while (d->busy)
+    pthread_cond_wait(&d->done, &d->lock);
+  d->stats.discarded += d->head - d->tail;
+  for (; d->tail < d->head; d->tail++)
+    d->slot[d->tail % d->depth].state = SLOT_FREE;
+  d->held = 0;
+  pthread_mutex_unlock(&d->lock);
+}
+
+void vdec_get_stats(vdec_t *d, vdec_stats_t *st) {
+  pthread_mutex_lock(&d->lock);
+  *st = d->stats;
+  pthread_mutex_unlock(&d->lock);
+  st->threads = d->nworkers;
+  st->depth = d->depth;
+}
@@ -0,0 +1,133 @@
+/*
+ * vdec.h -- video decoders keyed by fourcc, decoding frames in parallel
+ *
+ * A codec is a set of callbacks registered under the fourccs it reads,
+ * which are matched against the biCompression of the stream's strf (what
+ * AVI_video_compressor returns; "" for uncompressed RGB). vdec_t runs an
+ * instance of the codec on each of a pool of worker threads, so several
+ * frames decode at once, and every frame is converted and scaled to the
+ * output format and size (pixconv, pixscale) on the worker that decoded
+ * it. Frames come out of a reorder buffer in the order they went in,
+ * whichever worker finished first.
+ *
+ * Only intra-only codecs decode in parallel. A codec whose frames build
+ * on the ones before gets a single worker, which still takes decoding
+ * off the caller's thread and ahead of the presentation time.
+ *
+ * One thread feeds a vdec_t and takes the frames out; the workers are
+ * the vdec_t's own.
+ */
+
+#ifndef VDEC_H
+#define VDEC_H
+
+#include <stdint.h>
+
+#include "avilib1_1_5/avilib.h"
+#include "pixconv.h"
+
+#define VDEC_FOURCC(a, b, c, d) \
+  ((uint32_t) (a) | (uint32_t) (b) << 8 | (uint32_t) (c) << 16 | (uint32_t) (d) << 24)
+
+typedef struct
+{
+  uint32_t fourcc;
+  int      width, height;           /* from the avi header */
+  const alBITMAPINFOHEADER *bih;    /* strf, NULL if the file has none */
+  const uint8_t *palette;           /* the RGBQUADs after it in strf, */
+  int      colors;                  /* 0 if there are none */
+} vdec_stream_t;
+
+enum {
+  VDEC_INTRA = 1,           /* every frame decodes on its own */
+};
+
+typedef struct
+{
+  const char     *name;
+  const uint32_t *fourccs;
+  int             nfourccs;
+  int             flags;
+
+  /* an instance for one worker, NULL if it can't read this stream */
+  void *(*open)(const vdec_stream_t *st);
+  void  (*close)(void *ctx);
+  /* decodes a chunk into pic, which may point into data or into ctx and
+     stays valid until the next call on ctx; < 0 if the chunk is bad */
+  int   (*decode)(void *ctx, const char *data, long len, int keyframe,
+                  pix_image_t *pic);
+  /* optional: decodes straight into dst, which has the stream's size
+     and the output format, instead of decode and a pix_convert */
+  int   (*decode_into)(void *ctx, const char *data, long len, int keyframe,
+                       pix_image_t *dst);
+} vdec_codec_t;
+
+/* before the first vdec_new; takes over fourccs of the built-in codecs.
+   The codec is not copied */
+int vdec_register(const vdec_codec_t *codec);
+/* case is ignored, files in the wild have both mjpg and MJPG */
+const vdec_codec_t *vdec_find(uint32_t fourcc);
+
+typedef struct
+{
+  pix_fmt_t fmt;            /* PIX_FMT_RGB565 or PIX_FMT_RGBA8888 */
+  int width, height;        /* 0 for the stream's size, else scaled */
+  int threads;              /* <= 0 for one per CPU */
+  int depth;                /* frames in flight, 0 for two per worker */
+} vdec_config_t;
+
+typedef struct
+{
+  long        frame;
+  int         keyframe;
+  int         status;       /* < 0 if the chunk did not decode */
+  pix_image_t image;        /* in the output format and size */
+} vdec_frame_t;
+
+typedef struct
+{
+  unsigned long submitted;
+  unsigned long decoded;
+  unsigned long failed;     /* chunks the codec refused */
+  unsigned long discarded;  /* dropped by vdec_get or vdec_flush */
+  unsigned long waits;      /* vdec_get found its frame not done */
+  uint64_t wait_ns;         /* ... and waited this long in total */
+  uint64_t decode_ns;       /* worker time, conversion included */
+  int threads, depth;
+} vdec_stats_t;
+
+typedef struct vdec_s vdec_t;
+
+vdec_t *vdec_new(const vdec_stream_t *st, const vdec_config_t *cfg);
+/* for the video stream of AVI, NULL if no codec reads it */
+vdec_t *vdec_open(avi_t *AVI, const vdec_config_t *cfg);
+void vdec_free(vdec_t *d);
+
+/* one chunk of the video stream of AVI decoded on the calling thread
+   and fitted to dst, for a still where a pool is too much. A codec that
+   is not intra-only shows key frames only right */
+int vdec_decode_one(avi_t *AVI, const char *data, long len, int keyframe, pix_image_t *dst);
+
+const char *vdec_name(const vdec_t *d);
+int vdec_threads(const vdec_t *d);
+
+/* copies the chunk in and queues it for the workers; -1 while depth
+   frames are in flight, vdec_get and vdec_release make room */
+int vdec_submit(vdec_t *d, long frame, const char *data, long len, int keyframe);
+/* 1 if there is room for vdec_submit */
+int vdec_can_submit(vdec_t *d);
+
+/*
+ * The frame, once decoded. Frames submitted in front of it are dropped,
+ * those not yet started without decoding them when the codec is
+ * intra-only. NULL if frame is not in flight. The frame stays valid
+ * until vdec_release, which must come before the next get.
+ */
+const vdec_frame_t *vdec_get(vdec_t *d, long frame);
+void vdec_release(vdec_t *d);
+/* drops all frames in flight, e.g. before a seek */
+void vdec_flush(vdec_t *d);
+
+void vdec_get_stats(vdec_t *d, vdec_stats_t *st);
+
+#endif /* VDEC_H */
@@ -0,0 +1,90 @@
+/*
+ * vdec_dib.c -- uncompressed frames as a vdec codec
+ *
+ * Nothing to decode: the picture is the chunk itself, laid out as the
+ * strf says (pix_image_dib). Files without a strf are taken as the raw
+ * RGB565 rows the app was first written for. 8 bit DIBs index the
+ * palette that follows the strf header.
+ */
+
+#include <stdlib.h>
+
+#include "vdec_impl.h"
+
+static const uint32_t dib_fourccs[] = {
+  0,                                    /* BI_RGB */
+  3,                                    /* BI_BITFIELDS */
+  VDEC_FOURCC('D', 'I', 'B', ' '),
+  VDEC_FOURCC('R', 'G', 'B', ' '),
+  VDEC_FOURCC('R', 'A', 'W', ' '),
+  VDEC_FOURCC('Y', 'U', 'Y', '2'),
+  VDEC_FOURCC('Y', 'U', 'Y', 'V'),
+  VDEC_FOURCC('U', 'Y', 'V', 'Y'),
+  VDEC_FOURCC('I', '4', '2', '0'),
+  VDEC_FOURCC('I', 'Y', 'U', 'V'),
+  VDEC_FOURCC('Y', 'V', '1', '2'),
+};
+
+typedef struct
+{
+  vdec_stream_t st;
+  alBITMAPINFOHEADER bih;   /* with the DIB, RGB and RAW codes as BI_RGB */
+  pix_palette_t pal;
+} dib_t;
+
+void vdec_palette(const vdec_stream_t *st, pix_palette_t *pal) {
+  uint8_t gray[256][4];
+  int i;
+
+  if (st->palette && st->colors > 0) {
+    pix_palette_init(pal, st->palette, st->colors);
+    return;
+  }
+  for (i = 0; i < 256; i++)
+    gray[i][0] = gray[i][1] = gray[i][2] = gray[i][3] = (uint8_t) i;
+  pix_palette_init(pal, gray[0], 256);
+}
+
+static void *dib_open(const vdec_stream_t *st) {
+  dib_t *c;
+
+  if (!st->bih && (st->width <= 0 || st->height <= 0)) return NULL;
+  c = calloc(1, sizeof(*c));
+  if (!c) return NULL;
+  c->st = *st;
+  if (st->bih) {
+    c->bih = *st->bih;
+    if (st->fourcc == dib_fourccs[2] || st->fourcc == dib_fourccs[3] || st->fourcc == dib_fourccs[4])
+      c->bih.bi_compression = 0;
+  }
+  vdec_palette(st, &c->pal);
+  return c;
+}
+
+static void dib_close(void *ctx) {
+  free(ctx);
+}
+
+static int dib_decode(void *ctx, const char *data, long len, int keyframe, pix_image_t *pic) {
+  dib_t *c = ctx;
+
+  (void) keyframe;
+  if (c->st.bih) {
+    if (pix_image_dib(pic, &c->bih, data, len) < 0) return -1;
+    if (pic->fmt == PIX_FMT_PAL8) pic->data[1] = (uint8_t *) &c->pal;
+    return 0;
+  }
+  if (len < (long) c->st.width * c->st.height * 2) return -1;
+  return pix_image_init(pic, PIX_FMT_RGB565, c->st.width, c->st.height, (void *) data, 0);
+}
+
+const vdec_codec_t vdec_codec_dib = {
+  "dib",
+  dib_fourccs,
+  sizeof(dib_fourccs) / sizeof(dib_fourccs[0]),
+  VDEC_INTRA,
+  dib_open,
+  dib_close,
+  dib_decode,
+  NULL,
+};
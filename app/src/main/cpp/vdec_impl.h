@@ -0,0 +1,20 @@
+/*
+ * vdec_impl.h -- the built-in codecs of vdec
+ */
+
+#ifndef VDEC_IMPL_H
+#define VDEC_IMPL_H
+
+#include "vdec.h"
+
+/* uncompressed DIBs and the raw YUV layouts pixconv reads */
+extern const vdec_codec_t vdec_codec_dib;
+/* MJPG and AVI1, jpeg.c */
+extern const vdec_codec_t vdec_codec_mjpeg;
+/* BI_RLE8 and BI_RLE4 */
+extern const vdec_codec_t vdec_codec_rle;
+
+/* the stream's palette, or a gray ramp for streams without one */
+void vdec_palette(const vdec_stream_t *st, pix_palette_t *pal);
+
+#endif /* VDEC_IMPL_H */
@@ -0,0 +1,113 @@
+/*
+ * vdec_mjpeg.c -- Motion-JPEG as a vdec codec
+ *
+ * Every chunk is a JPEG image (jpeg.c), so frames decode on all the
+ * workers at once. With the output at the stream's size the image is
+ * decoded straight into the frame; for scaling it is handed out in its
+ * own planar format, the smallest thing pixscale reads.
+ *
+ * Interlaced AVI1 chunks hold two images of half the height, the top
+ * field first; they are woven into the rows of one frame.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "jpeg.h"
+#include "vdec_impl.h"
+
+static const uint32_t mjpeg_fourccs[] = {
+  VDEC_FOURCC('M', 'J', 'P', 'G'),
+  VDEC_FOURCC('A', 'V', 'I', '1'),
+  VDEC_FOURCC('J', 'P', 'E', 'G'),
+};
+
+typedef struct
+{
+  vdec_stream_t st;
+  jpeg_t *j;
+  uint8_t *buf;             /* the picture decode hands out */
+  size_t size;
+} mjpeg_t;
+
+static void *mjpeg_open(const vdec_stream_t *st) {
+  mjpeg_t *c = calloc(1, sizeof(*c));
+
+  if (!c) return NULL;
+  c->st = *st;
+  if (!(c->j = jpeg_new())) {
+    free(c);
+    return NULL;
+  }
+  return c;
+}
+
+static void mjpeg_close(void *ctx) {
+  mjpeg_t *c = ctx;
+
+  jpeg_free(c->j);
+  free(c->buf);
+  free(c);
+}
+
+/* one image or two fields to dst, an RGB format when they are fields */
+static int put(mjpeg_t *c, const char *data, long len, const jpeg_info_t *info, pix_image_t *dst) {
+  pix_image_t field;
+  long n;
+  int y;
+
+  if (info->height >= dst->height) return jpeg_decode(c->j, data, len, dst) < 0 ? -1 : 0;
+
+  field = *dst;
+  field.height = (dst->height + 1) / 2;
+  field.stride[0] = 2 * dst->stride[0];
+  if (info->height < field.height || (n = jpeg_decode(c->j, data, len, &field)) < 0) return -1;
+  field.data[0] = dst->data[0] + dst->stride[0];
+  field.height = dst->height / 2;
+  if (jpeg_decode(c->j, data + n, len - n, &field) >= 0) return 0;
+  // no second field: the first one on every row
+  for (y = 1; y < dst->height; y += 2)
+    memcpy(dst->data[0] + (long) y * dst->stride[0], dst->data[0] + (long) (y - 1) * dst->stride[0],
+           (size_t) dst->width * (dst->fmt == PIX_FMT_RGB565 ? 2 : 4));
+  return 0;
+}
+
+static int mjpeg_decode(void *ctx, const char *data, long len, int keyframe, pix_image_t *pic) {
+  mjpeg_t *c = ctx;
+  jpeg_info_t info;
+  pix_fmt_t fmt;
+  size_t size;
+
+  (void) keyframe;
+  if (jpeg_info(data, len, &info) < 0) return -1;
+  // fields are woven in RGB, planar chroma of two fields does not interleave
+  fmt = info.height >= c->st.height ? info.fmt : PIX_FMT_RGBA8888;
+  size = pix_image_size(fmt, c->st.width, c->st.height);
+  if (size > c->size) {
+    free(c->buf);
+    c->buf = malloc(size);
+    c->size = c->buf ? size : 0;
+    if (!c->buf) return -1;
+  }
+  pix_image_init(pic, fmt, c->st.width, c->st.height, c->buf, 0);
+  return put(c, data, len, &info, pic);
+}
+
+static int mjpeg_decode_into(void *ctx, const char *data, long len, int keyframe, pix_image_t *dst) {
+  jpeg_info_t info;
+
+  (void) keyframe;
+  if (jpeg_info(data, len, &info) < 0) return -1;
+  return put(ctx, data, len, &info, dst);
+}
+
+const vdec_codec_t vdec_codec_mjpeg = {
+  "mjpeg",
+  mjpeg_fourccs,
+  sizeof(mjpeg_fourccs) / sizeof(mjpeg_fourccs[0]),
+  VDEC_INTRA,
+  mjpeg_open,
+  mjpeg_close,
+  mjpeg_decode,
+  mjpeg_decode_into,
+};
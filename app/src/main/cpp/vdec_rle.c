@@ -0,0 +1,143 @@
+/*
+ * vdec_rle.c -- MS-RLE (BI_RLE8, BI_RLE4) as a vdec codec
+ *
+ * A chunk is run-length coded indices into the stream's palette, the
+ * rows bottom-up. Only key frames code the whole picture, the others
+ * skip what did not change with delta escapes, so the decoder keeps the
+ * last frame's indices and draws each chunk over them: not intra-only,
+ * the frames go through one worker in order. The picture handed out is
+ * that buffer as PAL8; pixconv expands it through the palette.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "vdec_impl.h"
+
+static const uint32_t rle_fourccs[] = {
+  1,                                    /* BI_RLE8 */
+  2,                                    /* BI_RLE4 */
+  VDEC_FOURCC('m', 'r', 'l', 'e'),
+};
+
+typedef struct
+{
+  int bits;                 /* 8 or 4 */
+  int width, height;
+  uint8_t *idx;             /* the last frame, bottom row first */
+  pix_palette_t pal;
+} rle_t;
+
+static void *rle_open(const vdec_stream_t *st) {
+  rle_t *c;
+  int bits = st->fourcc == 2 ? 4 : 8;
+
+  if (st->bih) bits = st->bih->bi_bit_count;
+  if ((bits != 8 && bits != 4) || st->width <= 0 || st->height <= 0) return NULL;
+  c = calloc(1, sizeof(*c));
+  if (!c) return NULL;
+  c->bits = bits;
+  c->width = st->width;
+  c->height = st->height;
+  if (!(c->idx = calloc((size_t) st->width, st->height))) {
+    free(c);
+    return NULL;
+  }
+  vdec_palette(st, &c->pal);
+  return c;
+}
+
+static void rle_close(void *ctx) {
+  rle_t *c = ctx;
+
+  free(c->idx);
+  free(c);
+}
+
+/* n pixels from x of row on, clipped to the width; the 4 bit ones
+   alternate between the high and the low nibble of a */
+static inline void put_run(const rle_t *c, uint8_t *row, int x, int n, int a) {
+  if (n > c->width - x) n = c->width - x;
+  if (n <= 0) return;
+  if (c->bits == 8 || a >> 4 == (a & 15)) {
+    memset(row + x, c->bits == 8 ? a : a & 15, n);
+  } else {
+    int i;
+
+    for (i = 0; i < n; i++)
+      row[x + i] = (uint8_t) (i & 1 ? a & 15 : a >> 4);
+  }
+}
+
+static inline void put_literal(const rle_t *c, uint8_t *row, int x, int n, const uint8_t *p) {
+  if (n > c->width - x) n = c->width - x;
+  if (n <= 0) return;
+  if (c->bits == 8) {
+    memcpy(row + x, p, n);
+  } else {
+    int i;
+
+    for (i = 0; i < n; i++)
+      row[x + i] = (uint8_t) (i & 1 ? p[i >> 1] & 15 : p[i >> 1] >> 4);
+  }
+}
+
+/* draws the chunk over c->idx; a chunk cut short leaves the rest as it
+   was, as does an empty one (a frame that repeats the last) */
+static void draw(rle_t *c, const uint8_t *p, const uint8_t *end) {
+  int x = 0, y = 0;
+
+  while (end - p >= 2 && y < c->height) {
+    const int n = p[0], a = p[1];
+
+    p += 2;
+    if (n) {
+      put_run(c, c->idx + (long) y * c->width, x, n, a);
+      x += n;
+    } else if (a == 0) {
+      x = 0;
+      y++;
+    } else if (a == 1) {
+      break;
+    } else if (a == 2) {
+      if (end - p < 2) break;
+      x += p[0];
+      y += p[1];
+      p += 2;
+    } else {
+      // literal pixels, padded to 16 bit
+      const long bytes = c->bits == 8 ? a : (a + 1) >> 1;
+
+      if (end - p < bytes) break;
+      put_literal(c, c->idx + (long) y * c->width, x, a, p);
+      x += a;
+      p += bytes;
+      if ((bytes & 1) && p < end) p++;
+    }
+    if (x > c->width) x = c->width;
+  }
+}
+
+static int rle_decode(void *ctx, const char *data, long len, int keyframe, pix_image_t *pic) {
+  rle_t *c = ctx;
+
+  if (keyframe) memset(c->idx, 0, (size_t) c->width * c->height);
+  draw(c, (const uint8_t *) data, (const uint8_t *) data + len);
+
+  pix_image_init(pic, PIX_FMT_PAL8, c->width, c->height, c->idx, 0);
+  pic->data[0] += (long) c->width * (c->height - 1);
+  pic->stride[0] = -c->width;
+  pic->data[1] = (uint8_t *) &c->pal;
+  return 0;
+}
+
+const vdec_codec_t vdec_codec_rle = {
+  "rle",
+  rle_fourccs,
+  sizeof(rle_fourccs) / sizeof(rle_fourccs[0]),
+  0,
+  rle_open,
+  rle_close,
+  rle_decode,
+  NULL,
+};
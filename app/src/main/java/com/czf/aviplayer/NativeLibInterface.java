@@ -1,6 +1,7 @@
 package com.czf.aviplayer;
 
 import android.graphics.Bitmap;
+import android.view.Surface;
 
 public class NativeLibInterface {
 
@@ -20,4 +21,15 @@ public class NativeLibInterface {
 
   public static native long setFrame(long fileFd, Bitmap bp);
 
+  // clock driven playback into a Surface, see playback.h
+  public static native long playerNew(long fileFd, Surface surface);
+
+  public static native int playerRun(long player);
+
+  public static native void playerStop(long player);
+
+  public static native long playerPosition(long player);
+
+  public static native void playerFree(long player);
+
 }
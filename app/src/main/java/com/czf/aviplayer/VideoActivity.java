@@ -1,11 +1,7 @@
 package com.czf.aviplayer;
 
-import android.graphics.Bitmap;
-import android.graphics.Canvas;
-import android.graphics.Matrix;
 import android.os.Bundle;
 import android.os.Environment;
-import android.os.SystemClock;
 import android.util.Log;
 import android.view.Surface;
 import android.view.SurfaceHolder;
@@ -18,9 +14,19 @@ import androidx.appcompat.app.AppCompatActivity;
 public class VideoActivity extends AppCompatActivity {
 
   private long avi = -1;
+  private long player = -1;
+  private Thread renderThread;
 
   private TextView tv;
-  private int time = 0;
+
+  private final Runnable showTime = new Runnable() {
+    @Override
+    public void run() {
+      if (player == -1) return;
+      tv.setText(NativeLibInterface.playerPosition(player) + "");
+      tv.postDelayed(this, 100);
+    }
+  };
 
   @Override
   protected void onCreate(Bundle savedInstanceState) {
@@ -36,10 +42,7 @@ public class VideoActivity extends AppCompatActivity {
       public void surfaceCreated(SurfaceHolder holder) {
         openAviFile();
         if (avi != -1) {
-          int intervalMs = (int)(1000/NativeLibInterface.frameRate(avi));
-          Bitmap bp = Bitmap.createBitmap(NativeLibInterface.frameWidth(avi),
-            NativeLibInterface.frameHeight(avi), Bitmap.Config.RGB_565);
-          startRenderTask(holder.getSurface(), bp, intervalMs);
+          startRenderTask(holder.getSurface());
         } else {
           Toast.makeText(VideoActivity.this, "打开文件出错", Toast.LENGTH_SHORT).show();
         }
@@ -52,6 +55,7 @@ public class VideoActivity extends AppCompatActivity {
 
       @Override
       public void surfaceDestroyed(SurfaceHolder holder) {
+        stopRenderTask();
         if (avi != -1) {
           NativeLibInterface.closeFile(avi);
           avi = -1;
@@ -70,35 +74,37 @@ public class VideoActivity extends AppCompatActivity {
     }
   }
 
-  private void startRenderTask(final Surface surface, final Bitmap bp, final int intervalMs) {
-    new Thread(new Runnable() {
+  // the native player times the frames itself, this thread only runs it
+  private void startRenderTask(Surface surface) {
+    player = NativeLibInterface.playerNew(avi, surface);
+    if (player == -1) {
+      Toast.makeText(this, "打开文件出错", Toast.LENGTH_SHORT).show();
+      return;
+    }
+    final long p = player;
+    renderThread = new Thread(new Runnable() {
       @Override
       public void run() {
-        while (true) {
-          if (avi == -1) break;
-          renderFrame(surface, bp);
-          if (tv != null) {
-            runOnUiThread(new Runnable() {
-              @Override
-              public void run() {
-                time += intervalMs;
-                tv.setText(time + "");
-              }
-            });
-          }
-          SystemClock.sleep(intervalMs);
-        }
+        NativeLibInterface.playerRun(p);
       }
-    }).start();
+    });
+    renderThread.start();
+    tv.post(showTime);
   }
 
-  private void renderFrame(Surface surface, Bitmap bp) {
-    long result = NativeLibInterface.setFrame(avi, bp);
-    if (result != -1) {
-      Canvas canvas = surface.lockCanvas(null);
-      canvas.drawBitmap(bp, 0, 0, null);
-      surface.unlockCanvasAndPost(canvas);
+  // the player must be done with the surface and the file before they go
+  private void stopRenderTask() {
+    if (player == -1) return;
+    NativeLibInterface.playerStop(player);
+    try {
+      renderThread.join();
+    } catch (InterruptedException e) {
+      Thread.currentThread().interrupt();
     }
+    tv.removeCallbacks(showTime);
+    NativeLibInterface.playerFree(player);
+    player = -1;
+    renderThread = null;
   }
 
 }